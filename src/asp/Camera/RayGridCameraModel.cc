@@ -0,0 +1,202 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/RayGridCameraModel.h>
+#include <vw/Core/Exception.h>
+#include <cmath>
+#include <limits>
+#include <set>
+
+using namespace vw;
+
+namespace asp {
+
+  namespace {
+
+    // Below this many pixels between nodes the grid saves little.
+    const double MIN_GRID_SPACING = 4.0;
+
+    // The angle between two vectors, accurate also when it is tiny.
+    double angle_between(Vector3 const& a, Vector3 const& b) {
+      return atan2(norm_2(cross_prod(a, b)), dot_prod(a, b));
+    }
+
+    Vector3 bilinear(ImageView<Vector3> const& v, int i, int j, double s, double t) {
+      return (1-s)*(1-t)*v(i, j) + s*(1-t)*v(i+1, j) + (1-s)*t*v(i, j+1) + s*t*v(i+1, j+1);
+    }
+  }
+
+  RayGridCameraModel::RayGridCameraModel(camera::CameraModel const* exact_camera):
+    m_exact_camera(exact_camera), m_built(false), m_spacing(0), m_error(0) {}
+
+  bool RayGridCameraModel::build(BBox2 const& box, double spacing, double max_error) {
+
+    m_built = false;
+    if (box.empty() || spacing <= 0)
+      return false;
+
+    // A box one pixel wide or tall still needs two nodes each way
+    m_box = box;
+    for (int k = 0; k < 2; k++) {
+      if (m_box.max()[k] - m_box.min()[k] < 1.0) {
+        m_box.min()[k] -= 0.5;
+        m_box.max()[k] += 0.5;
+      }
+    }
+
+    for (double s = spacing; s >= MIN_GRID_SPACING; s /= 2.0) {
+
+      if (!tabulate(s))
+        return false;
+      m_built   = true;
+      m_spacing = s;
+
+      // Check the first, last, and a few cells in between each way, at
+      // points along their edges and inside, as the error is zero only
+      // at the nodes.
+      m_error = 0;
+      try {
+        m_error = sampled_error();
+      } catch (...) {
+        m_built = false;
+        return false;
+      }
+
+      if (m_error <= max_error)
+        return true;
+      m_built = false;
+    }
+
+    return false;
+  }
+
+  double RayGridCameraModel::sampled_error() const {
+
+    const int num_cells = 5;
+    int nx = m_dirs.cols(), ny = m_dirs.rows();
+    std::set<int> cells_x, cells_y;
+    for (int a = 0; a < num_cells; a++) {
+      cells_x.insert(a*(nx-2)/(num_cells-1));
+      cells_y.insert(a*(ny-2)/(num_cells-1));
+    }
+
+    const int num_steps = 4; // The points in a cell are this many steps apart
+    double error = 0;
+    for (std::set<int>::const_iterator ix = cells_x.begin(); ix != cells_x.end(); ix++) {
+      for (std::set<int>::const_iterator iy = cells_y.begin(); iy != cells_y.end(); iy++) {
+        for (int a = 0; a <= num_steps; a++) {
+          for (int b = 0; b <= num_steps; b++) {
+            if ((a == 0 || a == num_steps) && (b == 0 || b == num_steps))
+              continue; // A node
+            Vector2 pos(*ix + double(a)/num_steps, *iy + double(b)/num_steps);
+            error = std::max(error, ray_error(m_box.min() + elem_prod(pos, m_step)));
+          }
+        }
+      }
+    }
+    return error;
+  }
+
+  bool RayGridCameraModel::tabulate(double spacing) {
+
+    int nx = std::max(2, int(ceil(m_box.width ()/spacing)) + 1);
+    int ny = std::max(2, int(ceil(m_box.height()/spacing)) + 1);
+    m_step = Vector2(m_box.width()/(nx-1), m_box.height()/(ny-1));
+    m_dirs.set_size(nx, ny);
+    m_ctrs.set_size(nx, ny);
+
+    try {
+      for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+          Vector2 pix = m_box.min() + elem_prod(Vector2(i, j), m_step);
+          m_dirs(i, j) = m_exact_camera->pixel_to_vector(pix);
+          m_ctrs(i, j) = m_exact_camera->camera_center(pix);
+        }
+      }
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+
+  double RayGridCameraModel::ray_error(Vector2 const& pix) const {
+
+    Vector3 dir = m_exact_camera->pixel_to_vector(pix);
+    Vector3 ctr = m_exact_camera->camera_center(pix);
+
+    // How much the ray changes from a pixel to its neighbors. For a
+    // linescan camera the direction may change only across the line
+    // and the center only along it.
+    double pix_angle = 0, ctr_step = 0;
+    for (int k = 0; k < 2; k++) {
+      Vector2 nbr = pix;
+      nbr[k] += 1.0;
+      pix_angle = std::max(pix_angle, angle_between(dir, m_exact_camera->pixel_to_vector(nbr)));
+      ctr_step  = std::max(ctr_step, norm_2(m_exact_camera->camera_center(nbr) - ctr));
+    }
+
+    double inf   = std::numeric_limits<double>::infinity();
+    double angle = angle_between(dir, pixel_to_vector(pix));
+    double dist  = norm_2(camera_center(pix) - ctr);
+
+    double error = 0;
+    if (angle > 0)
+      error += (pix_angle > 0) ? angle/pix_angle : inf;
+    if (dist > 1e-8*norm_2(ctr)) // Differences in the last digits do not count
+      error += (ctr_step > 0) ? dist/ctr_step : inf;
+    return error;
+  }
+
+  bool RayGridCameraModel::locate(Vector2 const& pix, int & i, int & j,
+                                  double & s, double & t) const {
+    if (!m_built ||
+        pix.x() < m_box.min().x() || pix.x() > m_box.max().x() ||
+        pix.y() < m_box.min().y() || pix.y() > m_box.max().y() ||
+        pix != pix) // NaN
+      return false;
+
+    double x = (pix.x() - m_box.min().x())/m_step.x();
+    double y = (pix.y() - m_box.min().y())/m_step.y();
+    i = std::min(int(x), m_dirs.cols() - 2);
+    j = std::min(int(y), m_dirs.rows() - 2);
+    s = x - i;
+    t = y - j;
+    return true;
+  }
+
+  Vector2 RayGridCameraModel::point_to_pixel(Vector3 const& point) const {
+    return m_exact_camera->point_to_pixel(point);
+  }
+
+  Vector3 RayGridCameraModel::pixel_to_vector(Vector2 const& pix) const {
+    int i, j;
+    double s, t;
+    if (!locate(pix, i, j, s, t))
+      return m_exact_camera->pixel_to_vector(pix);
+    return normalize(bilinear(m_dirs, i, j, s, t));
+  }
+
+  Vector3 RayGridCameraModel::camera_center(Vector2 const& pix) const {
+    int i, j;
+    double s, t;
+    if (!locate(pix, i, j, s, t))
+      return m_exact_camera->camera_center(pix);
+    return bilinear(m_ctrs, i, j, s, t);
+  }
+
+} // namespace asp
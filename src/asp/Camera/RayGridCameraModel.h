@@ -0,0 +1,98 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file RayGridCameraModel.h
+///
+/// For linescan cameras, finding the ray through a pixel interpolates
+/// the camera position and pose, and can be slow. Over a small box of
+/// pixels the rays change smoothly, so this camera model evaluates the
+/// exact camera on a coarse grid over the box and interpolates the
+/// camera centers and directions bilinearly in between. The grid is
+/// checked against the exact camera before it is used.
+
+#ifndef __ASP_CAMERA_RAY_GRID_CAMERA_MODEL_H__
+#define __ASP_CAMERA_RAY_GRID_CAMERA_MODEL_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <string>
+
+namespace asp {
+
+  class RayGridCameraModel: public vw::camera::CameraModel {
+  public:
+
+    /// The exact camera must outlive this object. Until build()
+    /// succeeds all calls go to the exact camera.
+    RayGridCameraModel(vw::camera::CameraModel const* exact_camera);
+
+    virtual ~RayGridCameraModel() {}
+    virtual std::string type() const { return "RayGrid"; }
+
+    /// Tabulate the rays over the box, with grid nodes no more than
+    /// spacing pixels apart. The grid is made finer until its error at
+    /// points along the edges of, and inside, some of the grid cells is
+    /// no more than max_error pixels. Returns false, and the exact camera is used everywhere,
+    /// if that does not happen before the spacing gets below a few
+    /// pixels, or if the exact camera fails at a node.
+    bool build(vw::BBox2 const& box, double spacing, double max_error);
+
+    bool   is_built() const { return m_built; }
+    double spacing () const { return m_spacing; }
+    /// The largest error at the check pixels, in pixels.
+    double error   () const { return m_error; }
+
+    /// The error at a pixel, in pixels, of the interpolated ray. The
+    /// angle between the interpolated and exact directions is compared
+    /// with the angle between the rays of neighboring pixels, and the
+    /// distance between the centers with the distance between the
+    /// centers of neighboring pixels, which for a linescan camera is
+    /// how far it moves in a line.
+    double ray_error(vw::Vector2 const& pix) const;
+
+    // Pixels outside of the box, and projecting points into the
+    // camera, are done by the exact camera.
+    virtual vw::Vector2 point_to_pixel (vw::Vector3 const& point) const;
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const;
+    virtual vw::Vector3 camera_center  (vw::Vector2 const& pix) const;
+
+  private:
+
+    /// Find the grid cell of a pixel and the position in it. Returns
+    /// false if the pixel is not in the box.
+    bool locate(vw::Vector2 const& pix, int & i, int & j, double & s, double & t) const;
+
+    bool tabulate(double spacing);
+
+    /// The largest error at points along the edges of, and inside, some
+    /// of the grid cells, evenly spread over the box.
+    double sampled_error() const;
+
+    vw::camera::CameraModel const* m_exact_camera;
+    vw::BBox2   m_box;
+    vw::Vector2 m_step; // Between nodes
+    vw::ImageView<vw::Vector3> m_dirs, m_ctrs;
+    bool   m_built;
+    double m_spacing, m_error;
+  };
+
+} // namespace asp
+
+#endif//__ASP_CAMERA_RAY_GRID_CAMERA_MODEL_H__
@@ -0,0 +1,83 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Camera/RayGridCameraModel.h>
+#include <test/Helpers.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+// A camera moving along y, one line per row, looking down with a
+// slightly curved field of view. The jitter, if any, changes the pose
+// from line to line.
+class FakeLinescanModel: public camera::CameraModel {
+  double m_jitter;
+public:
+  FakeLinescanModel(double jitter): m_jitter(jitter) {}
+  virtual std::string type() const { return "FakeLinescan"; }
+  virtual Vector2 point_to_pixel(Vector3 const& point) const {
+    vw_throw( NoImplErr() << "FakeLinescanModel: point_to_pixel is not implemented.\n" );
+    return Vector2();
+  }
+  virtual Vector3 pixel_to_vector(Vector2 const& pix) const {
+    double u = pix.x() - 500;
+    return normalize(Vector3(u*1e-5 + 2e-9*u*u, m_jitter*sin(pix.y()), -1));
+  }
+  virtual Vector3 camera_center(Vector2 const& pix) const {
+    return Vector3(0, 0.5*pix.y() + 1e-4*pix.y()*pix.y(), 7e6);
+  }
+};
+
+TEST( RayGridCameraModel, Interpolate ) {
+
+  FakeLinescanModel exact(0);
+  RayGridCameraModel grid(&exact);
+  BBox2 box(Vector2(100.3, 2000.7), Vector2(355.9, 2250.1));
+  ASSERT_TRUE(grid.build(box, 64, 0.01));
+  EXPECT_LE(grid.spacing(), 32);
+  EXPECT_LE(grid.error(), 0.01);
+
+  // The error is small also away from the check pixels
+  for (double x = box.min().x(); x <= box.max().x(); x += 17.3) {
+    for (double y = box.min().y(); y <= box.max().y(); y += 11.1) {
+      EXPECT_LT(grid.ray_error(Vector2(x, y)), 0.02);
+    }
+  }
+
+  // Outside the box the exact camera is used
+  Vector2 pix(50, 10);
+  EXPECT_VECTOR_NEAR(exact.pixel_to_vector(pix), grid.pixel_to_vector(pix), 1e-15);
+  EXPECT_VECTOR_NEAR(exact.camera_center  (pix), grid.camera_center  (pix), 1e-15);
+
+  // A box of a single pixel
+  ASSERT_TRUE(grid.build(BBox2(pix, pix), 64, 0.01));
+  EXPECT_VECTOR_NEAR(exact.pixel_to_vector(pix), grid.pixel_to_vector(pix), 1e-8);
+}
+
+TEST( RayGridCameraModel, Jitter ) {
+
+  // The rays change too much from line to line to interpolate
+  FakeLinescanModel exact(1e-4);
+  RayGridCameraModel grid(&exact);
+  BBox2 box(Vector2(0, 0), Vector2(200, 200));
+  EXPECT_FALSE(grid.build(box, 64, 0.01));
+  EXPECT_FALSE(grid.is_built());
+
+  Vector2 pix(10.5, 20.5);
+  EXPECT_VECTOR_NEAR(exact.pixel_to_vector(pix), grid.pixel_to_vector(pix), 1e-15);
+}
@@ -0,0 +1,477 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/AffineSubpixel.h>
+#include <vw/Core/Exception.h>
+
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cmath>
+
+// The vectorized window sums are compiled for x86 with GCC and Clang,
+// each with its own target, and picked at run time.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ASP_SUBPIXEL_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace vw;
+
+namespace asp {
+
+  SubpixelIsa detect_subpixel_isa() {
+#ifdef ASP_SUBPIXEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return SUBPIXEL_ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+      return SUBPIXEL_ISA_SSE41;
+#endif
+    return SUBPIXEL_ISA_SCALAR;
+  }
+
+  SubpixelIsa subpixel_isa_from_string(std::string const& name) {
+    std::string lname = boost::to_lower_copy(name);
+    SubpixelIsa best = detect_subpixel_isa();
+    if (lname == "auto")
+      return best;
+    if (lname == "scalar")
+      return SUBPIXEL_ISA_SCALAR;
+    if (lname == "sse4.1" || lname == "sse4")
+      return std::min(best, SUBPIXEL_ISA_SSE41);
+    if (lname == "avx2")
+      return best;
+    vw_throw( ArgumentErr() << "Unknown subpixel instruction set: " << name
+              << ". Use auto, avx2, sse4.1, or scalar.\n" );
+    return best;
+  }
+
+  std::string subpixel_isa_name(SubpixelIsa isa) {
+    switch (isa) {
+      case SUBPIXEL_ISA_AVX2:  return "avx2";
+      case SUBPIXEL_ISA_SSE41: return "sse4.1";
+      default:                 return "scalar";
+    }
+  }
+
+  void AffineWindowSamples::reserve(int n) {
+    dx.reserve(n); dy.reserve(n); gx.reserve(n); gy.reserve(n);
+    err.reserve(n); weight.reserve(n);
+  }
+
+  void AffineWindowSamples::push_back(float dx_, float dy_, float gx_, float gy_,
+                                      float err_, float weight_) {
+    if (size == int(dx.size())) {
+      dx.push_back(dx_); dy.push_back(dy_); gx.push_back(gx_); gy.push_back(gy_);
+      err.push_back(err_); weight.push_back(weight_);
+    } else {
+      dx[size] = dx_; dy[size] = dy_; gx[size] = gx_; gy[size] = gy_;
+      err[size] = err_; weight[size] = weight_;
+    }
+    size++;
+  }
+
+  // The sums are, for each of w*gx*gx, w*gx*gy, and w*gy*gy, that times
+  // 1, dx, dy, dx*dx, dx*dy, and dy*dy, followed by w*err*gx and
+  // w*err*gy times 1, dx, and dy.
+
+  // The reference implementation. Sums the samples from 'begin' on.
+  void affine_window_sums_scalar(AffineWindowSamples const& s, int begin,
+                                 double sums[NUM_AFFINE_SUMS]) {
+    for (int i = begin; i < s.size; i++) {
+      double dx = s.dx[i], dy = s.dy[i];
+      double wgx = double(s.weight[i]) * s.gx[i], wgy = double(s.weight[i]) * s.gy[i];
+      double v[3] = {wgx * s.gx[i], wgx * s.gy[i], wgy * s.gy[i]};
+      double m[6] = {1.0, dx, dy, dx*dx, dx*dy, dy*dy};
+      for (int k = 0; k < 3; k++)
+        for (int j = 0; j < 6; j++)
+          sums[6*k + j] += v[k] * m[j];
+      double ex = wgx * s.err[i], ey = wgy * s.err[i];
+      sums[18] += ex; sums[19] += ex * dx; sums[20] += ex * dy;
+      sums[21] += ey; sums[22] += ey * dx; sums[23] += ey * dy;
+    }
+  }
+
+#ifdef ASP_SUBPIXEL_X86
+
+  // The vector versions convert the samples to double and accumulate
+  // in double, as the reference does, so they differ from it only in
+  // the order of the additions.
+
+  __attribute__((target("avx2")))
+  void affine_window_sums_avx2(AffineWindowSamples const& s, double sums[NUM_AFFINE_SUMS]) {
+    __m256d acc[NUM_AFFINE_SUMS];
+    for (int k = 0; k < NUM_AFFINE_SUMS; k++)
+      acc[k] = _mm256_setzero_pd();
+
+    int i = 0;
+    for (; i + 4 <= s.size; i += 4) {
+      __m256d dx  = _mm256_cvtps_pd(_mm_loadu_ps(&s.dx[i]));
+      __m256d dy  = _mm256_cvtps_pd(_mm_loadu_ps(&s.dy[i]));
+      __m256d gx  = _mm256_cvtps_pd(_mm_loadu_ps(&s.gx[i]));
+      __m256d gy  = _mm256_cvtps_pd(_mm_loadu_ps(&s.gy[i]));
+      __m256d err = _mm256_cvtps_pd(_mm_loadu_ps(&s.err[i]));
+      __m256d w   = _mm256_cvtps_pd(_mm_loadu_ps(&s.weight[i]));
+      __m256d wgx = _mm256_mul_pd(w, gx), wgy = _mm256_mul_pd(w, gy);
+      __m256d v[3] = {_mm256_mul_pd(wgx, gx), _mm256_mul_pd(wgx, gy), _mm256_mul_pd(wgy, gy)};
+      __m256d m[5] = {dx, dy, _mm256_mul_pd(dx, dx), _mm256_mul_pd(dx, dy), _mm256_mul_pd(dy, dy)};
+      for (int k = 0; k < 3; k++) {
+        acc[6*k] = _mm256_add_pd(acc[6*k], v[k]);
+        for (int j = 0; j < 5; j++)
+          acc[6*k + 1 + j] = _mm256_add_pd(acc[6*k + 1 + j], _mm256_mul_pd(v[k], m[j]));
+      }
+      __m256d ex = _mm256_mul_pd(wgx, err), ey = _mm256_mul_pd(wgy, err);
+      acc[18] = _mm256_add_pd(acc[18], ex);
+      acc[19] = _mm256_add_pd(acc[19], _mm256_mul_pd(ex, dx));
+      acc[20] = _mm256_add_pd(acc[20], _mm256_mul_pd(ex, dy));
+      acc[21] = _mm256_add_pd(acc[21], ey);
+      acc[22] = _mm256_add_pd(acc[22], _mm256_mul_pd(ey, dx));
+      acc[23] = _mm256_add_pd(acc[23], _mm256_mul_pd(ey, dy));
+    }
+
+    double lanes[4];
+    for (int k = 0; k < NUM_AFFINE_SUMS; k++) {
+      _mm256_storeu_pd(lanes, acc[k]);
+      for (int l = 0; l < 4; l++)
+        sums[k] += lanes[l];
+    }
+    // Leaving the upper halves of the registers dirty would slow down
+    // all SSE code which runs after this, such as in libm.
+    _mm256_zeroupper();
+    affine_window_sums_scalar(s, i, sums);
+  }
+
+  // Convert two floats to double
+  __attribute__((target("sse4.1")))
+  inline __m128d load_two_pd(float const* p) {
+    return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(p))));
+  }
+
+  __attribute__((target("sse4.1")))
+  void affine_window_sums_sse41(AffineWindowSamples const& s, double sums[NUM_AFFINE_SUMS]) {
+    __m128d acc[NUM_AFFINE_SUMS];
+    for (int k = 0; k < NUM_AFFINE_SUMS; k++)
+      acc[k] = _mm_setzero_pd();
+
+    int i = 0;
+    for (; i + 2 <= s.size; i += 2) {
+      __m128d dx  = load_two_pd(&s.dx[i]);
+      __m128d dy  = load_two_pd(&s.dy[i]);
+      __m128d gx  = load_two_pd(&s.gx[i]);
+      __m128d gy  = load_two_pd(&s.gy[i]);
+      __m128d err = load_two_pd(&s.err[i]);
+      __m128d w   = load_two_pd(&s.weight[i]);
+      __m128d wgx = _mm_mul_pd(w, gx), wgy = _mm_mul_pd(w, gy);
+      __m128d v[3] = {_mm_mul_pd(wgx, gx), _mm_mul_pd(wgx, gy), _mm_mul_pd(wgy, gy)};
+      __m128d m[5] = {dx, dy, _mm_mul_pd(dx, dx), _mm_mul_pd(dx, dy), _mm_mul_pd(dy, dy)};
+      for (int k = 0; k < 3; k++) {
+        acc[6*k] = _mm_add_pd(acc[6*k], v[k]);
+        for (int j = 0; j < 5; j++)
+          acc[6*k + 1 + j] = _mm_add_pd(acc[6*k + 1 + j], _mm_mul_pd(v[k], m[j]));
+      }
+      __m128d ex = _mm_mul_pd(wgx, err), ey = _mm_mul_pd(wgy, err);
+      acc[18] = _mm_add_pd(acc[18], ex);
+      acc[19] = _mm_add_pd(acc[19], _mm_mul_pd(ex, dx));
+      acc[20] = _mm_add_pd(acc[20], _mm_mul_pd(ex, dy));
+      acc[21] = _mm_add_pd(acc[21], ey);
+      acc[22] = _mm_add_pd(acc[22], _mm_mul_pd(ey, dx));
+      acc[23] = _mm_add_pd(acc[23], _mm_mul_pd(ey, dy));
+    }
+
+    double lanes[2];
+    for (int k = 0; k < NUM_AFFINE_SUMS; k++) {
+      _mm_storeu_pd(lanes, acc[k]);
+      sums[k] += lanes[0] + lanes[1];
+    }
+    affine_window_sums_scalar(s, i, sums);
+  }
+
+#endif // ASP_SUBPIXEL_X86
+
+  void affine_window_sums(SubpixelIsa isa, AffineWindowSamples const& samples,
+                          double sums[NUM_AFFINE_SUMS]) {
+    std::fill(sums, sums + NUM_AFFINE_SUMS, 0.0);
+#ifdef ASP_SUBPIXEL_X86
+    if (isa == SUBPIXEL_ISA_AVX2)
+      return affine_window_sums_avx2(samples, sums);
+    if (isa == SUBPIXEL_ISA_SSE41)
+      return affine_window_sums_sse41(samples, sums);
+#endif
+    affine_window_sums_scalar(samples, 0, sums);
+  }
+
+  bool solve_affine_normal_equations(double const sums[NUM_AFFINE_SUMS],
+                                     Vector<double, 6> & delta) {
+
+    // Parameter 3*g + t multiplies the gradient component g (gx, gy)
+    // times the offset term t (dx, dy, 1).
+    const int prod_index[3][3] = {{3, 4, 1}, {4, 5, 2}, {1, 2, 0}}; // Of the offset terms
+    const int grad_index[2][2] = {{0, 1}, {1, 2}};
+    const int rhs_index[3]     = {1, 2, 0};
+
+    double A[6][7];
+    for (int p = 0; p < 6; p++) {
+      for (int q = 0; q < 6; q++)
+        A[p][q] = sums[6*grad_index[p/3][q/3] + prod_index[p%3][q%3]];
+      A[p][6] = sums[18 + 3*(p/3) + rhs_index[p%3]];
+    }
+
+    double scale = 0.0;
+    for (int p = 0; p < 6; p++)
+      scale = std::max(scale, std::abs(A[p][p]));
+    if (scale <= 0.0)
+      return false;
+
+    // Gaussian elimination with partial pivoting
+    for (int c = 0; c < 6; c++) {
+      int pivot = c;
+      for (int r = c + 1; r < 6; r++)
+        if (std::abs(A[r][c]) > std::abs(A[pivot][c]))
+          pivot = r;
+      if (std::abs(A[pivot][c]) < 1e-10 * scale)
+        return false;
+      if (pivot != c)
+        for (int k = c; k < 7; k++)
+          std::swap(A[c][k], A[pivot][k]);
+      for (int r = c + 1; r < 6; r++) {
+        double f = A[r][c] / A[c][c];
+        for (int k = c; k < 7; k++)
+          A[r][k] -= f * A[c][k];
+      }
+    }
+    for (int r = 5; r >= 0; r--) {
+      double val = A[r][6];
+      for (int k = r + 1; k < 6; k++)
+        val -= A[r][k] * delta[k];
+      delta[r] = val / A[r][r];
+    }
+    return true;
+  }
+
+  namespace {
+
+    // Bilinear interpolation of the image and of its gradient. The
+    // gradient is that of the interpolant, so it is consistent with the
+    // values. Returns false if the point is too close to the boundary.
+    inline bool sample_with_gradient(ImageView<float> const& img, double x, double y,
+                                     float & val, float & gx, float & gy) {
+      double fx0 = std::floor(x), fy0 = std::floor(y);
+      if (fx0 < 0 || fy0 < 0 || fx0 > img.cols() - 2 || fy0 > img.rows() - 2)
+        return false;
+      int x0 = int(fx0), y0 = int(fy0);
+      float fx = float(x - fx0), fy = float(y - fy0);
+      float a = img(x0, y0),     b = img(x0 + 1, y0);
+      float c = img(x0, y0 + 1), d = img(x0 + 1, y0 + 1);
+      float top = a + fx * (b - a), bot = c + fx * (d - c);
+      val = top + fy * (bot - top);
+      gx  = (1 - fy) * (b - a) + fy * (d - c);
+      gy  = bot - top;
+      return true;
+    }
+
+    // Average 2x2 blocks
+    ImageView<float> downsample_by_two(ImageView<float> const& img) {
+      ImageView<float> out(img.cols() / 2, img.rows() / 2);
+      for (int row = 0; row < out.rows(); row++)
+        for (int col = 0; col < out.cols(); col++)
+          out(col, row) = 0.25f * (img(2*col, 2*row)     + img(2*col + 1, 2*row) +
+                                   img(2*col, 2*row + 1) + img(2*col + 1, 2*row + 1));
+      return out;
+    }
+
+    // Scale each sample weight by the chance of the sample being an
+    // inlier, with Gaussian noise for the inliers and uniform for the
+    // outliers. The noise variance and the inlier fraction are updated
+    // from the new weights, as in an EM step.
+    void bayes_em_reweight(std::vector<float> const& prior_weight,
+                           AffineWindowSamples & samples,
+                           double & sigma2, double & inlier_frac) {
+      float min_err = samples.err[0], max_err = samples.err[0];
+      for (int i = 1; i < samples.size; i++) {
+        min_err = std::min(min_err, samples.err[i]);
+        max_err = std::max(max_err, samples.err[i]);
+      }
+      float outlier_density = 1.0 / std::max(double(max_err - min_err), 1e-6);
+      float in_scale  = inlier_frac / std::sqrt(2.0 * M_PI * sigma2);
+      float out_scale = (1.0 - inlier_frac) * outlier_density;
+      float half_inv_sigma2 = 0.5 / sigma2;
+
+      double sum_w = 0, sum_wr = 0, sum_wre2 = 0;
+      for (int i = 0; i < samples.size; i++) {
+        float e = samples.err[i];
+        // Tiny weights are set to zero, as denormals are very slow to sum
+        float z = half_inv_sigma2 * e * e;
+        float p_in = z < 30.0f ? in_scale * std::exp(-z) : 0.0f;
+        float r = p_in / std::max(p_in + out_scale, 1e-30f);
+        if (r < 1e-6f)
+          r = 0.0f;
+        double w = prior_weight[i];
+        samples.weight[i] = float(w * r);
+        sum_w += w; sum_wr += w * r; sum_wre2 += w * r * e * e;
+      }
+      if (sum_w > 0)
+        inlier_frac = std::min(0.99, std::max(0.05, sum_wr / sum_w));
+      if (sum_wr > 0)
+        sigma2 = std::max(sum_wre2 / sum_wr, 1e-8);
+    }
+
+    // Fit the affine transform at one pixel, starting from disp.
+    bool refine_pixel(ImageView<float> const& left, ImageView<float> const& right,
+                      Vector2 const& right_offset, int col, int row,
+                      AffineSubpixelOptions const& opt,
+                      std::vector<float> const& kernel_weights,
+                      AffineWindowSamples & samples, std::vector<float> & prior_weight,
+                      Vector2f & disp) {
+
+      int hx = opt.kernel_size[0] / 2, hy = opt.kernel_size[1] / 2;
+      int min_samples = std::max(6, int(kernel_weights.size()) / 4);
+      double a[6] = {0, 0, disp[0] + right_offset[0], 0, 0, disp[1] + right_offset[1]};
+      double sigma2 = -1, inlier_frac = 0.9;
+
+      for (int iter = 0; iter < opt.max_iter; iter++) {
+
+        samples.clear();
+        prior_weight.clear();
+        for (int j = -hy; j <= hy; j++) {
+          int lr = row + j;
+          if (lr < 0 || lr >= left.rows())
+            continue;
+          for (int i = -hx; i <= hx; i++) {
+            int lc = col + i;
+            if (lc < 0 || lc >= left.cols())
+              continue;
+            double x = lc + a[0]*i + a[1]*j + a[2];
+            double y = lr + a[3]*i + a[4]*j + a[5];
+            float val, gx, gy;
+            if (!sample_with_gradient(right, x, y, val, gx, gy))
+              continue;
+            float w = kernel_weights[(j + hy) * opt.kernel_size[0] + (i + hx)];
+            samples.push_back(i, j, gx, gy, left(lc, lr) - val, w);
+            prior_weight.push_back(w);
+          }
+        }
+        if (samples.size < min_samples)
+          return false;
+
+        if (opt.use_bayes_em) {
+          if (sigma2 < 0) {
+            double sum_w = 0, sum_we2 = 0;
+            for (int i = 0; i < samples.size; i++) {
+              sum_w   += prior_weight[i];
+              sum_we2 += prior_weight[i] * samples.err[i] * samples.err[i];
+            }
+            sigma2 = std::max(sum_we2 / std::max(sum_w, 1e-300), 1e-8);
+          }
+          bayes_em_reweight(prior_weight, samples, sigma2, inlier_frac);
+        }
+
+        double sums[NUM_AFFINE_SUMS];
+        affine_window_sums(opt.isa, samples, sums);
+        Vector<double, 6> delta;
+        if (!solve_affine_normal_equations(sums, delta))
+          return false;
+        for (int p = 0; p < 6; p++)
+          a[p] += delta[p];
+
+        // Give up on extreme distortions, or if we wandered off
+        if (std::abs(a[0]) > 1 || std::abs(a[1]) > 1 || std::abs(a[3]) > 1 || std::abs(a[4]) > 1)
+          return false;
+        if (std::abs(a[2] - right_offset[0] - disp[0]) > hx ||
+            std::abs(a[5] - right_offset[1] - disp[1]) > hy)
+          return false;
+
+        if (std::abs(delta[2]) < 1e-3 && std::abs(delta[5]) < 1e-3)
+          break;
+      }
+
+      disp = Vector2f(a[2] - right_offset[0], a[5] - right_offset[1]);
+      return true;
+    }
+
+  } // end anonymous namespace
+
+  void affine_subpixel_refine(ImageView<float> const& left,
+                              ImageView<float> const& right,
+                              Vector2i const& right_offset,
+                              AffineSubpixelOptions const& opt,
+                              ImageView<PixelMask<Vector2f> > & disparity) {
+
+    VW_ASSERT(disparity.cols() == left.cols() && disparity.rows() == left.rows(),
+              ArgumentErr() << "affine_subpixel_refine: The disparity and the left image "
+              << "must have the same size.\n");
+    VW_ASSERT(opt.kernel_size[0] > 0 && opt.kernel_size[1] > 0 && opt.max_levels >= 0,
+              ArgumentErr() << "affine_subpixel_refine: Invalid options.\n");
+
+    int max_levels = opt.max_levels;
+    std::vector<ImageView<float> > left_pyr(1, left), right_pyr(1, right);
+    for (int l = 1; l <= max_levels; l++) {
+      left_pyr.push_back (downsample_by_two(left_pyr.back()));
+      right_pyr.push_back(downsample_by_two(right_pyr.back()));
+    }
+
+    // Gaussian weights, falling to about 0.14 at the window edges
+    int kx = opt.kernel_size[0], ky = opt.kernel_size[1];
+    double sx = std::max(kx / 4.0, 0.5), sy = std::max(ky / 4.0, 0.5);
+    std::vector<float> kernel_weights(kx * ky);
+    for (int j = 0; j < ky; j++)
+      for (int i = 0; i < kx; i++) {
+        double u = (i - kx/2) / sx, v = (j - ky/2) / sy;
+        kernel_weights[j*kx + i] = float(std::exp(-0.5 * (u*u + v*v)));
+      }
+
+    AffineWindowSamples samples;
+    samples.reserve(kx * ky);
+    std::vector<float> prior_weight;
+    prior_weight.reserve(kx * ky);
+
+    ImageView<PixelMask<Vector2f> > prev;
+    for (int l = max_levels; l >= 0; l--) {
+      ImageView<float> const& left_l = left_pyr[l];
+      ImageView<PixelMask<Vector2f> > curr(left_l.cols(), left_l.rows());
+      float scale = 1.0f / (1 << l);
+      Vector2 offset_l(right_offset[0] >> l, right_offset[1] >> l);
+
+      for (int row = 0; row < curr.rows(); row++) {
+        for (int col = 0; col < curr.cols(); col++) {
+          curr(col, row).invalidate();
+          PixelMask<Vector2f> const& input = disparity(col << l, row << l);
+          if (!is_valid(input))
+            continue;
+
+          // Start from the result of the coarser level, unless it failed
+          // or is far from the input.
+          Vector2f disp = input.child() * scale;
+          if (l < max_levels && col/2 < prev.cols() && row/2 < prev.rows() &&
+              is_valid(prev(col/2, row/2))) {
+            Vector2f coarse = prev(col/2, row/2).child() * 2.0f;
+            if (std::abs(coarse[0] - disp[0]) <= 2 && std::abs(coarse[1] - disp[1]) <= 2)
+              disp = coarse;
+          }
+
+          if (refine_pixel(left_l, right_pyr[l], offset_l, col, row, opt, kernel_weights,
+                           samples, prior_weight, disp))
+            curr(col, row) = PixelMask<Vector2f>(disp);
+        }
+      }
+      prev = curr;
+    }
+
+    disparity = prev;
+  }
+
+} // namespace asp
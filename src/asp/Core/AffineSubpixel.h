@@ -0,0 +1,101 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file AffineSubpixel.h
+///
+/// Affine adaptive window subpixel refinement, with optional Bayes EM
+/// weighting of the window. Most of the time goes into summing the
+/// normal equations over each window. These sums are done with AVX2 or
+/// SSE4.1 instructions when the CPU has them. The scalar code is the
+/// reference implementation.
+
+#ifndef __ASP_CORE_AFFINE_SUBPIXEL_H__
+#define __ASP_CORE_AFFINE_SUBPIXEL_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Vector.h>
+#include <vector>
+#include <string>
+
+namespace asp {
+
+  /// The instruction sets the window sums can use.
+  enum SubpixelIsa { SUBPIXEL_ISA_SCALAR = 0, SUBPIXEL_ISA_SSE41 = 1, SUBPIXEL_ISA_AVX2 = 2 };
+
+  /// The best instruction set supported by this CPU and build.
+  SubpixelIsa detect_subpixel_isa();
+
+  /// Parse one of "auto", "avx2", "sse4.1", or "scalar". For "auto",
+  /// or if the named one is not supported, return detect_subpixel_isa().
+  SubpixelIsa subpixel_isa_from_string(std::string const& name);
+
+  std::string subpixel_isa_name(SubpixelIsa isa);
+
+  /// The samples of a window, as parallel arrays. For each sample there
+  /// is its offset from the window center, the gradient of the warped
+  /// right image, the left minus the warped right image, and its weight.
+  struct AffineWindowSamples {
+    std::vector<float> dx, dy, gx, gy, err, weight;
+    int size;
+    AffineWindowSamples(): size(0) {}
+    void reserve(int n);
+    void clear() { size = 0; }
+    void push_back(float dx, float dy, float gx, float gy, float err, float weight);
+  };
+
+  /// The number of distinct sums making up the normal equations.
+  const int NUM_AFFINE_SUMS = 24;
+
+  /// Sum over the window the products which make up the normal
+  /// equations J^T W J and J^T W e of the affine fit. The row of J for a
+  /// sample is [dx*gx, dy*gx, gx, dx*gy, dy*gy, gy].
+  void affine_window_sums(SubpixelIsa isa, AffineWindowSamples const& samples,
+                          double sums[NUM_AFFINE_SUMS]);
+
+  /// Solve the normal equations given by the window sums for the
+  /// update to the six affine parameters. Returns false if singular.
+  bool solve_affine_normal_equations(double const sums[NUM_AFFINE_SUMS],
+                                     vw::Vector<double, 6> & delta);
+
+  struct AffineSubpixelOptions {
+    vw::Vector2i kernel_size;
+    int  max_levels;  // Pyramid levels above the full resolution one
+    int  max_iter;    // Gauss-Newton iterations per level
+    bool use_bayes_em; // Reweight the window by the chance of each sample being an inlier
+    SubpixelIsa isa;
+    AffineSubpixelOptions(): kernel_size(35, 35), max_levels(2), max_iter(10),
+                             use_bayes_em(false), isa(SUBPIXEL_ISA_SCALAR) {}
+  };
+
+  /// Refine a disparity. The images must be prefiltered. The pixel
+  /// (col, row) of the left image corresponds to the pixel
+  /// (col, row) + disparity + right_offset of the right image, so the
+  /// images can be crops. The disparity is refined at each of the pyramid
+  /// levels, coarse to fine. For the pyramid to line up, right_offset
+  /// must be a multiple of 2^max_levels. Pixels where the fit fails are
+  /// invalidated.
+  void affine_subpixel_refine(vw::ImageView<float> const& left,
+                              vw::ImageView<float> const& right,
+                              vw::Vector2i const& right_offset,
+                              AffineSubpixelOptions const& opt,
+                              vw::ImageView<vw::PixelMask<vw::Vector2f> > & disparity);
+
+} // namespace asp
+
+#endif//__ASP_CORE_AFFINE_SUBPIXEL_H__
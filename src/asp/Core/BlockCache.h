@@ -0,0 +1,256 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BlockCache.h
+///
+/// A view which serves an image from fixed-size blocks kept in a
+/// thread-safe, size-bounded, least-recently-used cache. Copies of the
+/// view share the cache, so when many tiles are processed in parallel
+/// and read overlapping regions of the same image, each block is read
+/// only once while it stays in the cache.
+
+#ifndef __ASP_CORE_BLOCK_CACHE_H__
+#define __ASP_CORE_BLOCK_CACHE_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace asp {
+
+  /// A thread-safe least-recently-used cache of image blocks, indexed
+  /// by block column and row, and holding at most a given number of bytes.
+  template <class PixelT>
+  class BlockCache : private boost::noncopyable {
+  public:
+    typedef std::pair<int, int> KeyT;
+    typedef vw::ImageView<PixelT> BlockT;
+
+    BlockCache(size_t max_bytes): m_max_bytes(max_bytes), m_bytes(0), m_hits(0), m_misses(0){}
+
+    /// Find a block in the cache. If found, mark it as most recently used.
+    bool get(KeyT const& key, BlockT & block) {
+      vw::Mutex::Lock lock(m_mutex);
+      typename MapT::iterator it = m_map.find(key);
+      if (it == m_map.end()){
+        m_misses++;
+        return false;
+      }
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      block = it->second->second;
+      m_hits++;
+      return true;
+    }
+
+    /// Add a block, evicting the least recently used ones if over the limit.
+    void put(KeyT const& key, BlockT const& block) {
+      vw::Mutex::Lock lock(m_mutex);
+      if (m_map.find(key) != m_map.end())
+        return; // Another thread got here first
+      m_lru.push_front(std::make_pair(key, block));
+      m_map[key] = m_lru.begin();
+      m_bytes += block_bytes(block);
+      // Always keep the block just added, even if it alone is too big
+      while (m_bytes > m_max_bytes && m_lru.size() > 1){
+        m_bytes -= block_bytes(m_lru.back().second);
+        m_map.erase(m_lru.back().first);
+        m_lru.pop_back();
+      }
+    }
+
+    size_t bytes () const { vw::Mutex::Lock lock(m_mutex); return m_bytes;  }
+    size_t hits  () const { vw::Mutex::Lock lock(m_mutex); return m_hits;   }
+    size_t misses() const { vw::Mutex::Lock lock(m_mutex); return m_misses; }
+
+  private:
+    typedef std::list<std::pair<KeyT, BlockT> > ListT;
+    typedef std::map<KeyT, typename ListT::iterator> MapT;
+
+    static size_t block_bytes(BlockT const& block) {
+      return size_t(block.cols())*block.rows()*block.planes()*sizeof(PixelT);
+    }
+
+    ListT  m_lru; // Most recently used at the front
+    MapT   m_map;
+    size_t m_max_bytes, m_bytes, m_hits, m_misses;
+    mutable vw::Mutex m_mutex;
+  };
+
+  /// The blocks of a CachedBlockView which cover a box, looked up in the
+  /// cache once, so that their pixels are then read without locking it.
+  /// Pixels outside the image are zero.
+  template <class PixelT>
+  class CachedBlocks : public vw::ImageViewBase<CachedBlocks<PixelT> > {
+  public:
+    typedef PixelT     pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<CachedBlocks> pixel_accessor;
+
+    /// The blocks from min_block to max_block, inclusive, in row-major order
+    CachedBlocks(std::vector<vw::ImageView<PixelT> > const& blocks,
+                 vw::Vector2i const& min_block, vw::Vector2i const& max_block,
+                 int block_size, vw::BBox2i const& image_box):
+      m_blocks(blocks), m_min_block(min_block), m_max_block(max_block),
+      m_num_block_cols(max_block[0] - min_block[0] + 1),
+      m_block_size(block_size), m_image_box(image_box){}
+
+    inline vw::int32 cols  () const { return m_image_box.width (); }
+    inline vw::int32 rows  () const { return m_image_box.height(); }
+    inline vw::int32 planes() const { return m_blocks.empty() ? 1 : m_blocks[0].planes(); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const {
+      if (!m_image_box.contains(vw::Vector2i(i, j)))
+        return result_type();
+      return block(i/m_block_size, j/m_block_size)(i % m_block_size, j % m_block_size, p);
+    }
+
+    typedef CachedBlocks prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& /*bbox*/ ) const { return *this; }
+
+    /// Copy whole rows of each block rather than pixel by pixel
+    template <class DestT> inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::BBox2i box = bbox;
+      box.crop(m_image_box);
+      if (box != bbox)
+        vw::fill(dest, pixel_type()); // Parts outside the image are not copied below
+      if (box.empty())
+        return;
+      for (int row = box.min().y()/m_block_size; row <= (box.max().y()-1)/m_block_size; row++){
+        for (int col = box.min().x()/m_block_size; col <= (box.max().x()-1)/m_block_size; col++){
+          vw::BBox2i block_box(col*m_block_size, row*m_block_size, m_block_size, m_block_size);
+          block_box.crop(m_image_box);
+          vw::BBox2i overlap = block_box;
+          overlap.crop(box);
+          crop(dest, overlap - bbox.min()) = crop(block(col, row), overlap - block_box.min());
+        }
+      }
+    }
+
+  private:
+    vw::ImageView<PixelT> const& block(int col, int row) const {
+      VW_ASSERT(col >= m_min_block[0] && col <= m_max_block[0] &&
+                row >= m_min_block[1] && row <= m_max_block[1],
+                vw::ArgumentErr() << "CachedBlocks: Reading outside of the prerasterized box.\n");
+      return m_blocks[(row - m_min_block[1])*m_num_block_cols + col - m_min_block[0]];
+    }
+
+    std::vector<vw::ImageView<PixelT> > m_blocks;
+    vw::Vector2i m_min_block, m_max_block;
+    int m_num_block_cols, m_block_size;
+    vw::BBox2i m_image_box;
+  };
+
+  /// Serve an image from blocks of given size kept in a shared BlockCache.
+  /// Missing blocks are rasterized from the underlying view outside of
+  /// the cache lock. Reading a single pixel looks up its block in the
+  /// cache, so images should be read through prerasterize(), which looks
+  /// up each block once.
+  template <class ImageT>
+  class CachedBlockView : public vw::ImageViewBase<CachedBlockView<ImageT> > {
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<CachedBlockView> pixel_accessor;
+    typedef BlockCache<pixel_type>      cache_type;
+
+    CachedBlockView(ImageT const& image, int block_size,
+                    boost::shared_ptr<cache_type> cache):
+      m_image(image), m_block_size(block_size), m_cache(cache){
+      VW_ASSERT(block_size > 0,
+                vw::ArgumentErr() << "CachedBlockView: The block size must be positive.\n");
+    }
+
+    inline vw::int32 cols  () const { return m_image.cols  (); }
+    inline vw::int32 rows  () const { return m_image.rows  (); }
+    inline vw::int32 planes() const { return m_image.planes(); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const {
+      vw::ImageView<pixel_type> b = block(i/m_block_size, j/m_block_size);
+      return b(i % m_block_size, j % m_block_size, p);
+    }
+
+    boost::shared_ptr<cache_type> cache() const { return m_cache; }
+
+    typedef CachedBlocks<pixel_type> prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      vw::BBox2i box = bbox;
+      box.crop(vw::bounding_box(m_image));
+      std::vector<vw::ImageView<pixel_type> > blocks;
+      vw::Vector2i min_block(0, 0), max_block(-1, -1);
+      if (!box.empty()){
+        min_block = box.min()/m_block_size;
+        max_block = (box.max() - vw::Vector2i(1, 1))/m_block_size;
+        for (int row = min_block[1]; row <= max_block[1]; row++)
+          for (int col = min_block[0]; col <= max_block[0]; col++)
+            blocks.push_back(block(col, row));
+      }
+      return prerasterize_type(blocks, min_block, max_block, m_block_size,
+                               vw::bounding_box(m_image));
+    }
+
+    template <class DestT> inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      prerasterize(bbox).rasterize(dest, bbox);
+    }
+
+  private:
+
+    vw::BBox2i block_bbox(int col, int row) const {
+      vw::BBox2i box(col*m_block_size, row*m_block_size, m_block_size, m_block_size);
+      box.crop(vw::bounding_box(m_image));
+      return box;
+    }
+
+    vw::ImageView<pixel_type> block(int col, int row) const {
+      typename cache_type::KeyT key(col, row);
+      vw::ImageView<pixel_type> b;
+      if (m_cache->get(key, b))
+        return b;
+      b = crop(m_image, block_bbox(col, row));
+      m_cache->put(key, b);
+      return b;
+    }
+
+    ImageT m_image;
+    int    m_block_size;
+    boost::shared_ptr<cache_type> m_cache;
+  };
+
+  /// Wrap a view in a CachedBlockView with a new cache holding at most max_bytes.
+  template <class ImageT>
+  CachedBlockView<ImageT> cached_block_view( vw::ImageViewBase<ImageT> const& image,
+                                             int block_size, size_t max_bytes ) {
+    typedef typename CachedBlockView<ImageT>::cache_type cache_type;
+    boost::shared_ptr<cache_type> cache(new cache_type(max_bytes));
+    return CachedBlockView<ImageT>( image.impl(), block_size, cache );
+  }
+
+} // namespace asp
+
+#endif//__ASP_CORE_BLOCK_CACHE_H__
@@ -28,7 +28,10 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/ImageIO.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/FileIO/DiskImageView.h>
@@ -40,6 +43,8 @@
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <map>
 #include <string>
+#include <limits>
+#include <cmath>
 
 namespace asp {
 
@@ -118,6 +123,11 @@ namespace asp {
   // Note: We use this constant in the python code as well
   const std::string ASP_POINT_OFFSET_TAG_STR = "POINT_OFFSET";
 
+  /// String we use in point cloud files saved as integers for the
+  /// size of one integer step. See block_write_quantized_gdal_image().
+  // Note: We use this constant in the python code as well
+  const std::string ASP_POINT_SCALE_TAG_STR = "POINT_SCALE";
+
   // Specialized functions for reading/writing images with a shift.
   // The shift is meant to bring the pixel values closer to origin,
   // with goal of saving the pixels as float instead of double.
@@ -165,6 +175,41 @@ namespace asp {
   }
 
 
+  /// Divide the pixels by a scale and round them to int32. A point
+  /// whose first three channels do not fit is set to zero, the no-data
+  /// value, and the other channels are clamped.
+  template <class VecT>
+  struct QuantizeImagePixels:
+    public vw::ReturnFixedType<vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> > {
+    typedef vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> IntVecT;
+    double m_scale;
+    QuantizeImagePixels(double scale):m_scale(scale){
+      VW_ASSERT( m_scale > 0.0,
+                 vw::ArgumentErr() << "The quantization scale must be positive.");
+    }
+    IntVecT operator() (VecT const& pt) const {
+      const double max_val = std::numeric_limits<vw::int32>::max();
+      IntVecT out;
+      for (size_t i = 0; i < out.size(); i++){
+        double val = round(pt[i]/m_scale);
+        if (std::abs(val) > max_val){
+          if (i < 3)
+            return IntVecT();
+          val = (val > 0) ? max_val : -max_val;
+        }
+        out[i] = vw::int32(val);
+      }
+      return out;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+  inline quantize_image_pixels( vw::ImageViewBase<ImageT> const& image,
+                                double scale ) {
+    return vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+      ( image.impl(), QuantizeImagePixels<typename ImageT::pixel_type>(scale) );
+  }
+
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
   const double APPROX_ONE_MM = 1.0/1024.0;
@@ -195,6 +240,40 @@ namespace asp {
                                      std::map<std::string, std::string>() );
 
 
+  /// Block write a point cloud image while subtracting a given value
+  /// from all pixels and saving them as int32 multiples of the rounding
+  /// error. This keeps the full precision of the rounded values, while
+  /// with an integer predictor the file compresses much better than
+  /// with floats. Tiles with no valid points are not written at all,
+  /// so readers do not decompress them. The shift must be close to the
+  /// points, as only points within 2^31 rounding errors of it fit.
+  template <class ImageT>
+  void block_write_quantized_gdal_image(const std::string &filename,
+                                        vw::Vector3 const& shift,
+                                        double rounding_error,
+                                        vw::ImageViewBase<ImageT> const& image,
+                                        bool has_georef,
+                                        vw::cartography::GeoReference const& georef,
+                                        vw::cartography::GdalWriteOptions const& opt,
+                                        vw::ProgressCallback const& progress_callback
+                                        = vw::ProgressCallback::dummy_instance(),
+                                        std::map<std::string, std::string> const& keywords =
+                                        std::map<std::string, std::string>() );
+
+  /// Single-threaded version of block_write_quantized_gdal_image().
+  template <class ImageT>
+  void write_quantized_gdal_image(const std::string &filename,
+                                  vw::Vector3 const& shift,
+                                  double rounding_error,
+                                  vw::ImageViewBase<ImageT> const& image,
+                                  bool has_georef,
+                                  vw::cartography::GeoReference const& georef,
+                                  vw::cartography::GdalWriteOptions const& opt,
+                                  vw::ProgressCallback const& progress_callback
+                                  = vw::ProgressCallback::dummy_instance(),
+                                  std::map<std::string, std::string> const& keywords =
+                                  std::map<std::string, std::string>() );
+
   /// Single-threaded write image while subtracting a given value from
   /// all pixels and casting the result to float.
   template <class ImageT>
@@ -212,6 +291,24 @@ namespace asp {
                                std::map<std::string, std::string>() );
 
 
+  /// Block write an image to disk with multiple threads, processing its
+  /// tiles in the given order rather than in raster order. The tiles must
+  /// be aligned with opt.raster_tile_size. Use this to start first the
+  /// tiles known to be the most expensive, so that no single slow tile
+  /// is left running alone at the end.
+  template <class ImageT>
+  void block_write_gdal_image_in_order(const std::string &filename,
+                                       vw::ImageViewBase<ImageT> const& image,
+                                       std::vector<vw::BBox2i> const& tiles,
+                                       bool has_georef,
+                                       vw::cartography::GeoReference const& georef,
+                                       bool has_nodata, double nodata,
+                                       vw::cartography::GdalWriteOptions const& opt,
+                                       vw::ProgressCallback const& progress_callback
+                                       = vw::ProgressCallback::dummy_instance(),
+                                       std::map<std::string, std::string> const& keywords =
+                                       std::map<std::string, std::string>() );
+
   /// Often times, we'd like to save an image to disk by using big
   /// blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
@@ -97,6 +97,141 @@ namespace asp {
     }
   }
 
+  namespace detail {
+    // The keywords and options for a point cloud saved as integers.
+    inline void quantized_write_settings(vw::Vector3 const& shift, double scale,
+                                         std::map<std::string, std::string> const& keywords,
+                                         vw::cartography::GdalWriteOptions const& opt,
+                                         std::map<std::string, std::string> & local_keywords,
+                                         vw::cartography::GdalWriteOptions & local_opt) {
+      VW_ASSERT( norm_2(shift) > 0,
+                 vw::ArgumentErr() << "A point cloud saved as integers needs a shift.\n" );
+      std::ostringstream os;
+      os.precision(17);
+      os << scale;
+      local_keywords = keywords;
+      local_keywords[ASP_POINT_OFFSET_TAG_STR] = vw::vec_to_str(shift);
+      local_keywords[ASP_POINT_SCALE_TAG_STR ] = os.str();
+
+      local_opt = opt;
+      local_opt.gdal_options["PREDICTOR"] = "2"; // Difference neighboring integers
+      local_opt.gdal_options["SPARSE_OK"] = "TRUE"; // Skip blocks with no valid points
+    }
+  }
+
+  template <class ImageT>
+  void block_write_quantized_gdal_image(const std::string &filename,
+                                        vw::Vector3 const& shift,
+                                        double rounding_error,
+                                        vw::ImageViewBase<ImageT> const& image,
+                                        bool has_georef,
+                                        vw::cartography::GeoReference const& georef,
+                                        vw::cartography::GdalWriteOptions const& opt,
+                                        vw::ProgressCallback const& progress_callback,
+                                        std::map<std::string, std::string> const& keywords) {
+
+    double scale = get_rounding_error(shift, rounding_error);
+    std::map<std::string, std::string> local_keywords;
+    vw::cartography::GdalWriteOptions local_opt;
+    detail::quantized_write_settings(shift, scale, keywords, opt, local_keywords, local_opt);
+
+    bool has_nodata = false;
+    block_write_gdal_image(filename,
+                           quantize_image_pixels(subtract_shift(image.impl(), shift), scale),
+                           has_georef, georef, has_nodata, 0,
+                           local_opt, progress_callback, local_keywords);
+  }
+
+  template <class ImageT>
+  void write_quantized_gdal_image(const std::string &filename,
+                                  vw::Vector3 const& shift,
+                                  double rounding_error,
+                                  vw::ImageViewBase<ImageT> const& image,
+                                  bool has_georef,
+                                  vw::cartography::GeoReference const& georef,
+                                  vw::cartography::GdalWriteOptions const& opt,
+                                  vw::ProgressCallback const& progress_callback,
+                                  std::map<std::string, std::string> const& keywords) {
+
+    double scale = get_rounding_error(shift, rounding_error);
+    std::map<std::string, std::string> local_keywords;
+    vw::cartography::GdalWriteOptions local_opt;
+    detail::quantized_write_settings(shift, scale, keywords, opt, local_keywords, local_opt);
+
+    bool has_nodata = false;
+    write_gdal_image(filename,
+                     quantize_image_pixels(subtract_shift(image.impl(), shift), scale),
+                     has_georef, georef, has_nodata, 0,
+                     local_opt, progress_callback, local_keywords);
+  }
+
+  // Task to rasterize one tile of an image and write it to a resource.
+  template <class ImageT>
+  class WriteTileTask : public vw::Task, private boost::noncopyable {
+    ImageT const&            m_image;
+    vw::BBox2i               m_bbox;
+    vw::DiskImageResource&   m_rsrc;
+    vw::Mutex&               m_mutex;
+    vw::ProgressCallback const& m_progress;
+    double                   m_inc_amt;
+  public:
+    WriteTileTask(ImageT const& image, vw::BBox2i const& bbox,
+                  vw::DiskImageResource& rsrc, vw::Mutex& mutex,
+                  vw::ProgressCallback const& progress, double inc_amt):
+      m_image(image), m_bbox(bbox), m_rsrc(rsrc), m_mutex(mutex),
+      m_progress(progress), m_inc_amt(inc_amt){}
+
+    void operator()() {
+      // Do the work outside the lock, only the write is serialized.
+      vw::ImageView<typename ImageT::pixel_type> tile = crop(m_image, m_bbox);
+      vw::Mutex::Lock lock( m_mutex );
+      m_rsrc.write(tile.buffer(), m_bbox);
+      m_progress.report_incremental_progress( m_inc_amt );
+    }
+  };
+
+  template <class ImageT>
+  void block_write_gdal_image_in_order(const std::string &filename,
+                                       vw::ImageViewBase<ImageT> const& image,
+                                       std::vector<vw::BBox2i> const& tiles,
+                                       bool has_georef,
+                                       vw::cartography::GeoReference const& georef,
+                                       bool has_nodata, double nodata,
+                                       vw::cartography::GdalWriteOptions const& opt,
+                                       vw::ProgressCallback const& progress_callback,
+                                       std::map<std::string, std::string> const& keywords) {
+
+    boost::scoped_ptr<vw::DiskImageResourceGDAL>
+      rsrc( vw::cartography::build_gdal_rsrc( filename, image, opt ) );
+    if ( has_nodata )
+      rsrc->set_nodata_write( nodata );
+    if ( has_georef )
+      vw::cartography::write_georeference( *rsrc, georef );
+    for ( std::map<std::string, std::string>::const_iterator it = keywords.begin();
+          it != keywords.end(); it++ )
+      vw::cartography::write_header_string( *rsrc, it->first, it->second );
+
+    vw::BBox2i image_box = bounding_box(image.impl());
+    for (size_t i = 0; i < tiles.size(); i++){
+      VW_ASSERT( image_box.contains(tiles[i]),
+                 vw::ArgumentErr() << "block_write_gdal_image_in_order: Tile "
+                 << tiles[i] << " is not within the image.\n" );
+    }
+
+    vw::FifoWorkQueue queue( vw::vw_settings().default_num_threads() );
+    vw::Mutex mutex;
+    double inc_amt = 1.0 / std::max(1.0, double(tiles.size()));
+    progress_callback.report_progress(0);
+    for (size_t i = 0; i < tiles.size(); i++){
+      boost::shared_ptr< WriteTileTask<ImageT> >
+        task( new WriteTileTask<ImageT>( image.impl(), tiles[i], *rsrc, mutex,
+                                         progress_callback, inc_amt ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+    progress_callback.report_finished();
+  }
+
   // Often times, we'd like to save an image to disk by using big
   // blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
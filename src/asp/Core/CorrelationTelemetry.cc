@@ -0,0 +1,113 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/CorrelationTelemetry.h>
+#include <vw/Core/Exception.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+using namespace vw;
+
+namespace asp {
+
+  double correlation_ops(BBox2i const& tile, Vector2i const& kernel_size,
+                         BBox2f const& search_range) {
+    return double(tile.width()) * tile.height()
+      * double(kernel_size[0]) * kernel_size[1]
+      * (search_range.width() + 1.0) * (search_range.height() + 1.0);
+  }
+
+  double search_volume(BBox2i const& tile, BBox2f const& search_range) {
+    return double(tile.width()) * tile.height()
+      * (search_range.width() + 1.0) * (search_range.height() + 1.0);
+  }
+
+  CorrelationTelemetry::CorrelationTelemetry(int num_calibration_tiles):
+    m_num_calibration_tiles(num_calibration_tiles) {}
+
+  // Sort tiles by row, then by column
+  bool tile_record_less(CorrTileRecord const& a, CorrTileRecord const& b) {
+    if (a.tile.min().y() != b.tile.min().y())
+      return a.tile.min().y() < b.tile.min().y();
+    return a.tile.min().x() < b.tile.min().x();
+  }
+
+  void CorrelationTelemetry::add(CorrTileRecord const& record) {
+    Mutex::Lock lock(m_mutex);
+    m_records.push_back(record);
+  }
+
+  bool CorrelationTelemetry::needs_calibration() const {
+    Mutex::Lock lock(m_mutex);
+    return int(m_calibration_rates.size()) < m_num_calibration_tiles;
+  }
+
+  void CorrelationTelemetry::add_calibration(double seconds_per_op) {
+    Mutex::Lock lock(m_mutex);
+    if (seconds_per_op > 0 && int(m_calibration_rates.size()) < m_num_calibration_tiles)
+      m_calibration_rates.push_back(seconds_per_op);
+  }
+
+  bool CorrelationTelemetry::measured_seconds_per_op(double & seconds_per_op) const {
+    Mutex::Lock lock(m_mutex);
+    if (m_calibration_rates.empty())
+      return false;
+    std::vector<double> rates = m_calibration_rates;
+    std::nth_element(rates.begin(), rates.begin() + rates.size()/2, rates.end());
+    seconds_per_op = rates[rates.size()/2];
+    return true;
+  }
+
+  size_t CorrelationTelemetry::size() const {
+    Mutex::Lock lock(m_mutex);
+    return m_records.size();
+  }
+
+  void CorrelationTelemetry::write(std::string const& file) const {
+
+    std::vector<CorrTileRecord> records;
+    {
+      Mutex::Lock lock(m_mutex);
+      records = m_records;
+    }
+    std::sort(records.begin(), records.end(), tile_record_less);
+
+    std::ofstream fh(file.c_str());
+    if (!fh.good())
+      vw_throw( IOErr() << "CorrelationTelemetry: Cannot write: " << file << ".\n" );
+
+    fh << "# min_x, min_y, width, height, search_min_x, search_min_y, search_max_x, "
+       << "search_max_y, ops, seconds, seconds_per_op, timed_out, reused\n";
+    fh << std::setprecision(8);
+    for (size_t i = 0; i < records.size(); i++) {
+      CorrTileRecord const& r = records[i];
+      fh << r.tile.min().x() << ", " << r.tile.min().y() << ", "
+         << r.tile.width()   << ", " << r.tile.height()  << ", "
+         << r.search_range.min().x() << ", " << r.search_range.min().y() << ", "
+         << r.search_range.max().x() << ", " << r.search_range.max().y() << ", "
+         << r.ops << ", " << r.seconds << ", " << r.seconds_per_op << ", "
+         << r.timed_out << ", " << r.reused << "\n";
+    }
+
+    if (!fh.good())
+      vw_throw( IOErr() << "CorrelationTelemetry: Failed writing: " << file << ".\n" );
+    fh.close();
+  }
+
+} // namespace asp
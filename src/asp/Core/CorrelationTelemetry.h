@@ -0,0 +1,95 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CorrelationTelemetry.h
+///
+/// Per-tile timing of correlation. The correlation rate, in seconds per
+/// operation, is measured on the first few tiles with the same benchmark
+/// as the one run at startup, but under the actual load of the machine
+/// and on the tile's own pixels. The median of these rates replaces the
+/// startup benchmark when estimating if a tile would exceed the
+/// correlation timeout.
+
+#ifndef __ASP_CORE_CORRELATION_TELEMETRY_H__
+#define __ASP_CORE_CORRELATION_TELEMETRY_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/BBox.h>
+#include <vector>
+#include <string>
+
+namespace asp {
+
+  /// What happened when correlating one tile.
+  struct CorrTileRecord {
+    vw::BBox2i tile;
+    vw::BBox2f search_range;
+    double ops;            // See search_volume()
+    double seconds;        // Wall time
+    double seconds_per_op; // Rate used to estimate the time of the tile
+    bool   timed_out;      // The estimated time exceeded the timeout
+    bool   reused;         // Copied from a previous run rather than correlated
+    CorrTileRecord(): ops(0), seconds(0), seconds_per_op(0), timed_out(false), reused(false) {}
+  };
+
+  /// The work to correlate a tile by brute force, counted as the product
+  /// of the tile area, the kernel area, and the search range area. Used
+  /// to rank tiles by cost.
+  double correlation_ops(vw::BBox2i const& tile, vw::Vector2i const& kernel_size,
+                         vw::BBox2f const& search_range);
+
+  /// The product of the tile area and the search range area. This is
+  /// what the timeout check of the correlator multiplies by the seconds
+  /// per operation, which already account for the kernel size.
+  double search_volume(vw::BBox2i const& tile, vw::BBox2f const& search_range);
+
+  /// A thread-safe collection of tile records, and of the rates of
+  /// correlation measured on the first num_calibration_tiles tiles.
+  class CorrelationTelemetry {
+  public:
+    CorrelationTelemetry(int num_calibration_tiles);
+
+    void add(CorrTileRecord const& record);
+
+    /// If more tiles should be benchmarked. Tiles which start at the
+    /// same time may all get true, which only adds a few samples.
+    bool needs_calibration() const;
+
+    /// Add the rate measured on a tile, in the units of the startup
+    /// benchmark.
+    void add_calibration(double seconds_per_op);
+
+    /// The median of the rates measured so far. Returns false if none
+    /// was measured yet.
+    bool measured_seconds_per_op(double & seconds_per_op) const;
+
+    size_t size() const;
+
+    /// Save the records, sorted by tile position, as CSV.
+    void write(std::string const& file) const;
+
+  private:
+    int    m_num_calibration_tiles;
+    std::vector<double>         m_calibration_rates;
+    std::vector<CorrTileRecord> m_records;
+    mutable vw::Mutex m_mutex;
+  };
+
+} // namespace asp
+
+#endif//__ASP_CORE_CORRELATION_TELEMETRY_H__
@@ -0,0 +1,221 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/HoleFill.h>
+#include <vw/Core/Exception.h>
+#include <algorithm>
+
+using namespace vw;
+
+namespace asp {
+
+  int label_holes(ImageView<uint8> const& invalid, Vector2i const& offset,
+                  ImageView<int32> & labels, std::vector<HoleInfo> & holes) {
+    labels.set_size(invalid.cols(), invalid.rows());
+    fill(labels, -1);
+    holes.clear();
+
+    std::vector<Vector2i> stack;
+    for (int row = 0; row < invalid.rows(); row++) {
+      for (int col = 0; col < invalid.cols(); col++) {
+        if (!invalid(col, row) || labels(col, row) >= 0)
+          continue;
+
+        // Flood fill a new hole. The seed is its first pixel in raster order.
+        int label = holes.size();
+        int min_x = col, max_x = col, min_y = row, max_y = row, area = 0;
+        labels(col, row) = label;
+        stack.assign(1, Vector2i(col, row));
+        while (!stack.empty()) {
+          Vector2i p = stack.back();
+          stack.pop_back();
+          area++;
+          min_x = std::min(min_x, p[0]); max_x = std::max(max_x, p[0]);
+          min_y = std::min(min_y, p[1]); max_y = std::max(max_y, p[1]);
+          Vector2i nbrs[4] = {Vector2i(p[0]-1, p[1]), Vector2i(p[0]+1, p[1]),
+                              Vector2i(p[0], p[1]-1), Vector2i(p[0], p[1]+1)};
+          for (int k = 0; k < 4; k++) {
+            Vector2i q = nbrs[k];
+            if (q[0] < 0 || q[1] < 0 || q[0] >= invalid.cols() || q[1] >= invalid.rows() ||
+                !invalid(q[0], q[1]) || labels(q[0], q[1]) >= 0)
+              continue;
+            labels(q[0], q[1]) = label;
+            stack.push_back(q);
+          }
+        }
+
+        HoleInfo hole;
+        hole.bbox = BBox2i(min_x + offset[0], min_y + offset[1],
+                           max_x - min_x + 1, max_y - min_y + 1);
+        hole.seed = Vector2i(col, row) + offset;
+        hole.area = area;
+        holes.push_back(hole);
+      }
+    }
+    return holes.size();
+  }
+
+  TiledHoleIndex::TiledHoleIndex(int cols, int rows, int tile_size, int max_area):
+    m_tile_size(tile_size), m_max_area(max_area) {
+    VW_ASSERT(tile_size > 0,
+              ArgumentErr() << "TiledHoleIndex: The tile size must be positive.\n");
+    m_tiles_x = (cols + tile_size - 1)/tile_size;
+    m_tiles_y = (rows + tile_size - 1)/tile_size;
+    for (int ty = 0; ty < m_tiles_y; ty++) {
+      for (int tx = 0; tx < m_tiles_x; tx++) {
+        int x = tx*tile_size, y = ty*tile_size;
+        m_tiles.push_back(BBox2i(x, y, std::min(tile_size, cols - x),
+                                 std::min(tile_size, rows - y)));
+      }
+    }
+    m_tile_labels.resize(m_tiles.size());
+  }
+
+  void TiledHoleIndex::add_tile(size_t tile_id, ImageView<uint8> const& invalid) {
+    BBox2i const& box = m_tiles[tile_id];
+    VW_ASSERT(invalid.cols() == box.width() && invalid.rows() == box.height(),
+              ArgumentErr() << "TiledHoleIndex: The mask does not match the tile.\n");
+
+    // Each tile has its own slot, so no lock is needed
+    TileLabels & tile = m_tile_labels[tile_id];
+    ImageView<int32> labels;
+    label_holes(invalid, box.min(), labels, tile.holes);
+
+    int cols = labels.cols(), rows = labels.rows();
+    tile.top.resize(cols); tile.bottom.resize(cols);
+    tile.left.resize(rows); tile.right.resize(rows);
+    for (int col = 0; col < cols; col++) {
+      tile.top   [col] = labels(col, 0);
+      tile.bottom[col] = labels(col, rows - 1);
+    }
+    for (int row = 0; row < rows; row++) {
+      tile.left [row] = labels(0,        row);
+      tile.right[row] = labels(cols - 1, row);
+    }
+  }
+
+  namespace {
+    size_t find_root(std::vector<size_t> & parent, size_t i) {
+      while (parent[i] != i) {
+        parent[i] = parent[parent[i]]; // Path halving
+        i = parent[i];
+      }
+      return i;
+    }
+
+    void unite(std::vector<size_t> & parent, size_t i, size_t j) {
+      i = find_root(parent, i);
+      j = find_root(parent, j);
+      if (i < j)
+        parent[j] = i;
+      else if (j < i)
+        parent[i] = j;
+    }
+  }
+
+  void TiledHoleIndex::merge() {
+
+    // Number the holes of all tiles in sequence
+    size_t num_tiles = m_tiles.size();
+    std::vector<size_t> start(num_tiles + 1, 0);
+    for (size_t t = 0; t < num_tiles; t++)
+      start[t + 1] = start[t] + m_tile_labels[t].holes.size();
+    std::vector<size_t> parent(start[num_tiles]);
+    for (size_t i = 0; i < parent.size(); i++)
+      parent[i] = i;
+
+    // Join the holes which meet across tile edges
+    for (int ty = 0; ty < m_tiles_y; ty++) {
+      for (int tx = 0; tx < m_tiles_x; tx++) {
+        size_t t = ty*m_tiles_x + tx;
+        if (tx + 1 < m_tiles_x) {
+          std::vector<int32> const& a = m_tile_labels[t].right;
+          std::vector<int32> const& b = m_tile_labels[t + 1].left;
+          for (size_t i = 0; i < a.size(); i++)
+            if (a[i] >= 0 && b[i] >= 0)
+              unite(parent, start[t] + a[i], start[t + 1] + b[i]);
+        }
+        if (ty + 1 < m_tiles_y) {
+          std::vector<int32> const& a = m_tile_labels[t].bottom;
+          std::vector<int32> const& b = m_tile_labels[t + m_tiles_x].top;
+          for (size_t i = 0; i < a.size(); i++)
+            if (a[i] >= 0 && b[i] >= 0)
+              unite(parent, start[t] + a[i], start[t + m_tiles_x] + b[i]);
+        }
+      }
+    }
+
+    // Accumulate each hole at its root, which is its first part, as
+    // unite() keeps the smaller index.
+    std::vector<HoleInfo> merged(parent.size());
+    for (size_t t = 0; t < num_tiles; t++) {
+      std::vector<HoleInfo> const& holes = m_tile_labels[t].holes;
+      for (size_t i = 0; i < holes.size(); i++) {
+        HoleInfo & root = merged[find_root(parent, start[t] + i)];
+        if (root.area == 0) {
+          root = holes[i];
+        } else {
+          root.area += holes[i].area;
+          root.bbox.grow(holes[i].bbox);
+        }
+      }
+    }
+    m_tile_labels.clear();
+
+    m_holes.clear();
+    m_tile_holes.assign(num_tiles, std::vector<int>());
+    for (size_t i = 0; i < merged.size(); i++) {
+      if (merged[i].area == 0 || merged[i].area > m_max_area)
+        continue;
+      HoleInfo const& hole = merged[i];
+      int id = m_holes.size();
+      m_holes.push_back(hole);
+      for (int ty = hole.bbox.min().y()/m_tile_size; ty <= (hole.bbox.max().y()-1)/m_tile_size; ty++)
+        for (int tx = hole.bbox.min().x()/m_tile_size; tx <= (hole.bbox.max().x()-1)/m_tile_size; tx++)
+          m_tile_holes[ty*m_tiles_x + tx].push_back(id);
+    }
+  }
+
+  void TiledHoleIndex::holes_in(BBox2i const& bbox, std::vector<HoleInfo> & holes) const {
+    holes.clear();
+    if (bbox.empty() || m_tiles.empty())
+      return;
+    int tx0 = std::max(0, bbox.min().x()/m_tile_size);
+    int ty0 = std::max(0, bbox.min().y()/m_tile_size);
+    int tx1 = std::min(m_tiles_x - 1, (bbox.max().x() - 1)/m_tile_size);
+    int ty1 = std::min(m_tiles_y - 1, (bbox.max().y() - 1)/m_tile_size);
+
+    std::vector<int> ids;
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = tx0; tx <= tx1; tx++) {
+        std::vector<int> const& tile_holes = m_tile_holes[ty*m_tiles_x + tx];
+        ids.insert(ids.end(), tile_holes.begin(), tile_holes.end());
+      }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    for (size_t i = 0; i < ids.size(); i++) {
+      BBox2i const& b = m_holes[ids[i]].bbox;
+      if (b.min().x() < bbox.max().x() && bbox.min().x() < b.max().x() &&
+          b.min().y() < bbox.max().y() && bbox.min().y() < b.max().y())
+        holes.push_back(m_holes[ids[i]]);
+    }
+  }
+
+} // namespace asp
@@ -0,0 +1,296 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file HoleFill.h
+///
+/// Find and fill the small holes in a masked image, without holding the
+/// whole image in memory. The holes are labeled in each tile in
+/// parallel, and the labels of neighboring tiles are then merged with a
+/// union-find over the pixels on the tile boundaries. Each output tile
+/// is filled by reading only the tile and the holes which touch it.
+
+#ifndef __ASP_CORE_HOLE_FILL_H__
+#define __ASP_CORE_HOLE_FILL_H__
+
+#include <vw/Core/System.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace asp {
+
+  /// A hole, that is, a 4-connected set of invalid pixels.
+  struct HoleInfo {
+    vw::BBox2i   bbox;
+    vw::Vector2i seed; // One of the pixels of the hole
+    int          area;
+    HoleInfo(): seed(0, 0), area(0) {}
+  };
+
+  /// Label the 4-connected invalid pixels of an image, with labels
+  /// starting from 0, and -1 for valid pixels. The seed and bounding box
+  /// of each hole are shifted by the given offset. Returns the number of
+  /// holes.
+  int label_holes(vw::ImageView<vw::uint8> const& invalid, vw::Vector2i const& offset,
+                  vw::ImageView<vw::int32> & labels, std::vector<HoleInfo> & holes);
+
+  /// The holes of an image no larger than a given area. Holes are
+  /// labeled tile by tile with add_tile(), which may be called from
+  /// several threads for different tiles, then merged across tiles.
+  class TiledHoleIndex : private boost::noncopyable {
+  public:
+    TiledHoleIndex(int cols, int rows, int tile_size, int max_area);
+
+    std::vector<vw::BBox2i> const& tiles() const { return m_tiles; }
+
+    /// Label the holes of a tile, given which of its pixels are invalid.
+    void add_tile(size_t tile_id, vw::ImageView<vw::uint8> const& invalid);
+
+    /// Merge the holes across tiles and keep the small ones. Call after
+    /// all tiles were added.
+    void merge();
+
+    size_t num_holes() const { return m_holes.size(); }
+
+    /// The small holes intersecting a box.
+    void holes_in(vw::BBox2i const& bbox, std::vector<HoleInfo> & holes) const;
+
+  private:
+    // For each tile, the labels of the pixels on its edges, and its holes
+    struct TileLabels {
+      std::vector<vw::int32> top, bottom, left, right;
+      std::vector<HoleInfo> holes;
+    };
+
+    int m_tile_size, m_max_area, m_tiles_x, m_tiles_y;
+    std::vector<vw::BBox2i>  m_tiles;
+    std::vector<TileLabels>  m_tile_labels;
+    std::vector<HoleInfo>    m_holes;   // The small holes
+    std::vector<std::vector<int> > m_tile_holes; // The small holes touching each tile
+  };
+
+  /// Label the holes of one tile of a masked view.
+  template <class ViewT>
+  class HoleLabelTask : public vw::Task, private boost::noncopyable {
+    ViewT            m_view;
+    TiledHoleIndex & m_index;
+    size_t           m_tile_id;
+  public:
+    HoleLabelTask(ViewT const& view, TiledHoleIndex & index, size_t tile_id):
+      m_view(view), m_index(index), m_tile_id(tile_id) {}
+
+    void operator()() {
+      vw::BBox2i box = m_index.tiles()[m_tile_id];
+      vw::ImageView<typename ViewT::pixel_type> tile = crop(m_view, box);
+      vw::ImageView<vw::uint8> invalid(tile.cols(), tile.rows());
+      for (int row = 0; row < tile.rows(); row++)
+        for (int col = 0; col < tile.cols(); col++)
+          invalid(col, row) = !is_valid(tile(col, row));
+      m_index.add_tile(m_tile_id, invalid);
+    }
+  };
+
+  /// Find the holes of a masked view, with one task per tile.
+  template <class ViewT>
+  void build_hole_index(vw::ImageViewBase<ViewT> const& view, TiledHoleIndex & index) {
+    vw::FifoWorkQueue queue( vw::vw_settings().default_num_threads() );
+    for (size_t i = 0; i < index.tiles().size(); i++) {
+      boost::shared_ptr<HoleLabelTask<ViewT> >
+        task(new HoleLabelTask<ViewT>(view.impl(), index, i));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    index.merge();
+  }
+
+  /// Fill a hole in the region of an image starting at the given
+  /// offset. As in VW's inpaint() with grassfire, the pixels are filled
+  /// in order of their 4-connected distance to the valid pixels, each
+  /// being the average of its valid and already filled 8 neighbors.
+  /// Only the hole and the original values around it are used, so a
+  /// hole is filled the same way whatever the region and other holes are.
+  template <class ChildT>
+  void fill_hole(vw::ImageView<vw::PixelMask<ChildT> > const& orig,
+                 vw::ImageView<vw::PixelMask<ChildT> >       & out,
+                 vw::Vector2i const& offset, HoleInfo const& hole) {
+    using namespace vw;
+    typedef PixelMask<ChildT> PixelT;
+
+    BBox2i box = hole.bbox;
+    box.expand(1);
+    box.crop(BBox2i(offset[0], offset[1], orig.cols(), orig.rows()));
+    ImageView<PixelT> buf = crop(orig, box.min().x() - offset[0], box.min().y() - offset[1],
+                                 box.width(), box.height());
+
+    // Collect the pixels of the hole, marking them with a distance of 0
+    Vector2i seed = hole.seed - box.min();
+    if (seed[0] < 0 || seed[1] < 0 || seed[0] >= buf.cols() || seed[1] >= buf.rows() ||
+        is_valid(buf(seed[0], seed[1])))
+      return;
+    ImageView<int32> dist(buf.cols(), buf.rows());
+    fill(dist, -1);
+    std::vector<Vector2i> pixels, stack(1, seed);
+    dist(seed[0], seed[1]) = 0;
+    while (!stack.empty()) {
+      Vector2i p = stack.back();
+      stack.pop_back();
+      pixels.push_back(p);
+      Vector2i nbrs[4] = {Vector2i(p[0]-1, p[1]), Vector2i(p[0]+1, p[1]),
+                          Vector2i(p[0], p[1]-1), Vector2i(p[0], p[1]+1)};
+      for (int k = 0; k < 4; k++) {
+        Vector2i q = nbrs[k];
+        if (q[0] < 0 || q[1] < 0 || q[0] >= buf.cols() || q[1] >= buf.rows() ||
+            dist(q[0], q[1]) >= 0 || is_valid(buf(q[0], q[1])))
+          continue;
+        dist(q[0], q[1]) = 0;
+        stack.push_back(q);
+      }
+    }
+
+    // The grassfire distance, found breadth first from the pixels next
+    // to a valid one. Any other 4-neighbor of a hole pixel is in the
+    // hole, so this is the same as the distance in the whole image.
+    std::vector<Vector2i> front, next;
+    for (size_t i = 0; i < pixels.size(); i++) {
+      Vector2i p = pixels[i];
+      Vector2i nbrs[4] = {Vector2i(p[0]-1, p[1]), Vector2i(p[0]+1, p[1]),
+                          Vector2i(p[0], p[1]-1), Vector2i(p[0], p[1]+1)};
+      for (int k = 0; k < 4; k++) {
+        Vector2i q = nbrs[k];
+        if (q[0] >= 0 && q[1] >= 0 && q[0] < buf.cols() && q[1] < buf.rows() &&
+            dist(q[0], q[1]) < 0) {
+          dist(p[0], p[1]) = 1;
+          front.push_back(p);
+          break;
+        }
+      }
+    }
+
+    // Fill one distance at a time. The values at a distance are found
+    // before any of them is set, so the order of the pixels does not
+    // matter. Each pixel has a 4-neighbor at the previous distance, so
+    // it always has something to average. A hole with no valid pixel
+    // around it is not filled.
+    std::vector<PixelT> values;
+    for (int level = 1; !front.empty(); level++) {
+      values.clear();
+      for (size_t i = 0; i < front.size(); i++) {
+        Vector2i p = front[i];
+        ChildT sum = ChildT();
+        int count = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) {
+            int x = p[0] + dx, y = p[1] + dy;
+            if (x < 0 || y < 0 || x >= buf.cols() || y >= buf.rows() || !is_valid(buf(x, y)))
+              continue;
+            sum += buf(x, y).child();
+            count++;
+          }
+        }
+        sum /= float(count);
+        values.push_back(PixelT(sum));
+      }
+
+      next.clear();
+      for (size_t i = 0; i < front.size(); i++) {
+        Vector2i p = front[i];
+        buf(p[0], p[1]) = values[i];
+        out(p[0] + box.min().x() - offset[0], p[1] + box.min().y() - offset[1]) = values[i];
+        Vector2i nbrs[4] = {Vector2i(p[0]-1, p[1]), Vector2i(p[0]+1, p[1]),
+                            Vector2i(p[0], p[1]-1), Vector2i(p[0], p[1]+1)};
+        for (int k = 0; k < 4; k++) {
+          Vector2i q = nbrs[k];
+          if (q[0] < 0 || q[1] < 0 || q[0] >= buf.cols() || q[1] >= buf.rows() ||
+              dist(q[0], q[1]) != 0)
+            continue;
+          dist(q[0], q[1]) = level + 1;
+          next.push_back(q);
+        }
+      }
+      front.swap(next);
+    }
+  }
+
+  /// Fill the holes in a masked view which are listed in the index.
+  /// Each tile is read together with the holes touching it, so the
+  /// memory use is bounded by the tile size and the largest hole.
+  template <class ViewT>
+  class InpaintHolesView : public vw::ImageViewBase<InpaintHolesView<ViewT> > {
+    ViewT m_view;
+    TiledHoleIndex const& m_index;
+  public:
+    InpaintHolesView(ViewT const& view, TiledHoleIndex const& index):
+      m_view(view), m_index(index) {}
+
+    typedef typename ViewT::pixel_type pixel_type;
+    typedef pixel_type                 result_type;
+    typedef vw::ProceduralPixelAccessor<InpaintHolesView> pixel_accessor;
+
+    inline vw::int32 cols  () const { return m_view.cols(); }
+    inline vw::int32 rows  () const { return m_view.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, vw::int32 /*p*/ = 0 ) const {
+      vw::vw_throw(vw::NoImplErr() << "InpaintHolesView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      std::vector<HoleInfo> holes;
+      m_index.holes_in(bbox, holes);
+
+      vw::BBox2i region = bbox;
+      for (size_t i = 0; i < holes.size(); i++) {
+        vw::BBox2i hole_box = holes[i].bbox;
+        hole_box.expand(1);
+        region.grow(hole_box);
+      }
+      region.crop(bounding_box(m_view));
+
+      vw::ImageView<pixel_type> orig = crop(m_view, region);
+      vw::ImageView<pixel_type> out  = copy(orig);
+      for (size_t i = 0; i < holes.size(); i++)
+        fill_hole(orig, out, region.min(), holes[i]);
+
+      return prerasterize_type(out, -region.min().x(), -region.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ViewT>
+  InpaintHolesView<ViewT>
+  inpaint_holes(vw::ImageViewBase<ViewT> const& view, TiledHoleIndex const& index) {
+    return InpaintHolesView<ViewT>(view.impl(), index);
+  }
+
+} // namespace asp
+
+#endif//__ASP_CORE_HOLE_FILL_H__
@@ -38,6 +38,7 @@
 #include <asp/Core/Point2Grid.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/next.hpp>
+#include <boost/shared_ptr.hpp>
 #include <asp/Core/OrthoRasterizer.h>
 #include <valarray>
 
@@ -359,6 +360,124 @@ namespace asp{
 
 
 
+  void BoundaryGridIndex::build(std::vector<BBoxPair> const& boundaries) {
+
+    m_cols = m_rows = 0;
+    m_cell_start.clear();
+    m_cell_items.clear();
+    m_large.clear();
+    if (boundaries.empty())
+      return;
+
+    // The cells are about as many as the boundaries, and no smaller
+    // than a typical boundary, so most boundaries are in a few cells.
+    BBox2 extent;
+    std::vector<double> sizes;
+    sizes.reserve(boundaries.size());
+    BOOST_FOREACH( BBoxPair const& boundary, boundaries ) {
+      BBox3 const& b = boundary.first;
+      extent.grow(subvector(b.min(), 0, 2));
+      extent.grow(subvector(b.max(), 0, 2));
+      sizes.push_back(std::max(b.width(), b.height()));
+    }
+    std::nth_element(sizes.begin(), sizes.begin() + sizes.size()/2, sizes.end());
+    double median_size = sizes[sizes.size()/2];
+    std::vector<double>().swap(sizes);
+
+    double num = boundaries.size();
+    m_cell_size = std::max(sqrt(extent.width()*extent.height()/num), median_size);
+    m_cell_size = std::max(m_cell_size, std::max(extent.width(), extent.height())/num);
+    if (!(m_cell_size > 0)) // All boundaries are at one point
+      m_cell_size = 1.0;
+    m_origin = extent.min();
+    m_cols   = std::max(1, int(ceil(extent.width ()/m_cell_size)));
+    m_rows   = std::max(1, int(ceil(extent.height()/m_cell_size)));
+
+    // Count the boundaries in each cell, then list them
+    const int max_cells = 64;
+    m_cell_start.assign(size_t(m_cols)*m_rows + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+      std::vector<size_t> pos;
+      if (pass == 1) {
+        for (size_t k = 1; k < m_cell_start.size(); k++)
+          m_cell_start[k] += m_cell_start[k-1];
+        m_cell_items.resize(m_cell_start.back());
+        pos.assign(m_cell_start.begin(), m_cell_start.end() - 1);
+      }
+      for (size_t i = 0; i < boundaries.size(); i++) {
+        int c0, r0, c1, r1;
+        cell_range(boundaries[i].first, c0, r0, c1, r1);
+        if (double(c1 - c0 + 1)*double(r1 - r0 + 1) > max_cells) {
+          if (pass == 0)
+            m_large.push_back(i);
+          continue;
+        }
+        for (int r = r0; r <= r1; r++) {
+          for (int c = c0; c <= c1; c++) {
+            size_t k = size_t(r)*m_cols + c;
+            if (pass == 0)
+              m_cell_start[k+1]++;
+            else
+              m_cell_items[pos[k]++] = i;
+          }
+        }
+      }
+    }
+  }
+
+  void BoundaryGridIndex::cell_range(BBox3 const& box, int & c0, int & r0,
+                                     int & c1, int & r1) const {
+    c0 = int(floor((box.min().x() - m_origin.x())/m_cell_size));
+    r0 = int(floor((box.min().y() - m_origin.y())/m_cell_size));
+    c1 = int(floor((box.max().x() - m_origin.x())/m_cell_size));
+    r1 = int(floor((box.max().y() - m_origin.y())/m_cell_size));
+    c0 = std::min(std::max(c0, 0), m_cols - 1);
+    c1 = std::min(std::max(c1, 0), m_cols - 1);
+    r0 = std::min(std::max(r0, 0), m_rows - 1);
+    r1 = std::min(std::max(r1, 0), m_rows - 1);
+  }
+
+  void BoundaryGridIndex::find(std::vector<BBoxPair> const& boundaries, BBox3 const& box,
+                               std::vector<size_t> & indices) const {
+    indices.clear();
+    if (m_cols == 0 || box.empty())
+      return;
+
+    int qc0, qr0, qc1, qr1;
+    cell_range(box, qc0, qr0, qc1, qr1);
+    for (int r = qr0; r <= qr1; r++) {
+      for (int c = qc0; c <= qc1; c++) {
+        size_t k = size_t(r)*m_cols + c;
+        for (size_t j = m_cell_start[k]; j < m_cell_start[k+1]; j++) {
+          size_t i = m_cell_items[j];
+          // A boundary in several of these cells is checked only in the
+          // first of them.
+          int c0, r0, c1, r1;
+          cell_range(boundaries[i].first, c0, r0, c1, r1);
+          if (c != std::max(c0, qc0) || r != std::max(r0, qr0))
+            continue;
+          if (box.intersects(boundaries[i].first))
+            indices.push_back(i);
+        }
+      }
+    }
+    BOOST_FOREACH( size_t i, m_large ) {
+      if (box.intersects(boundaries[i].first))
+        indices.push_back(i);
+    }
+    std::sort(indices.begin(), indices.end());
+  }
+
+  int OrthoRasterizerView::sub_block_size(int cols, int rows) {
+    double s = 10000.0;
+    int sub_block_size = int(double(cols)*double(rows)/(s*s));
+    sub_block_size = std::max(1, sub_block_size);
+    sub_block_size = int(round(pow(2.0, floor(log(sub_block_size)/log(2.0)))));
+    sub_block_size = std::max(16, sub_block_size);
+    sub_block_size = std::min(max_subblock_size(), sub_block_size);
+    return sub_block_size;
+  }
+
   OrthoRasterizerView::OrthoRasterizerView
   (ImageViewRef<Vector3> point_image, ImageViewRef<double> texture,
    double search_radius_factor, double sigma_factor, bool use_surface_sampling, int pc_tile_size,
@@ -367,7 +486,7 @@ namespace asp{
    ImageViewRef<double> const& error_image, double estim_max_error,
    double max_valid_triangulation_error,
    Vector2 median_filter_params, int erode_len, bool has_las_or_csv,
-   const ProgressCallback& progress):
+   const ProgressCallback& progress, PointImageSummary const* summary):
     // Ensure all members are initiated, even if to temporary values
     m_point_image(point_image), m_texture(ImageView<float>(1,1)),
     m_bbox(BBox3()), m_snapped_bbox(BBox3()), m_spacing(0.0), m_default_spacing(0.0),
@@ -381,7 +500,9 @@ namespace asp{
     m_projwin(projwin),
     m_hole_fill_len(0),
     m_error_image(error_image), m_error_cutoff(-1.0),
-    m_median_filter_params(median_filter_params), m_erode_len(erode_len){
+    m_median_filter_params(median_filter_params), m_erode_len(erode_len),
+    m_boundary_padding(0.0), m_summary_block_size(0), m_summary_blocks_x(0),
+    m_summary_mismatch(new SummaryMismatch){
 
     set_texture(texture.impl());
 
@@ -392,49 +513,64 @@ namespace asp{
     // They're used for querying what part of the image we need
     VW_OUT(DebugMessage,"asp") << "Computing raster bounding box...\n";
 
-    int num_bins = 1024;
+    int num_bins = num_error_hist_bins();
     std::vector<double> errors_hist;
     if (remove_outliers_with_pct){
       // Need to compute the histogram of all errors in the error image
       errors_hist = std::vector<double>(num_bins, 0.0);
     }
 
-    // Subdivide each block into smaller chunks. Note: small chunks
-    // greatly increase the memory usage and run-time for very large
-    // images (because they are very many). As such, make the chunks
-    // bigger for bigger images.
-    double s = 10000.0;
-    int sub_block_size
-      = int(double(point_image.cols())*double(point_image.rows())/(s*s));
-    sub_block_size = std::max(1, sub_block_size);
-    sub_block_size = int(round(pow(2.0, floor(log(sub_block_size)/log(2.0)))));
-    sub_block_size = std::max(16, sub_block_size);
-    sub_block_size = std::min(max_subblock_size(), sub_block_size);
-    std::vector<BBox2i> blocks =
-      subdivide_bbox( m_point_image, m_block_size, m_block_size );
-
-    // Find the bounding box of each subblock, stored in
-    // m_point_image_boundaries, together with other info by
-    // searching through the image.
-    FifoWorkQueue queue( vw_settings().default_num_threads() );
-    typedef SubBlockBoundaryTask task_type;
-    Mutex mutex;
-    float inc_amt = 1.0 / float(blocks.size());
-    for ( size_t i = 0; i < blocks.size(); i++ ) {
-      boost::shared_ptr<task_type>
-	task( new task_type( m_point_image, sub_block_size, blocks[i],
-			     m_bbox, m_point_image_boundaries,
-			     error_image, estim_max_error, errors_hist,
-			     max_valid_triangulation_error,
-			     mutex, progress, inc_amt ) );
-      queue.add_task( task );
+    int sub_block_size = OrthoRasterizerView::sub_block_size(point_image.cols(),
+							     point_image.rows());
+    if (summary != NULL){
+      VW_ASSERT(summary->sub_block_size == sub_block_size &&
+		(!remove_outliers_with_pct || (int)summary->errors_hist.size() == num_bins),
+		ArgumentErr() << "OrthoRasterize: The point image summary does not match.\n");
+      vw_out() << "Using the point cloud index instead of scanning the point cloud.\n";
+      m_point_image_boundaries = summary->boundaries;
+      m_bbox = summary->bbox;
+      m_boundary_padding = summary->boundary_padding;
+      if (remove_outliers_with_pct)
+	errors_hist = summary->errors_hist;
+
+      m_summary_block_size = sub_block_size;
+      m_summary_blocks_x   = (point_image.cols() + sub_block_size - 1)/sub_block_size;
+      int blocks_y         = (point_image.rows() + sub_block_size - 1)/sub_block_size;
+      m_summary_blocks.assign(m_summary_blocks_x*blocks_y, -1);
+      for (size_t i = 0; i < m_point_image_boundaries.size(); i++){
+	Vector2i b = m_point_image_boundaries[i].second.min()/sub_block_size;
+	m_summary_blocks[b.y()*m_summary_blocks_x + b.x()] = i;
+      }
+    }else{
+      std::vector<BBox2i> blocks =
+	subdivide_bbox( m_point_image, m_block_size, m_block_size );
+
+      // Find the bounding box of each subblock, stored in
+      // m_point_image_boundaries, together with other info by
+      // searching through the image.
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      typedef SubBlockBoundaryTask task_type;
+      Mutex mutex;
+      float inc_amt = 1.0 / float(blocks.size());
+      for ( size_t i = 0; i < blocks.size(); i++ ) {
+	boost::shared_ptr<task_type>
+	  task( new task_type( m_point_image, sub_block_size, blocks[i],
+			       m_bbox, m_point_image_boundaries,
+			       error_image, estim_max_error, errors_hist,
+			       max_valid_triangulation_error,
+			       mutex, progress, inc_amt ) );
+	queue.add_task( task );
+      }
+      queue.join_all();
+      progress.report_finished();
     }
-    queue.join_all();
-    progress.report_finished();
 
     if ( m_bbox.empty() )
       vw_throw( ArgumentErr() << "OrthoRasterize: Input point cloud is empty!\n" );
 
+    // Index the boundaries once, for all DEM tiles and spacings
+    m_boundary_index.build(m_point_image_boundaries);
+
     // Override with user's projwin, if specified
     if (m_projwin != BBox2()){
       subvector(m_bbox.min(), 0, 2) = m_projwin.min();
@@ -560,28 +696,87 @@ namespace asp{
 
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type OrthoRasterizerView::prerasterize( BBox2i const& bbox ) const {
+    std::vector< ImageViewRef<float> > textures(1, m_texture);
+    std::vector< ImageView< PixelGray<float> > > tiles;
+    BBox2i tiles_box;
+    rasterize_textures(bbox, textures, tiles, tiles_box);
+    return prerasterize_type (tiles[0], BBox2i(-tiles_box.min().x(),
+					       -tiles_box.min().y(),
+					       cols(), rows()));
+  }
+
+  void OrthoRasterizerView::check_summary(ImageView<Vector3> const& points,
+					  BBox2i const& points_box,
+					  BBox2i const& block) const {
+    bool check_dem_box = (m_projwin == BBox2());
+    for (int row = block.min().y(); row < block.max().y(); row++){
+      for (int col = block.min().x(); col < block.max().x(); col++){
+	Vector3 const& p = points(col - points_box.min().x(), row - points_box.min().y());
+	if (boost::math::isnan(p.z()))
+	  continue;
+	int k = m_summary_blocks[(row/m_summary_block_size)*m_summary_blocks_x
+				 + col/m_summary_block_size];
+	bool is_good = (k >= 0);
+	if (is_good){
+	  BBox3 const& box = m_point_image_boundaries[k].first;
+	  is_good = (p.x() >= box.min().x() - m_boundary_padding &&
+		     p.x() <= box.max().x() + m_boundary_padding &&
+		     p.y() >= box.min().y() - m_boundary_padding &&
+		     p.y() <= box.max().y() + m_boundary_padding);
+	}
+	if (is_good && check_dem_box)
+	  is_good = (p.x() >= m_snapped_bbox.min().x() && p.x() <= m_snapped_bbox.max().x() &&
+		     p.y() >= m_snapped_bbox.min().y() && p.y() <= m_snapped_bbox.max().y());
+	if (!is_good){
+	  Mutex::Lock lock(m_summary_mismatch->mutex);
+	  m_summary_mismatch->found = true;
+	  return;
+	}
+      }
+    }
+  }
+
+  bool OrthoRasterizerView::summary_mismatch() const {
+    Mutex::Lock lock(m_summary_mismatch->mutex);
+    return m_summary_mismatch->found;
+  }
+
+  void OrthoRasterizerView::rasterize_textures
+  (BBox2i const& bbox, std::vector< ImageViewRef<float> > const& textures,
+   std::vector< ImageView< PixelGray<float> > > & tiles, BBox2i & tiles_box) const {
+
+    VW_ASSERT(!textures.empty(),
+	      ArgumentErr() << "OrthoRasterizer: Expecting at least one texture.\n");
+    int num_textures = textures.size();
 
     BBox2i bbox_1 = bbox;
 
     // bugfix, ensure we see enough beyond current tile
     bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
+    tiles_box = bbox_1;
 
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
-    ImageView<float> render_buffer;
-    ImageView<double> d_buffer, weights;
+    std::vector< ImageView<float> > render_buffers(num_textures);
+    std::vector< ImageView<double> > d_buffers(num_textures);
+    ImageView<double> weights;
+
+    // Setup a software renderer for each texture and the orthographic
+    // view matrix
+    std::vector< boost::shared_ptr<vw::stereo::SoftwareRenderer> > renderers;
     if (m_use_surface_sampling){
-      render_buffer.set_size(bbox_1.width(), bbox_1.height());
+      for (int t = 0; t < num_textures; t++){
+	render_buffers[t].set_size(bbox_1.width(), bbox_1.height());
+	renderers.push_back(boost::shared_ptr<vw::stereo::SoftwareRenderer>
+			    (new vw::stereo::SoftwareRenderer(bbox_1.width(),
+							      bbox_1.height(),
+							      &render_buffers[t](0,0))));
+	renderers[t]->Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+			      local_3d_bbox.min().y(), local_3d_bbox.max().y());
+      }
     }
 
-    // Setup a software renderer and the orthographic view matrix
-    vw::stereo::SoftwareRenderer renderer(bbox_1.width(),
-					  bbox_1.height(),
-					  &render_buffer(0,0) );
-    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-		     local_3d_bbox.min().y(), local_3d_bbox.max().y());
-
     // Given a DEM grid point, search for cloud points within the
     // circular region of radius equal to grid size. As such, a
     // given cloud point may contribute to multiple DEM points, but
@@ -595,7 +790,7 @@ namespace asp{
       search_radius = m_spacing*m_search_radius_factor;
     vw::stereo::Point2Grid point2grid(bbox_1.width(),
 				      bbox_1.height(),
-				      d_buffer, weights,
+				      d_buffers, weights,
 				      local_3d_bbox.min().x(),
 				      local_3d_bbox.min().y(),
 				      m_spacing, m_default_spacing,
@@ -612,14 +807,19 @@ namespace asp{
       min_val = m_default_value;
     }
 
-    std::valarray<float> vertices(10), intensities(5);
+    std::valarray<float> vertices(10);
+    std::vector< std::valarray<float> > intensities(num_textures, std::valarray<float>(5));
+    // The valid points of a block, gridded together once it is read
+    std::vector<double> xs, ys, values;
 
     if (m_use_surface_sampling){
       static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
       static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-      renderer.Clear(min_val);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
+      for (int t = 0; t < num_textures; t++){
+	renderers[t]->Clear(min_val);
+	renderers[t]->SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
+	renderers[t]->SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[t][0]);
+      }
     }else{
       point2grid.Clear(min_val);
     }
@@ -631,9 +831,13 @@ namespace asp{
     // their union instead of them individually, for reasons of
     // speed.
     std::map<BBox2i, BBox2i, compare_bboxes> blocks_map;
-    BOOST_FOREACH( BBoxPair const& boundary,
-		   m_point_image_boundaries ) {
-      if (! local_3d_bbox.intersects(boundary.first) ) continue;
+    std::vector<size_t> boundary_indices;
+    BBox3 query_bbox = local_3d_bbox;
+    query_bbox.min() -= Vector3(m_boundary_padding, m_boundary_padding, 0);
+    query_bbox.max() += Vector3(m_boundary_padding, m_boundary_padding, 0);
+    m_boundary_index.find(m_point_image_boundaries, query_bbox, boundary_indices);
+    BOOST_FOREACH( size_t boundary_index, boundary_indices ) {
+      BBoxPair const& boundary = m_point_image_boundaries[boundary_index];
 
       BBox2i pc_block = boundary.second;
 
@@ -649,18 +853,15 @@ namespace asp{
 
     }
 
+    tiles.resize(num_textures);
     if ( blocks_map.empty() ){
-      if (m_use_surface_sampling){
-	return prerasterize_type( render_buffer,
-				  BBox2i(-bbox_1.min().x(),
-					 -bbox_1.min().y(),
-					 cols(), rows()) );
-      }else{
-	return prerasterize_type( d_buffer,
-				  BBox2i(-bbox_1.min().x(),
-					 -bbox_1.min().y(),
-					 cols(), rows()) );
+      for (int t = 0; t < num_textures; t++){
+	if (m_use_surface_sampling)
+	  tiles[t] = render_buffers[t];
+	else
+	  tiles[t] = d_buffers[t];
       }
+      return;
     }
 
     // This is very important. When doing surface sampling, for each
@@ -682,6 +883,8 @@ namespace asp{
       biased_block.expand(bias);
       biased_block.crop(vw::bounding_box(m_point_image));
       ImageView<Vector3> point_copy = crop(m_point_image, biased_block);
+      if (!m_summary_blocks.empty())
+	check_summary(point_copy, biased_block, block);
 
       remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_block);
       filter_by_median(point_copy, m_median_filter_params);
@@ -697,7 +900,9 @@ namespace asp{
       // Crop back to the area of interest
       point_copy = crop(point_copy, block - biased_block.min());
 
-      ImageView<float> texture_copy = crop(m_texture, block );
+      std::vector< ImageView<float> > texture_copies(num_textures);
+      for (int t = 0; t < num_textures; t++)
+	texture_copies[t] = crop(textures[t], block );
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -727,28 +932,32 @@ namespace asp{
 	      vertices[8] = (*point_ul).x(); // UL
 	      vertices[9] = (*point_ul).y();
 
-	      intensities[0] = texture_copy(col,  row);
-	      intensities[1] = texture_copy(col,row+1);
-	      intensities[2] = texture_copy(col+1,  row+1);
-	      intensities[3] = texture_copy(col+1,row);
-	      intensities[4] = texture_copy(col,row);
-
-	      if ( !boost::math::isnan((*point_ll).z()) ) {
-		// triangle 1 is: UL LL LR
-		renderer.DrawPolygon(0, 3);
-	      }
-	      if ( !boost::math::isnan((*point_ur).z()) ) {
-		// triangle 2 is: LR, UR, UL
-		renderer.DrawPolygon(2, 3);
+	      for (int t = 0; t < num_textures; t++){
+		ImageView<float> const& texture_copy = texture_copies[t];
+		intensities[t][0] = texture_copy(col,  row);
+		intensities[t][1] = texture_copy(col,row+1);
+		intensities[t][2] = texture_copy(col+1,  row+1);
+		intensities[t][3] = texture_copy(col+1,row);
+		intensities[t][4] = texture_copy(col,row);
+
+		if ( !boost::math::isnan((*point_ll).z()) ) {
+		  // triangle 1 is: UL LL LR
+		  renderers[t]->DrawPolygon(0, 3);
+		}
+		if ( !boost::math::isnan((*point_ur).z()) ) {
+		  // triangle 2 is: LR, UR, UL
+		  renderers[t]->DrawPolygon(2, 3);
+		}
 	      }
 	    }
 
 	  }else{
 	    // The new engine
 	    if ( !boost::math::isnan(point_copy(col, row).z()) ){
-	      point2grid.AddPoint(point_copy(col, row).x(),
-				  point_copy(col, row).y(),
-				  texture_copy(col,  row));
+	      xs.push_back(point_copy(col, row).x());
+	      ys.push_back(point_copy(col, row).y());
+	      for (int t = 0; t < num_textures; t++)
+		values.push_back(texture_copies[t](col, row));
 	    }
 	  }
 	  point_ul.next_col();
@@ -756,6 +965,10 @@ namespace asp{
 	row_acc.next_row();
       }
 
+      if (!m_use_surface_sampling && !xs.empty()){
+	point2grid.AddPoints(xs.size(), &xs[0], &ys[0], &values[0]);
+	xs.clear(); ys.clear(); values.clear();
+      }
     }
 
     if (!m_use_surface_sampling)
@@ -766,16 +979,38 @@ namespace asp{
     // We also introduce transparent pixels into the result where
     // necessary.
     // To do: Here can do flipping in place.
-    ImageView< PixelGray<float> > result;
-    if (m_use_surface_sampling)
-      result = flip_vertical(render_buffer);
-    else
-      result = flip_vertical(d_buffer);
+    for (int t = 0; t < num_textures; t++){
+      if (m_use_surface_sampling)
+	tiles[t] = flip_vertical(render_buffers[t]);
+      else
+	tiles[t] = flip_vertical(d_buffers[t]);
+    }
+  }
+
+  OrthoRasterizerMultiView::OrthoRasterizerMultiView
+  (OrthoRasterizerView const& rasterizer,
+   std::vector< ImageViewRef<float> > const& textures):
+    m_rasterizer(&rasterizer), m_textures(textures){
+    VW_ASSERT(!m_textures.empty(),
+	      ArgumentErr() << "OrthoRasterizerMultiView: Expecting at least one texture.\n");
+  }
 
-    return prerasterize_type (result, BBox2i(-bbox_1.min().x(),
-					     -bbox_1.min().y(),
+  OrthoRasterizerMultiView::prerasterize_type
+  OrthoRasterizerMultiView::prerasterize( BBox2i const& bbox ) const {
+    std::vector< ImageView< PixelGray<float> > > tiles;
+    BBox2i tiles_box;
+    m_rasterizer->rasterize_textures(bbox, m_textures, tiles, tiles_box);
+
+    ImageView<float> result(tiles_box.width(), tiles_box.height(), planes());
+    for (int p = 0; p < planes(); p++)
+      for (int col = 0; col < result.cols(); col++)
+	for (int row = 0; row < result.rows(); row++)
+	  result(col, row, p) = tiles[p](col, row);
+    return prerasterize_type (result, BBox2i(-tiles_box.min().x(),
+					     -tiles_box.min().y(),
 					     cols(), rows()));
   }
+  /// \endcond
 
 
   // Return the affine georeferencing transform.
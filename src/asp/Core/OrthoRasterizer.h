@@ -25,10 +25,13 @@
 #ifndef __ASP_CORE_ORTHORASTERIZER_H__
 #define __ASP_CORE_ORTHORASTERIZER_H__
 
+#include <vw/Core/Thread.h>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
+#include <boost/shared_ptr.hpp>
+#include <vector>
 
 namespace asp{
 
@@ -36,6 +39,54 @@ namespace asp{
 
   typedef std::pair<BBox3, BBox2i> BBoxPair;
 
+  /// What the OrthoRasterizerView finds in its first pass over the
+  /// point image, when it is known without that pass, as from a
+  /// PointCloudIndex. The boundaries are for sub-blocks of the given
+  /// size, and the errors histogram is binned as in that pass. As the
+  /// boundaries are estimated, a point may be up to boundary_padding
+  /// outside of the box of its sub-block.
+  struct PointImageSummary {
+    int sub_block_size;
+    std::vector<BBoxPair> boundaries;
+    BBox3 bbox;
+    std::vector<double> errors_hist;
+    double boundary_padding;
+    PointImageSummary(): sub_block_size(0), boundary_padding(0.0) {}
+  };
+
+  /// A uniform grid over the x-y extent of the point image boundaries,
+  /// to quickly find those which intersect a box. Each boundary is
+  /// listed in the grid cells it overlaps, except for the few which
+  /// overlap very many cells, and those are checked for every box.
+  class BoundaryGridIndex {
+  public:
+    BoundaryGridIndex(): m_cols(0), m_rows(0), m_cell_size(0.0) {}
+
+    /// The boundaries must not change until the index is built again.
+    void build(std::vector<BBoxPair> const& boundaries);
+
+    /// Find the indices, in increasing order, of the boundaries which
+    /// intersect the box. The result is the same as checking each of
+    /// the boundaries the index was built from.
+    void find(std::vector<BBoxPair> const& boundaries, BBox3 const& box,
+              std::vector<size_t> & indices) const;
+
+    int cols() const { return m_cols; }
+    int rows() const { return m_rows; }
+
+  private:
+    // The range of grid cells overlapped by the x-y extent of a box,
+    // clamped to the grid.
+    void cell_range(BBox3 const& box, int & c0, int & r0, int & c1, int & r1) const;
+
+    int m_cols, m_rows;
+    double m_cell_size;
+    Vector2 m_origin;
+    std::vector<size_t> m_cell_start; // The boundaries of cell k are
+    std::vector<size_t> m_cell_items; // m_cell_items[m_cell_start[k]..m_cell_start[k+1])
+    std::vector<size_t> m_large;
+  };
+
   /// Given a point image and corresponding texture, this class
   /// bins and averages the point cloud on a regular grid over the [x,y]
   /// plane of the point image; producing an evenly sampled ortho-image
@@ -63,14 +114,32 @@ namespace asp{
     Vector2 m_median_filter_params;
     int     m_erode_len;
 
-    // We could actually use a quadtree here .. but this should be a
-    // good enough improvement.
     std::vector<BBoxPair> m_point_image_boundaries;
     // These boundaries describe a point cloud 3D boundaries and then
     // their location in the the point cloud image. These boxes are
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
 
+    // Finds the boundaries a DEM tile needs. It is built with the
+    // boundaries, so it does not depend on the DEM spacing.
+    BoundaryGridIndex m_boundary_index;
+
+    // With a summary, the boundary of each sub-block, in raster order,
+    // or -1 for those with no points, to check that the points which
+    // are read are where the summary says. The copies of this view
+    // share whether a point was not.
+    double m_boundary_padding;
+    int    m_summary_block_size, m_summary_blocks_x;
+    std::vector<int> m_summary_blocks;
+    struct SummaryMismatch {
+      Mutex mutex;
+      bool  found;
+      SummaryMismatch(): found(false) {}
+    };
+    boost::shared_ptr<SummaryMismatch> m_summary_mismatch;
+    void check_summary(ImageView<Vector3> const& points, BBox2i const& points_box,
+		       BBox2i const& block) const;
+
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
@@ -79,8 +148,17 @@ namespace asp{
     typedef const PixelGray<float> result_type;
     typedef ProceduralPixelAccessor<OrthoRasterizerView> pixel_accessor;
     static int max_subblock_size(){ return 128;} // is used in point2dem and below
+    static int num_error_hist_bins(){ return 1024;}
+
+    /// The size of the sub-blocks the point image is split into. Small
+    /// sub-blocks greatly increase the memory usage and run-time for
+    /// very large images (because they are very many), so they are
+    /// bigger for bigger images.
+    static int sub_block_size(int cols, int rows);
 
     /// Constructor.  You must call initialize_spacing before using the object!!
+    /// If a summary of the point image is given, the point image is not
+    /// scanned to find it.
     OrthoRasterizerView(ImageViewRef<Vector3> point_image,
 			ImageViewRef<double> texture,
 			double  search_radius_factor,
@@ -96,7 +174,8 @@ namespace asp{
 			Vector2 median_filter_params,
 			int     erode_len,
 			bool    has_las_or_csv,
-			const ProgressCallback& progress);
+			const ProgressCallback& progress,
+			PointImageSummary const* summary = NULL);
 
     /// This must be called before the object can be used!
     void initialize_spacing(double spacing=0.0);
@@ -114,6 +193,8 @@ namespace asp{
       m_texture = channel_cast<float>(channels_to_planes(texture.impl()));
     }
 
+    ImageViewRef<float> const& texture() const { return m_texture; }
+
     inline int32 cols() const { return (int) round((fabs(m_snapped_bbox.max().x() - m_snapped_bbox.min().x()) / m_spacing)) + 1; }
     inline int32 rows() const { return (int) round((fabs(m_snapped_bbox.max().y() - m_snapped_bbox.min().y()) / m_spacing)) + 1; }
 
@@ -135,6 +216,15 @@ namespace asp{
     }
     /// \endcond
 
+    /// Rasterize several textures over the same points in one pass,
+    /// so the points are read, filtered, and binned only once. Each
+    /// texture must be as the one given to set_texture(). The tiles
+    /// cover tiles_box, which contains bbox.
+    void rasterize_textures(BBox2i const& bbox,
+			    std::vector< ImageViewRef<float> > const& textures,
+			    std::vector< ImageView< PixelGray<float> > > & tiles,
+			    BBox2i & tiles_box) const;
+
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
@@ -179,6 +269,12 @@ namespace asp{
 
     BBox3 bounding_box() const { return m_snapped_bbox; }
 
+    /// If a summary was given, whether some point read so far was not
+    /// in the box of its sub-block, so it may have been missed by the
+    /// DEM tiles which did not read its sub-block, or was outside the
+    /// DEM. Then the results do not match those of scanning the points.
+    bool summary_mismatch() const;
+
     // Return the affine georeferencing transform.
     vw::Matrix<double,3,3> geo_transform();
 
@@ -188,6 +284,43 @@ namespace asp{
 
   };
 
+  /// The rasters of several textures made by an OrthoRasterizerView,
+  /// one per plane, so that they can be written in one pass. The
+  /// rasterizer must outlive this view and not change meanwhile.
+  class OrthoRasterizerMultiView:
+    public ImageViewBase<OrthoRasterizerMultiView> {
+    OrthoRasterizerView const* m_rasterizer;
+    std::vector< ImageViewRef<float> > m_textures;
+
+  public:
+    typedef float pixel_type;
+    typedef const float result_type;
+    typedef ProceduralPixelAccessor<OrthoRasterizerMultiView> pixel_accessor;
+
+    OrthoRasterizerMultiView(OrthoRasterizerView const& rasterizer,
+			     std::vector< ImageViewRef<float> > const& textures);
+
+    inline int32 cols() const { return m_rasterizer->cols(); }
+    inline int32 rows() const { return m_rasterizer->rows(); }
+    inline int32 planes() const { return m_textures.size(); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "OrthoRasterizerMultiView::operator()(int i, int j, int p) has not been implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const;
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   // TODO: Make this a BBox class function!!!
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
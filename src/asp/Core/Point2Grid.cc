@@ -38,9 +38,28 @@ Point2Grid::Point2Grid(int width, int height,
                        double x0, double y0, double grid_size, double min_spacing,
                        double radius, double sigma_factor):
   m_width(width), m_height(height),
-  m_buffer(buffer), m_weights(weights),
+  m_buffers(1, &buffer), m_weights(weights),
   m_x0(x0), m_y0(y0), m_grid_size(grid_size),
   m_radius(radius){
+  init(min_spacing, sigma_factor);
+}
+
+Point2Grid::Point2Grid(int width, int height,
+                       std::vector< ImageView<double> > & buffers, ImageView<double> & weights,
+                       double x0, double y0, double grid_size, double min_spacing,
+                       double radius, double sigma_factor):
+  m_width(width), m_height(height),
+  m_weights(weights),
+  m_x0(x0), m_y0(y0), m_grid_size(grid_size),
+  m_radius(radius){
+  for (size_t i = 0; i < buffers.size(); i++)
+    m_buffers.push_back(&buffers[i]);
+  init(min_spacing, sigma_factor);
+}
+
+void Point2Grid::init(double min_spacing, double sigma_factor){
+  if (m_buffers.empty())
+    vw_throw( ArgumentErr() << "Point2Grid: Expecting at least one buffer.\n" );
   if (m_grid_size <= 0)
     vw_throw( ArgumentErr() << "Point2Grid: Grid size must be > 0.\n" );
   if (m_radius <= 0)
@@ -51,7 +70,7 @@ Point2Grid::Point2Grid(int width, int height,
   // that the user may choose to make the grid size very small, but we
   // put a limit to how small 'spacing' gets, that is, how large sigma
   // gets, to ensure that the DEM stays smooth.
-  double spacing = std::max(grid_size, min_spacing);
+  double spacing = std::max(m_grid_size, min_spacing);
   double val = 0.25;
   double sigma = -log(val)/spacing/spacing;
 
@@ -59,60 +78,136 @@ Point2Grid::Point2Grid(int width, int height,
   if (sigma_factor > 0)
     sigma = sigma_factor/spacing/spacing;
   
-  // Sample the gaussian for speed
+  // Sample the gaussian for speed. The samples are evenly spaced in
+  // the squared distance, so no square root is needed to look them up.
   int num_samples = 1000;
-  m_dx = m_radius/(num_samples - 1.0);
+  m_radius2 = m_radius*m_radius;
+  m_dd = m_radius2/(num_samples - 1.0);
   m_sampled_gauss.resize(num_samples);
   for (int k = 0; k < num_samples; k++){
-    double dist = k*m_dx;
-    m_sampled_gauss[k] = exp(-sigma*dist*dist);
+    double dist2 = k*m_dd;
+    m_sampled_gauss[k] = exp(-sigma*dist2);
   }
   
 }
 
 void Point2Grid::Clear(const float value) {
-  m_buffer.set_size (m_width, m_height);
   m_weights.set_size (m_width, m_height);
-  for (int c = 0; c < m_buffer.cols(); c++){
-    for (int r = 0; r < m_buffer.rows(); r++){
-      m_buffer (c, r) = value;
+  for (size_t b = 0; b < m_buffers.size(); b++){
+    ImageView<double> & buffer = *m_buffers[b];
+    buffer.set_size (m_width, m_height);
+    for (int c = 0; c < buffer.cols(); c++){
+      for (int r = 0; r < buffer.rows(); r++){
+        buffer(c, r) = value;
+      }
+    }
+  }
+  for (int c = 0; c < m_weights.cols(); c++){
+    for (int r = 0; r < m_weights.rows(); r++){
       m_weights(c, r) = 0.0;
     }
   }
+  m_sums.assign(size_t(m_width)*m_height*(m_buffers.size() + 1), 0.0);
 }
 
 void Point2Grid::AddPoint(double x, double y, double z){
+  AddPoint(x, y, &z);
+}
 
-  int minx = std::max( (int)ceil( (x - m_radius - m_x0)/m_grid_size ), 0 );
-  int miny = std::max( (int)ceil( (y - m_radius - m_y0)/m_grid_size ), 0 );
-  
-  int maxx = std::min( (int)floor( (x + m_radius - m_x0)/m_grid_size ), m_buffer.cols() - 1 );
-  int maxy = std::min( (int)floor( (y + m_radius - m_y0)/m_grid_size ), m_buffer.rows() - 1 );
+void Point2Grid::AddPoint(double x, double y, double const* values){
+  AddPoints(1, &x, &y, values);
+}
+
+void Point2Grid::AddPoints(int num_points, double const* x, double const* y,
+                           double const* values){
+
+  if (num_points <= 0)
+    return;
+
+  // Visit the points by the grid row they are on, so that the grid
+  // rows being summed into stay in cache. This is a counting sort,
+  // and keeps the points of a row in the order they were given.
+  m_row_starts.assign(m_height + 2, 0);
+  m_order.resize(num_points);
+  for (int i = 0; i < num_points; i++)
+    m_row_starts[row_key(y[i]) + 1]++;
+  for (int r = 0; r <= m_height; r++)
+    m_row_starts[r + 1] += m_row_starts[r];
+  for (int i = 0; i < num_points; i++)
+    m_order[m_row_starts[row_key(y[i])]++] = i;
 
-  // Add the contribution of current point to all grid points within radius
-  for (int ix = minx; ix <= maxx; ix++){
+  int num_buffers = m_buffers.size();
+  int stride = num_buffers + 1; // the values, then the weight
+  int num_samples = m_sampled_gauss.size();
+  double inv_dd = 1.0/m_dd, inv_grid = 1.0/m_grid_size;
+  double const* gauss = &m_sampled_gauss[0];
+  for (int k = 0; k < num_points; k++){
+    int i = m_order[k];
+    double px = x[i] - m_x0, py = y[i] - m_y0;
+    double const* pv = values + size_t(i)*num_buffers;
+
+    int minx = std::max( (int)ceil( (px - m_radius)*inv_grid ), 0 );
+    int miny = std::max( (int)ceil( (py - m_radius)*inv_grid ), 0 );
+    int maxx = std::min( (int)floor( (px + m_radius)*inv_grid ), m_width - 1 );
+    int maxy = std::min( (int)floor( (py + m_radius)*inv_grid ), m_height - 1 );
+    if (minx > maxx || miny > maxy)
+      continue;
+
+    // The squared distances along x are the same on all rows
+    int num_cols = maxx - minx + 1;
+    if ((int)m_dx2.size() < num_cols)
+      m_dx2.resize(num_cols);
+    double * dx2 = &m_dx2[0];
+    for (int j = 0; j < num_cols; j++){
+      double dx = px - (minx + j)*m_grid_size;
+      dx2[j] = dx*dx;
+    }
+
+    // Add the contribution of current point to all grid points within
+    // radius. The grid points of the square around the point which are
+    // outside the radius get a zero weight.
     for (int iy = miny; iy <= maxy; iy++){
-      
-      double gx = m_x0 + ix*m_grid_size;
-      double gy = m_y0 + iy*m_grid_size;
-      double dist = sqrt( (x-gx)*(x-gx) + (y-gy)*(y-gy) );
-      if ( dist > m_radius ) continue;
-
-      if (m_weights(ix, iy) == 0) m_buffer(ix, iy) = 0.0;
-      double wt = m_sampled_gauss[(int)round(dist/m_dx)];
-      if (wt <= 0) continue;
-      m_buffer(ix, iy)  += z*wt;
-      m_weights(ix, iy) += wt;
+      double dy = py - iy*m_grid_size;
+      double dy2 = dy*dy;
+      double * sum = &m_sums[(size_t(iy)*m_width + minx)*stride];
+      for (int j = 0; j < num_cols; j++, sum += stride){
+        double dist2 = dx2[j] + dy2;
+        int s = std::min((int)(dist2*inv_dd + 0.5), num_samples - 1);
+        double wt = (dist2 <= m_radius2) ? gauss[s] : 0.0;
+        if (num_buffers == 1){ // the usual case, a DEM only
+          sum[0] += pv[0]*wt;
+          sum[1] += wt;
+          continue;
+        }
+        for (int b = 0; b < num_buffers; b++)
+          sum[b] += pv[b]*wt;
+        sum[num_buffers] += wt;
+      }
     }
     
   }
 }
 
 void Point2Grid::normalize(){
-  for (int c = 0; c < m_buffer.cols(); c++){
-    for (int r = 0; r < m_buffer.rows(); r++){
-      if (m_weights(c, r) > 0)
-        m_buffer (c, r) /= m_weights(c, r);
+  int num_buffers = m_buffers.size();
+  int stride = num_buffers + 1;
+  for (int r = 0; r < m_height; r++){
+    double const* sum = &m_sums[size_t(r)*m_width*stride];
+    for (int c = 0; c < m_width; c++, sum += stride){
+      double wt = sum[num_buffers];
+      m_weights(c, r) = wt;
+      if (wt <= 0)
+        continue; // keep the value the grid was cleared with
+      for (int b = 0; b < num_buffers; b++)
+        (*m_buffers[b])(c, r) = sum[b]/wt;
     }
   }
 }
+
+int Point2Grid::row_key(double y) const{
+  // The nearest grid row, with the points off the grid first or last
+  double r = floor( (y - m_y0)/m_grid_size + 0.5 );
+  if (!(r >= 0)) return 0; // also catches NaN
+  if (r >= m_height) return m_height;
+  return (int)r;
+}
@@ -23,6 +23,7 @@
 #define __VW_POINT2GRID_H__
 
 #include <vw/Image/ImageView.h>
+#include <vector>
 
 namespace vw { namespace stereo {
   
@@ -33,20 +34,50 @@ namespace vw { namespace stereo {
                double x0, double y0,
                double grid_size, double min_spacing, double radius,
 	       double sigma_factor);
+    /// Grid several values of each point at once, each into its own
+    /// buffer, with the weights found only once.
+    Point2Grid(int width, int height,
+               std::vector< ImageView<double> > & buffers, ImageView<double> & weights,
+               double x0, double y0,
+               double grid_size, double min_spacing, double radius,
+	       double sigma_factor);
     ~Point2Grid(){}
     void Clear(const float val);
+    /// Add a point with one value, if there is one buffer.
     void AddPoint(double x, double y, double z);
+    /// Add a point with a value for each buffer.
+    void AddPoint(double x, double y, double const* values);
+    /// Add many points at once, which is faster than one by one. Point
+    /// i is at (x[i], y[i]) and its value for buffer b is
+    /// values[i*num_buffers + b].
+    void AddPoints(int num_points, double const* x, double const* y,
+                   double const* values);
+    /// Divide the sums by the weights and write them to the buffers.
+    /// Must be called after the last point is added.
     void normalize();
 
   private:
+    void init(double min_spacing, double sigma_factor);
+    int row_key(double y) const;
+
     int m_width, m_height; // DEM dimensions
-    ImageView<double> & m_buffer;
+    std::vector< ImageView<double>* > m_buffers;
     ImageView<double> & m_weights;
     double m_x0, m_y0; // lower-left corner
     double m_grid_size;  // spacing between output DEM pixels
     double m_radius;   // how far to search for cloud points
-    double m_dx;       // spacing between samples
+    double m_radius2;  // its square
+    double m_dd;       // spacing between samples, in squared distance
     std::vector<double> m_sampled_gauss;
+
+    // For each grid point, the weighted sum of each value, then the
+    // sum of weights, next to each other so they are added together.
+    std::vector<double> m_sums;
+
+    // Scratch space to sort the points by grid row, and for the
+    // squared distances along x of the grid points near a point
+    std::vector<int> m_row_starts, m_order;
+    std::vector<double> m_dx2;
     
   };
   
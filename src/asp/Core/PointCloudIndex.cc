@@ -0,0 +1,197 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/PointCloudIndex.h>
+#include <vw/Core/Exception.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <cmath>
+#include <fstream>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+  namespace {
+
+    // The file starts with this line, then the sizes, the datum, the
+    // histogram, and the count and box of each block, all binary in
+    // the byte order of the machine which wrote it.
+    const std::string INDEX_MAGIC = "ASP_POINT_CLOUD_INDEX 1\n";
+
+    const double HIST_MIN_LOG = -6.0, HIST_MAX_LOG = 6.0;
+
+    template <class T>
+    void write_value(std::ofstream & os, T const& val) {
+      os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+
+    template <class T>
+    void read_value(std::ifstream & is, T & val) {
+      is.read(reinterpret_cast<char*>(&val), sizeof(T));
+    }
+  }
+
+  PointCloudIndex::PointCloudIndex(Vector2i const& image_size,
+                                   double semi_major_axis, double semi_minor_axis):
+    m_image_size(image_size),
+    m_num_blocks((image_size[0] + BLOCK_SIZE - 1)/BLOCK_SIZE,
+                 (image_size[1] + BLOCK_SIZE - 1)/BLOCK_SIZE),
+    m_semi_major_axis(semi_major_axis), m_semi_minor_axis(semi_minor_axis),
+    m_counts(m_num_blocks[0]*m_num_blocks[1], 0),
+    m_boxes(m_num_blocks[0]*m_num_blocks[1]),
+    m_hist(NUM_HIST_BINS, 0.0) {}
+
+  std::string PointCloudIndex::file_name(std::string const& point_cloud_file) {
+    return fs::path(point_cloud_file).replace_extension("").string() + "-index.bin";
+  }
+
+  int PointCloudIndex::hist_bin(double error) {
+    double pos = (log10(error) - HIST_MIN_LOG)/(HIST_MAX_LOG - HIST_MIN_LOG);
+    int bin = int(floor(pos*NUM_HIST_BINS));
+    return std::min(std::max(bin, 0), NUM_HIST_BINS - 1);
+  }
+
+  double PointCloudIndex::hist_bin_center(int bin) {
+    return pow(10.0, HIST_MIN_LOG + (bin + 0.5)*(HIST_MAX_LOG - HIST_MIN_LOG)/NUM_HIST_BINS);
+  }
+
+  void PointCloudIndex::add_tile(BBox2i const& tile, ImageView<Vector4> const& points) {
+    VW_ASSERT(points.cols() == tile.width() && points.rows() == tile.height(),
+              ArgumentErr() << "PointCloudIndex: The points do not match the tile.\n");
+    VW_ASSERT(BBox2i(0, 0, m_image_size[0], m_image_size[1]).contains(tile),
+              ArgumentErr() << "PointCloudIndex: The tile is not in the image.\n");
+
+    // Gather the tile blocks on their own, so that the lock is held
+    // only to merge them.
+    int bx0 = tile.min().x()/BLOCK_SIZE, bx1 = (tile.max().x() - 1)/BLOCK_SIZE;
+    int by0 = tile.min().y()/BLOCK_SIZE, by1 = (tile.max().y() - 1)/BLOCK_SIZE;
+    int nbx = bx1 - bx0 + 1;
+    std::vector<int64> counts(nbx*(by1 - by0 + 1), 0);
+    std::vector<BBox3> boxes (counts.size());
+    std::vector<double> hist (NUM_HIST_BINS, 0.0);
+    for (int row = 0; row < points.rows(); row++) {
+      int k = ((tile.min().y() + row)/BLOCK_SIZE - by0)*nbx;
+      for (int col = 0; col < points.cols(); col++) {
+        Vector4 const& p = points(col, row);
+        if (boost::math::isnan(p[2]))
+          continue;
+        int b = k + (tile.min().x() + col)/BLOCK_SIZE - bx0;
+        counts[b]++;
+        boxes[b].grow(subvector(p, 0, 3));
+        if (p[3] != 0) // As point2dem, skip the null errors of invalid pixels
+          hist[hist_bin(p[3])]++;
+      }
+    }
+
+    Mutex::Lock lock(m_mutex);
+    for (int by = by0; by <= by1; by++) {
+      for (int bx = bx0; bx <= bx1; bx++) {
+        int b = (by - by0)*nbx + bx - bx0;
+        if (counts[b] == 0)
+          continue;
+        m_counts[index(bx, by)] += counts[b];
+        m_boxes [index(bx, by)].grow(boxes[b]);
+      }
+    }
+    for (int i = 0; i < NUM_HIST_BINS; i++)
+      m_hist[i] += hist[i];
+  }
+
+  void PointCloudIndex::write(std::string const& point_cloud_file) const {
+    std::string file = file_name(point_cloud_file);
+    std::string tmp  = file + ".tmp";
+    std::ofstream os(tmp.c_str(), std::ios::binary);
+    if (!os.good())
+      vw_throw( IOErr() << "PointCloudIndex: Cannot write: " << tmp << ".\n" );
+
+    os << INDEX_MAGIC;
+    int32 sizes[4] = {m_image_size[0], m_image_size[1], BLOCK_SIZE, NUM_HIST_BINS};
+    for (int i = 0; i < 4; i++)
+      write_value(os, sizes[i]);
+    write_value(os, m_semi_major_axis);
+    write_value(os, m_semi_minor_axis);
+    for (int i = 0; i < NUM_HIST_BINS; i++)
+      write_value(os, m_hist[i]);
+    for (size_t b = 0; b < m_counts.size(); b++) {
+      write_value(os, m_counts[b]);
+      if (m_counts[b] == 0)
+        continue;
+      for (int c = 0; c < 3; c++) {
+        write_value(os, m_boxes[b].min()[c]);
+        write_value(os, m_boxes[b].max()[c]);
+      }
+    }
+    os.close();
+    if (!os.good())
+      vw_throw( IOErr() << "PointCloudIndex: Failed to write: " << tmp << ".\n" );
+    fs::rename(tmp, file);
+  }
+
+  bool PointCloudIndex::read(std::string const& point_cloud_file,
+                             Vector2i const& image_size) {
+    std::string file = file_name(point_cloud_file);
+    if (!fs::exists(file) || !fs::exists(point_cloud_file) ||
+        fs::last_write_time(file) < fs::last_write_time(point_cloud_file))
+      return false;
+
+    std::ifstream is(file.c_str(), std::ios::binary);
+    std::string magic(INDEX_MAGIC.size(), ' ');
+    is.read(&magic[0], magic.size());
+    int32 sizes[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++)
+      read_value(is, sizes[i]);
+    if (!is.good() || magic != INDEX_MAGIC ||
+        sizes[2] != BLOCK_SIZE || sizes[3] != NUM_HIST_BINS)
+      vw_throw( IOErr() << "PointCloudIndex: Invalid file: " << file << ".\n" );
+    if (Vector2i(sizes[0], sizes[1]) != image_size)
+      return false;
+
+    double a = 0, b = 0;
+    read_value(is, a);
+    read_value(is, b);
+    PointCloudIndex index(image_size, a, b);
+    for (int i = 0; i < NUM_HIST_BINS; i++)
+      read_value(is, index.m_hist[i]);
+    for (size_t k = 0; k < index.m_counts.size(); k++) {
+      read_value(is, index.m_counts[k]);
+      if (index.m_counts[k] == 0)
+        continue;
+      BBox3 & box = index.m_boxes[k];
+      for (int c = 0; c < 3; c++) {
+        read_value(is, box.min()[c]);
+        read_value(is, box.max()[c]);
+      }
+    }
+    if (!is.good())
+      vw_throw( IOErr() << "PointCloudIndex: Truncated file: " << file << ".\n" );
+
+    m_image_size      = index.m_image_size;
+    m_num_blocks      = index.m_num_blocks;
+    m_semi_major_axis = a;
+    m_semi_minor_axis = b;
+    m_counts.swap(index.m_counts);
+    m_boxes.swap (index.m_boxes);
+    m_hist.swap  (index.m_hist);
+    return true;
+  }
+
+} // namespace asp
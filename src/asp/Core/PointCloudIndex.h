@@ -0,0 +1,106 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudIndex.h
+///
+/// To find where the points of a cloud are, point2dem must read the
+/// whole cloud before it can make the DEM. As stereo_tri writes the
+/// cloud it can record this instead, in an index saved next to it. For
+/// each block of BLOCK_SIZE x BLOCK_SIZE pixels of the cloud the index
+/// has the number of points and the box of their longitude, latitude,
+/// and height above the datum, and for the whole cloud a histogram of
+/// the triangulation errors. The geodetic boxes do not depend on the
+/// projection of the DEM, so one index serves any of them.
+
+#ifndef __ASP_CORE_POINT_CLOUD_INDEX_H__
+#define __ASP_CORE_POINT_CLOUD_INDEX_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <vector>
+#include <string>
+
+namespace asp {
+
+  class PointCloudIndex {
+  public:
+
+    /// The smallest sub-block the OrthoRasterizerView uses, so that
+    /// its sub-blocks are always made of whole blocks.
+    static const int BLOCK_SIZE = 16;
+
+    /// The errors histogram has bins evenly spaced in log10 of the
+    /// error, from 1e-6 to 1e6 meters, so it needs no range up front.
+    static const int NUM_HIST_BINS = 4096;
+
+    /// The datum is given by its semi-axes, as the geodetic
+    /// coordinates are only valid for the same datum.
+    PointCloudIndex(vw::Vector2i const& image_size = vw::Vector2i(),
+                    double semi_major_axis = 0, double semi_minor_axis = 0);
+
+    /// The index of a point cloud file, such as run-PC-index.bin for
+    /// run-PC.tif.
+    static std::string file_name(std::string const& point_cloud_file);
+
+    /// Add the points of a tile of the cloud. Each pixel has the
+    /// longitude, latitude, height, and triangulation error of the
+    /// point, and pixels with no point have a NaN height. Tiles need
+    /// not be aligned to blocks. This is safe to call from several
+    /// threads for different tiles.
+    void add_tile(vw::BBox2i const& tile, vw::ImageView<vw::Vector4> const& points);
+
+    vw::Vector2i const& image_size() const { return m_image_size; }
+    double semi_major_axis() const { return m_semi_major_axis; }
+    double semi_minor_axis() const { return m_semi_minor_axis; }
+    int num_blocks_x() const { return m_num_blocks[0]; }
+    int num_blocks_y() const { return m_num_blocks[1]; }
+
+    /// The number of points in a block, and the box of their longitude,
+    /// latitude, and height. A box of a single point is not empty here.
+    vw::int64 count(int bx, int by) const { return m_counts[index(bx, by)]; }
+    vw::BBox3 const& box(int bx, int by) const { return m_boxes[index(bx, by)]; }
+
+    /// Counts of the nonzero errors in each bin.
+    std::vector<double> const& errors_hist() const { return m_hist; }
+    static int    hist_bin(double error);
+    static double hist_bin_center(int bin);
+
+    /// Write the index of the cloud. The index is written under another
+    /// name first, so that a partially written one is never found.
+    void write(std::string const& point_cloud_file) const;
+
+    /// Read the index of the cloud. Returns false if there is none, or
+    /// if it is older than the cloud or for a cloud of a different size.
+    bool read(std::string const& point_cloud_file, vw::Vector2i const& image_size);
+
+  private:
+    int index(int bx, int by) const { return by*m_num_blocks[0] + bx; }
+
+    vw::Vector2i m_image_size, m_num_blocks;
+    double m_semi_major_axis, m_semi_minor_axis;
+    std::vector<vw::int64> m_counts;
+    std::vector<vw::BBox3> m_boxes;
+    std::vector<double> m_hist;
+    vw::Mutex m_mutex;
+  };
+
+} // namespace asp
+
+#endif//__ASP_CORE_POINT_CLOUD_INDEX_H__
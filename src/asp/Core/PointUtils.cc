@@ -24,8 +24,13 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
 #include <vw/Cartography/Chipper.h>
+#include <vw/Core/Settings.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cstring>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -117,6 +122,16 @@ namespace asp{
 
 
 
+  /// A chunk of a LAS or CSV file. It is read serially, and then
+  /// parsed and binned on its own by a worker thread.
+  struct PointChunk{
+    PointBuffer points;   // The points, once read or parsed
+    char const* begin;    // For CSV, the lines to parse, in the mapped file
+    char const* end;
+    bool has_first_line;  // If the lines start with the first line of the file
+    PointChunk(): begin(NULL), end(NULL), has_first_line(false){}
+  };
+
   // Classes to read points from CSV and LAS files one point at a
   // time. We basically implement an interface for CSV files
   // mimicking the existing interface for las files in liblas.
@@ -130,6 +145,17 @@ namespace asp{
     virtual bool ReadNextPoint() = 0;
     virtual Vector3 GetPoint() = 0;
 
+    /// Read up to the given number of points. Parsing them may be left
+    /// to ParseChunk(), which is safe to call from several threads.
+    virtual void ReadChunk(int max_num_points, PointChunk & chunk){
+      int count = 0;
+      while (count < max_num_points && ReadNextPoint()){
+        chunk.points.push_back(GetPoint());
+        count++;
+      }
+    }
+    virtual void ParseChunk(PointChunk & chunk) const {}
+
     virtual ~BaseReader(){}
   };
 
@@ -161,31 +187,23 @@ namespace asp{
   };
 
   class CsvReader: public BaseReader{
-    std::string  m_csv_file;
-    asp::CsvConv m_csv_conv;
-    bool         m_is_first_line;
-    bool         m_has_valid_point;
-    Vector3      m_curr_point;
-    std::ifstream * m_ifs;
+    asp::CsvConv            m_csv_conv;
+    asp::CsvFileParser      m_parser;
+    asp::CsvConv::CsvPoints m_points; // The values of the current line
+    Vector3                 m_curr_point;
   public:
 
     CsvReader(std::string const & csv_file,
               asp::CsvConv const& csv_conv,
               GeoReference const& georef)
-      : m_csv_file(csv_file), m_csv_conv(csv_conv),
-        m_is_first_line(true), m_has_valid_point(false){
+      : m_csv_conv(csv_conv), m_parser(csv_file, csv_conv){
 
       // We will convert from projected space to xyz, unless points
       // are already in this format.
       m_has_georef = (m_csv_conv.format != asp::CsvConv::XYZ);
 
       m_georef      = georef;
-      m_num_points  = asp::csv_file_size(m_csv_file);
-
-      m_ifs = new std::ifstream ( m_csv_file.c_str() );
-      if ( !*m_ifs ) {
-        vw_throw( vw::IOErr() << "Unable to open file \"" << m_csv_file << "\"" );
-      }
+      m_num_points  = asp::csv_file_size(csv_file);
 
       VW_ASSERT(m_csv_conv.csv_format_str != "",
                 ArgumentErr() << "CsvReader: The CSV format was not specified.\n");
@@ -194,18 +212,15 @@ namespace asp{
 
     virtual bool ReadNextPoint(){
 
-      std::string line;
-      asp::CsvConv::CsvRecord vals;
-
       // Keep on reading, until a valid point is hit or the end of the file
       // is reached.
-      while (1){
-	
-        m_has_valid_point = getline(*m_ifs, line, '\n');
-        if (!m_has_valid_point) return m_has_valid_point; // reached end of file
-
-        vals = m_csv_conv.parse_csv_line(m_is_first_line, m_has_valid_point, line);
-        if (m_has_valid_point) break;
+      char const *begin = NULL, *end = NULL;
+      bool has_first_line = false;
+      m_points.clear();
+      while (m_points.size() == 0){
+        if (!m_parser.next_lines(1, begin, end, has_first_line))
+          return false; // reached end of file
+        m_csv_conv.parse_csv_lines(begin, end, has_first_line, m_points);
       }
 
       // Will return projected point and height or xyz. We really
@@ -214,52 +229,76 @@ namespace asp{
       // operates the first two coordinates.
       bool return_point_height = true;
       m_curr_point
-	= m_csv_conv.csv_to_cartesian_or_point_height(vals, m_georef, return_point_height);
+	= m_csv_conv.csv_to_cartesian_or_point_height(m_points.record(0), m_georef,
+                                                      return_point_height);
 
-      return m_has_valid_point;
+      return true;
     }
 
     virtual Vector3 GetPoint(){
       return m_curr_point;
     }
 
-    virtual ~CsvReader(){
-      delete m_ifs;
-      m_ifs = NULL;
+    /// Find the lines only, as parsing them is slower than reading.
+    /// The lines which are empty or comments are not counted.
+    virtual void ReadChunk(int max_num_points, PointChunk & chunk){
+      m_parser.next_lines(max_num_points, chunk.begin, chunk.end, chunk.has_first_line);
     }
 
-  }; // End class CsvReader
+    virtual void ParseChunk(PointChunk & chunk) const {
 
+      // Each thread uses its own copy of the georeference
+      GeoReference georef = m_georef;
+      bool return_point_height = true; // as in ReadNextPoint()
+      asp::CsvConv::CsvPoints points;
+      m_csv_conv.parse_csv_lines(chunk.begin, chunk.end, chunk.has_first_line, points);
+      for (size_t i = 0; i < points.size(); i++)
+        chunk.points.push_back(m_csv_conv.csv_to_cartesian_or_point_height
+                               (points.record(i), georef, return_point_height));
+    }
 
-  /// Create a point cloud image from a las file. The image will be
-  /// created block by block, when it needs to be written to disk. It is
-  /// important that the writer invoking this image be single-threaded,
-  /// as we read from the las file sequentially.
-  template <class ImageT>
-  class LasOrCsvToTif_Class : public ImageViewBase< LasOrCsvToTif_Class<ImageT> > {
+  }; // End class CsvReader
 
-    typedef typename ImageT::pixel_type PixelT;
 
-    asp::BaseReader * m_reader;
-    int m_rows, m_cols; // These are pixel sizes, not tile counts.
-    int m_block_size;
+  // The points binned from a LAS or CSV file are saved in a scratch
+  // file with this header, padded to SCRATCH_HEADER_SIZE bytes, and
+  // then the tiles in row-major order, each with its points in
+  // row-major order. The tiles are as the chunks they were binned
+  // from, so reading a tile touches a contiguous area of the file.
+  const std::string SCRATCH_MAGIC = "ASP_POINT_SCRATCH 1\n";
+  const size_t SCRATCH_HEADER_SIZE = 64;
+
+  /// The points of a scratch file, read through a memory mapping, so
+  /// the operating system pages them in and out as needed.
+  class PointScratchView : public ImageViewBase<PointScratchView> {
+    boost::shared_ptr<boost::iostreams::mapped_file_source> m_file;
+    Vector3 const* m_points;
+    int m_cols, m_rows, m_tile_len, m_num_col_tiles;
+
+    Vector3 const* tile_row(int col, int row) const {
+      int tile = (row/m_tile_len)*m_num_col_tiles + col/m_tile_len;
+      return m_points + (size_t(tile)*m_tile_len + row % m_tile_len)*m_tile_len;
+    }
 
   public:
-
-    typedef PixelT pixel_type;
-    typedef PixelT result_type;
-    typedef ProceduralPixelAccessor<LasOrCsvToTif_Class> pixel_accessor;
-
-    LasOrCsvToTif_Class(asp::BaseReader * reader, int num_rows, int tile_len, int block_size):
-      m_reader(reader), m_block_size(block_size){
-
-      boost::uint64_t num_points = m_reader->m_num_points;
-      int num_row_tiles = std::max(1, (int)ceil(double(num_rows)/tile_len));
-      m_rows = tile_len*num_row_tiles;
-
-      int points_per_row = (int)ceil(double(num_points)/m_rows);
-      int num_col_tiles  = std::max(1, (int)ceil(double(points_per_row)/tile_len));
-      m_cols = tile_len*num_col_tiles;
+    typedef Vector3 pixel_type;
+    typedef Vector3 result_type;
+    typedef ProceduralPixelAccessor<PointScratchView> pixel_accessor;
+
+    PointScratchView(std::string const& file):
+      m_file(new boost::iostreams::mapped_file_source(file)){
+      char const* data = m_file->data();
+      int32 sizes[3] = {0, 0, 0};
+      if (m_file->size() >= SCRATCH_HEADER_SIZE)
+        memcpy(sizes, data + SCRATCH_MAGIC.size(), sizeof(sizes));
+      m_cols = sizes[0]; m_rows = sizes[1]; m_tile_len = sizes[2];
+      if (m_file->size() < SCRATCH_HEADER_SIZE ||
+          std::string(data, SCRATCH_MAGIC.size()) != SCRATCH_MAGIC ||
+          m_tile_len <= 0 || m_cols % m_tile_len != 0 || m_rows % m_tile_len != 0 ||
+          m_file->size() != SCRATCH_HEADER_SIZE + size_t(m_cols)*m_rows*sizeof(Vector3))
+        vw_throw( IOErr() << "Invalid point scratch file: " << file << ".\n" );
+      m_points = reinterpret_cast<Vector3 const*>(data + SCRATCH_HEADER_SIZE);
+      m_num_col_tiles = m_cols/m_tile_len;
     }
 
     inline int32 cols  () const { return m_cols; }
@@ -268,47 +307,24 @@ namespace asp{
 
     inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
-    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
-      vw_throw( NoImplErr() << "LasOrCsvToTif_Class::operator(...) has not been implemented.\n");
-      return result_type();
+    inline result_type operator()( int32 i, int32 j, int32 p=0 ) const {
+      return tile_row(i, j)[i % m_tile_len];
     }
 
-    typedef CropView<ImageView<PixelT> > prerasterize_type;
+    typedef CropView<ImageView<Vector3> > prerasterize_type;
     inline prerasterize_type prerasterize( BBox2i const& bbox ) const{
-
-      // Read a chunk of the las file, and store it in the current tile.
-
-      int num_cols = bbox.width();
-      int num_rows = bbox.height();
-
-      VW_ASSERT((num_rows % m_block_size == 0) && (num_cols % m_block_size == 0),
-                ArgumentErr() << "LasOrCsvToTif_Class: Expecting the number of rows "
-                              << "to be a multiple of the block size.\n");
-
-      // Read the specified number of points from the file
-      int max_num_pts_to_read = num_cols*num_rows;
-      int count = 0;
-      PointBuffer in;
-      std::vector<PointBuffer> outVec;
-      while (m_reader->ReadNextPoint()){
-        in.push_back(m_reader->GetPoint());
-        count++;
-        if (count >= max_num_pts_to_read)
-          break;
+      // Copy the part of each row of each tile which is in the box
+      ImageView<Vector3> tile(bbox.width(), bbox.height());
+      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
+        int col = bbox.min().x();
+        while (col < bbox.max().x()){
+          int len = std::min(bbox.max().x(), (col/m_tile_len + 1)*m_tile_len) - col;
+          memcpy(&tile(col - bbox.min().x(), row - bbox.min().y()),
+                 tile_row(col, row) + col % m_tile_len, len*sizeof(Vector3));
+          col += len;
+        }
       }
-
-      // Take the points just read, and put them in groups by spatial
-      // location, so that later point2dem does not need to read every
-      // input point when writing a given tile, but only certain
-      // groups.
-      ImageView<Vector3> Img;
-      Chipper(in, m_block_size, m_reader->m_has_georef, m_reader->m_georef, num_cols, num_rows, Img);
-
-      VW_ASSERT(num_cols == Img.cols() && num_rows == Img.rows(),
-                ArgumentErr() << "LasOrCsvToTif_Class: Size mis-match.\n");
-
-      return crop( Img, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
     }
 
     template <class DestT>
@@ -316,7 +332,142 @@ namespace asp{
       vw::rasterize( prerasterize(bbox), dest, bbox );
     }
 
-  }; // End class LasOrCsvToTif_Class
+  }; // End class PointScratchView
+
+  /// Parse a chunk of a LAS or CSV file, put its points in groups by
+  /// spatial location, and save them as a tile of the scratch file.
+  /// Later point2dem need not read every input point when writing a
+  /// given tile, but only certain groups. An error is kept in the
+  /// given string, for the reading thread to throw.
+  class BinPointChunkTask : public Task, private boost::noncopyable {
+    BaseReader const& m_reader;
+    boost::shared_ptr<PointChunk> m_chunk;
+    int m_tile_len, m_block_size;
+    Vector3 * m_tile;
+    Mutex & m_mutex;
+    Condition & m_done;
+    int & m_num_pending;
+    std::string & m_error;
+    ProgressCallback const& m_progress;
+    double m_inc_amt;
+
+    void bin_chunk(){
+      m_reader.ParseChunk(*m_chunk);
+
+      // Each thread uses its own copy of the georeference
+      GeoReference georef = m_reader.m_georef;
+      ImageView<Vector3> Img;
+      Chipper(m_chunk->points, m_block_size, m_reader.m_has_georef, georef,
+              m_tile_len, m_tile_len, Img);
+      m_chunk.reset();
+
+      VW_ASSERT(m_tile_len == Img.cols() && m_tile_len == Img.rows(),
+                ArgumentErr() << "BinPointChunkTask: Size mis-match.\n");
+      for (int row = 0; row < m_tile_len; row++)
+        memcpy(m_tile + size_t(row)*m_tile_len, &Img(0, row), m_tile_len*sizeof(Vector3));
+    }
+
+  public:
+    BinPointChunkTask(BaseReader const& reader, boost::shared_ptr<PointChunk> chunk,
+                      int tile_len, int block_size, Vector3 * tile,
+                      Mutex & mutex, Condition & done, int & num_pending,
+                      std::string & error,
+                      ProgressCallback const& progress, double inc_amt):
+      m_reader(reader), m_chunk(chunk), m_tile_len(tile_len), m_block_size(block_size),
+      m_tile(tile), m_mutex(mutex), m_done(done), m_num_pending(num_pending),
+      m_error(error), m_progress(progress), m_inc_amt(inc_amt){}
+
+    void operator()(){
+      // The reading thread waits on the count of pending chunks, so it
+      // must go down even if binning fails.
+      std::string error;
+      try {
+        bin_chunk();
+      } catch (std::exception const& e) {
+        error = e.what();
+        if (error == "")
+          error = "Failed to bin the points.";
+      }
+      m_chunk.reset();
+
+      Mutex::Lock lock(m_mutex);
+      if (m_error == "")
+        m_error = error;
+      m_num_pending--;
+      m_progress.report_incremental_progress(m_inc_amt);
+      m_done.notify_all();
+    }
+
+  }; // End class BinPointChunkTask
+
+  /// Read the points serially in chunks of a tile each, and bin them
+  /// into the tiles of the scratch file on the worker threads. Only a
+  /// few chunks are held in memory at any time.
+  void bin_points_to_scratch(BaseReader & reader, std::string const& out_file,
+                             int num_rows, int tile_len, int block_size){
+
+    // Size the image so that the points fit in it, with as many rows
+    // as requested, rounded up to whole tiles.
+    boost::uint64_t num_points = reader.m_num_points;
+    int num_row_tiles = std::max(1, (int)ceil(double(num_rows)/tile_len));
+    int rows = tile_len*num_row_tiles;
+    int points_per_row = (int)ceil(double(num_points)/rows);
+    int num_col_tiles  = std::max(1, (int)ceil(double(points_per_row)/tile_len));
+    int cols = tile_len*num_col_tiles;
+    VW_ASSERT(tile_len % block_size == 0,
+              ArgumentErr() << "bin_points_to_scratch: Expecting the tile size "
+                            << "to be a multiple of the block size.\n");
+
+    boost::iostreams::mapped_file_params params(out_file);
+    params.flags         = boost::iostreams::mapped_file::readwrite;
+    params.new_file_size = SCRATCH_HEADER_SIZE + size_t(cols)*rows*sizeof(Vector3);
+    boost::iostreams::mapped_file_sink file(params);
+    memset(file.data(), 0, SCRATCH_HEADER_SIZE);
+    memcpy(file.data(), SCRATCH_MAGIC.c_str(), SCRATCH_MAGIC.size());
+    int32 sizes[3] = {cols, rows, tile_len};
+    memcpy(file.data() + SCRATCH_MAGIC.size(), sizes, sizeof(sizes));
+    Vector3 * tiles = reinterpret_cast<Vector3*>(file.data() + SCRATCH_HEADER_SIZE);
+
+    int num_threads = std::max(1, int(vw_settings().default_num_threads()));
+    FifoWorkQueue queue(num_threads);
+    Mutex mutex;
+    Condition done;
+    int num_pending = 0;
+    std::string error; // The first error of a task
+    int num_tiles = num_row_tiles*num_col_tiles;
+    TerminalProgressCallback progress("asp", "\t--> ");
+    progress.report_progress(0);
+    for (int k = 0; k < num_tiles; k++){
+
+      // The tiles past the end of the file are binned from no points,
+      // so they have no points either.
+      boost::shared_ptr<PointChunk> chunk(new PointChunk);
+      reader.ReadChunk(tile_len*tile_len, *chunk);
+
+      // Wait for a thread to be free, so the chunks read ahead
+      // are no more than the threads. Stop reading after an error.
+      {
+        Mutex::Lock lock(mutex);
+        while (num_pending >= num_threads)
+          done.wait(lock);
+        if (error != "")
+          break;
+        num_pending++;
+      }
+      boost::shared_ptr<BinPointChunkTask>
+        task(new BinPointChunkTask(reader, chunk, tile_len, block_size,
+                                   tiles + size_t(k)*tile_len*tile_len,
+                                   mutex, done, num_pending, error,
+                                   progress, 1.0/num_tiles));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    if (error != "")
+      vw_throw( ArgumentErr() << "Failed to write: " << out_file << ". " << error << "\n" );
+    progress.report_finished();
+    file.close();
+  }
+
 
 } // namespace asp
 
@@ -413,6 +564,11 @@ void asp::CsvConv::parse_csv_format(std::string const& csv_format_str,
   if ((this->num_targets < MIN_NUM_TARGETS) || (this->num_targets > MAX_NUM_TARGETS))
     vw_throw(ArgumentErr() << "Invalid number of column indices in: '" << csv_format_str << "'\n");
 
+  // Record the type of each column, to look it up quickly when parsing
+  this->col2type.assign(this->col2name.rbegin()->first + 1, SKIP_COLUMN);
+  for (std::map<int, std::string>::iterator it = this->col2name.begin(); it != this->col2name.end(); it++)
+    this->col2type[it->first] = (it->second == "file") ? FILE_COLUMN : NUMBER_COLUMN;
+
   /*
 
   // Read in the three user inputs
@@ -514,22 +670,172 @@ bool asp::CsvConv::parse_georef(vw::cartography::GeoReference & georef) const {
 
 #include <iomanip>
 
-asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool & success,
-                                                     std::string const& line) const {
-  // Parse a CSV file line in given format
-  success = true;
+namespace {
+
+  // The characters in asp::csv_separator()
+  inline bool is_csv_separator(char c){
+    return c == ',' || c == ' ' || c == '\t';
+  }
+
+  // Where the line after the one at pos starts, or the end
+  inline char const* next_csv_line(char const* pos, char const* end){
+    char const* line_end = static_cast<char const*>(memchr(pos, '\n', end - pos));
+    return (line_end == NULL) ? end : line_end + 1;
+  }
+
+  // Parse the number at the start of the text between begin and end,
+  // as strtod() does, but without copying the text. A number
+  // with few digits and a small exponent is converted exactly with a
+  // single multiplication or division, as any such power of ten is
+  // exact in a double, and anything else is left to strtod().
+  bool parse_csv_number(char const* begin, char const* end, double & val){
+
+    static const double POW10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                   1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const int MAX_POW10 = 22, MAX_DIGITS = 19;
+
+    char const* p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')){
+      negative = (*p == '-');
+      p++;
+    }
+
+    // The digits, past the leading zeros, are kept while they fit
+    boost::uint64_t mantissa = 0;
+    int num_digits = 0, exponent = 0;
+    bool has_digits = false, is_exact = true;
+    for (; p < end && *p >= '0' && *p <= '9'; p++){
+      has_digits = true;
+      if (num_digits < MAX_DIGITS){
+        mantissa = 10*mantissa + (*p - '0');
+        if (mantissa != 0) num_digits++;
+      }else{
+        exponent++;
+        is_exact = is_exact && (*p == '0');
+      }
+    }
+    if (p < end && *p == '.'){
+      for (p++; p < end && *p >= '0' && *p <= '9'; p++){
+        has_digits = true;
+        if (num_digits < MAX_DIGITS){
+          mantissa = 10*mantissa + (*p - '0');
+          if (mantissa != 0) num_digits++;
+          exponent--;
+        }else{
+          is_exact = is_exact && (*p == '0');
+        }
+      }
+    }
+
+    // An exponent without digits is ignored, as strtod() does, and as
+    // did sscanf() in glibc, which the parsing used before.
+    if (has_digits && p < end && (*p == 'e' || *p == 'E')){
+      char const* q = p + 1;
+      bool negative_exp = false;
+      if (q < end && (*q == '-' || *q == '+')){
+        negative_exp = (*q == '-');
+        q++;
+      }
+      int exp_val = 0;
+      for (; q < end && *q >= '0' && *q <= '9'; q++){
+        if (exp_val < 100000)
+          exp_val = 10*exp_val + (*q - '0');
+      }
+      exponent += negative_exp ? -exp_val : exp_val;
+    }
+
+    // Hexadecimal numbers, nan, and inf go to strtod() too
+    bool is_hex = (p < end && (*p == 'x' || *p == 'X'));
+    if (has_digits && is_exact && !is_hex && mantissa <= (boost::uint64_t(1) << 53) &&
+        exponent >= -MAX_POW10 && exponent <= MAX_POW10){
+      val = (exponent < 0) ? double(mantissa)/POW10[-exponent] : double(mantissa)*POW10[exponent];
+      if (negative) val = -val;
+      return true;
+    }
+
+    std::string token(begin, end);
+    char * token_end = NULL;
+    val = strtod(token.c_str(), &token_end);
+    return token_end != token.c_str();
+  }
+
+  // Map a file in memory for reading. An empty file is not mapped, as
+  // that is not possible.
+  void map_csv_file(std::string const& file_path,
+                    boost::shared_ptr<boost::iostreams::mapped_file_source> & file,
+                    char const*& begin, char const*& end){
+    std::ifstream fh(file_path.c_str(), std::ios::in | std::ios::binary);
+    if (!fh)
+      vw_throw( vw::IOErr() << "Unable to open file \"" << file_path << "\"" );
+    fh.seekg(0, std::ios::end);
+    begin = end = NULL;
+    if (fh.tellg() <= 0)
+      return;
+    fh.close();
+
+    file.reset(new boost::iostreams::mapped_file_source(file_path));
+    begin = file->data();
+    end   = begin + file->size();
+  }
+
+  // Parse some of the lines of a CSV file on a thread of its own
+  class ParseCsvLinesTask : public Task, private boost::noncopyable {
+    asp::CsvConv const& m_csv_conv;
+    char const *m_begin, *m_end;
+    bool m_is_first_line;
+    asp::CsvConv::CsvPoints & m_points;
+
+  public:
+    ParseCsvLinesTask(asp::CsvConv const& csv_conv, char const* begin, char const* end,
+                      bool is_first_line, asp::CsvConv::CsvPoints & points):
+      m_csv_conv(csv_conv), m_begin(begin), m_end(end), m_is_first_line(is_first_line),
+      m_points(points){}
+
+    void operator()(){
+      m_csv_conv.parse_csv_lines(m_begin, m_end, m_is_first_line, m_points);
+    }
+  };
 
-  // Copy the input line into a temporary buffer
-  const int bufSize = 2048;
-  char temp[bufSize];
-  strncpy(temp, line.c_str(), bufSize);
+} // end unnamed namespace
 
-  std::string sep = asp::csv_separator();
+bool asp::CsvConv::parse_csv_values(char const* begin, char const* end,
+                                    double * values, std::string * file) const {
 
-  int col_index = -1; // The current column we are reading
+  // Split on the separators as strtok() does, so a run of them counts
+  // as one, and stop past the last column of interest.
   int num_floats_read = 0;
   int num_values_read = 0;
+  char const* pos = begin;
+  for (size_t col = 0; col < this->col2type.size(); col++){
+
+    while (pos < end && is_csv_separator(*pos))
+      pos++;
+    if (pos == end) break; // no more tokens
+    char const* token_end = pos;
+    while (token_end < end && !is_csv_separator(*token_end))
+      token_end++;
+
+    if (this->col2type[col] == FILE_COLUMN){ // This is a string input
+      if (file != NULL)
+        file->assign(pos, token_end);
+      num_values_read++;
+    }else if (this->col2type[col] == NUMBER_COLUMN){
+      if (!parse_csv_number(pos, token_end, values[num_floats_read]))
+        return false;
+      num_floats_read++;
+      num_values_read++;
+    }
+    pos = token_end;
+  }
+
+  return (num_values_read == this->num_targets);
+}
 
+asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool & success,
+                                                     std::string const& line) const {
+  // Parse a CSV file line in given format
   CsvRecord values;
   // Be prepared for the fact that the first line may be the header,
   // so almost certainly we won't read it correctly, but don't
@@ -541,38 +847,8 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
     return values;
   }
 
-  char * ptr = temp;
-  while(1){
-
-    col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
-    ptr = NULL; // After the first call, strtok expects a null pointer as input.
-    if ( token == NULL ) break; // no more tokens
-    if ( num_values_read >= this->num_targets ) break; // read enough values
-
-    // Check if this is one of the columns we need to read
-    if (this->col2name.find(col_index) == this->col2name.end())
-      continue;
-
-    if (this->col2name.at(col_index) == "file") // This is a string input
-      values.file = token;
-    else {
-      // Parse the floating point value from the token
-      double val;
-      int flag = sscanf(token, "%lg", &val);
-      if (flag == 0){ // Handle parsing failure
-        success = false;
-        break;
-      }
-      values.point_data[num_floats_read] = val;
-      num_floats_read++;
-    }
-    num_values_read++;
-
-  } // End loop through columns
-  
-  if (num_values_read != this->num_targets)
-    success = false;
+  success = parse_csv_values(line.data(), line.data() + line.size(),
+                             &values.point_data[0], &values.file);
 
   if (!success){
     if (!is_first_line){
@@ -585,31 +861,152 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
   return values;
 }
 
+void asp::CsvConv::parse_csv_lines(char const* begin, char const* end, bool is_first_line,
+                                   CsvPoints & points) const {
+
+  bool has_file = (this->name2col.count("file") != 0);
+  double values[3];
+  std::string file;
+  for (char const* line = begin; line < end; line = next_csv_line(line, end)){
+
+    char const* line_end = static_cast<char const*>(memchr(line, '\n', end - line));
+    if (line_end == NULL)
+      line_end = end;
+
+    // Skip the lines which are empty or comments, as is_valid_csv_line().
+    // They do not count as the first line, which may be the header.
+    if (line_end == line || line[0] == '#')
+      continue;
+    if (parse_csv_values(line, line_end, values, has_file ? &file : NULL)){
+      for (int c = 0; c < 3; c++)
+        points.values[c].push_back(values[c]);
+      if (has_file)
+        points.files.push_back(file);
+    }else if (!is_first_line){
+      // Not the header
+      vw_out() << "Failed to read line: " << std::string(line, line_end) << "\n";
+    }
+    is_first_line = false;
+  }
+}
 
 size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
 				   std::list<CsvRecord> & output_list) const {
   // Clear output object
   output_list.clear();
 
-  // Open input file
-  std::ifstream file( file_path.c_str() );
-  if( !file )
-    vw_throw( vw::IOErr() << "Unable to open file \"" << file_path << "\"" );
-
-  // Read through all the lines of the input file, parse each line, and build the output list.
-  bool success;
-  bool first_line = true;
-  std::string line = "";
-  while ( std::getline(file, line, '\n') ){
-    CsvRecord new_record = asp::CsvConv::parse_csv_line(first_line, success, line);
-    if (success)
-      output_list.push_back(new_record);
-    first_line = false;
+  // Parse the whole file, and build the output list.
+  CsvPoints points;
+  read_csv_points(file_path, points);
+  for (size_t i = 0; i < points.size(); i++)
+    output_list.push_back(points.record(i));
+
+  return output_list.size();
+}
+
+size_t asp::CsvConv::read_csv_points(std::string const& file_path, CsvPoints & points) const {
+  CsvFileParser parser(file_path, *this);
+  parser.parse_next(std::numeric_limits<size_t>::max(), points);
+  return points.size();
+}
+
+void asp::CsvConv::CsvPoints::clear(){
+  for (int c = 0; c < 3; c++)
+    values[c].clear();
+  files.clear();
+}
+
+asp::CsvConv::CsvRecord asp::CsvConv::CsvPoints::record(size_t i) const {
+  CsvRecord rec;
+  for (int c = 0; c < 3; c++)
+    rec.point_data[c] = values[c][i];
+  if (!files.empty())
+    rec.file = files[i];
+  return rec;
+}
+
+asp::CsvFileParser::CsvFileParser(std::string const& file_path, CsvConv const& csv_conv):
+  m_csv_conv(csv_conv), m_begin(NULL), m_pos(NULL), m_end(NULL){
+  map_csv_file(file_path, m_file, m_begin, m_end);
+  m_pos = m_begin;
+}
+
+bool asp::CsvFileParser::next_lines(size_t max_num_valid_lines,
+                                    char const*& begin, char const*& end,
+                                    bool & has_first_line){
+  if (m_pos >= m_end)
+    return false;
+
+  begin = m_pos;
+  has_first_line = (m_pos == m_begin);
+  size_t count = 0;
+  while (m_pos < m_end && count < max_num_valid_lines){
+    if (*m_pos != '\n' && *m_pos != '#') // as is_valid_csv_line()
+      count++;
+    m_pos = next_csv_line(m_pos, m_end);
+  }
+  end = m_pos;
+  return true;
+}
+
+bool asp::CsvFileParser::parse_next(size_t num_bytes, CsvConv::CsvPoints & points){
+
+  points.clear();
+  if (m_pos >= m_end)
+    return false;
+
+  // End at the end of a line
+  char const* begin = m_pos;
+  char const* end   = m_end;
+  if (num_bytes < size_t(m_end - m_pos))
+    end = next_csv_line(m_pos + num_bytes, m_end);
+  bool has_first_line = (begin == m_begin);
+  m_pos = end;
+
+  // Split the lines into pieces for the threads, unless there are few
+  const size_t MIN_PIECE_BYTES = 1024*1024;
+  size_t num_threads = std::max(1, int(vw_settings().default_num_threads()));
+  size_t num_pieces  = std::max(size_t(1), std::min(num_threads,
+                                                    size_t(end - begin)/MIN_PIECE_BYTES));
+  if (num_pieces == 1){
+    m_csv_conv.parse_csv_lines(begin, end, has_first_line, points);
+    return true;
   }
 
-  file.close();
+  std::vector<char const*> starts(num_pieces + 1, end);
+  starts[0] = begin;
+  size_t piece_len = (end - begin)/num_pieces;
+  for (size_t k = 1; k < num_pieces; k++)
+    starts[k] = next_csv_line(std::max(starts[k-1], begin + k*piece_len), end);
+
+  std::vector<CsvConv::CsvPoints> pieces(num_pieces);
+  FifoWorkQueue queue(num_threads);
+  for (size_t k = 0; k < num_pieces; k++){
+    boost::shared_ptr<ParseCsvLinesTask>
+      task(new ParseCsvLinesTask(m_csv_conv, starts[k], starts[k+1],
+                                 has_first_line && k == 0, pieces[k]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  // Put the points together in the order of the lines, freeing each
+  // piece once copied.
+  size_t num_points = 0;
+  for (size_t k = 0; k < num_pieces; k++)
+    num_points += pieces[k].size();
+  for (int c = 0; c < 3; c++)
+    points.values[c].reserve(num_points);
+  for (size_t k = 0; k < num_pieces; k++){
+    for (int c = 0; c < 3; c++){
+      points.values[c].insert(points.values[c].end(), pieces[k].values[c].begin(),
+                              pieces[k].values[c].end());
+      std::vector<double>().swap(pieces[k].values[c]);
+    }
+    points.files.insert(points.files.end(), pieces[k].files.begin(), pieces[k].files.end());
+    std::vector<std::string>().swap(pieces[k].files);
+  }
 
-  return output_list.size();
+  return true;
 }
 
 
@@ -819,58 +1216,50 @@ Vector3 asp::CsvConv::cartesian_to_csv(Vector3 const& xyz,
 // End class CsvConv functions
 //------------------------------------------------------------------------------------------
 
-void asp::las_or_csv_to_tif(std::string const& in_file,
-                            std::string const& out_file,
-                            int num_rows, int block_size,
-                            vw::cartography::GdalWriteOptions * opt,
-                            vw::cartography::GeoReference const& csv_georef,
-                            asp::CsvConv const& csv_conv) {
-
-  // We will fetch a chunk of the las file of area TILE_LEN x
-  // TILE_LEN, split it into bins of spatially close points, and write
-  // it to disk as a tile in a vector tif image. The bigger the tile
-  // size, the more likely the binning will be more efficient. But big
-  // tiles use a lot of memory.
+void asp::las_or_csv_to_scratch(std::string const& in_file,
+                                std::string const& out_file,
+                                int num_rows, int block_size,
+                                vw::cartography::GeoReference const& csv_georef,
+                                asp::CsvConv const& csv_conv) {
 
-  // To do: Study performance for large files when this number changes
-  const int TILE_LEN = 2048;
-  Vector2 tile_size(TILE_LEN, TILE_LEN);
+  // We will fetch a chunk of the file of area TILE_LEN x TILE_LEN,
+  // split it into bins of spatially close points, and write it as a
+  // tile of the scratch file. The bigger the tile size, the more
+  // likely the binning will be more efficient. But big tiles use a
+  // lot of memory, and there is a chunk in memory for each thread.
+  const int TILE_LEN = 1024;
 
   vw_out() << "Writing temporary file: " << out_file << std::endl;
 
-  // Temporarily change the raster tile size
-  Vector2 original_tile_size = opt->raster_tile_size;
-  opt->raster_tile_size = tile_size;
-
   if (asp::is_csv(in_file)){ // CSV
 
-    boost::shared_ptr<asp::CsvReader> csvReaderPtr( new asp::CsvReader(in_file, csv_conv, csv_georef) );
-    ImageViewRef<Vector3> Img
-      = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (csvReaderPtr.get(), num_rows, TILE_LEN, block_size);
-
-    // Must use a thread only, as we read the las file serially.
-    vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
+    asp::CsvReader reader(in_file, csv_conv, csv_georef);
+    asp::bin_points_to_scratch(reader, out_file, num_rows, TILE_LEN, block_size);
 
   }else if (asp::is_las(in_file)){ // LAS
 
     std::ifstream ifs;
     ifs.open(in_file.c_str(), std::ios::in | std::ios::binary);
     liblas::ReaderFactory f;
-    liblas::Reader reader = f.CreateWithStream(ifs);
-    boost::shared_ptr<asp::LasReader> lasReaderPtr( new asp::LasReader(reader) );
-    ImageViewRef<Vector3> Img
-      = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (lasReaderPtr.get(), num_rows, TILE_LEN, block_size);
+    liblas::Reader las_reader = f.CreateWithStream(ifs);
+    asp::LasReader reader(las_reader);
+    asp::bin_points_to_scratch(reader, out_file, num_rows, TILE_LEN, block_size);
 
-    // Must use a thread only, as we read the las file serially.
-    vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
   }else
     vw_throw( ArgumentErr() << "Unknown file type: " << in_file << "\n");
 
-  // Restore the original tile size
-  opt->raster_tile_size = original_tile_size;
+}
 
+bool asp::is_point_scratch(std::string const& file){
+  std::ifstream ifs(file.c_str(), std::ios::in | std::ios::binary);
+  std::string magic(asp::SCRATCH_MAGIC.size(), ' ');
+  ifs.read(&magic[0], magic.size());
+  return ifs.good() && magic == asp::SCRATCH_MAGIC;
 }
 
+vw::ImageViewRef<vw::Vector3> asp::read_point_scratch(std::string const& file){
+  return asp::PointScratchView(file);
+}
 
 bool asp::is_las(std::string const& file){
   std::string lfile = boost::to_lower_copy(file);
@@ -1006,14 +1395,13 @@ bool asp::is_valid_csv_line(std::string const& line){
 
 boost::uint64_t asp::csv_file_size(std::string const& file){
 
-  std::ifstream fh( file.c_str() );
-  if( !fh )
-    vw_throw( vw::IOErr() << "Unable to open file \"" << file << "\"" );
+  boost::shared_ptr<boost::iostreams::mapped_file_source> mapping;
+  char const *begin = NULL, *end = NULL;
+  map_csv_file(file, mapping, begin, end);
 
-  int num_total_points = 0;
-  std::string line;
-  while ( getline(fh, line, '\n') ){
-    if (!asp::is_valid_csv_line(line)) continue;
+  boost::uint64_t num_total_points = 0;
+  for (char const* line = begin; line < end; line = next_csv_line(line, end)){
+    if (*line == '\n' || *line == '#') continue; // as is_valid_csv_line()
     num_total_points++;
   }
 
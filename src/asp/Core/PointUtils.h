@@ -26,11 +26,13 @@
 #include <string>
 #include <vw/Core/Functors.h>
 #include <vw/Image/PerPixelViews.h>
+#include <vw/Image/ImageMath.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Mosaic/ImageComposite.h>
 #include <vw/FileIO/DiskImageUtils.h>
+#include <boost/shared_ptr.hpp>
 
 #include <asp/Core/Common.h>
 
@@ -41,6 +43,12 @@ namespace vw{
   }
 }
 
+namespace boost{
+  namespace iostreams{
+    class mapped_file_source;
+  }
+}
+
 namespace asp {
 
 
@@ -77,6 +85,20 @@ namespace asp {
       std::string file;
     };
 
+    /// Object used to store the data parsed from many CSV lines, with
+    /// an array for each of the values of CsvRecord::point_data, so
+    /// that there is no allocation per line.
+    struct CsvPoints{
+      std::vector<double>      values[3];
+      std::vector<std::string> files; ///< Empty unless there is a file column
+
+      size_t size() const {return values[0].size();}
+      void   clear();
+
+      /// The values parsed from a line, as from parse_csv_line
+      CsvRecord record(size_t i) const;
+    };
+
 
   public: // Functions
 
@@ -111,6 +133,16 @@ namespace asp {
     size_t read_csv_file(std::string const    & file_path,
                              std::list<CsvRecord> & output_list) const;
 
+    /// Parse the lines between begin and end, as parse_csv_line does, and
+    /// append the values of those read successfully. The empty lines and
+    /// the comments are skipped. The first line is allowed to be a header
+    /// if is_first_line is true. This is safe to call from several threads.
+    void parse_csv_lines(char const* begin, char const* end, bool is_first_line,
+                         CsvPoints & points) const;
+
+    /// Reads an entire CSV file, parsing its lines on several threads.
+    size_t read_csv_points(std::string const& file_path, CsvPoints & points) const;
+
     /// Convert values read from a csv file using parse_csv_line (in the same order they appear in the file)
     /// to a Cartesian point. If return_point_height is true, and the csv point is not
     /// in xyz format, return instead the projected point and height above datum.
@@ -145,6 +177,10 @@ namespace asp {
     std::map<int, std::string> col2name; ///< Target column in input csv -> Name
     std::map<int, int>         col2sort; ///< Which input columns went in which vector indices (numbers only)
 
+    /// What to do with each input column, up to the last one of interest
+    enum ColumnType {SKIP_COLUMN, NUMBER_COLUMN, FILE_COLUMN};
+    std::vector<ColumnType>    col2type;
+
     std::string csv_format_str;
     std::string csv_proj4_str;
     CsvFormat   format;
@@ -168,19 +204,56 @@ namespace asp {
       ///  that they originally appeared in the file (ignores the file field).
       vw::Vector3 unsort_vector3(vw::Vector3 const& v) const;
 
+      /// Split the line between begin and end on the separators and parse
+      ///  the values of interest, in the order they appear in the file.
+      ///  Returns false if some are missing or are not numbers.
+      bool parse_csv_values(char const* begin, char const* end,
+                            double * values, std::string * file) const;
+
 
   }; // End class CsvConv
 
 
-  /// Fetch a chunk of the las file of area TILE_LEN x TILE_LEN,
-  /// split it into bins of spatially close points, and write
-  /// it to disk as a tile in a vector tif image.
-  void las_or_csv_to_tif(std::string const& in_file,
-                         std::string const& out_file,
-                         int num_rows, int block_size,
-                         vw::cartography::GdalWriteOptions * opt,
-                         vw::cartography::GeoReference const& csv_georef,
-                         asp::CsvConv const& csv_conv);
+  /// Reads a CSV file through a memory mapping of it, so that the lines
+  /// are not copied before being parsed.
+  class CsvFileParser{
+  public:
+    CsvFileParser(std::string const& file_path, CsvConv const& csv_conv);
+
+    /// Move past the next lines of the file, with at most the given
+    /// number of valid lines among them, and return where they are in
+    /// memory. The range stays valid for the life of this object.
+    /// Returns false at the end of the file.
+    bool next_lines(size_t max_num_valid_lines, char const*& begin, char const*& end,
+                    bool & has_first_line);
+
+    /// Parse about the given number of bytes of the next lines, split
+    /// among several threads, and replace the points with the ones read.
+    /// Returns false at the end of the file.
+    bool parse_next(size_t num_bytes, CsvConv::CsvPoints & points);
+
+  private:
+    CsvConv m_csv_conv;
+    boost::shared_ptr<boost::iostreams::mapped_file_source> m_file;
+    char const *m_begin, *m_pos, *m_end;
+  };
+
+
+  /// Bin the points of a LAS or CSV file by spatial location, and save
+  /// them as an image with the given number of rows in a raw scratch
+  /// file. The file is read serially in chunks, which are parsed and
+  /// binned in parallel, so only a few of them are in memory at a time.
+  void las_or_csv_to_scratch(std::string const& in_file,
+                             std::string const& out_file,
+                             int num_rows, int block_size,
+                             vw::cartography::GeoReference const& csv_georef,
+                             asp::CsvConv const& csv_conv);
+
+  /// Return true if this is a scratch file written by las_or_csv_to_scratch
+  bool is_point_scratch(std::string const& file);
+
+  /// Read the points of a scratch file, through a memory mapping of it
+  vw::ImageViewRef<vw::Vector3> read_point_scratch(std::string const& file);
 
 
   bool is_las       (std::string const& file); ///< Return true if this is a LAS file
@@ -232,6 +305,7 @@ namespace asp {
   /// Given a point cloud with n channels, return the first m channels.
   /// We must have 1 <= m <= n <= 6.
   /// If the image was written by subtracting a shift, put that shift back.
+  /// If it was written as integers, multiply them by the scale first.
   template<int m>
   vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename);
 
@@ -239,6 +313,18 @@ namespace asp {
   /// Hide these functions from external users
   namespace point_utils_private {
 
+    /// The points of a scratch file have three channels, as any cloud
+    /// read from it, but the type of the pixels may differ.
+    template<class PixelT>
+    struct ScratchToPointFunc : public vw::ReturnFixedType<PixelT> {
+      PixelT operator()(vw::Vector3 const& p) const {
+        PixelT q;
+        for (size_t c = 0; c < 3; c++)
+          q[c] = p[c];
+        return q;
+      }
+    };
+
     // These two functions choose between two possible inputs for the form_point_cloud_composite function.
 
     /// Read a texture file
@@ -251,6 +337,8 @@ namespace asp {
     template<class PixelT>
     typename boost::disable_if<boost::is_same<PixelT, vw::PixelGray<float> >, vw::ImageViewRef<PixelT> >::type
     read_point_cloud_compatible_file(std::string const& file){
+      if (asp::is_point_scratch(file))
+        return vw::per_pixel_filter(asp::read_point_scratch(file), ScratchToPointFunc<PixelT>());
       return asp::read_asp_point_cloud< vw::math::VectorSize<PixelT>::value >(file);
     }
 
@@ -338,17 +426,29 @@ template<int m>
 vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename){
 
   vw::Vector3 shift;
-  std::string shift_str;
+  std::string shift_str, scale_str;
   boost::shared_ptr<vw::DiskImageResource> rsrc
     ( new vw::DiskImageResourceGDAL(filename) );
   if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
 
+  // A cloud saved as integers has the size of an integer step
+  double scale = 0;
+  if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_SCALE_TAG_STR, scale_str)){
+    scale = atof(scale_str.c_str());
+    if (scale <= 0)
+      vw::vw_throw( vw::ArgumentErr() << "Invalid " << asp::ASP_POINT_SCALE_TAG_STR
+                    << " in: " << filename << ".\n" );
+  }
+
   // Read the first m channels
   vw::ImageViewRef< vw::Vector<double, m> > out_image
     = vw::read_channels<m, double>(filename, 0);
 
+  if (scale > 0)
+    out_image = out_image * scale;
+
   // Add the shift back to the first several channels.
   if (shift != vw::Vector3())
     out_image = subtract_shift(out_image, -shift);
@@ -0,0 +1,417 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SearchRangeIndex.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Stereo/DisparityMap.h>
+#include <asp/Core/SearchRangeIndex.h>
+
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+using namespace vw;
+
+namespace asp {
+
+  // Tag at the start of the index file, followed by a format version.
+  const char SEARCH_RANGE_INDEX_TAG[] = "ASPSRIDX";
+  const int32 SEARCH_RANGE_INDEX_VERSION = 2;
+
+  bool lowres_search_range(ImageViewRef<PixelMask<Vector2f> > const& sub_disp,
+                           ImageViewRef<PixelMask<Vector2i> > const& sub_disp_spread,
+                           Matrix<double> const& lowres_hom,
+                           bool use_local_homography,
+                           BBox2i const& seed_bbox,
+                           BBox2i & search_range){
+
+    typedef ImageViewRef<PixelMask<Vector2f> > DispSeedImageType;
+
+    bool do_round = true; // round integer disparities after transform
+
+    // Bring the seed in memory once, rather than pulling it from disk
+    // for each of the passes below.
+    ImageView<PixelMask<Vector2f> > disparity_in_box = crop(sub_disp, seed_bbox);
+
+    BBox2f local_search_range;
+    if (!use_local_homography){
+      local_search_range = stereo::get_disparity_range( disparity_in_box );
+    }else{
+      local_search_range = stereo::get_disparity_range
+        (transform_disparities(do_round, seed_bbox, lowres_hom, disparity_in_box));
+    }
+
+    bool has_sub_disp_spread = ( sub_disp_spread.cols() != 0 &&
+                                 sub_disp_spread.rows() != 0 );
+    // Sanity check: If sub_disp_spread was provided, it better have the same size as sub_disp.
+    if ( has_sub_disp_spread &&
+         ( sub_disp_spread.cols() != sub_disp.cols() ||
+           sub_disp_spread.rows() != sub_disp.rows() ) ){
+      vw_throw( ArgumentErr() << "stereo_corr: D_sub and D_sub_spread must have equal sizes.\n");
+    }
+
+    if (has_sub_disp_spread){
+      // Expand the disparity range by sub_disp_spread.
+      ImageView<PixelMask<Vector2i> > spread_in_box = crop( sub_disp_spread, seed_bbox );
+
+      if (!use_local_homography){
+        BBox2f spread = stereo::get_disparity_range( spread_in_box );
+        local_search_range.min() -= spread.max();
+        local_search_range.max() += spread.max();
+      }else{
+        DispSeedImageType upper_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
+                                                             disparity_in_box + spread_in_box);
+        DispSeedImageType lower_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
+                                                             disparity_in_box - spread_in_box);
+        BBox2f upper_range = stereo::get_disparity_range(upper_disp);
+        BBox2f lower_range = stereo::get_disparity_range(lower_disp);
+
+        local_search_range = upper_range;
+        local_search_range.grow(lower_range);
+      } //endif use_local_homography
+    } //endif has_sub_disp_spread
+
+    search_range = grow_bbox_to_int(local_search_range);
+
+    for (int row = 0; row < disparity_in_box.rows(); row++){
+      for (int col = 0; col < disparity_in_box.cols(); col++){
+        if (is_valid(disparity_in_box(col, row)))
+          return true;
+      }
+    }
+    return false;
+  }
+
+  SearchRangeIndex::SearchRangeIndex():
+    m_tile_size(0), m_cols(0), m_rows(0),
+    m_use_local_homography(false), m_has_spread(false), m_input_hash(0){}
+
+  SearchRangeIndex::SearchRangeIndex(int tile_size, Vector2i const& image_size,
+                                     Vector2i const& sub_image_size,
+                                     bool use_local_homography, bool has_spread):
+    m_tile_size(tile_size), m_image_size(image_size), m_sub_image_size(sub_image_size),
+    m_use_local_homography(use_local_homography), m_has_spread(has_spread),
+    m_input_hash(0){
+
+    VW_ASSERT(tile_size > 0,
+              ArgumentErr() << "SearchRangeIndex: The tile size must be positive.\n");
+    m_cols = (int)ceil(image_size[0]/double(tile_size));
+    m_rows = (int)ceil(image_size[1]/double(tile_size));
+    m_ranges.resize(m_cols*m_rows);
+    m_valid.resize (m_cols*m_rows, 0);
+  }
+
+  BBox2i SearchRangeIndex::cell_bbox(int col, int row) const {
+    BBox2i bbox(col*m_tile_size, row*m_tile_size, m_tile_size, m_tile_size);
+    bbox.crop(BBox2i(0, 0, m_image_size[0], m_image_size[1]));
+    return bbox;
+  }
+
+  void SearchRangeIndex::set(int col, int row, BBox2i const& range, bool is_valid){
+    VW_ASSERT(col >= 0 && col < m_cols && row >= 0 && row < m_rows,
+              ArgumentErr() << "SearchRangeIndex: Cell out of bounds.\n");
+    m_ranges[row*m_cols + col] = range;
+    m_valid [row*m_cols + col] = is_valid;
+  }
+
+  bool SearchRangeIndex::get(int col, int row, BBox2i & range) const {
+    VW_ASSERT(col >= 0 && col < m_cols && row >= 0 && row < m_rows,
+              ArgumentErr() << "SearchRangeIndex: Cell out of bounds.\n");
+    range = m_ranges[row*m_cols + col];
+    return m_valid[row*m_cols + col];
+  }
+
+  bool SearchRangeIndex::is_single_cell(BBox2i const& bbox) const {
+    if (bbox.empty())
+      return false;
+    return (bbox.min().x()/m_tile_size == (bbox.max().x()-1)/m_tile_size &&
+            bbox.min().y()/m_tile_size == (bbox.max().y()-1)/m_tile_size);
+  }
+
+  bool SearchRangeIndex::lookup(BBox2i const& bbox, BBox2i & range) const {
+
+    range = BBox2i();
+    if (empty())
+      return false;
+
+    BBox2i box = bbox;
+    box.crop(BBox2i(0, 0, m_image_size[0], m_image_size[1]));
+    if (box.empty())
+      return false;
+
+    int min_col = box.min().x()/m_tile_size, max_col = (box.max().x()-1)/m_tile_size;
+    int min_row = box.min().y()/m_tile_size, max_row = (box.max().y()-1)/m_tile_size;
+
+    bool found = false;
+    for (int row = min_row; row <= max_row; row++){
+      for (int col = min_col; col <= max_col; col++){
+        if (!m_valid[row*m_cols + col])
+          continue;
+        if (!found)
+          range = m_ranges[row*m_cols + col];
+        else
+          range.grow(m_ranges[row*m_cols + col]);
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  bool SearchRangeIndex::is_compatible(int tile_size, Vector2i const& image_size,
+                                       Vector2i const& sub_image_size,
+                                       bool use_local_homography, bool has_spread) const {
+    return (!empty()                                       &&
+            m_tile_size            == tile_size            &&
+            m_image_size           == image_size           &&
+            m_sub_image_size       == sub_image_size       &&
+            m_use_local_homography == use_local_homography &&
+            m_has_spread           == has_spread);
+  }
+
+  void SearchRangeIndex::write(std::string const& file) const {
+
+    std::ofstream fh(file.c_str(), std::ios::binary);
+    if (!fh.good())
+      vw_throw( IOErr() << "SearchRangeIndex: Cannot write: " << file << ".\n" );
+
+    int32 header[] = {SEARCH_RANGE_INDEX_VERSION, m_tile_size, m_cols, m_rows,
+                      m_image_size[0], m_image_size[1],
+                      m_sub_image_size[0], m_sub_image_size[1],
+                      m_use_local_homography, m_has_spread};
+    fh.write(SEARCH_RANGE_INDEX_TAG, sizeof(SEARCH_RANGE_INDEX_TAG) - 1);
+    fh.write((const char*)header, sizeof(header));
+    fh.write((const char*)&m_input_hash, sizeof(m_input_hash));
+
+    // Each cell is stored as min x, min y, max x, max y, is_valid.
+    for (size_t i = 0; i < m_ranges.size(); i++){
+      int32 cell[] = {m_ranges[i].min().x(), m_ranges[i].min().y(),
+                      m_ranges[i].max().x(), m_ranges[i].max().y(), m_valid[i]};
+      fh.write((const char*)cell, sizeof(cell));
+    }
+
+    if (!fh.good())
+      vw_throw( IOErr() << "SearchRangeIndex: Failed writing: " << file << ".\n" );
+    fh.close();
+  }
+
+  void SearchRangeIndex::read(std::string const& file) {
+
+    std::ifstream fh(file.c_str(), std::ios::binary);
+    if (!fh.good())
+      vw_throw( IOErr() << "SearchRangeIndex: File does not exist: " << file << ".\n" );
+
+    char tag[sizeof(SEARCH_RANGE_INDEX_TAG) - 1];
+    int32 header[10];
+    uint64 input_hash = 0;
+    fh.read(tag, sizeof(tag));
+    fh.read((char*)header, sizeof(header));
+    fh.read((char*)&input_hash, sizeof(input_hash));
+    if (!fh.good() || std::memcmp(tag, SEARCH_RANGE_INDEX_TAG, sizeof(tag)) != 0 ||
+        header[0] != SEARCH_RANGE_INDEX_VERSION || header[1] <= 0 ||
+        header[2] < 0 || header[3] < 0)
+      vw_throw( IOErr() << "SearchRangeIndex: Invalid file: " << file << ".\n" );
+
+    *this = SearchRangeIndex(header[1], Vector2i(header[4], header[5]),
+                             Vector2i(header[6], header[7]), header[8], header[9]);
+    if (m_cols != header[2] || m_rows != header[3])
+      vw_throw( IOErr() << "SearchRangeIndex: Invalid file: " << file << ".\n" );
+    m_input_hash = input_hash;
+
+    for (size_t i = 0; i < m_ranges.size(); i++){
+      int32 cell[5];
+      if (!fh.read((char*)cell, sizeof(cell)))
+        vw_throw( IOErr() << "SearchRangeIndex: Invalid file: " << file << ".\n" );
+      m_ranges[i] = BBox2i(Vector2i(cell[0], cell[1]), Vector2i(cell[2], cell[3]));
+      m_valid [i] = (cell[4] != 0);
+    }
+    fh.close();
+  }
+
+  void compute_search_range_index(ImageViewRef<PixelMask<Vector2f> > const& sub_disp,
+                                  ImageViewRef<PixelMask<Vector2i> > const& sub_disp_spread,
+                                  ImageView<Matrix3x3> const& local_hom,
+                                  bool use_local_homography,
+                                  Vector2i const& image_size,
+                                  int tile_size,
+                                  SearchRangeIndex & index){
+
+    Stopwatch sw;
+    sw.start();
+
+    bool has_spread = (sub_disp_spread.cols() != 0 && sub_disp_spread.rows() != 0);
+    Vector2i sub_size(sub_disp.cols(), sub_disp.rows());
+    index = SearchRangeIndex(tile_size, image_size, sub_size, use_local_homography, has_spread);
+
+    // D_sub is small, so read it, and its spread, fully in memory once.
+    ImageView<PixelMask<Vector2f> > sub_disp_mem = sub_disp;
+    ImageView<PixelMask<Vector2i> > spread_mem;
+    if (has_spread)
+      spread_mem = sub_disp_spread;
+
+    Vector2 upscale_factor(double(image_size[0]) / sub_size[0],
+                           double(image_size[1]) / sub_size[1]);
+    BBox2i sub_bbox = bounding_box(sub_disp_mem);
+
+    for (int row = 0; row < index.rows(); row++){
+      for (int col = 0; col < index.cols(); col++){
+
+        BBox2i bbox = index.cell_bbox(col, row);
+
+        // The low-res version of bbox. This must be kept in sync with
+        // how SeededCorrelatorView computes it for a tile.
+        BBox2i seed_bbox( elem_quot(bbox.min(), upscale_factor),
+                          elem_quot(bbox.max(), upscale_factor) );
+        seed_bbox.expand(1);
+        seed_bbox.crop( sub_bbox );
+
+        Matrix<double> lowres_hom = math::identity_matrix<3>();
+        if (use_local_homography)
+          lowres_hom = local_hom(col, row);
+
+        BBox2i range;
+        bool is_valid = lowres_search_range(sub_disp_mem, spread_mem, lowres_hom,
+                                            use_local_homography, seed_bbox, range);
+        index.set(col, row, range, is_valid);
+      }
+    }
+
+    sw.stop();
+    vw_out(DebugMessage,"asp") << "Search range index elapsed time: "
+                               << sw.elapsed_seconds() << " s." << std::endl;
+  }
+
+  namespace {
+    // The value at fraction p of the way through the sorted values,
+    // interpolating between neighbors.
+    double sorted_quantile(std::vector<double> const& sorted, double p){
+      double pos = p*(sorted.size() - 1);
+      size_t i   = size_t(floor(pos));
+      if (i + 1 >= sorted.size())
+        return sorted.back();
+      return sorted[i] + (pos - i)*(sorted[i+1] - sorted[i]);
+    }
+  }
+
+  BBox2 robust_disparity_range(std::vector<Vector2> const& disparities,
+                               std::vector<size_t> const& indices,
+                               double outlier_factor){
+
+    Vector2 lo, hi;
+    std::vector<double> vals(indices.size());
+    for (int axis = 0; axis < 2; axis++){
+      for (size_t k = 0; k < indices.size(); k++)
+        vals[k] = disparities[indices[k]][axis];
+      std::sort(vals.begin(), vals.end());
+      lo[axis] = vals.front();
+      hi[axis] = vals.back();
+
+      // Quartiles of fewer values are too coarse to judge by.
+      if (outlier_factor <= 0 || vals.size() < 4)
+        continue;
+      double q1 = sorted_quantile(vals, 0.25), q3 = sorted_quantile(vals, 0.75);
+      double fence = outlier_factor*(q3 - q1);
+      // Both searches find a value, as q1 and q3 are within the values.
+      lo[axis] = *std::lower_bound(vals.begin(), vals.end(), q1 - fence);
+      hi[axis] = *(std::upper_bound(vals.begin(), vals.end(), q3 + fence) - 1);
+    }
+    return BBox2(lo, hi);
+  }
+
+  void compute_search_range_index_from_points(std::vector<Vector2> const& points,
+                                              std::vector<Vector2> const& disparities,
+                                              Vector2i const& image_size,
+                                              int tile_size, int min_points,
+                                              double pad_fraction, int margin,
+                                              double outlier_factor,
+                                              SearchRangeIndex & index){
+
+    VW_ASSERT(points.size() == disparities.size(),
+              ArgumentErr() << "SearchRangeIndex: Expecting as many points as disparities.\n");
+
+    Stopwatch sw;
+    sw.start();
+
+    index = SearchRangeIndex(tile_size, image_size, image_size, false, false);
+    if (points.empty())
+      return;
+
+    // Bucket the points by cell, so that the points near a cell are
+    // found without visiting all of them.
+    std::vector< std::vector<size_t> > buckets(index.cols()*index.rows());
+    for (size_t i = 0; i < points.size(); i++){
+      int col = std::min(std::max(int(floor(points[i].x()/tile_size)), 0), index.cols()-1);
+      int row = std::min(std::max(int(floor(points[i].y()/tile_size)), 0), index.rows()-1);
+      buckets[row*index.cols() + col].push_back(i);
+    }
+
+    std::vector< std::pair<double, size_t> > dist(points.size());
+    for (int row = 0; row < index.rows(); row++){
+      for (int col = 0; col < index.cols(); col++){
+
+        BBox2 region = index.cell_bbox(col, row);
+        region.expand(tile_size/2.0);
+
+        // The points within half a tile of the cell. These are all in
+        // the cell's bucket or in the neighboring ones.
+        std::vector<size_t> near;
+        for (int r = std::max(row-1, 0); r <= std::min(row+1, index.rows()-1); r++){
+          for (int c = std::max(col-1, 0); c <= std::min(col+1, index.cols()-1); c++){
+            std::vector<size_t> const& bucket = buckets[r*index.cols() + c];
+            for (size_t k = 0; k < bucket.size(); k++){
+              if (region.contains(points[bucket[k]]))
+                near.push_back(bucket[k]);
+            }
+          }
+        }
+
+        // Too few of these, use the nearest points instead.
+        if (int(near.size()) < min_points){
+          Vector2 center = index.cell_bbox(col, row).center();
+          for (size_t i = 0; i < points.size(); i++)
+            dist[i] = std::make_pair(norm_2_sqr(points[i] - center), i);
+          size_t num = std::min(points.size(), size_t(std::max(min_points, 1)));
+          std::nth_element(dist.begin(), dist.begin() + (num-1), dist.end());
+          near.clear();
+          for (size_t k = 0; k < num; k++)
+            near.push_back(dist[k].second);
+        }
+
+        // A single wrong match would widen the range of the whole cell,
+        // so leave out those far from the bulk of the others.
+        BBox2 range = robust_disparity_range(disparities, near, outlier_factor);
+
+        Vector2 expansion = (pad_fraction/2.0)*Vector2(range.width(), range.height())
+          + Vector2(margin, margin);
+        range.min() -= expansion;
+        range.max() += expansion;
+        index.set(col, row, grow_bbox_to_int(range), true);
+      }
+    }
+
+    sw.stop();
+    vw_out(DebugMessage,"asp") << "Search range index from points elapsed time: "
+                               << sw.elapsed_seconds() << " s." << std::endl;
+  }
+
+} // namespace asp
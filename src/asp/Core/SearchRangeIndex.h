@@ -0,0 +1,153 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SearchRangeIndex.h
+///
+/// A compact table holding, for each correlation tile, the search range
+/// implied by the low-resolution disparity D_sub. It is computed once
+/// after low-resolution correlation and saved next to D_sub, so that
+/// each full-resolution tile can look up its search range rather than
+/// re-reading and re-scanning D_sub and D_sub_spread. The index records
+/// a hash of the inputs it was made from, rather than relying on file
+/// times, as D_sub is rewritten when a georeference is attached to it.
+
+#ifndef __ASP_CORE_SEARCH_RANGE_INDEX_H__
+#define __ASP_CORE_SEARCH_RANGE_INDEX_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Matrix.h>
+#include <vw/Core/FundamentalTypes.h>
+#include <vector>
+#include <string>
+
+namespace asp {
+
+  /// Compute the search range, in low-resolution pixels, implied by the
+  /// seed disparity in the low-res box seed_bbox. If use_local_homography
+  /// is set, the disparities are first transformed by lowres_hom. If
+  /// sub_disp_spread is non-empty, the range is expanded by it. Returns
+  /// false if there are no valid seed disparities in the box, in which
+  /// case the range is whatever vw::stereo::get_disparity_range() gives.
+  bool lowres_search_range(vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& sub_disp,
+                           vw::ImageViewRef<vw::PixelMask<vw::Vector2i> > const& sub_disp_spread,
+                           vw::Matrix<double> const& lowres_hom,
+                           bool use_local_homography,
+                           vw::BBox2i const& seed_bbox,
+                           vw::BBox2i & search_range);
+
+  /// Per-tile low-resolution search ranges, on the same grid of
+  /// tile_size x tile_size full-resolution tiles as the local homographies.
+  class SearchRangeIndex {
+  public:
+    SearchRangeIndex();
+    SearchRangeIndex(int tile_size, vw::Vector2i const& image_size,
+                     vw::Vector2i const& sub_image_size,
+                     bool use_local_homography, bool has_spread);
+
+    int  tile_size           () const { return m_tile_size;            }
+    int  cols                () const { return m_cols;                 }
+    int  rows                () const { return m_rows;                 }
+    bool empty               () const { return m_ranges.empty();       }
+    bool use_local_homography() const { return m_use_local_homography; }
+    bool has_spread          () const { return m_has_spread;           }
+    vw::Vector2i image_size    () const { return m_image_size;     }
+    vw::Vector2i sub_image_size() const { return m_sub_image_size; }
+
+    /// The full-resolution box covered by the given cell.
+    vw::BBox2i cell_bbox(int col, int row) const;
+
+    /// Set the low-res search range of a cell. Cells with no valid seed
+    /// disparity are marked as such and are skipped in lookups.
+    void set(int col, int row, vw::BBox2i const& range, bool is_valid);
+
+    /// Get the low-res search range of a cell. Returns false if the cell is invalid.
+    bool get(int col, int row, vw::BBox2i & range) const;
+
+    /// Return true if the given full-resolution box is contained in one cell.
+    bool is_single_cell(vw::BBox2i const& bbox) const;
+
+    /// Find the union of the low-res search ranges of all cells which
+    /// intersect the given full-resolution box. Returns false if none
+    /// of these has a valid range. For a box spanning several cells this
+    /// is wider than the range found from D_sub for the box itself, so
+    /// it is exact only if is_single_cell() holds for the box.
+    bool lookup(vw::BBox2i const& bbox, vw::BBox2i & range) const;
+
+    /// Return true if this index was made with the given settings.
+    bool is_compatible(int tile_size, vw::Vector2i const& image_size,
+                       vw::Vector2i const& sub_image_size,
+                       bool use_local_homography, bool has_spread) const;
+
+    /// The hash of the inputs this index was made from, as set by the caller.
+    vw::uint64 input_hash() const { return m_input_hash; }
+    void set_input_hash(vw::uint64 hash) { m_input_hash = hash; }
+
+    void write(std::string const& file) const;
+    void read (std::string const& file);
+
+  private:
+    int  m_tile_size, m_cols, m_rows;
+    vw::Vector2i m_image_size, m_sub_image_size;
+    bool m_use_local_homography, m_has_spread;
+    vw::uint64 m_input_hash;
+    std::vector<vw::BBox2i> m_ranges;
+    std::vector<vw::uint8>  m_valid;
+  };
+
+  /// Compute the search range index for all tiles of a full-resolution
+  /// image of size image_size, given the seed disparity.
+  void compute_search_range_index(vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& sub_disp,
+                                  vw::ImageViewRef<vw::PixelMask<vw::Vector2i> > const& sub_disp_spread,
+                                  vw::ImageView<vw::Matrix3x3> const& local_hom,
+                                  bool use_local_homography,
+                                  vw::Vector2i const& image_size,
+                                  int tile_size,
+                                  SearchRangeIndex & index);
+
+  /// The range of the disparities of the points with given indices. On
+  /// each axis, the values farther than outlier_factor times the
+  /// interquartile range below the first quartile or above the third are
+  /// left out. That is skipped if outlier_factor is not positive or there
+  /// are fewer than four points.
+  vw::BBox2 robust_disparity_range(std::vector<vw::Vector2> const& disparities,
+                                   std::vector<size_t> const& indices,
+                                   double outlier_factor);
+
+  /// Compute the search range index from sparse disparities, such as
+  /// those of interest point matches, rather than from D_sub. The range
+  /// of a cell is the robust_disparity_range() of the points within half
+  /// a tile of it, or, if there are fewer than min_points of those, of
+  /// the min_points points closest to its center. It is padded by
+  /// pad_fraction of its size, and then by margin pixels on each side.
+  /// The ranges are in full-resolution pixels, so the index is made with
+  /// sub_image_size equal to image_size. Cells are invalid only if there
+  /// are no points at all.
+  void compute_search_range_index_from_points(std::vector<vw::Vector2> const& points,
+                                              std::vector<vw::Vector2> const& disparities,
+                                              vw::Vector2i const& image_size,
+                                              int tile_size, int min_points,
+                                              double pad_fraction, int margin,
+                                              double outlier_factor,
+                                              SearchRangeIndex & index);
+
+} // namespace asp
+
+#endif//__ASP_CORE_SEARCH_RANGE_INDEX_H__
@@ -0,0 +1,327 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/StageInstrumentation.h>
+#include <asp/Core/Common.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <vw/Image/PixelTypeInfo.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace {
+  vw::RunOnce stage_instrumentation_once = VW_RUNONCE_INIT;
+  boost::shared_ptr<asp::StageInstrumentation> stage_instrumentation_ptr;
+  void init_stage_instrumentation() {
+    stage_instrumentation_ptr
+      = boost::shared_ptr<asp::StageInstrumentation>(new asp::StageInstrumentation());
+  }
+}
+
+namespace asp {
+
+  StageInstrumentation& stage_instrumentation() {
+    stage_instrumentation_once.run( init_stage_instrumentation );
+    return *stage_instrumentation_ptr;
+  }
+
+  ResourceUsage current_resource_usage() {
+
+    ResourceUsage usage;
+
+    boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    usage.wall_seconds = (boost::posix_time::microsec_clock::universal_time() - epoch)
+      .total_microseconds() / 1.0e+6;
+
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+      usage.cpu_seconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1.0e+6
+                        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1.0e+6;
+#ifdef __APPLE__
+      usage.peak_rss_mb = ru.ru_maxrss / (1024.0 * 1024.0); // Bytes
+#else
+      usage.peak_rss_mb = ru.ru_maxrss / 1024.0; // kB
+#endif
+    }
+
+    // The I/O counters are available on Linux only
+    std::ifstream ifs("/proc/self/io");
+    std::string key;
+    uint64 value;
+    while (ifs >> key >> value) {
+      if (key == "rchar:")
+        usage.bytes_read = value;
+      else if (key == "wchar:")
+        usage.bytes_written = value;
+    }
+
+    return usage;
+  }
+
+  std::string json_string(std::string const& str) {
+    std::ostringstream os;
+    os << '"';
+    for (size_t i = 0; i < str.size(); i++) {
+      char c = str[i];
+      if (c == '"' || c == '\\')
+        os << '\\' << c;
+      else if (c == '\n')
+        os << "\\n";
+      else if (c == '\t')
+        os << "\\t";
+      else if ((unsigned char)c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+        os << buf;
+      } else
+        os << c;
+    }
+    os << '"';
+    return os.str();
+  }
+
+  // The share of the available thread time which was spent computing
+  double thread_utilization(double wall_seconds, double cpu_seconds, int num_threads) {
+    if (wall_seconds <= 0 || num_threads <= 0)
+      return 0.0;
+    return cpu_seconds / (wall_seconds * num_threads);
+  }
+
+  // The size of the pixels of an image, as decoded. Returns false if the
+  // image cannot be opened.
+  bool image_bytes(std::string const& file, uint64 & bytes) {
+    try {
+      boost::scoped_ptr<DiskImageResource> rsrc(DiskImageResource::open(file));
+      bytes = uint64(rsrc->cols()) * rsrc->rows() * rsrc->planes()
+        * num_channels(rsrc->pixel_format()) * channel_size(rsrc->channel_type());
+      return true;
+    } catch (...) {
+      return false;
+    }
+  }
+
+  // Print a list of files with their sizes on disk, and the bytes read
+  // or written, with null for what is not known.
+  void write_json_files(std::ostream & os, std::vector<std::string> const& files,
+                        std::map<std::string, uint64> const& bytes_read, bool is_output) {
+    os << "[";
+    for (size_t i = 0; i < files.size(); i++) {
+      os << (i == 0 ? "\n" : ",\n") << "    {\"file\": " << json_string(files[i])
+         << ", \"size\": ";
+      boost::system::error_code ec;
+      uintmax_t size = fs::file_size(files[i], ec);
+      if (ec)
+        os << "null";
+      else
+        os << uint64(size);
+
+      uint64 bytes = 0;
+      if (is_output) {
+        os << ", \"bytes_written\": ";
+        if (!ec && image_bytes(files[i], bytes))
+          os << bytes;
+        else
+          os << "null";
+      } else {
+        os << ", \"bytes_read\": ";
+        std::map<std::string, uint64>::const_iterator it = bytes_read.find(files[i]);
+        if (it != bytes_read.end())
+          os << it->second;
+        else
+          os << "null";
+      }
+      os << "}";
+    }
+    os << (files.empty() ? "]" : "\n  ]");
+  }
+
+  StageInstrumentation::StageInstrumentation(): m_num_threads(0) {}
+
+  void StageInstrumentation::start(std::string const& stage, std::string const& out_prefix) {
+    Mutex::Lock lock(m_mutex);
+    m_stage             = stage;
+    m_out_prefix        = out_prefix;
+    m_start_time        = current_posix_time_string();
+    m_num_threads       = vw_settings().default_num_threads();
+    m_start_usage       = current_resource_usage();
+    m_phase_start_usage = m_start_usage;
+    m_phases.clear();
+    m_tiles.clear();
+    m_input_files.clear();
+    m_output_files.clear();
+    m_bytes_read.clear();
+  }
+
+  bool StageInstrumentation::is_started() const {
+    Mutex::Lock lock(m_mutex);
+    return !m_stage.empty();
+  }
+
+  void StageInstrumentation::end_phase(std::string const& name) {
+    if (!is_started())
+      return;
+    ResourceUsage usage = current_resource_usage();
+    Mutex::Lock lock(m_mutex);
+    Phase phase;
+    phase.name         = name;
+    phase.wall_seconds = usage.wall_seconds - m_phase_start_usage.wall_seconds;
+    phase.cpu_seconds  = usage.cpu_seconds  - m_phase_start_usage.cpu_seconds;
+    m_phases.push_back(phase);
+    m_phase_start_usage = usage;
+  }
+
+  void StageInstrumentation::add_tile(BBox2i const& tile, double seconds) {
+    Mutex::Lock lock(m_mutex);
+    if (m_stage.empty())
+      return;
+    Tile t;
+    t.bbox    = tile;
+    t.seconds = seconds;
+    m_tiles.push_back(t);
+  }
+
+  size_t StageInstrumentation::num_tiles() const {
+    Mutex::Lock lock(m_mutex);
+    return m_tiles.size();
+  }
+
+  void StageInstrumentation::add_input_file(std::string const& file) {
+    Mutex::Lock lock(m_mutex);
+    if (std::find(m_input_files.begin(), m_input_files.end(), file) == m_input_files.end())
+      m_input_files.push_back(file);
+  }
+
+  void StageInstrumentation::add_output_file(std::string const& file) {
+    Mutex::Lock lock(m_mutex);
+    if (std::find(m_output_files.begin(), m_output_files.end(), file) == m_output_files.end())
+      m_output_files.push_back(file);
+  }
+
+  void StageInstrumentation::add_bytes_read(std::string const& file, uint64 bytes) {
+    Mutex::Lock lock(m_mutex);
+    if (m_stage.empty())
+      return;
+    if (std::find(m_input_files.begin(), m_input_files.end(), file) == m_input_files.end())
+      m_input_files.push_back(file);
+    m_bytes_read[file] += bytes;
+  }
+
+  void InstrumentedDiskImageResource::read(ImageBuffer const& dest, BBox2i const& bbox) const {
+    DiskImageResourceGDAL::read(dest, bbox);
+    uint64 bytes = uint64(bbox.width()) * bbox.height() * planes()
+      * num_channels(pixel_format()) * channel_size(channel_type());
+    stage_instrumentation().add_bytes_read(m_filename, bytes);
+  }
+
+  std::string StageInstrumentation::json() const {
+
+    ResourceUsage usage = current_resource_usage();
+    Mutex::Lock lock(m_mutex);
+
+    double wall_seconds = usage.wall_seconds - m_start_usage.wall_seconds;
+    double cpu_seconds  = usage.cpu_seconds  - m_start_usage.cpu_seconds;
+
+    std::ostringstream os;
+    os << std::setprecision(10);
+    os << "{\n";
+    os << "  \"stage\": "              << json_string(m_stage)      << ",\n";
+    os << "  \"out_prefix\": "         << json_string(m_out_prefix) << ",\n";
+    os << "  \"start_time\": "         << json_string(m_start_time) << ",\n";
+    os << "  \"wall_seconds\": "       << wall_seconds              << ",\n";
+    os << "  \"cpu_seconds\": "        << cpu_seconds               << ",\n";
+    os << "  \"num_threads\": "        << m_num_threads             << ",\n";
+    os << "  \"thread_utilization\": "
+       << thread_utilization(wall_seconds, cpu_seconds, m_num_threads) << ",\n";
+    os << "  \"peak_rss_mb\": "        << usage.peak_rss_mb         << ",\n";
+    os << "  \"bytes_read\": "    << usage.bytes_read    - m_start_usage.bytes_read    << ",\n";
+    os << "  \"bytes_written\": " << usage.bytes_written - m_start_usage.bytes_written << ",\n";
+
+    os << "  \"phases\": [";
+    for (size_t i = 0; i < m_phases.size(); i++) {
+      Phase const& p = m_phases[i];
+      os << (i == 0 ? "\n" : ",\n")
+         << "    {\"name\": " << json_string(p.name)
+         << ", \"wall_seconds\": " << p.wall_seconds
+         << ", \"cpu_seconds\": "  << p.cpu_seconds
+         << ", \"thread_utilization\": "
+         << thread_utilization(p.wall_seconds, p.cpu_seconds, m_num_threads) << "}";
+    }
+    os << (m_phases.empty() ? "],\n" : "\n  ],\n");
+
+    os << "  \"input_files\": ";
+    write_json_files(os, m_input_files, m_bytes_read, false);
+    os << ",\n  \"output_files\": ";
+    write_json_files(os, m_output_files, m_bytes_read, true);
+    os << ",\n";
+
+    os << "  \"tiles\": [";
+    for (size_t i = 0; i < m_tiles.size(); i++) {
+      Tile const& t = m_tiles[i];
+      os << (i == 0 ? "\n" : ",\n")
+         << "    {\"x\": " << t.bbox.min().x() << ", \"y\": " << t.bbox.min().y()
+         << ", \"width\": " << t.bbox.width() << ", \"height\": " << t.bbox.height()
+         << ", \"seconds\": " << t.seconds << "}";
+    }
+    os << (m_tiles.empty() ? "]\n" : "\n  ]\n");
+    os << "}\n";
+
+    return os.str();
+  }
+
+  void StageInstrumentation::write() const {
+
+    if (!is_started())
+      return;
+
+    std::string file;
+    {
+      Mutex::Lock lock(m_mutex);
+      file = m_out_prefix + "-" + m_stage + "-instrumentation.json";
+    }
+
+    // parallel_stereo may have made this a symlink to the file of the
+    // main run, which must not be overwritten.
+    if (fs::is_symlink(file))
+      fs::remove(file);
+
+    std::string text = json();
+    std::ofstream fh(file.c_str());
+    if (!fh.good())
+      vw_throw( IOErr() << "StageInstrumentation: Cannot write: " << file << ".\n" );
+    fh << text;
+    if (!fh.good())
+      vw_throw( IOErr() << "StageInstrumentation: Failed writing: " << file << ".\n" );
+    fh.close();
+
+    vw_out() << "Writing: " << file << "\n";
+  }
+
+} // namespace asp
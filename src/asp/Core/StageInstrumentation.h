@@ -0,0 +1,210 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file StageInstrumentation.h
+///
+/// A record of where a stereo stage spends its resources: wall and CPU
+/// time, overall and per phase and tile, the files read and written,
+/// peak memory, and how busy the threads were. Each stereo_* tool saves
+/// it as JSON, as <output prefix>-<stage>-instrumentation.json, if
+/// run with --save-stage-instrumentation. Otherwise nothing is recorded.
+
+#ifndef __ASP_CORE_STAGE_INSTRUMENTATION_H__
+#define __ASP_CORE_STAGE_INSTRUMENTATION_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Math/BBox.h>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <map>
+#include <string>
+
+namespace asp {
+
+  /// Resources used by this process so far.
+  struct ResourceUsage {
+    double     wall_seconds;  // Since the epoch
+    double     cpu_seconds;   // User plus system time, of all threads
+    double     peak_rss_mb;   // Peak resident memory
+    vw::uint64 bytes_read;    // Through read() and write() calls, on Linux
+    vw::uint64 bytes_written; // only. Elsewhere these are 0.
+    ResourceUsage(): wall_seconds(0), cpu_seconds(0), peak_rss_mb(0),
+                     bytes_read(0), bytes_written(0) {}
+  };
+
+  /// Sample the resources used by this process.
+  ResourceUsage current_resource_usage();
+
+  /// Quote a string for JSON, escaping what is needed.
+  std::string json_string(std::string const& str);
+
+  /// The resource record of one stage. All methods are thread-safe.
+  class StageInstrumentation {
+  public:
+    StageInstrumentation();
+
+    /// Start recording a stage. It will be saved to
+    /// out_prefix + "-" + stage + "-instrumentation.json". Until this is
+    /// called nothing is recorded.
+    void start(std::string const& stage, std::string const& out_prefix);
+    bool is_started() const;
+
+    /// End the current phase of the stage, such as low-resolution
+    /// correlation, giving it a name. The next phase starts now.
+    void end_phase(std::string const& name);
+
+    /// Record how long it took to compute a tile.
+    void add_tile(vw::BBox2i const& tile, double seconds);
+    size_t num_tiles() const;
+
+    /// Record a file that the stage read or wrote. The bytes read from
+    /// an input are known only if it was opened with
+    /// instrumented_disk_image_view(). The bytes written to an output
+    /// are those of its pixels, as each is written once. The file sizes
+    /// on disk are found when the record is made.
+    void add_input_file (std::string const& file);
+    void add_output_file(std::string const& file);
+
+    /// Count bytes read from an input file. See
+    /// InstrumentedDiskImageResource.
+    void add_bytes_read(std::string const& file, vw::uint64 bytes);
+
+    /// The record, with the totals up to now, as JSON.
+    std::string json() const;
+
+    /// Save the record. Does nothing if no stage was started.
+    void write() const;
+
+  private:
+    struct Phase {
+      std::string name;
+      double wall_seconds, cpu_seconds;
+    };
+    struct Tile {
+      vw::BBox2i bbox;
+      double seconds;
+    };
+
+    std::string m_stage, m_out_prefix, m_start_time;
+    int m_num_threads;
+    ResourceUsage m_start_usage, m_phase_start_usage;
+    std::vector<Phase>       m_phases;
+    std::vector<Tile>        m_tiles;
+    std::vector<std::string> m_input_files, m_output_files;
+    std::map<std::string, vw::uint64> m_bytes_read; // Only for the counted inputs
+    mutable vw::Mutex m_mutex;
+  };
+
+  /// The instrumentation of the stage run by this process.
+  StageInstrumentation& stage_instrumentation();
+
+  /// A view which records in stage_instrumentation() how long it took
+  /// to compute each tile of its child. Wrap with it the image being
+  /// written by a stage. The tiles are passed through, not copied, and
+  /// are timed only if the stage is being recorded. A tile is timed
+  /// from the start of its prerasterization to the end of its
+  /// rasterization, or if only prerasterized, which is how lazy views
+  /// above this one use it, up to the end of that. For the tile-based
+  /// views of the stereo tools, that is when the work is done.
+  template <class ImageT>
+  class TimedTileView : public vw::ImageViewBase<TimedTileView<ImageT> > {
+    ImageT m_child;
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<TimedTileView> pixel_accessor;
+
+    TimedTileView(ImageT const& child): m_child(child) {}
+
+    inline vw::int32 cols  () const { return m_child.cols();   }
+    inline vw::int32 rows  () const { return m_child.rows();   }
+    inline vw::int32 planes() const { return m_child.planes(); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+    inline result_type operator()(vw::int32 i, vw::int32 j, vw::int32 p = 0) const {
+      return m_child(i, j, p);
+    }
+
+    typedef typename ImageT::prerasterize_type prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      if (!stage_instrumentation().is_started())
+        return m_child.prerasterize(bbox);
+      vw::Stopwatch sw;
+      sw.start();
+      prerasterize_type tile = m_child.prerasterize(bbox);
+      sw.stop();
+      stage_instrumentation().add_tile(bbox, sw.elapsed_seconds());
+      return tile;
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      if (!stage_instrumentation().is_started()) {
+        m_child.rasterize(dest, bbox);
+        return;
+      }
+      vw::Stopwatch sw;
+      sw.start();
+      m_child.rasterize(dest, bbox);
+      sw.stop();
+      stage_instrumentation().add_tile(bbox, sw.elapsed_seconds());
+    }
+  };
+
+  template <class ImageT>
+  TimedTileView<ImageT> timed_tile_view(vw::ImageViewBase<ImageT> const& image) {
+    return TimedTileView<ImageT>(image.impl());
+  }
+
+  /// A GDAL image resource which counts in stage_instrumentation() the
+  /// bytes it reads, as decoded pixels. Reads served by the image cache
+  /// of Vision Workbench do not reach it, so they are not counted.
+  class InstrumentedDiskImageResource : public vw::DiskImageResourceGDAL {
+  public:
+    InstrumentedDiskImageResource(std::string const& filename):
+      vw::DiskImageResourceGDAL(filename), m_filename(filename) {}
+    virtual ~InstrumentedDiskImageResource() {}
+
+    virtual void read(vw::ImageBuffer const& dest, vw::BBox2i const& bbox) const;
+
+  private:
+    std::string m_filename;
+  };
+
+  /// Open an image written by an earlier stage and add it to the
+  /// inputs of stage_instrumentation(). If the stage is being recorded,
+  /// the bytes read from it are counted.
+  template <class PixelT>
+  vw::DiskImageView<PixelT> instrumented_disk_image_view(std::string const& file) {
+    StageInstrumentation & record = stage_instrumentation();
+    if (!record.is_started())
+      return vw::DiskImageView<PixelT>(file);
+    record.add_bytes_read(file, 0);
+    boost::shared_ptr<vw::DiskImageResource> rsrc(new InstrumentedDiskImageResource(file));
+    return vw::DiskImageView<PixelT>(rsrc);
+  }
+
+} // namespace asp
+
+#endif//__ASP_CORE_STAGE_INSTRUMENTATION_H__
@@ -138,7 +138,7 @@ namespace asp {
       ("prefilter-mode",         po::value(&global.pre_filter_mode)->default_value(2),
                      "Preprocessing filter mode. [0 None, 1 Gaussian, 2 LoG, 3 Sign of LoG]")
       ("corr-seed-mode",         po::value(&global.seed_mode)->default_value(1),
-                     "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity produced by sparse_disp (in development)]")
+                     "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity produced by sparse_disp (in development), 4 Use per-tile search ranges from interest point matches, with no low-res disparity]")
       ("corr-sub-seed-percent",  po::value(&global.seed_percent_pad)->default_value(0.25),
                      "Percent fudge factor for disparity seed's search range.")
       ("cost-mode",              po::value(&global.cost_mode)->default_value(2),
@@ -170,8 +170,14 @@ namespace asp {
                      "Error (in meters) of the disparity estimation DEM.")
       ("use-local-homography",   po::bool_switch(&global.use_local_homography)->default_value(false)->implicit_value(true),
                      "Apply a local homography in each tile.")
+      ("reuse-local-homography-warps", po::bool_switch(&global.reuse_local_homography_warps)->default_value(false)->implicit_value(true),
+                     "With use-local-homography, save the warped right image seen by each correlation tile, and read it back during refinement rather than warping again.")
       ("corr-timeout",           po::value(&global.corr_timeout)->default_value(900),
                      "Correlation timeout for a tile, in seconds.")
+      ("corr-timeout-calibration-tiles", po::value(&global.corr_timeout_calibration_tiles)->default_value(0),
+                     "Run the startup correlation benchmark again on this many tiles, under the load of correlating the other tiles, and use its median to estimate if tiles would exceed corr-timeout. This adds work, and is still a benchmark rather than the time of the actual correlation. The default of 0 always uses the startup benchmark.")
+      ("save-corr-telemetry",    po::bool_switch(&global.save_corr_telemetry)->default_value(false)->implicit_value(true),
+                     "Save the search range, amount of work, time, and whether the timeout may have been reached, for each correlation tile, in output-prefix-corr_telemetry.csv.")
       ("stereo-algorithm",       po::value(&global.stereo_algorithm)->default_value(0),
                      "Stereo algorithm to use [0=local window, 1=SGM, 2=Smooth SGM].")
       ("corr-blob-filter",       po::value(&global.corr_blob_filter_area)->default_value(0),
@@ -179,7 +185,23 @@ namespace asp {
       ("corr-tile-size",         po::value(&global.corr_tile_size_ovr)->default_value(ASPGlobalOptions::corr_tile_size()),
                      "Override the default tile size used for processing.")
       ("sgm-collar-size",        po::value(&global.sgm_collar_size)->default_value(512),
-                     "Extend SGM calculation to this distance to increase accuracy at tile borders.");
+                     "Extend SGM calculation to this distance to increase accuracy at tile borders.")
+      ("single-process-blend",   po::bool_switch(&global.single_process_blend)->default_value(false)->implicit_value(true),
+                     "With parallel_stereo and SGM, blend the seams of all tiles in one process, reading each tile once, and write RD.tif for the whole image, rather than blending each tile in its own process.")
+      ("single-process-blend-cache-mb", po::value(&global.single_process_blend_cache_mb)->default_value(0),
+                     "Memory, in MB, for the tiles kept in memory with single-process-blend. The default of 0 keeps three rows of tiles. With less than two rows, tiles are read from disk more than once.")
+      ("parallel-job-size",      po::value(&global.parallel_job_size)->default_value(Vector2i(0,0),"0 0"),
+                     "The size of the tiles which parallel_stereo processes separately. This option is used in parallel_stereo.")
+      ("disable-cost-based-tile-order", po::bool_switch(&global.disable_cost_based_tile_order)->default_value(false)->implicit_value(true),
+                     "Process the correlation tiles in raster order, rather than starting with the ones estimated to be the most expensive based on their search range.")
+      ("corr-right-image-cache-mb", po::value(&global.corr_right_image_cache_mb)->default_value(0),
+                     "Memory, in MB, for caching blocks of the right image which are shared among neighboring correlation tiles. The default of 0 reads them through the usual image cache only.")
+      ("lowres-seed-on-demand", po::bool_switch(&global.lowres_seed_on_demand)->default_value(false)->implicit_value(true),
+                     "Do not compute the low-resolution disparity for the whole image before full-resolution correlation. Instead, compute it for each region when a full-resolution tile first needs it, and reuse it for other tiles. Applies only to corr-seed-mode 1. No D_sub file is written.")
+      ("incremental-correlation", po::bool_switch(&global.incremental_correlation)->default_value(false)->implicit_value(true),
+                     "Save a hash of the inputs of each tile next to D.tif. When run again with this option, recompute only the tiles whose inputs or settings changed, and copy the others from the existing D.tif.")
+      ("fuse-correlation-and-refinement", po::bool_switch(&global.fuse_correlation_and_refinement)->default_value(false)->implicit_value(true),
+                     "Do subpixel refinement of each tile right after its correlation, in memory, and write only RD.tif, skipping D.tif. Refinement is then skipped. Applies only to stereo-algorithm 0 and subpixel-mode 0 to 4.");
 
 
     po::options_description backwards_compat_options("Aliased backwards compatibility options");
@@ -207,7 +229,9 @@ namespace asp {
       ("disable-v-subpixel",  po::bool_switch(&global.disable_v_subpixel)->default_value(false)->implicit_value(true),
                               "Disable calculation of subpixel in vertical direction.")
       ("subpixel-max-levels", po::value(&global.subpixel_max_levels)->default_value(2),
-                              "Max pyramid levels to process when using the BayesEM refinement. (0 is just a single level).");
+                              "Max pyramid levels to process when using the BayesEM refinement. (0 is just a single level).")
+      ("subpixel-simd",       po::value(&global.subpixel_simd)->default_value("off"),
+                              "Use an implementation of subpixel modes 2 and 3 with vector instructions for the window sums. Options: off (the original implementation of these modes), auto (the best this CPU supports), avx2, sse4.1, and scalar (the same code without vector instructions). This implementation is experimental, and its results differ slightly from the original one.");
 
     po::options_description experimental_subpixel_options("Experimental Subpixel Options");
     experimental_subpixel_options.add_options()
@@ -282,6 +306,10 @@ namespace asp {
                                             "The minimum angle, in degrees, at which rays must meet at a triangulated point to accept this point as valid. The internal default is somewhat less than 1 degree.")
       ("use-least-squares",                 po::bool_switch(&global.use_least_squares)->default_value(false)->implicit_value(true),
                                             "Use rigorous least squares triangulation process. This is slow for ISIS processes.")
+      ("ray-grid-spacing",                  po::value(&global.ray_grid_spacing)->default_value(0.0),
+                                            "For linescan cameras, find the camera rays exactly on a grid with this spacing in pixels, such as 64, and interpolate them in between. The default of 0 finds all rays exactly.")
+      ("ray-grid-max-error",                po::value(&global.ray_grid_max_error)->default_value(0.01),
+                                            "The largest error, in pixels, allowed for the interpolated camera rays. Where it is larger the grid is made finer, and at the end the rays are found exactly.")
       ("bundle-adjust-prefix", po::value(&global.bundle_adjust_prefix),
        "Use the camera adjustments obtained by previously running bundle_adjust with this output prefix.")
       ("image-lines-per-piecewise-adjustment", po::value(&global.image_lines_per_piecewise_adjustment)->default_value(0), "A positive value, e.g., 1000, will turn on using piecewise camera adjustments to help reduce jitter effects. Use one adjustment per this many image lines.")
@@ -293,6 +321,10 @@ namespace asp {
                                             "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
                                             "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
+      ("compact-point-cloud",               po::bool_switch(&global.compact_point_cloud)->default_value(false)->implicit_value(true),
+                                            "Save the point cloud as integer multiples of the point cloud rounding error rather than as float. This keeps the same precision, but the file compresses better, and tiles with no valid points take no space.")
+      ("save-point-cloud-index",            po::bool_switch(&global.save_point_cloud_index)->default_value(false)->implicit_value(true),
+                                            "Save next to the point cloud an index of where its points are, so that point2dem need not read the cloud an extra time to find that.")
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
                                             "Only compute the center of triangulated point cloud and exit.")
       ("skip-point-cloud-center-comp", po::bool_switch(&global.skip_point_cloud_center_comp)->default_value(false)->implicit_value(true),
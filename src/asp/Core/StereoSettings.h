@@ -102,6 +102,7 @@ namespace asp {
     double nodata_optimal_threshold_factor; ///< Pixels with values less than this factor times the optimal Otsu threshold are treated as no-data
     bool   skip_image_normalization;        ///< Skip the step of normalizing the values of input images and removing nodata-pixels. Create instead symbolic links to original images.
     bool   part_of_multiview_run;           ///< If the current run is part of a larger multiview run
+    bool   save_stage_instrumentation;      ///< Save the resource usage of each stage as JSON
 
     // Correlation Options
     float slogW;                      ///< Preprocessing filter width
@@ -115,6 +116,8 @@ namespace asp {
                                       //     (see disparity-estimation-dem)
                                       // 3 = Use low-res disparity produced by sparse_disp
                                       //     (in development)
+                                      // 4 = Use per-tile search ranges from interest
+                                      //     point matches, with no low-res disparity
 
     float seed_percent_pad;           ///< Pad amound towards the IP found
     vw::uint16 cost_mode;             // 0 = absolute difference
@@ -131,13 +134,27 @@ namespace asp {
     std::string disparity_estimation_dem;     // DEM to use in estimating the low-resolution disparity
     double disparity_estimation_dem_error; // Error (in meters) of the disparity estimation DEM
     bool   use_local_homography;      // Apply a local homography in each tile
+    bool   reuse_local_homography_warps; // Save the warped right image in correlation,
+                                         // and read it back in refinement.
     int    corr_timeout;              // Correlation timeout for a tile, in seconds
+    int    corr_timeout_calibration_tiles; // Tiles to measure the correlation rate on
+    bool   save_corr_telemetry;            // Write the timing of each correlation tile
     int    stereo_algorithm;          // 0 = Default local window search method.
                                       // 1 = Slower SGM method.
                                       // 2 = Even slower smooth SGM method.
     int    corr_blob_filter_area;     // Use blob filtering in pyramidal correlation
     int    corr_tile_size_ovr;        // Override the default tile size used for processing.
     int    sgm_collar_size;           // Extra tile padding used for SGM calculation.
+    bool   single_process_blend;      // Blend all parallel_stereo tiles in one process.
+    int    single_process_blend_cache_mb; // Memory for the tiles so blended, 0 for three rows.
+    vw::Vector2i parallel_job_size;   // The size of the parallel_stereo tiles.
+    bool   disable_cost_based_tile_order; // Process correlation tiles in raster order rather
+                                          // than most expensive first.
+    int    corr_right_image_cache_mb; // Memory for right image blocks shared among tiles.
+    bool   lowres_seed_on_demand;     // Compute D_sub per region as full-res tiles need it.
+    bool   incremental_correlation;   // Recompute only the tiles whose inputs changed.
+    bool   fuse_correlation_and_refinement; // Refine each tile right after correlation,
+                                            // writing RD.tif rather than D.tif.
 
     // Subpixel Options
     vw::uint16 subpixel_mode;         // 0 = none
@@ -149,6 +166,7 @@ namespace asp {
     vw::Vector2i subpixel_kernel;     // Subpixel correlation kernel
     bool disable_h_subpixel, disable_v_subpixel;
     vw::uint16 subpixel_max_levels;   // Max pyramid levels to process. 0 hits only once.
+    std::string subpixel_simd;        // Vector instructions for modes 2 and 3, or "off"
 
     // Experimental Subpixel Options (mode 3 only)
     int subpixel_em_iter;
@@ -195,7 +213,11 @@ namespace asp {
 
     double min_triangulation_angle;           // min angle for valid triangulation
     bool   use_least_squares;                 // Use a more rigorous triangulation
+    double ray_grid_spacing;                  // For linescan cameras, interpolate the rays on a grid with this spacing in pixels
+    double ray_grid_max_error;                // The largest error in pixels of the interpolated rays
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
+    bool   compact_point_cloud;               // Save the point cloud as integer multiples of the rounding error.
+    bool   save_point_cloud_index;            // Save an index of the point cloud for point2dem
     double point_cloud_rounding_error;        // How much to round the output point cloud values
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
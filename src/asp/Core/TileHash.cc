@@ -0,0 +1,145 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/TileHash.h>
+#include <vw/Core/Exception.h>
+#include <boost/filesystem/operations.hpp>
+#include <fstream>
+
+namespace fs = boost::filesystem;
+
+using namespace vw;
+
+namespace asp {
+
+  // Tag on the first line of the hash file, followed by a format version.
+  const std::string TILE_HASH_TAG = "ASP_TILE_HASHES";
+  const int TILE_HASH_VERSION = 1;
+
+  void ContentHash::add_file(std::string const& file) {
+    std::ifstream fh(file.c_str(), std::ios::binary);
+    if (!fh.good()) {
+      add_value(int64(-1));
+      return;
+    }
+    add_value(int64(fs::file_size(file)));
+    char buf[65536];
+    while (fh.read(buf, sizeof(buf)) || fh.gcount() > 0)
+      add(buf, fh.gcount());
+  }
+
+  TileHashTable::KeyT TileHashTable::key(BBox2i const& tile) {
+    return std::make_pair(std::make_pair(tile.min().x(), tile.min().y()),
+                          std::make_pair(tile.width(),   tile.height()));
+  }
+
+  size_t TileHashTable::size() const {
+    Mutex::Lock lock(m_mutex);
+    return m_hashes.size();
+  }
+
+  void TileHashTable::set(BBox2i const& tile, uint64 hash) {
+    Mutex::Lock lock(m_mutex);
+    m_hashes[key(tile)] = hash;
+  }
+
+  bool TileHashTable::get(BBox2i const& tile, uint64 & hash) const {
+    Mutex::Lock lock(m_mutex);
+    std::map<KeyT, uint64>::const_iterator it = m_hashes.find(key(tile));
+    if (it == m_hashes.end())
+      return false;
+    hash = it->second;
+    return true;
+  }
+
+  size_t TileHashTable::count_equal(TileHashTable const& other) const {
+    Mutex::Lock lock(m_mutex);
+    size_t count = 0;
+    for (std::map<KeyT, uint64>::const_iterator it = m_hashes.begin();
+         it != m_hashes.end(); it++) {
+      BBox2i tile(it->first.first.first,  it->first.first.second,
+                  it->first.second.first, it->first.second.second);
+      uint64 hash;
+      if (other.get(tile, hash) && hash == it->second)
+        count++;
+    }
+    return count;
+  }
+
+  void TileHashTable::write(std::string const& file) const {
+
+    Mutex::Lock lock(m_mutex);
+    std::ofstream fh(file.c_str());
+    if (!fh.good())
+      vw_throw( IOErr() << "TileHashTable: Cannot write: " << file << ".\n" );
+
+    // One tile per line: min x, min y, width, height, hash.
+    fh << TILE_HASH_TAG << " " << TILE_HASH_VERSION << "\n";
+    fh << m_image_size[0] << " " << m_image_size[1] << " " << m_hashes.size() << "\n";
+    for (std::map<KeyT, uint64>::const_iterator it = m_hashes.begin();
+         it != m_hashes.end(); it++)
+      fh << it->first.first.first  << " " << it->first.first.second  << " "
+         << it->first.second.first << " " << it->first.second.second << " "
+         << it->second << "\n";
+
+    if (!fh.good())
+      vw_throw( IOErr() << "TileHashTable: Failed writing: " << file << ".\n" );
+    fh.close();
+  }
+
+  void TileHashTable::read(std::string const& file) {
+
+    std::ifstream fh(file.c_str());
+    if (!fh.good())
+      vw_throw( IOErr() << "TileHashTable: File does not exist: " << file << ".\n" );
+
+    std::string tag;
+    int version = 0;
+    Vector2i image_size;
+    size_t num_tiles = 0;
+    if (!(fh >> tag >> version >> image_size[0] >> image_size[1] >> num_tiles) ||
+        tag != TILE_HASH_TAG || version != TILE_HASH_VERSION)
+      vw_throw( IOErr() << "TileHashTable: Invalid file: " << file << ".\n" );
+
+    std::map<KeyT, uint64> hashes;
+    for (size_t i = 0; i < num_tiles; i++) {
+      int x, y, width, height;
+      uint64 hash;
+      if (!(fh >> x >> y >> width >> height >> hash))
+        vw_throw( IOErr() << "TileHashTable: Invalid file: " << file << ".\n" );
+      hashes[key(BBox2i(x, y, width, height))] = hash;
+    }
+    fh.close();
+
+    Mutex::Lock lock(m_mutex);
+    m_image_size = image_size;
+    m_hashes.swap(hashes);
+  }
+
+  std::string previous_tile_output(std::string const& prefix,
+                                   std::string const& suffix,
+                                   std::string const& nosym_suffix) {
+    std::string file = prefix + suffix, nosym_file = prefix + nosym_suffix;
+    if (fs::exists(file) && !fs::is_symlink(file))
+      return file; // Not renamed, so written after any parallel_stereo run
+    if (fs::is_symlink(file) && fs::exists(nosym_file) && !fs::is_symlink(nosym_file))
+      return nosym_file;
+    return "";
+  }
+
+} // namespace asp
@@ -0,0 +1,120 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TileHash.h
+///
+/// Content hashes of the inputs of each output tile, saved next to an
+/// output image. When a tool is run again, a tile whose hash did not
+/// change can be copied from the previous output rather than recomputed.
+
+#ifndef __ASP_CORE_TILE_HASH_H__
+#define __ASP_CORE_TILE_HASH_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Math/BBox.h>
+#include <map>
+#include <string>
+
+namespace asp {
+
+  /// The 64-bit FNV-1a hash, accumulated over successive pieces of data.
+  class ContentHash {
+  public:
+    ContentHash(): m_hash(14695981039346656037ULL) {}
+
+    void add(const void* data, size_t num_bytes) {
+      const unsigned char* bytes = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < num_bytes; i++) {
+        m_hash ^= bytes[i];
+        m_hash *= 1099511628211ULL;
+      }
+    }
+
+    /// Add a number. Use only with arithmetic types, which have no padding.
+    template <class T>
+    void add_value(T value) { add(&value, sizeof(T)); }
+
+    void add_bbox(vw::BBox2i const& box) {
+      add_value(box.min().x()); add_value(box.min().y());
+      add_value(box.max().x()); add_value(box.max().y());
+    }
+
+    /// Add the size and the pixels of an image. The pixel type must not
+    /// have padding, which holds for the plain and masked pixel types.
+    template <class PixelT>
+    void add_image(vw::ImageView<PixelT> const& image) {
+      add_value(image.cols()); add_value(image.rows()); add_value(image.planes());
+      for (int p = 0; p < image.planes(); p++)
+        for (int row = 0; row < image.rows(); row++)
+          if (image.cols() > 0)
+            add(&image(0, row, p), image.cols()*sizeof(PixelT));
+    }
+
+    /// Add the size and the bytes of a file. A missing file adds only a
+    /// marker, so that its later appearance changes the hash.
+    void add_file(std::string const& file);
+
+    vw::uint64 value() const { return m_hash; }
+
+  private:
+    vw::uint64 m_hash;
+  };
+
+  /// A thread-safe table of content hashes, indexed by tile, for an
+  /// output image of given size.
+  class TileHashTable {
+  public:
+    TileHashTable(): m_image_size(0, 0) {}
+    TileHashTable(vw::Vector2i const& image_size): m_image_size(image_size) {}
+
+    vw::Vector2i image_size() const { return m_image_size; }
+    size_t size() const;
+
+    void set(vw::BBox2i const& tile, vw::uint64 hash);
+
+    /// Returns false if the tile is not in the table.
+    bool get(vw::BBox2i const& tile, vw::uint64 & hash) const;
+
+    /// The number of tiles with the same hash in both tables.
+    size_t count_equal(TileHashTable const& other) const;
+
+    void write(std::string const& file) const;
+    void read (std::string const& file);
+
+  private:
+    typedef std::pair<std::pair<int, int>, std::pair<int, int> > KeyT;
+    static KeyT key(vw::BBox2i const& tile);
+
+    vw::Vector2i m_image_size;
+    std::map<KeyT, vw::uint64> m_hashes;
+    mutable vw::Mutex m_mutex;
+  };
+
+  /// The file holding the output of the previous run for given prefix,
+  /// or an empty string if there is none. parallel_stereo renames each
+  /// tile's output to prefix + nosym_suffix and replaces prefix + suffix
+  /// with a symbolic link to the mosaic of all tiles, which is not this
+  /// tile's output.
+  std::string previous_tile_output(std::string const& prefix,
+                                   std::string const& suffix,
+                                   std::string const& nosym_suffix);
+
+} // namespace asp
+
+#endif//__ASP_CORE_TILE_HASH_H__
@@ -0,0 +1,128 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/WarpedFootprints.h>
+#include <vw/Core/Exception.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <vw/FileIO/DiskImageView.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+  int correlation_footprint_margin(Vector2i const& kernel_size, int max_levels,
+                                   int collar) {
+    const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+    int max_upscaling = 1 << max_levels;
+    int half_kernel   = std::max(kernel_size[0], kernel_size[1])/2;
+    return (half_kernel + rm_half_kernel + 1) * max_upscaling + collar;
+  }
+
+  BBox2i correlation_footprint(BBox2i const& bbox, BBox2f const& search_range,
+                               int margin, BBox2i const& image_box) {
+    BBox2i footprint = bbox;
+    footprint.min() += Vector2i(floor(search_range.min()));
+    footprint.max() += Vector2i(ceil (search_range.max()));
+    footprint.expand(margin);
+    footprint.crop(image_box);
+    return footprint;
+  }
+
+  WarpedFootprintStore::WarpedFootprintStore(std::string const& out_prefix):
+    m_dir(out_prefix + "-R_warped") {}
+
+  void WarpedFootprintStore::clear() const {
+    if (fs::exists(m_dir))
+      fs::remove_all(m_dir);
+  }
+
+  std::string WarpedFootprintStore::file_name(Vector2i const& cell, BBox2i const& footprint) {
+    std::ostringstream os;
+    os << "cell_" << cell[0] << "_" << cell[1] << "_box_"
+       << footprint.min().x() << "_" << footprint.min().y() << "_"
+       << footprint.width()   << "_" << footprint.height() << ".tif";
+    return os.str();
+  }
+
+  bool WarpedFootprintStore::parse_file_name(std::string const& name, Vector2i & cell,
+                                             BBox2i & footprint) {
+    int cx, cy, x, y, width, height;
+    char tail[8];
+    if (sscanf(name.c_str(), "cell_%d_%d_box_%d_%d_%d_%d%7s",
+               &cx, &cy, &x, &y, &width, &height, tail) != 7 ||
+        std::string(tail) != ".tif" || width <= 0 || height <= 0)
+      return false;
+    cell      = Vector2i(cx, cy);
+    footprint = BBox2i(x, y, width, height);
+    return true;
+  }
+
+  void WarpedFootprintStore::write(Vector2i const& cell, BBox2i const& footprint,
+                                   ImageView<PixelGray<float> > const& image) const {
+    VW_ASSERT(image.cols() == footprint.width() && image.rows() == footprint.height(),
+              ArgumentErr() << "WarpedFootprintStore: The image does not match the footprint.\n");
+
+    boost::system::error_code ec;
+    fs::create_directories(m_dir, ec); // Another thread may have made it
+    if (!fs::is_directory(m_dir))
+      vw_throw( IOErr() << "WarpedFootprintStore: Cannot create: " << m_dir << ".\n" );
+
+    // Write under another name first, so that a partially written file
+    // is never found.
+    std::string file = m_dir + "/" + file_name(cell, footprint);
+    std::string tmp  = file + ".tmp.tif";
+    write_image(tmp, image);
+    fs::rename(tmp, file);
+  }
+
+  void WarpedFootprintStore::load_index() {
+    m_index.clear();
+    if (!fs::is_directory(m_dir))
+      return;
+    for (fs::directory_iterator it(m_dir); it != fs::directory_iterator(); ++it) {
+      Vector2i cell;
+      BBox2i footprint;
+      if (parse_file_name(it->path().filename().string(), cell, footprint))
+        m_index[std::make_pair(cell[0], cell[1])].push_back(footprint);
+    }
+  }
+
+  bool WarpedFootprintStore::find(Vector2i const& cell, BBox2i const& region,
+                                  std::string & file, BBox2i & footprint) const {
+    std::map<std::pair<int, int>, std::vector<BBox2i> >::const_iterator it
+      = m_index.find(std::make_pair(cell[0], cell[1]));
+    if (it == m_index.end())
+      return false;
+    for (size_t i = 0; i < it->second.size(); i++) {
+      if (it->second[i].contains(region)) {
+        footprint = it->second[i];
+        file      = m_dir + "/" + file_name(cell, footprint);
+        return true;
+      }
+    }
+    return false;
+  }
+
+} // namespace asp
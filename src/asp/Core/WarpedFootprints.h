@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file WarpedFootprints.h
+///
+/// With local homographies, each correlation tile sees the right image
+/// warped by the homography of its cell. The part of the warped image
+/// which refinement of a tile reads, its footprint, can be saved by
+/// stereo_corr, so that stereo_rfne reads it back rather than warping the
+/// right image again. stereo_rfne removes them when done.
+/// The footprints are saved as images in the directory
+/// <output prefix>-R_warped, with the cell and the footprint box in the
+/// file name.
+
+#ifndef __ASP_CORE_WARPED_FOOTPRINTS_H__
+#define __ASP_CORE_WARPED_FOOTPRINTS_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+#include <vector>
+#include <map>
+#include <string>
+
+namespace asp {
+
+  /// How far beyond a tile, or its search range, the correlator may
+  /// read. This is the kernel and filter sizes at the coarsest of the
+  /// max_levels pyramid levels, plus the SGM collar, if any.
+  int correlation_footprint_margin(vw::Vector2i const& kernel_size, int max_levels,
+                                   int collar);
+
+  /// The region of the right image which the correlator may access when
+  /// processing the tile bbox with given search range. This is bbox
+  /// shifted by the search range and expanded by the margin, within the
+  /// image box.
+  vw::BBox2i correlation_footprint(vw::BBox2i const& bbox, vw::BBox2f const& search_range,
+                                   int margin, vw::BBox2i const& image_box);
+
+  /// An image of the given footprint, seen in the coordinates of the
+  /// full image of size cols x rows. Pixels outside the footprint are
+  /// zero, hence invalid for masked pixels.
+  template <class PixelT>
+  vw::CropView<vw::EdgeExtendView<vw::ImageView<PixelT>, vw::ZeroEdgeExtension> >
+  footprint_in_image(vw::ImageView<PixelT> const& footprint_image,
+                     vw::BBox2i const& footprint, int cols, int rows) {
+    return vw::crop(vw::edge_extend(footprint_image, vw::ZeroEdgeExtension()),
+                    -footprint.min().x(), -footprint.min().y(), cols, rows);
+  }
+
+  class WarpedFootprintStore {
+  public:
+    WarpedFootprintStore(std::string const& out_prefix);
+
+    std::string const& directory() const { return m_dir; }
+
+    /// Remove any footprints saved earlier, as they may be for other
+    /// homographies or settings.
+    void clear() const;
+
+    /// The file name for the footprint of a cell, and back. Parsing
+    /// returns false if this is not the name of a footprint.
+    static std::string file_name(vw::Vector2i const& cell, vw::BBox2i const& footprint);
+    static bool parse_file_name(std::string const& name, vw::Vector2i & cell,
+                                vw::BBox2i & footprint);
+
+    /// Save the warped footprint of a cell. This is safe to call from
+    /// several threads for different footprints.
+    void write(vw::Vector2i const& cell, vw::BBox2i const& footprint,
+               vw::ImageView<vw::PixelGray<float> > const& image) const;
+
+    /// Find the saved footprints.
+    void load_index();
+
+    /// Find a saved footprint of the cell which contains the region.
+    /// Returns false if there is none.
+    bool find(vw::Vector2i const& cell, vw::BBox2i const& region,
+              std::string & file, vw::BBox2i & footprint) const;
+
+  private:
+    std::string m_dir;
+    std::map<std::pair<int, int>, std::vector<vw::BBox2i> > m_index;
+  };
+
+} // namespace asp
+
+#endif//__ASP_CORE_WARPED_FOOTPRINTS_H__
@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/AffineSubpixel.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+TEST( AffineSubpixel, WindowSums ) {
+
+  // An odd number of samples, so the vector code has a remainder
+  AffineWindowSamples samples;
+  for (int i = 0; i < 101; i++)
+    samples.push_back(i % 11 - 5, i / 11 - 4, std::sin(0.3*i), std::cos(0.7*i),
+                      std::sin(1.1*i), 0.5 + 0.4*std::cos(0.2*i));
+
+  double ref[NUM_AFFINE_SUMS], sums[NUM_AFFINE_SUMS];
+  affine_window_sums(SUBPIXEL_ISA_SCALAR, samples, ref);
+  SubpixelIsa isas[2] = {SUBPIXEL_ISA_SSE41, detect_subpixel_isa()};
+  for (int t = 0; t < 2; t++) {
+    affine_window_sums(isas[t], samples, sums);
+    // Only the order of the additions in double differs
+    for (int k = 0; k < NUM_AFFINE_SUMS; k++)
+      EXPECT_NEAR(ref[k], sums[k], 1e-10 * (1.0 + std::abs(ref[k])));
+  }
+
+  EXPECT_EQ(SUBPIXEL_ISA_SCALAR, subpixel_isa_from_string("scalar"));
+  EXPECT_EQ(detect_subpixel_isa(), subpixel_isa_from_string("auto"));
+  EXPECT_THROW(subpixel_isa_from_string("neon"), ArgumentErr);
+}
+
+TEST( AffineSubpixel, Refine ) {
+
+  // A smooth texture, and a copy of it shifted by a subpixel amount
+  int size = 100;
+  Vector2  shift(3.3, -1.7);
+  Vector2i right_offset(-8, 4);
+  ImageView<float> left(size, size), right(size, size);
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      double x = col, y = row;
+      left(col, row) = std::sin(0.31*x) + std::cos(0.23*y) + 0.5*std::sin(0.17*x + 0.29*y);
+      x = col - shift[0] - right_offset[0];
+      y = row - shift[1] - right_offset[1];
+      right(col, row) = std::sin(0.31*x) + std::cos(0.23*y) + 0.5*std::sin(0.17*x + 0.29*y);
+    }
+  }
+
+  for (int em = 0; em < 2; em++) {
+    AffineSubpixelOptions opt;
+    opt.kernel_size  = Vector2i(15, 15);
+    opt.max_levels   = 1;
+    opt.use_bayes_em = (em == 1);
+    opt.isa          = detect_subpixel_isa();
+
+    ImageView<PixelMask<Vector2f> > disp(size, size);
+    for (int row = 0; row < size; row++)
+      for (int col = 0; col < size; col++)
+        disp(col, row) = PixelMask<Vector2f>(Vector2f(3, -2));
+    disp(50, 50).invalidate();
+
+    affine_subpixel_refine(left, right, right_offset, opt, disp);
+
+    EXPECT_FALSE(is_valid(disp(50, 50)));
+    for (int row = 20; row < size - 20; row += 7) {
+      for (int col = 20; col < size - 20; col += 7) {
+        ASSERT_TRUE(is_valid(disp(col, row)));
+        EXPECT_NEAR(shift[0], disp(col, row).child()[0], 0.2);
+        EXPECT_NEAR(shift[1], disp(col, row).child()[1], 0.2);
+      }
+    }
+  }
+}
@@ -0,0 +1,87 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/BlockCache.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( BlockCache, Eviction ) {
+
+  // Room for exactly two 10 x 10 float blocks
+  BlockCache<float> cache(2*10*10*sizeof(float));
+  ImageView<float> a(10, 10), b(10, 10), c(10, 10), out;
+  a(0, 0) = 1; b(0, 0) = 2; c(0, 0) = 3;
+
+  cache.put(std::make_pair(0, 0), a);
+  cache.put(std::make_pair(1, 0), b);
+  EXPECT_TRUE(cache.get(std::make_pair(0, 0), out)); // (0, 0) is now most recent
+  EXPECT_EQ(1, out(0, 0));
+
+  cache.put(std::make_pair(2, 0), c);                // evicts (1, 0)
+  EXPECT_FALSE(cache.get(std::make_pair(1, 0), out));
+  EXPECT_TRUE (cache.get(std::make_pair(0, 0), out));
+  EXPECT_TRUE (cache.get(std::make_pair(2, 0), out));
+  EXPECT_EQ(3, out(0, 0));
+  EXPECT_EQ(2*10*10*sizeof(float), cache.bytes());
+}
+
+TEST( BlockCache, CachedBlockView ) {
+
+  ImageView<float> image(37, 23);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      image(col, row) = col + 100*row;
+
+  CachedBlockView<ImageView<float> > cached = cached_block_view(image, 8, 1024*1024);
+
+  BBox2i box(5, 3, 20, 17);
+  ImageView<float> tile = crop(cached, box);
+  for (int row = 0; row < tile.rows(); row++)
+    for (int col = 0; col < tile.cols(); col++)
+      EXPECT_EQ(image(col + box.min().x(), row + box.min().y()), tile(col, row));
+
+  // A second, overlapping read is served from the cache.
+  size_t misses = cached.cache()->misses();
+  tile = crop(cached, BBox2i(8, 8, 8, 8));
+  EXPECT_EQ(misses, cached.cache()->misses());
+  EXPECT_EQ(image(30, 20), cached(30, 20));
+
+  // The blocks of a box are looked up once, and then read pixel by
+  // pixel without the cache.
+  CachedBlockView<ImageView<float> >::prerasterize_type blocks = cached.prerasterize(box);
+  size_t hits = cached.cache()->hits();
+  for (int row = box.min().y(); row < box.max().y(); row++)
+    for (int col = box.min().x(); col < box.max().x(); col++)
+      EXPECT_EQ(image(col, row), blocks(col, row));
+  EXPECT_EQ(hits, cached.cache()->hits());
+
+  // Parts of a box outside the image are zero
+  BBox2i edge_box(30, 18, 10, 8);
+  tile = crop(cached, edge_box);
+  for (int row = 0; row < tile.rows(); row++) {
+    for (int col = 0; col < tile.cols(); col++) {
+      Vector2i pix = Vector2i(col, row) + edge_box.min();
+      if (bounding_box(image).contains(pix))
+        EXPECT_EQ(image(pix[0], pix[1]), tile(col, row));
+      else
+        EXPECT_EQ(0, tile(col, row));
+    }
+  }
+}
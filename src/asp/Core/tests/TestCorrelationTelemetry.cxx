@@ -0,0 +1,67 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/CorrelationTelemetry.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( CorrelationTelemetry, Calibration ) {
+
+  // A 10x10 tile, 3x3 kernel, and 2x1 search range give 100*9*6 ops,
+  // or a search volume of 100*6.
+  EXPECT_NEAR(5400.0, correlation_ops(BBox2i(0, 0, 10, 10), Vector2i(3, 3),
+                                      BBox2f(0, 0, 2, 1)), 1e-8);
+  EXPECT_NEAR(600.0, search_volume(BBox2i(0, 0, 10, 10), BBox2f(0, 0, 2, 1)), 1e-8);
+
+  CorrelationTelemetry telemetry(3);
+  double rate = 0;
+  EXPECT_TRUE(telemetry.needs_calibration());
+  EXPECT_FALSE(telemetry.measured_seconds_per_op(rate));
+
+  // The rate is available from the first tile on
+  telemetry.add_calibration(0.003);
+  EXPECT_TRUE(telemetry.measured_seconds_per_op(rate));
+  EXPECT_NEAR(0.003, rate, 1e-12);
+
+  // Invalid rates don't count
+  telemetry.add_calibration(0.0);
+  telemetry.add_calibration(0.001);
+  EXPECT_TRUE(telemetry.needs_calibration());
+  telemetry.add_calibration(0.002);
+  EXPECT_FALSE(telemetry.needs_calibration());
+  EXPECT_TRUE(telemetry.measured_seconds_per_op(rate));
+  EXPECT_NEAR(0.002, rate, 1e-12); // The median
+
+  // Later tiles don't change the rate
+  telemetry.add_calibration(0.05);
+  EXPECT_TRUE(telemetry.measured_seconds_per_op(rate));
+  EXPECT_NEAR(0.002, rate, 1e-12);
+
+  CorrTileRecord record;
+  telemetry.add(record);
+  telemetry.add(record);
+  EXPECT_EQ(2u, telemetry.size());
+
+  // Without calibration tiles the startup benchmark is always used
+  CorrelationTelemetry no_calibration(0);
+  EXPECT_FALSE(no_calibration.needs_calibration());
+  no_calibration.add_calibration(0.001);
+  EXPECT_FALSE(no_calibration.measured_seconds_per_op(rate));
+}
@@ -0,0 +1,124 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/HoleFill.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // An image with a small hole crossing tile edges, a large hole, and
+  // two small holes touching only at a corner.
+  ImageView<PixelMask<float> > make_image() {
+    ImageView<PixelMask<float> > img(40, 30);
+    for (int row = 0; row < img.rows(); row++)
+      for (int col = 0; col < img.cols(); col++)
+        img(col, row) = PixelMask<float>(col + 2.0*row);
+    for (int row = 6; row < 10; row++)   // Small, across tiles
+      for (int col = 6; col < 10; col++)
+        img(col, row).invalidate();
+    for (int row = 12; row < 26; row++)  // Large
+      for (int col = 20; col < 36; col++)
+        img(col, row).invalidate();
+    img(3, 20).invalidate();
+    img(4, 21).invalidate();
+    return img;
+  }
+}
+
+TEST( HoleFill, Index ) {
+  ImageView<PixelMask<float> > img = make_image();
+
+  for (int tile_size = 5; tile_size <= 40; tile_size += 7) {
+    TiledHoleIndex index(img.cols(), img.rows(), tile_size, 50);
+    build_hole_index(img, index);
+    EXPECT_EQ(3u, index.num_holes());
+
+    std::vector<HoleInfo> holes;
+    index.holes_in(BBox2i(0, 0, 7, 7), holes);
+    ASSERT_EQ(1u, holes.size());
+    EXPECT_EQ(BBox2i(6, 6, 4, 4), holes[0].bbox);
+    EXPECT_EQ(16, holes[0].area);
+
+    index.holes_in(BBox2i(20, 12, 10, 10), holes);
+    EXPECT_EQ(0u, holes.size());
+  }
+}
+
+TEST( HoleFill, Inpaint ) {
+  ImageView<PixelMask<float> > img = make_image();
+
+  ImageView<PixelMask<float> > ref;
+  for (int tile_size = 5; tile_size <= 40; tile_size += 7) {
+    TiledHoleIndex index(img.cols(), img.rows(), tile_size, 50);
+    build_hole_index(img, index);
+    ImageView<PixelMask<float> > out = inpaint_holes(img, index);
+
+    EXPECT_TRUE(is_valid(out(7, 7)));
+    EXPECT_TRUE(is_valid(out(3, 20)));
+    EXPECT_TRUE(is_valid(out(4, 21)));
+    EXPECT_FALSE(is_valid(out(25, 20)));
+
+    // The filled values are between those around the holes
+    EXPECT_NEAR(3 + 2.0*20, out(3, 20).child(), 0.5);
+    EXPECT_GT(out(7, 7).child(), 5 + 2.0*5);
+    EXPECT_LT(out(7, 7).child(), 10 + 2.0*10);
+
+    // The result does not depend on the tiling
+    if (ref.cols() == 0) {
+      ref = out;
+      continue;
+    }
+    for (int row = 0; row < img.rows(); row++) {
+      for (int col = 0; col < img.cols(); col++) {
+        ASSERT_EQ(is_valid(ref(col, row)), is_valid(out(col, row)));
+        if (is_valid(ref(col, row)))
+          EXPECT_EQ(ref(col, row).child(), out(col, row).child());
+      }
+    }
+  }
+}
+
+TEST( HoleFill, GrassfireOrder ) {
+  // A plus-shaped hole. Its center is two steps away from the valid
+  // pixels, so it is filled after the arms, even though its diagonal
+  // neighbors are valid.
+  ImageView<PixelMask<float> > img(9, 9);
+  fill(img, PixelMask<float>(0.0));
+  img(3, 3) = img(5, 3) = img(3, 5) = img(5, 5) = PixelMask<float>(9.0);
+  img(4, 4).invalidate();
+  img(4, 3).invalidate();
+  img(4, 5).invalidate();
+  img(3, 4).invalidate();
+  img(5, 4).invalidate();
+
+  TiledHoleIndex index(img.cols(), img.rows(), 4, 50);
+  build_hole_index(img, index);
+  ASSERT_EQ(1u, index.num_holes());
+  ImageView<PixelMask<float> > out = inpaint_holes(img, index);
+
+  // Each arm averages three zeros and two nines
+  EXPECT_NEAR(3.6, out(4, 3).child(), 1e-5);
+  EXPECT_NEAR(3.6, out(3, 4).child(), 1e-5);
+  EXPECT_NEAR(3.6, out(5, 4).child(), 1e-5);
+  EXPECT_NEAR(3.6, out(4, 5).child(), 1e-5);
+
+  // The center averages the four arms and the four nines
+  EXPECT_NEAR((4*3.6 + 4*9.0)/8.0, out(4, 4).child(), 1e-5);
+}
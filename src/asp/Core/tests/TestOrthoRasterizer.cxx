@@ -0,0 +1,85 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // Find the boundaries intersecting the box by checking all of them
+  std::vector<size_t> find_all(std::vector<BBoxPair> const& boundaries, BBox3 const& box) {
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < boundaries.size(); i++)
+      if (box.intersects(boundaries[i].first))
+        indices.push_back(i);
+    return indices;
+  }
+
+  double rand_val(double max) { return max*double(rand())/double(RAND_MAX); }
+}
+
+TEST( OrthoRasterizer, BoundaryGridIndex ) {
+
+  // Small boxes on a grid, as for the blocks of a point cloud, a few
+  // big ones, as for blocks with outliers, and a box of a single point.
+  srand(7);
+  std::vector<BBoxPair> boundaries;
+  for (int i = 0; i < 40; i++) {
+    for (int j = 0; j < 30; j++) {
+      Vector3 corner(10*i + rand_val(3), 10*j + rand_val(3), rand_val(5));
+      BBox3 box(corner, corner + Vector3(8 + rand_val(4), 8 + rand_val(4), 1));
+      boundaries.push_back(std::make_pair(box, BBox2i(16*i, 16*j, 16, 16)));
+    }
+  }
+  boundaries.push_back(std::make_pair(BBox3(Vector3(-50, 20, 0), Vector3(500, 40, 5)),
+                                      BBox2i(0, 0, 16, 16)));
+  boundaries.push_back(std::make_pair(BBox3(Vector3(0, -90, 0), Vector3(30, 400, 5)),
+                                      BBox2i(16, 0, 16, 16)));
+  Vector3 point(123.5, 77.25, 2);
+  boundaries.push_back(std::make_pair(BBox3(point, point), BBox2i(32, 0, 16, 16)));
+
+  BoundaryGridIndex index;
+  index.build(boundaries);
+  EXPECT_GT(index.cols()*index.rows(), 100);
+  EXPECT_LE(index.cols()*index.rows(), 4*int(boundaries.size()));
+
+  std::vector<size_t> indices;
+  for (int k = 0; k < 200; k++) {
+    Vector3 corner(rand_val(600) - 100, rand_val(500) - 100, -10);
+    BBox3 box(corner, corner + Vector3(rand_val(80), rand_val(80), 20));
+    index.find(boundaries, box, indices);
+    std::vector<size_t> expected = find_all(boundaries, box);
+    ASSERT_EQ(expected.size(), indices.size());
+    for (size_t i = 0; i < indices.size(); i++)
+      EXPECT_EQ(expected[i], indices[i]);
+  }
+
+  // Boxes outside of the grid, or touching only a height range not seen
+  index.find(boundaries, BBox3(Vector3(-900, -900, 0), Vector3(-800, -800, 5)), indices);
+  EXPECT_TRUE(indices.empty());
+  index.find(boundaries, BBox3(Vector3(0, 0, 100), Vector3(500, 500, 200)), indices);
+  EXPECT_TRUE(indices.empty());
+
+  // No boundaries
+  BoundaryGridIndex empty_index;
+  empty_index.build(std::vector<BBoxPair>());
+  empty_index.find(boundaries, BBox3(Vector3(0, 0, 0), Vector3(500, 500, 5)), indices);
+  EXPECT_TRUE(indices.empty());
+}
@@ -0,0 +1,111 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/Point2Grid.h>
+#include <cstdlib>
+#include <cmath>
+
+using namespace vw;
+using namespace vw::stereo;
+
+namespace {
+  const int    WIDTH = 40, HEIGHT = 30;
+  const double X0 = 10, Y0 = 20, GRID = 0.5, RADIUS = 1.3;
+
+  double rand_val(double max) { return max*double(rand())/double(RAND_MAX); }
+
+  // Points over the grid and a little beyond it, each with a height
+  // and twice the height as values.
+  void make_points(int num_points, std::vector<double> & x, std::vector<double> & y,
+                   std::vector<double> & values) {
+    x.clear(); y.clear(); values.clear();
+    for (int i = 0; i < num_points; i++) {
+      x.push_back(X0 - 1 + rand_val(GRID*WIDTH  + 2));
+      y.push_back(Y0 - 1 + rand_val(GRID*HEIGHT + 2));
+      double z = rand_val(100);
+      values.push_back(z);
+      values.push_back(2*z);
+    }
+  }
+}
+
+TEST( Point2Grid, AddPoints ) {
+
+  srand(3);
+  std::vector<double> x, y, values;
+  make_points(2000, x, y, values);
+
+  // The points one by one, with one value
+  ImageView<double> buffer, weights;
+  Point2Grid grid(WIDTH, HEIGHT, buffer, weights, X0, Y0, GRID, GRID, RADIUS, 0);
+  grid.Clear(-1);
+  for (size_t i = 0; i < x.size(); i++)
+    grid.AddPoint(x[i], y[i], values[2*i]);
+  grid.normalize();
+
+  // All points at once, with two values
+  std::vector< ImageView<double> > buffers(2);
+  ImageView<double> weights2;
+  Point2Grid grid2(WIDTH, HEIGHT, buffers, weights2, X0, Y0, GRID, GRID, RADIUS, 0);
+  grid2.Clear(-1);
+  grid2.AddPoints(x.size(), &x[0], &y[0], &values[0]);
+  grid2.normalize();
+
+  // The weights as given by the Gaussian, decaying to 1/4 at the grid size
+  double sigma = log(4.0)/GRID/GRID;
+  for (int col = 0; col < WIDTH; col++) {
+    for (int row = 0; row < HEIGHT; row++) {
+      double gx = X0 + col*GRID, gy = Y0 + row*GRID;
+      double wt = 0, sum = 0;
+      int count = 0;
+      for (size_t i = 0; i < x.size(); i++) {
+        double dist2 = (x[i] - gx)*(x[i] - gx) + (y[i] - gy)*(y[i] - gy);
+        if (dist2 > RADIUS*RADIUS) continue;
+        wt  += exp(-sigma*dist2);
+        sum += exp(-sigma*dist2)*values[2*i];
+        count++;
+      }
+      EXPECT_NEAR(wt, weights(col, row), 1e-3*count);
+      if (count == 0) {
+        EXPECT_EQ(-1, buffer(col, row));
+        EXPECT_EQ(-1, buffers[1](col, row));
+        continue;
+      }
+      EXPECT_NEAR(sum/wt, buffer(col, row), 0.5);
+
+      // The order the points are added in does not matter
+      EXPECT_NEAR(weights(col, row), weights2(col, row), 1e-12*count);
+      EXPECT_NEAR(buffer(col, row), buffers[0](col, row), 1e-10);
+      EXPECT_NEAR(2*buffers[0](col, row), buffers[1](col, row), 1e-10);
+    }
+  }
+}
+
+TEST( Point2Grid, PointOnNode ) {
+
+  ImageView<double> buffer, weights;
+  Point2Grid grid(WIDTH, HEIGHT, buffer, weights, X0, Y0, GRID, GRID, RADIUS, 0);
+  grid.Clear(-1);
+  grid.AddPoint(X0 + 3*GRID, Y0 + 5*GRID, 7.5);
+  grid.normalize();
+  EXPECT_EQ(1.0, weights(3, 5));
+  EXPECT_EQ(7.5, buffer(3, 5));
+  EXPECT_NEAR(0.25, weights(4, 5), 1e-3);
+  EXPECT_EQ(0.0, weights(3 + 3, 5)); // beyond the radius
+  EXPECT_EQ(-1,  buffer(3 + 3, 5));
+}
@@ -0,0 +1,99 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/PointCloudIndex.h>
+#include <boost/filesystem/operations.hpp>
+#include <fstream>
+#include <limits>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A cloud of 40 x 20 pixels, with points only in the left half
+  ImageView<Vector4> make_points() {
+    ImageView<Vector4> points(40, 20);
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    for (int col = 0; col < points.cols(); col++)
+      for (int row = 0; row < points.rows(); row++)
+        points(col, row) = (col < 20) ? Vector4(col, -row, 0.5*col, 0.01*(col+1))
+                                      : Vector4(0, 0, nan, 0);
+    return points;
+  }
+}
+
+TEST( PointCloudIndex, AddTiles ) {
+
+  ImageView<Vector4> points = make_points();
+  PointCloudIndex index(Vector2i(40, 20), 6378137, 6356752.3);
+  EXPECT_EQ(3, index.num_blocks_x());
+  EXPECT_EQ(2, index.num_blocks_y());
+
+  // Tiles which are not aligned to the blocks
+  BBox2i tiles[2] = {BBox2i(0, 0, 23, 20), BBox2i(23, 0, 17, 20)};
+  for (int i = 0; i < 2; i++)
+    index.add_tile(tiles[i], crop(points, tiles[i]));
+
+  EXPECT_EQ(16*16, index.count(0, 0));
+  EXPECT_EQ(4*16,  index.count(1, 0));
+  EXPECT_EQ(4*4,   index.count(1, 1));
+  EXPECT_EQ(0,     index.count(2, 0));
+  EXPECT_VECTOR_NEAR(Vector3(16, -15, 8),  index.box(1, 0).min(), 1e-12);
+  EXPECT_VECTOR_NEAR(Vector3(19, 0,   9.5), index.box(1, 0).max(), 1e-12);
+  EXPECT_VECTOR_NEAR(Vector3(16, -19, 8),  index.box(1, 1).min(), 1e-12);
+
+  // Every point has a nonzero error
+  double num_errors = 0;
+  for (size_t i = 0; i < index.errors_hist().size(); i++)
+    num_errors += index.errors_hist()[i];
+  EXPECT_EQ(20*20, num_errors);
+  int bin = PointCloudIndex::hist_bin(0.05);
+  EXPECT_EQ(20, index.errors_hist()[bin]);
+  EXPECT_NEAR(0.05, PointCloudIndex::hist_bin_center(bin), 0.05*0.01);
+}
+
+TEST( PointCloudIndex, WriteRead ) {
+
+  std::string cloud_file = "PointCloudIndexTest-PC.tif";
+  EXPECT_EQ("PointCloudIndexTest-PC-index.bin", PointCloudIndex::file_name(cloud_file));
+  std::ofstream(cloud_file.c_str()) << "cloud";
+
+  ImageView<Vector4> points = make_points();
+  PointCloudIndex index(Vector2i(40, 20), 6378137, 6356752.3);
+  index.add_tile(bounding_box(points), points);
+  index.write(cloud_file);
+
+  PointCloudIndex index2;
+  EXPECT_FALSE(index2.read(cloud_file, Vector2i(41, 20))); // not for this cloud
+  ASSERT_TRUE (index2.read(cloud_file, Vector2i(40, 20)));
+  EXPECT_EQ(6378137, index2.semi_major_axis());
+  for (int bx = 0; bx < index.num_blocks_x(); bx++) {
+    for (int by = 0; by < index.num_blocks_y(); by++) {
+      EXPECT_EQ(index.count(bx, by), index2.count(bx, by));
+      if (index.count(bx, by) == 0) continue;
+      EXPECT_VECTOR_NEAR(index.box(bx, by).min(), index2.box(bx, by).min(), 0);
+      EXPECT_VECTOR_NEAR(index.box(bx, by).max(), index2.box(bx, by).max(), 0);
+    }
+  }
+  for (size_t i = 0; i < index.errors_hist().size(); i++)
+    EXPECT_EQ(index.errors_hist()[i], index2.errors_hist()[i]);
+
+  boost::filesystem::remove(PointCloudIndex::file_name(cloud_file));
+  EXPECT_FALSE(index2.read(cloud_file, Vector2i(40, 20)));
+  boost::filesystem::remove(cloud_file);
+}
@@ -18,6 +18,10 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/PointUtils.h>
+#include <boost/filesystem/operations.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 
 using namespace vw;
 using namespace asp;
@@ -128,3 +132,217 @@ TEST( PointUtils, CsvConv ) {
   
   
 }
+
+TEST( PointUtils, CsvPoints ) {
+
+  // A file with a header, comments, empty lines, a bad line, numbers
+  // written in various ways, and no newline at the end
+  std::string csv_file = "csv_points_test.csv";
+  std::vector<std::string> lines;
+  lines.push_back("# A comment");
+  lines.push_back("name, lon, lat, height");
+  srand(5);
+  for (int i = 0; i < 3000; i++) {
+    char buf[256];
+    double r = double(rand())/double(RAND_MAX);
+    snprintf(buf, sizeof(buf), "img%d.tif,\t%.17g  %.6f,%.4e,%d", i, 360*r - 180, 0.37*i - 90,
+             r*pow(10.0, i % 30 - 15), i);
+    lines.push_back(buf);
+    if (i % 500 == 0) {
+      lines.push_back("");
+      lines.push_back("#");
+    }
+  }
+  lines.push_back("img.tif, 1, abc, 3, 4");
+  lines.push_back("img.tif, -1.5E2, .5, +3, 4\r");
+  {
+    std::ofstream os(csv_file.c_str());
+    for (size_t i = 0; i < lines.size(); i++)
+      os << lines[i] << (i + 1 < lines.size() ? "\n" : "");
+  }
+
+  CsvConv conv;
+  conv.parse_csv_format("1:file 2:lon 3:lat 5:height_above_datum", "");
+
+  // Line by line
+  std::vector<CsvConv::CsvRecord> expected;
+  bool is_first_line = true, success = false;
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (!is_valid_csv_line(lines[i]))
+      continue;
+    CsvConv::CsvRecord vals = conv.parse_csv_line(is_first_line, success, lines[i]);
+    if (success)
+      expected.push_back(vals);
+  }
+  ASSERT_EQ(3001u, expected.size());
+  EXPECT_EQ(-150, expected.back().point_data[0]);
+  EXPECT_EQ(0.5,  expected.back().point_data[1]);
+  EXPECT_EQ(4,    expected.back().point_data[2]);
+  EXPECT_EQ(lines.size() - 2*6 - 1, asp::csv_file_size(csv_file));
+
+  // The numbers are as strtod() reads them
+  EXPECT_EQ(strtod(lines[2].c_str() + lines[2].find('\t') + 1, NULL), expected[0].point_data[0]);
+
+  // An exponent without digits is ignored, as by strtod()
+  const char* numbers[] = {"1e", "1e+", "2.5E-", "1e+2", "1.2345678901234567890123e"};
+  for (int i = 0; i < 5; i++) {
+    bool first = false, ok = false;
+    CsvConv::CsvRecord rec
+      = conv.parse_csv_line(first, ok, std::string("img.tif, ") + numbers[i] + ", 2, 3, 4");
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(strtod(numbers[i], NULL), rec.point_data[0]);
+  }
+
+  // All at once, and in small batches
+  CsvConv::CsvPoints points;
+  EXPECT_EQ(expected.size(), conv.read_csv_points(csv_file, points));
+  std::vector<CsvConv::CsvRecord> batched;
+  CsvFileParser parser(csv_file, conv);
+  CsvConv::CsvPoints batch;
+  while (parser.parse_next(1000, batch))
+    for (size_t i = 0; i < batch.size(); i++)
+      batched.push_back(batch.record(i));
+  ASSERT_EQ(expected.size(), points.size());
+  ASSERT_EQ(expected.size(), batched.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    CsvConv::CsvRecord rec = points.record(i);
+    EXPECT_EQ(expected[i].file, rec.file);
+    EXPECT_EQ(expected[i].file, batched[i].file);
+    for (int c = 0; c < 3; c++) {
+      EXPECT_EQ(expected[i].point_data[c], rec.point_data[c]);
+      EXPECT_EQ(expected[i].point_data[c], batched[i].point_data[c]);
+    }
+  }
+
+  boost::filesystem::remove(csv_file);
+}
+
+namespace vw {
+  template<> struct PixelFormatID<Vector<double, 4> > { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
+  template<> struct PixelFormatID<Vector<int32,  4> > { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
+}
+
+TEST( PointUtils, QuantizedPointCloud ) {
+
+  Vector3 shift(-2.1e6, 4.3e6, 4.1e6);
+  double rounding_error = 1.0/1024.0;
+
+  ImageView< Vector<double, 4> > cloud(40, 30);
+  for (int row = 0; row < cloud.rows(); row++) {
+    for (int col = 0; col < cloud.cols(); col++) {
+      Vector<double, 4> pt;
+      subvector(pt, 0, 3) = shift + Vector3(col*1.37, row*2.11, 0.3*col*row);
+      pt[3] = 0.01*col;
+      cloud(col, row) = pt;
+    }
+  }
+  cloud(5, 5) = Vector<double, 4>(); // No data
+  subvector(cloud(6, 5), 0, 3) = shift + Vector3(3e6, 0, 0); // Too far to fit
+
+  vw::cartography::GdalWriteOptions opt;
+  vw::cartography::GeoReference georef;
+  block_write_quantized_gdal_image("quantized_pc.tif", shift, rounding_error, cloud,
+                                   false, georef, opt);
+
+  ImageView< Vector<double, 4> > in_cloud = read_asp_point_cloud<4>("quantized_pc.tif");
+  ASSERT_EQ(cloud.cols(), in_cloud.cols());
+  ASSERT_EQ(cloud.rows(), in_cloud.rows());
+  EXPECT_TRUE(in_cloud(5, 5) == Vector<double, 4>());
+  EXPECT_TRUE(in_cloud(6, 5) == Vector<double, 4>());
+  for (int row = 0; row < cloud.rows(); row++) {
+    for (int col = 0; col < cloud.cols(); col++) {
+      if (row == 5 && (col == 5 || col == 6))
+        continue;
+      for (int c = 0; c < 4; c++)
+        EXPECT_NEAR(cloud(col, row)[c], in_cloud(col, row)[c], 0.5001*rounding_error);
+    }
+  }
+}
+
+TEST( PointUtils, PointScratch ) {
+
+  // A scratch file written by hand, as in PointUtils.cc: a header
+  // padded to 64 bytes, then 3 x 2 tiles of 4 x 4 points, each tile
+  // in row-major order.
+  const int tile_len = 4, cols = 12, rows = 8;
+  std::string scratch_file = "point_scratch_test.bin";
+  {
+    std::string magic = "ASP_POINT_SCRATCH 1\n";
+    std::vector<char> header(64, 0);
+    int32 sizes[3] = {cols, rows, tile_len};
+    memcpy(&header[0], magic.c_str(), magic.size());
+    memcpy(&header[magic.size()], sizes, sizeof(sizes));
+    std::ofstream os(scratch_file.c_str(), std::ios::binary);
+    os.write(&header[0], header.size());
+    for (int ty = 0; ty < rows/tile_len; ty++)
+      for (int tx = 0; tx < cols/tile_len; tx++)
+        for (int row = ty*tile_len; row < (ty + 1)*tile_len; row++)
+          for (int col = tx*tile_len; col < (tx + 1)*tile_len; col++) {
+            Vector3 pt(col, row, 100*col + row);
+            os.write(reinterpret_cast<const char*>(&pt), sizeof(pt));
+          }
+  }
+  ASSERT_TRUE(is_point_scratch(scratch_file));
+
+  ImageViewRef<Vector3> points = read_point_scratch(scratch_file);
+  ASSERT_EQ(cols, points.cols());
+  ASSERT_EQ(rows, points.rows());
+  for (int row = 0; row < rows; row++)
+    for (int col = 0; col < cols; col++)
+      EXPECT_EQ(Vector3(col, row, 100*col + row), points(col, row));
+
+  // Boxes within a tile, across tile edges, and the whole image
+  std::vector<BBox2i> boxes;
+  boxes.push_back(BBox2i(1, 1, 2, 2));
+  boxes.push_back(BBox2i(3, 2, 7, 5));
+  boxes.push_back(BBox2i(4, 4, 8, 4));
+  boxes.push_back(BBox2i(0, 0, cols, rows));
+  for (size_t b = 0; b < boxes.size(); b++) {
+    ImageView<Vector3> tile = crop(points, boxes[b]);
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        Vector2i pix = Vector2i(col, row) + boxes[b].min();
+        EXPECT_EQ(Vector3(pix[0], pix[1], 100*pix[0] + pix[1]), tile(col, row));
+      }
+    }
+  }
+  boost::filesystem::remove(scratch_file);
+
+  // Points from a CSV file go through binning and back. The heights
+  // tell which point is which.
+  std::string csv_file = "point_scratch_test.csv";
+  const int num_points = 500;
+  {
+    std::ofstream os(csv_file.c_str());
+    os << "# x y z\n";
+    for (int i = 0; i < num_points; i++)
+      os << i % 37 + 1 << " " << i / 37 + 1 << " " << i << "\n";
+  }
+  CsvConv conv;
+  conv.parse_csv_format("1:x 2:y 3:z", "");
+  vw::cartography::GeoReference georef;
+  las_or_csv_to_scratch(csv_file, scratch_file, 1, 16, georef, conv);
+
+  points = read_point_scratch(scratch_file);
+  ImageView<Vector3> all = points;
+  std::vector<int> found(num_points, 0);
+  int num_found = 0;
+  for (int row = 0; row < all.rows(); row++) {
+    for (int col = 0; col < all.cols(); col++) {
+      Vector3 pt = all(col, row);
+      if (pt == Vector3())
+        continue; // No point here
+      int i = int(pt[2]);
+      ASSERT_TRUE(i >= 0 && i < num_points);
+      EXPECT_EQ(Vector3(i % 37 + 1, i / 37 + 1, i), pt);
+      found[i]++;
+      num_found++;
+    }
+  }
+  EXPECT_EQ(num_points, num_found);
+  for (int i = 0; i < num_points; i++)
+    EXPECT_EQ(1, found[i]);
+
+  boost::filesystem::remove(csv_file);
+  boost::filesystem::remove(scratch_file);
+}
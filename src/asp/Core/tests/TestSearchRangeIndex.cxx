@@ -0,0 +1,165 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/SearchRangeIndex.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( SearchRangeIndex, Lookup ) {
+
+  // A 2500 x 1500 image split into 1024 tiles gives a 3 x 2 grid.
+  SearchRangeIndex index(1024, Vector2i(2500, 1500), Vector2i(250, 150), false, false);
+  EXPECT_EQ(3, index.cols());
+  EXPECT_EQ(2, index.rows());
+  EXPECT_EQ(BBox2i(2048, 1024, 452, 476), index.cell_bbox(2, 1));
+
+  index.set(0, 0, BBox2i(Vector2i(-5, -1), Vector2i(3, 2)), true);
+  index.set(1, 0, BBox2i(Vector2i(-2, -3), Vector2i(7, 1)), true);
+  index.set(0, 1, BBox2i(Vector2i(-50, -50), Vector2i(50, 50)), false);
+
+  BBox2i range;
+  EXPECT_TRUE(index.lookup(BBox2i(0, 0, 1024, 1024), range));
+  EXPECT_EQ(BBox2i(Vector2i(-5, -1), Vector2i(3, 2)), range);
+
+  // A tile straddling the first two cells gets the union of their ranges,
+  // which is not exact, as is_single_cell() tells.
+  EXPECT_TRUE(index.lookup(BBox2i(1000, 0, 100, 100), range));
+  EXPECT_EQ(BBox2i(Vector2i(-5, -3), Vector2i(7, 2)), range);
+
+  // Invalid cells are skipped.
+  EXPECT_TRUE(index.lookup(BBox2i(0, 1000, 100, 100), range));
+  EXPECT_EQ(BBox2i(Vector2i(-5, -1), Vector2i(3, 2)), range);
+  EXPECT_FALSE(index.lookup(BBox2i(0, 1100, 100, 100), range));
+
+  EXPECT_TRUE (index.is_single_cell(BBox2i(1024, 0, 1024, 1024)));
+  EXPECT_FALSE(index.is_single_cell(BBox2i(1000, 0, 100, 100)));
+}
+
+TEST( SearchRangeIndex, ReadWrite ) {
+
+  SearchRangeIndex index(512, Vector2i(1000, 600), Vector2i(100, 60), true, true);
+  index.set(1, 1, BBox2i(Vector2i(-4, 2), Vector2i(8, 9)), true);
+  index.set_input_hash(0x0123456789abcdefULL);
+  index.write("search_range_index.bin");
+
+  SearchRangeIndex index2;
+  EXPECT_TRUE(index2.empty());
+  index2.read("search_range_index.bin");
+  EXPECT_TRUE(index2.is_compatible(512, Vector2i(1000, 600), Vector2i(100, 60), true, true));
+  EXPECT_FALSE(index2.is_compatible(512, Vector2i(1000, 600), Vector2i(100, 60), false, true));
+  EXPECT_EQ(0x0123456789abcdefULL, index2.input_hash());
+
+  BBox2i range;
+  EXPECT_TRUE (index2.get(1, 1, range));
+  EXPECT_EQ(BBox2i(Vector2i(-4, 2), Vector2i(8, 9)), range);
+  EXPECT_FALSE(index2.get(0, 1, range));
+}
+
+TEST( SearchRangeIndex, FromPoints ) {
+
+  // Points in the left half of a 200 x 100 image have a disparity of
+  // about 10, and in the right half of about -20.
+  std::vector<Vector2> points, disparities;
+  for (int i = 0; i < 10; i++){
+    points.push_back(Vector2(5 + 2*i, 10 + 8*i));
+    disparities.push_back(Vector2(10 + (i % 2), 0));
+    points.push_back(Vector2(180 + i, 10 + 8*i));
+    disparities.push_back(Vector2(-20 - (i % 3), 1));
+  }
+
+  SearchRangeIndex index;
+  compute_search_range_index_from_points(points, disparities, Vector2i(200, 100),
+                                         50, 3, 0.0, 2, 1.5, index);
+  EXPECT_EQ(4, index.cols());
+  EXPECT_EQ(2, index.rows());
+  EXPECT_TRUE(index.is_compatible(50, Vector2i(200, 100), Vector2i(200, 100), false, false));
+
+  // The first and last columns see only their own points, while the
+  // middle ones, which have none nearby, see the closest ones.
+  BBox2i range;
+  EXPECT_TRUE(index.get(0, 0, range));
+  EXPECT_EQ(BBox2i(Vector2i(8, -2), Vector2i(13, 2)), range);
+  EXPECT_TRUE(index.get(3, 1, range));
+  EXPECT_EQ(BBox2i(Vector2i(-24, -1), Vector2i(-18, 3)), range);
+  EXPECT_TRUE(index.get(2, 0, range));
+  EXPECT_TRUE(range.contains(Vector2i(-20, 1)));
+
+  // No points, no valid cells.
+  compute_search_range_index_from_points(std::vector<Vector2>(), std::vector<Vector2>(),
+                                         Vector2i(200, 100), 50, 3, 0.0, 2, 1.5, index);
+  EXPECT_FALSE(index.get(0, 0, range));
+}
+
+TEST( SearchRangeIndex, FromPointsWithOutlier ) {
+
+  // Twenty points in a 100 x 100 image with a disparity of 5 to 9 in x
+  // and -1 to 1 in y, and one wrong match with a disparity of 300 in x.
+  std::vector<Vector2> points, disparities;
+  for (int i = 0; i < 20; i++){
+    points.push_back(Vector2(5*i, 5*i));
+    disparities.push_back(Vector2(5 + (i % 5), (i % 3) - 1));
+  }
+  points.push_back(Vector2(50, 50));
+  disparities.push_back(Vector2(300, 0));
+
+  // The wrong match does not widen the range.
+  SearchRangeIndex index;
+  BBox2i range;
+  compute_search_range_index_from_points(points, disparities, Vector2i(100, 100),
+                                         100, 3, 0.0, 2, 1.5, index);
+  EXPECT_TRUE(index.get(0, 0, range));
+  EXPECT_EQ(BBox2i(Vector2i(3, -3), Vector2i(11, 3)), range);
+
+  // Without the clip it does.
+  compute_search_range_index_from_points(points, disparities, Vector2i(100, 100),
+                                         100, 3, 0.0, 2, 0.0, index);
+  EXPECT_TRUE(index.get(0, 0, range));
+  EXPECT_EQ(BBox2i(Vector2i(3, -3), Vector2i(302, 3)), range);
+
+  // Two groups of disparities, as across a cliff, are both kept.
+  std::vector<size_t> indices;
+  std::vector<Vector2> cliff;
+  for (int i = 0; i < 10; i++){
+    cliff.push_back(Vector2(i < 6 ? 10 : 60, 0));
+    indices.push_back(i);
+  }
+  EXPECT_EQ(BBox2(Vector2(10, 0), Vector2(60, 0)),
+            robust_disparity_range(cliff, indices, 1.5));
+}
+
+TEST( SearchRangeIndex, LowresSearchRange ) {
+
+  ImageView<PixelMask<Vector2f> > sub_disp(10, 10);
+  fill(sub_disp, PixelMask<Vector2f>(Vector2f(3, -1)));
+  ImageView<PixelMask<Vector2i> > spread(10, 10);
+  fill(spread, PixelMask<Vector2i>(Vector2i(1, 2)));
+  Matrix<double> hom = math::identity_matrix<3>();
+
+  BBox2i range;
+  EXPECT_TRUE(lowres_search_range(sub_disp, spread, hom, false, BBox2i(0, 0, 5, 5), range));
+  EXPECT_TRUE(range.contains(Vector2i(3, -1)));
+
+  // D_sub_spread must be as large as D_sub in both directions
+  ImageView<PixelMask<Vector2i> > short_spread(10, 8), narrow_spread(8, 10);
+  EXPECT_THROW(lowres_search_range(sub_disp, short_spread, hom, false,
+                                   BBox2i(0, 0, 5, 5), range), ArgumentErr);
+  EXPECT_THROW(lowres_search_range(sub_disp, narrow_spread, hom, false,
+                                   BBox2i(0, 0, 5, 5), range), ArgumentErr);
+}
@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/StageInstrumentation.h>
+#include <vw/FileIO.h>
+#include <fstream>
+
+using namespace vw;
+using namespace asp;
+
+TEST( StageInstrumentation, JsonString ) {
+  EXPECT_EQ("\"abc\"", json_string("abc"));
+  EXPECT_EQ("\"a\\\"b\\\\c\\n\"", json_string("a\"b\\c\n"));
+  EXPECT_EQ("\"\\u0001\"", json_string("\x01"));
+}
+
+TEST( StageInstrumentation, Record ) {
+
+  StageInstrumentation& record = stage_instrumentation();
+  EXPECT_FALSE(record.is_started());
+
+  // Nothing is recorded until the stage is started
+  ImageView<float> image(20, 10);
+  ImageView<float> result(20, 10);
+  result = timed_tile_view(image);
+  EXPECT_EQ(0u, record.num_tiles());
+
+  record.start("test", "instrumentation");
+  EXPECT_TRUE(record.is_started());
+
+  // Each tile written through the view is timed
+  for (int col = 0; col < 20; col += 10)
+    crop(result, BBox2i(col, 0, 10, 10))
+      = crop(timed_tile_view(image), BBox2i(col, 0, 10, 10));
+  EXPECT_EQ(2u, record.num_tiles());
+
+  // The bytes read through an instrumented view are counted, once
+  std::string image_file = "instrumentation-test-image.tif";
+  write_image(image_file, image);
+  ImageView<float> read_back = instrumented_disk_image_view<float>(image_file);
+  EXPECT_EQ(20, read_back.cols());
+
+  record.end_phase("first");
+  record.add_output_file(image_file);
+  record.write();
+
+  std::ifstream ifs("instrumentation-test-instrumentation.json");
+  std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  EXPECT_NE(std::string::npos, text.find("\"stage\": \"test\""));
+  EXPECT_NE(std::string::npos, text.find("\"name\": \"first\""));
+  EXPECT_NE(std::string::npos, text.find("\"x\": 10, \"y\": 0, \"width\": 10, \"height\": 10"));
+  EXPECT_NE(std::string::npos, text.find("\"thread_utilization\""));
+  EXPECT_NE(std::string::npos, text.find("{\"file\": \"" + image_file + "\", \"size\": "));
+  EXPECT_NE(std::string::npos, text.find("\"bytes_read\": 800}"));
+  EXPECT_NE(std::string::npos, text.find("\"bytes_written\": 800}"));
+}
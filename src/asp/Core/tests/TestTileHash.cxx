@@ -0,0 +1,120 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/TileHash.h>
+#include <boost/filesystem/operations.hpp>
+#include <fstream>
+
+namespace fs = boost::filesystem;
+
+using namespace vw;
+using namespace asp;
+
+TEST( TileHash, ContentHash ) {
+
+  ImageView<float> image(4, 3);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      image(col, row) = col + 10*row;
+
+  ContentHash h1, h2;
+  h1.add_image(image);
+  h2.add_image(copy(image));
+  EXPECT_EQ(h1.value(), h2.value());
+
+  // A changed pixel or an extra value changes the hash.
+  image(2, 1) += 1;
+  ContentHash h3;
+  h3.add_image(image);
+  EXPECT_NE(h1.value(), h3.value());
+
+  h2.add_value(5);
+  EXPECT_NE(h1.value(), h2.value());
+}
+
+TEST( TileHash, ReadWrite ) {
+
+  TileHashTable table(Vector2i(3000, 2000));
+  table.set(BBox2i(0,    0, 1024, 1024), 12345678901234567890ULL);
+  table.set(BBox2i(2048, 1024, 952, 976), 42);
+  table.write("tile_hashes.txt");
+
+  TileHashTable table2;
+  table2.read("tile_hashes.txt");
+  EXPECT_EQ(Vector2i(3000, 2000), table2.image_size());
+  EXPECT_EQ(2u, table2.size());
+
+  uint64 hash = 0;
+  EXPECT_TRUE(table2.get(BBox2i(0, 0, 1024, 1024), hash));
+  EXPECT_EQ(12345678901234567890ULL, hash);
+  EXPECT_TRUE(table2.get(BBox2i(2048, 1024, 952, 976), hash));
+  EXPECT_EQ(42u, hash);
+  EXPECT_FALSE(table2.get(BBox2i(1024, 0, 1024, 1024), hash));
+
+  table2.set(BBox2i(2048, 1024, 952, 976), 43);
+  table2.set(BBox2i(1024, 0, 1024, 1024), 7);
+  EXPECT_EQ(1u, table.count_equal(table2));
+}
+
+void write_text(std::string const& file, std::string const& text) {
+  std::ofstream fh(file.c_str());
+  fh << text;
+}
+
+TEST( TileHash, PreviousTileOutput ) {
+
+  // The layout of a parallel_stereo tile directory after correlation
+  fs::remove_all("tile_hash_run");
+  fs::create_directories("tile_hash_run/tile");
+  write_text("tile_hash_run/tile/run-Dnosym.tif", "tile");
+  write_text("tile_hash_run/run-D.vrt", "mosaic");
+  std::string prefix = "tile_hash_run/tile/run";
+  EXPECT_EQ("", previous_tile_output(prefix, "-D.tif", "-Dnosym.tif"));
+  fs::create_symlink("../run-D.vrt", prefix + "-D.tif");
+  EXPECT_EQ(prefix + "-Dnosym.tif", previous_tile_output(prefix, "-D.tif", "-Dnosym.tif"));
+
+  // A run of stereo_corr alone writes D.tif in place of the link.
+  fs::remove(prefix + "-D.tif");
+  write_text(prefix + "-D.tif", "tile");
+  EXPECT_EQ(prefix + "-D.tif", previous_tile_output(prefix, "-D.tif", "-Dnosym.tif"));
+
+  // A link without the renamed file is not the output of this tile.
+  fs::remove(prefix + "-D.tif");
+  fs::remove(prefix + "-Dnosym.tif");
+  fs::create_symlink("../run-D.vrt", prefix + "-D.tif");
+  EXPECT_EQ("", previous_tile_output(prefix, "-D.tif", "-Dnosym.tif"));
+  fs::remove_all("tile_hash_run");
+}
+
+TEST( TileHash, ContentHashFile ) {
+
+  write_text("tile_hash_file.txt", "abc");
+  ContentHash h1, h2, h3, h4;
+  h1.add_file("tile_hash_file.txt");
+  h2.add_file("tile_hash_file.txt");
+  EXPECT_EQ(h1.value(), h2.value());
+
+  // Same size but other content, and a missing file, differ.
+  write_text("tile_hash_file.txt", "abd");
+  h3.add_file("tile_hash_file.txt");
+  EXPECT_NE(h1.value(), h3.value());
+  fs::remove("tile_hash_file.txt");
+  h4.add_file("tile_hash_file.txt");
+  EXPECT_NE(h1.value(), h4.value());
+}
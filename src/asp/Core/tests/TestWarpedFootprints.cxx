@@ -0,0 +1,124 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/WarpedFootprints.h>
+#include <vw/Image/Filter.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Image/Transform.h>
+#include <vw/Image/UtilityViews.h>
+#include <vw/Stereo/CorrelationView.h>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+using namespace vw;
+using namespace asp;
+
+TEST( WarpedFootprints, FileName ) {
+
+  Vector2i cell(3, -1);
+  BBox2i footprint(-20, 512, 1300, 900);
+  std::string name = WarpedFootprintStore::file_name(cell, footprint);
+  EXPECT_EQ("cell_3_-1_box_-20_512_1300_900.tif", name);
+
+  Vector2i cell2;
+  BBox2i footprint2;
+  ASSERT_TRUE(WarpedFootprintStore::parse_file_name(name, cell2, footprint2));
+  EXPECT_EQ(cell, cell2);
+  EXPECT_EQ(footprint, footprint2);
+
+  // Files still being written, or not footprints at all
+  EXPECT_FALSE(WarpedFootprintStore::parse_file_name(name + ".tmp.tif", cell2, footprint2));
+  EXPECT_FALSE(WarpedFootprintStore::parse_file_name("cell_3_-1_box_0_0_0_9.tif",
+                                                     cell2, footprint2));
+  EXPECT_FALSE(WarpedFootprintStore::parse_file_name("run-D.tif", cell2, footprint2));
+}
+
+// Correlating a tile against the warped footprint alone must give the
+// same disparity, exactly, as against the lazily warped whole image.
+TEST( WarpedFootprints, SameDisparityAsLazyWarp ) {
+
+  typedef PixelGray<float> PixelT;
+  const int size = 256;
+  ImageView<PixelT> noise(size, size);
+  boost::random::mt19937 gen(42);
+  boost::random::uniform_real_distribution<float> dist(0.0, 1.0);
+  for (int row = 0; row < size; row++)
+    for (int col = 0; col < size; col++)
+      noise(col, row) = dist(gen);
+  ImageView<PixelT> left  = gaussian_filter(noise, 1.0);
+  ImageView<PixelT> right = translate(left, 3.0, 1.0, ZeroEdgeExtension(),
+                                      BilinearInterpolation());
+  ImageView<uint8> left_mask  = constant_view(uint8(255), size, size);
+  ImageView<uint8> right_mask = constant_view(uint8(255), size, size);
+
+  Matrix3x3 hom;
+  hom.set_identity();
+  hom(0, 1) = 0.01;  hom(0, 2) = -1.5;
+  hom(1, 0) = 0.005; hom(1, 2) = 0.5;
+
+  const Vector2i kernel_size(9, 9);
+  const int max_levels = 2;
+  BBox2i bbox(128, 128, 64, 64);
+  BBox2i search_range(-4, -4, 10, 8);
+  BBox2f search_range_f(-4, -4, 10, 8);
+  BBox2i footprint
+    = correlation_footprint(bbox, search_range_f,
+                            correlation_footprint_margin(kernel_size, max_levels, 0),
+                            bounding_box(left));
+  // Else this would not test anything
+  ASSERT_FALSE(footprint.contains(bounding_box(left)));
+
+  ImageViewRef<PixelMask<PixelT> > lazy
+    = transform(copy_mask(right, create_mask(right_mask)), HomographyTransform(hom),
+                size, size);
+  ImageView<PixelMask<PixelT> > warped_footprint = crop(lazy, footprint);
+  ImageViewRef<PixelMask<PixelT> > from_footprint
+    = footprint_in_image(warped_footprint, footprint, size, size);
+
+  const int rm_half_kernel = 5;
+  ImageView<PixelMask<Vector2f> > disp[2];
+  ImageViewRef<PixelMask<PixelT> > right_images[2] = {lazy, from_footprint};
+  for (int i = 0; i < 2; i++) {
+    ImageViewRef<PixelT> right_img  = apply_mask(right_images[i]);
+    ImageViewRef<uint8>  right_msk
+      = channel_cast_rescale<uint8>(select_channel(right_images[i], 1));
+    disp[i] = crop(stereo::pyramid_correlate(left, right_img, left_mask, right_msk,
+                                             stereo::PREFILTER_LOG, 1.4,
+                                             search_range, kernel_size,
+                                             stereo::CROSS_CORRELATION,
+                                             0, 0.0, 2.0, rm_half_kernel,
+                                             max_levels, stereo::CORRELATION_WINDOW,
+                                             0, 0, false),
+                   bbox);
+  }
+
+  int num_valid = 0;
+  for (int row = 0; row < bbox.height(); row++) {
+    for (int col = 0; col < bbox.width(); col++) {
+      ASSERT_EQ(is_valid(disp[0](col, row)), is_valid(disp[1](col, row)));
+      if (!is_valid(disp[0](col, row)))
+        continue;
+      num_valid++;
+      EXPECT_EQ(disp[0](col, row).child()[0], disp[1](col, row).child()[0]);
+      EXPECT_EQ(disp[0](col, row).child()[1], disp[1](col, row).child()[1]);
+    }
+  }
+  EXPECT_GT(num_valid, bbox.width() * bbox.height() / 2);
+}
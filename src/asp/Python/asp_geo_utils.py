@@ -94,6 +94,13 @@ def getImageGeoInfo(imagePath, getStats=True):
     except:
         pass # In most cases this line will not be present
 
+    # And the scale, for point clouds saved as integers
+    try:
+        pointScaleLine = asp_string_utils.getLineAfterText(textOutput, 'POINT_SCALE=') # Tag name must be synced with C++ code
+        outputDict['point_scale'] = float(pointScaleLine.split(' ')[0])
+    except:
+        pass
+
     # TODO: Currently this does not find much information, and there
     #       is another function in image_utils dedicated to returning statistics.
     if getStats:
@@ -420,10 +427,18 @@ def build_vrt( fullImageSize, tileLocs, tilePaths, outputPath ):
     num_bands = len(gdalInfo['band_info'])
     data_type = gdalInfo['band_info'][0]['type']
 
-    # This special metadata value is only used for ASP stereo point cloud files!    
+    # These special metadata values are only used for ASP stereo point cloud files!
+    # Without the scale, a cloud saved as integers would be read unscaled.
+    tags = []
     if 'point_offset' in gdalInfo:
-        f.write("  <Metadata>\n    <MDI key=\"" + 'POINT_OFFSET' + "\">" +
-                gdalInfo['point_offset'][0] + "</MDI>\n  </Metadata>\n")
+        tags.append(('POINT_OFFSET', ' '.join(['%.17g' % v for v in gdalInfo['point_offset']])))
+    if 'point_scale' in gdalInfo:
+        tags.append(('POINT_SCALE', '%.17g' % gdalInfo['point_scale']))
+    if len(tags) > 0:
+        f.write("  <Metadata>\n")
+        for (key, value) in tags:
+            f.write("    <MDI key=\"" + key + "\">" + value + "</MDI>\n")
+        f.write("  </Metadata>\n")
       
 
     # Write each band
@@ -0,0 +1,413 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file corr_bench.cc
+///
+/// Measure the throughput of the integer correlator on its own, without
+/// a full stereo run. Each combination of cost function, correlation
+/// algorithm, and kernel size is run on a synthetic image pair with a
+/// known shift, and on any image pairs given on the command line, at a
+/// fixed search range. For each run we report Mpix/s, the peak resident
+/// memory, and the time taken for each number of pyramid levels.
+
+#include <vw/Core/Stopwatch.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Filter.h>
+#include <vw/Image/Transform.h>
+#include <vw/Image/UtilityViews.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Stereo/Correlation.h>
+#include <vw/Stereo/CorrelationView.h>
+#include <vw/Stereo/DisparityMap.h>
+
+#include <asp/Core/Common.h>
+#include <asp/Core/Macros.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <sys/resource.h>
+#include <fstream>
+#include <iomanip>
+
+using namespace vw;
+
+namespace po = boost::program_options;
+
+typedef ImageViewRef<PixelGray<float> > ImageT;
+typedef ImageViewRef<uint8>             MaskT;
+
+struct Options : vw::cartography::GdalWriteOptions {
+  std::vector<std::string> image_files;
+  std::string cost_modes_str, algorithms_str, kernel_sizes_str, output_file;
+  std::vector<int> cost_modes, algorithms, kernel_sizes;
+  BBox2i   search_range;
+  Vector2  synthetic_shift;
+  int      synthetic_size, max_levels;
+  double   prefilter_kernel_width, xcorr_threshold;
+  bool     skip_synthetic, skip_level_timing;
+};
+
+/// An image pair to run the correlator on.
+struct BenchPair {
+  std::string name;
+  ImageT left, right;
+  MaskT  left_mask, right_mask;
+  bool   has_truth; // If the disparity is known everywhere
+  Vector2 truth;
+};
+
+/// The outcome of running one configuration on one pair.
+struct BenchResult {
+  double seconds, mpix_per_sec, peak_rss_mb, valid_frac, correct_frac;
+  std::vector<double> level_seconds; // Time using 0, 1, ..., max_levels levels
+};
+
+std::vector<int> parse_int_list(std::string const& str, std::string const& option) {
+  std::vector<std::string> tokens;
+  boost::split(tokens, str, boost::is_any_of(", "), boost::token_compress_on);
+  std::vector<int> vals;
+  for (size_t i = 0; i < tokens.size(); i++) {
+    if (tokens[i].empty())
+      continue;
+    try {
+      vals.push_back(boost::lexical_cast<int>(tokens[i]));
+    } catch (boost::bad_lexical_cast const&) {
+      vw_throw(ArgumentErr() << "Invalid value for --" << option << ": " << str << "\n");
+    }
+  }
+  if (vals.empty())
+    vw_throw(ArgumentErr() << "No values given for --" << option << ".\n");
+  return vals;
+}
+
+void handle_arguments(int argc, char *argv[], Options& opt) {
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("cost-modes",      po::value(&opt.cost_modes_str)->default_value("0,1,2,3,4"),
+     "Cost functions to benchmark, as in stereo's --cost-mode [0 Absolute, 1 Squared, 2 Normalized Cross Correlation, 3 Census Transform, 4 Ternary Census Transform]. The census modes are run only with SGM and MGM, and with kernel sizes 3 to 9.")
+    ("stereo-algorithms", po::value(&opt.algorithms_str)->default_value("0,1,2"),
+     "Correlation algorithms to benchmark, as in stereo's --stereo-algorithm [0=local window, 1=SGM, 2=Smooth SGM].")
+    ("kernel-sizes",    po::value(&opt.kernel_sizes_str)->default_value("5,9,21"),
+     "Square correlation kernel sizes to benchmark.")
+    ("corr-search",     po::value(&opt.search_range)->default_value(BBox2i(-32,-4,64,8), "-32 -4 32 4"),
+     "The fixed disparity search range. Specify in format: hmin vmin hmax vmax.")
+    ("corr-max-levels", po::value(&opt.max_levels)->default_value(5),
+     "Max pyramid levels to use (0 is just a single level).")
+    ("prefilter-kernel-width", po::value(&opt.prefilter_kernel_width)->default_value(1.5),
+     "Sigma value for the LoG prefilter.")
+    ("xcorr-threshold", po::value(&opt.xcorr_threshold)->default_value(2),
+     "L-R vs R-L agreement threshold in pixels.")
+    ("synthetic-size",  po::value(&opt.synthetic_size)->default_value(1024),
+     "Width and height of the synthetic image pair.")
+    ("synthetic-shift", po::value(&opt.synthetic_shift)->default_value(Vector2(12.3, -1.6), "12.3 -1.6"),
+     "Shift of the right synthetic image relative to the left one.")
+    ("skip-synthetic",  po::bool_switch(&opt.skip_synthetic)->default_value(false)->implicit_value(true),
+     "Do not benchmark the synthetic image pair.")
+    ("skip-level-timing", po::bool_switch(&opt.skip_level_timing)->default_value(false)->implicit_value(true),
+     "Do not time each number of pyramid levels separately. This makes the benchmark much faster.")
+    ("output-file,o",   po::value(&opt.output_file)->default_value(""),
+     "Also save the results to this CSV file.");
+  general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
+
+  po::options_description positional("");
+  positional.add_options()
+    ("image-files", po::value(&opt.image_files));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("image-files", -1);
+
+  std::string usage("[options] [<left image 1> <right image 1> ...]");
+  bool allow_unregistered = false;
+  std::vector<std::string> unregistered;
+  po::variables_map vm =
+    asp::check_command_line( argc, argv, opt, general_options, general_options,
+                             positional, positional_desc, usage,
+                             allow_unregistered, unregistered );
+
+  if (opt.image_files.size() % 2 != 0)
+    vw_throw( ArgumentErr() << "Expecting an even number of images, forming left-right pairs.\n"
+              << usage << general_options );
+  if (opt.skip_synthetic && opt.image_files.empty())
+    vw_throw( ArgumentErr() << "Nothing to benchmark.\n" << usage << general_options );
+  if (opt.synthetic_size <= 0 || opt.max_levels < 0)
+    vw_throw( ArgumentErr() << "The synthetic image size must be positive "
+              << "and the number of levels non-negative.\n" );
+
+  opt.cost_modes   = parse_int_list(opt.cost_modes_str,   "cost-modes");
+  opt.algorithms   = parse_int_list(opt.algorithms_str,   "stereo-algorithms");
+  opt.kernel_sizes = parse_int_list(opt.kernel_sizes_str, "kernel-sizes");
+  for (size_t i = 0; i < opt.cost_modes.size(); i++)
+    if (opt.cost_modes[i] < 0 || opt.cost_modes[i] > 4)
+      vw_throw( ArgumentErr() << "Unknown cost mode: " << opt.cost_modes[i] << ".\n" );
+  for (size_t i = 0; i < opt.algorithms.size(); i++)
+    if (opt.algorithms[i] < 0 || opt.algorithms[i] > 2)
+      vw_throw( ArgumentErr() << "Unknown stereo algorithm: " << opt.algorithms[i] << ".\n" );
+  for (size_t i = 0; i < opt.kernel_sizes.size(); i++)
+    if (opt.kernel_sizes[i] <= 0 || opt.kernel_sizes[i] % 2 == 0)
+      vw_throw( ArgumentErr() << "Kernel sizes must be positive and odd.\n" );
+}
+
+stereo::CostFunctionType cost_mode_value(int cost_mode) {
+  switch(cost_mode){
+    case 0:  return stereo::ABSOLUTE_DIFFERENCE;
+    case 1:  return stereo::SQUARED_DIFFERENCE;
+    case 2:  return stereo::CROSS_CORRELATION;
+    case 3:  return stereo::CENSUS_TRANSFORM;
+    default: return stereo::TERNARY_CENSUS_TRANSFORM;
+  }
+}
+
+/// Whether the correlator supports this combination. If not, the
+/// reason is returned.
+bool is_supported(int cost_mode, int algorithm, int kernel_size, std::string & reason) {
+  if (cost_mode >= 3 && algorithm == 0) {
+    reason = "the census costs are supported by SGM and MGM only";
+    return false;
+  }
+  if (cost_mode >= 3 && (kernel_size < 3 || kernel_size > 9)) {
+    reason = "the census costs support kernel sizes 3, 5, 7, and 9 only";
+    return false;
+  }
+  return true;
+}
+
+/// Reset the peak resident memory of this process, so that each run
+/// reports its own peak. This works on Linux only, elsewhere the peak
+/// is over the lifetime of the process.
+void reset_peak_rss() {
+  std::ofstream ofs("/proc/self/clear_refs");
+  if (ofs)
+    ofs << "5";
+}
+
+/// Peak resident memory, in MB.
+double peak_rss_mb() {
+  std::ifstream ifs("/proc/self/status");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return atof(line.c_str() + 6) / 1024.0; // The value is in kB
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes
+#else
+  return usage.ru_maxrss / 1024.0; // kB
+#endif
+}
+
+/// A textured image and a copy of it shifted by a known amount.
+BenchPair synthetic_pair(int size, Vector2 const& shift) {
+
+  ImageView<PixelGray<float> > noise(size, size);
+  boost::random::mt19937 gen(42); // Fixed seed, so runs are comparable
+  boost::random::uniform_real_distribution<float> dist(0.0, 1.0);
+  for (int row = 0; row < size; row++)
+    for (int col = 0; col < size; col++)
+      noise(col, row) = dist(gen);
+
+  ImageView<PixelGray<float> > left = gaussian_filter(noise, 1.0);
+
+  // The right image at pixel p + shift equals the left image at p.
+  ImageView<PixelGray<float> > right =
+    translate(left, shift.x(), shift.y(), ZeroEdgeExtension(), BilinearInterpolation());
+
+  BenchPair pair;
+  pair.name       = "synthetic";
+  pair.left       = left;
+  pair.right      = right;
+  pair.left_mask  = constant_view(uint8(255), size, size);
+  pair.right_mask = constant_view(uint8(255), size, size);
+  pair.has_truth  = true;
+  pair.truth      = shift;
+  return pair;
+}
+
+/// Load an image pair from disk into memory, so that file reading is
+/// not part of the timing.
+BenchPair disk_pair(std::string const& left_file, std::string const& right_file) {
+  BenchPair pair;
+  pair.name = left_file + " " + right_file;
+
+  ImageView<PixelGray<float> > left  = DiskImageView<PixelGray<float> >(left_file);
+  ImageView<PixelGray<float> > right = DiskImageView<PixelGray<float> >(right_file);
+  pair.left       = left;
+  pair.right      = right;
+  pair.left_mask  = constant_view(uint8(255), left.cols(),  left.rows());
+  pair.right_mask = constant_view(uint8(255), right.cols(), right.rows());
+  pair.has_truth  = false;
+  return pair;
+}
+
+/// Correlate the whole pair in one go, as one tile on one thread,
+/// returning the elapsed time.
+double time_correlation(Options const& opt, BenchPair const& pair,
+                        stereo::CostFunctionType cost_mode,
+                        stereo::CorrelationAlgorithm algorithm,
+                        int kernel_size, int max_levels,
+                        ImageView<PixelMask<Vector2f> > & disp) {
+  const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+  Stopwatch sw;
+  sw.start();
+  disp = stereo::pyramid_correlate(pair.left, pair.right,
+                                   pair.left_mask, pair.right_mask,
+                                   stereo::PREFILTER_LOG, opt.prefilter_kernel_width,
+                                   opt.search_range, Vector2i(kernel_size, kernel_size),
+                                   cost_mode,
+                                   0, 0.0, // No timeout
+                                   opt.xcorr_threshold, rm_half_kernel,
+                                   max_levels, algorithm,
+                                   0, // No collar, the whole image is one tile
+                                   0, // No blob filtering
+                                   false);
+  sw.stop();
+  return sw.elapsed_seconds();
+}
+
+BenchResult run_benchmark(Options const& opt, BenchPair const& pair,
+                          stereo::CostFunctionType cost_mode,
+                          stereo::CorrelationAlgorithm algorithm,
+                          int kernel_size) {
+  BenchResult result;
+  ImageView<PixelMask<Vector2f> > disp;
+
+  if (!opt.skip_level_timing) {
+    for (int level = 0; level < opt.max_levels; level++)
+      result.level_seconds.push_back(time_correlation(opt, pair, cost_mode, algorithm,
+                                                      kernel_size, level, disp));
+  }
+
+  // The main run, with all levels
+  disp = ImageView<PixelMask<Vector2f> >(); // Don't count the previous result
+  reset_peak_rss();
+  result.seconds     = time_correlation(opt, pair, cost_mode, algorithm,
+                                        kernel_size, opt.max_levels, disp);
+  result.peak_rss_mb = peak_rss_mb();
+  if (!opt.skip_level_timing)
+    result.level_seconds.push_back(result.seconds);
+
+  double num_pixels = double(pair.left.cols()) * pair.left.rows();
+  result.mpix_per_sec = result.seconds > 0 ? num_pixels / 1e6 / result.seconds : 0.0;
+
+  // Validity, and accuracy when the answer is known
+  size_t num_valid = 0, num_correct = 0;
+  for (int row = 0; row < disp.rows(); row++) {
+    for (int col = 0; col < disp.cols(); col++) {
+      if (!is_valid(disp(col, row)))
+        continue;
+      num_valid++;
+      if (pair.has_truth && norm_2(Vector2(disp(col, row).child()) - pair.truth) <= 1.0)
+        num_correct++;
+    }
+  }
+  result.valid_frac   = num_valid / num_pixels;
+  result.correct_frac = (pair.has_truth && num_valid > 0) ? double(num_correct) / num_valid : -1.0;
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+
+  Options opt;
+  try {
+    handle_arguments(argc, argv, opt);
+
+    std::vector<BenchPair> pairs;
+    if (!opt.skip_synthetic)
+      pairs.push_back(synthetic_pair(opt.synthetic_size, opt.synthetic_shift));
+    for (size_t i = 0; i + 1 < opt.image_files.size(); i += 2)
+      pairs.push_back(disk_pair(opt.image_files[i], opt.image_files[i+1]));
+
+    boost::scoped_ptr<std::ofstream> csv;
+    if (opt.output_file != "") {
+      csv.reset(new std::ofstream(opt.output_file.c_str()));
+      if (!csv->good())
+        vw_throw( IOErr() << "Could not open for writing: " << opt.output_file << "\n" );
+      *csv << "# pair, cost_mode, stereo_algorithm, kernel_size, seconds, mpix_per_sec, "
+           << "peak_rss_mb, valid_fraction, correct_fraction, seconds_by_max_levels\n";
+    }
+
+    // Each pair is one tile, done on one thread, so the timings are not
+    // the throughput of stereo_corr with several threads.
+    vw_out() << "Search range: " << opt.search_range
+             << ", each pair correlated as one tile on one thread\n";
+
+    // Say up front which combinations will be skipped
+    for (size_t a = 0; a < opt.algorithms.size(); a++) {
+      for (size_t c = 0; c < opt.cost_modes.size(); c++) {
+        for (size_t k = 0; k < opt.kernel_sizes.size(); k++) {
+          std::string reason;
+          if (!is_supported(opt.cost_modes[c], opt.algorithms[a], opt.kernel_sizes[k], reason))
+            vw_out() << "Skipping cost mode " << opt.cost_modes[c] << ", algorithm "
+                     << opt.algorithms[a] << ", kernel " << opt.kernel_sizes[k]
+                     << ": " << reason << ".\n";
+        }
+      }
+    }
+
+    for (size_t p = 0; p < pairs.size(); p++) {
+      vw_out() << "\nPair: " << pairs[p].name << " (" << pairs[p].left.cols()
+               << " x " << pairs[p].left.rows() << ")\n";
+      vw_out() << "cost  alg  kernel   seconds   Mpix/s  peak RSS MB  valid  correct"
+               << "  seconds with 0.." << opt.max_levels << " levels\n";
+
+      for (size_t a = 0; a < opt.algorithms.size(); a++) {
+        for (size_t c = 0; c < opt.cost_modes.size(); c++) {
+          for (size_t k = 0; k < opt.kernel_sizes.size(); k++) {
+            std::string reason;
+            if (!is_supported(opt.cost_modes[c], opt.algorithms[a], opt.kernel_sizes[k], reason))
+              continue;
+            BenchResult result
+              = run_benchmark(opt, pairs[p], cost_mode_value(opt.cost_modes[c]),
+                              static_cast<stereo::CorrelationAlgorithm>(opt.algorithms[a]),
+                              opt.kernel_sizes[k]);
+
+            std::ostringstream levels;
+            for (size_t l = 0; l < result.level_seconds.size(); l++)
+              levels << (l > 0 ? " " : "") << std::setprecision(3) << result.level_seconds[l];
+
+            vw_out() << std::fixed << std::setprecision(3)
+                     << std::setw(4)  << opt.cost_modes[c]
+                     << std::setw(5)  << opt.algorithms[a]
+                     << std::setw(8)  << opt.kernel_sizes[k]
+                     << std::setw(10) << result.seconds
+                     << std::setw(9)  << result.mpix_per_sec
+                     << std::setw(13) << std::setprecision(1) << result.peak_rss_mb
+                     << std::setw(7)  << std::setprecision(2) << result.valid_frac
+                     << std::setw(9)  << result.correct_frac
+                     << "  " << levels.str() << "\n";
+            if (csv)
+              *csv << pairs[p].name << ", " << opt.cost_modes[c] << ", "
+                   << opt.algorithms[a] << ", " << opt.kernel_sizes[k] << ", "
+                   << result.seconds << ", " << result.mpix_per_sec << ", "
+                   << result.peak_rss_mb << ", " << result.valid_frac << ", "
+                   << result.correct_frac << ", " << levels.str() << "\n";
+          }
+        }
+      }
+    }
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -225,23 +225,45 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
               << "as expected for the Moon.\n" );
   }
 
+  // A CSV file with a given format is parsed in large batches of
+  // lines, each on several threads.
+  const size_t CSV_BATCH_BYTES = 64*1024*1024;
+  boost::shared_ptr<asp::CsvFileParser> csv_parser;
+  asp::CsvConv::CsvPoints csv_points;
+  size_t csv_index = 0;
+  if (csv_conv.is_configured())
+    csv_parser.reset(new asp::CsvFileParser(file_name, csv_conv));
+
   bool shift_was_calc = false;
   bool is_first_line  = true;
   int points_count = 0;
   mean_longitude = 0.0;
   line = "";
-  while ( getline(file, line, '\n') ){
+  while (1){
 
-    if (!is_first_line && !line.empty() && line[0] == '#') {
-      vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
-      continue;
-    }
-    
     if (points_count >= num_points_to_load)
       break;
 
-    if (!asp::is_valid_csv_line(line))
-      continue;
+    if (csv_conv.is_configured()){
+      if (csv_index >= csv_points.size()){
+        if (!csv_parser->parse_next(CSV_BATCH_BYTES, csv_points))
+          break;
+        csv_index = 0;
+        continue;
+      }
+      csv_index++;
+    }else{
+      if (!getline(file, line, '\n'))
+        break;
+
+      if (!is_first_line && !line.empty() && line[0] == '#') {
+        vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
+        continue;
+      }
+
+      if (!asp::is_valid_csv_line(line))
+        continue;
+    }
 
     // Randomly skip a percentage of points
     double r = (double)std::rand()/(double)RAND_MAX;
@@ -256,11 +278,8 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
 
     if (csv_conv.is_configured()){
 
-      // Parse custom CSV file with given format string
-      bool success;
-      asp::CsvConv::CsvRecord vals = csv_conv.parse_csv_line(is_first_line, success, line);
-      if (!success)
-        continue;
+      // The values already parsed with the given format string
+      asp::CsvConv::CsvRecord vals = csv_points.record(csv_index - 1);
 
       xyz = csv_conv.csv_to_cartesian(vals, geo);
 
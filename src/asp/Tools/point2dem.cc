@@ -21,6 +21,7 @@
 
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/PointCloudIndex.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
@@ -196,12 +197,13 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
 
 }
 
-/// Convert any LAS or CSV files to ASP tif files. We do some binning
-/// to make the spatial data more localized, to improve performance.
-/// - We will later wipe these temporary tifs.
-void las_or_csv_to_tifs(Options& opt,
-			cartography::Datum const& datum,
-			std::vector<std::string> & tmp_tifs){
+/// Convert any LAS or CSV files to raw scratch files of points. We do
+/// some binning to make the spatial data more localized, to improve
+/// performance.
+/// - We will later wipe these temporary files.
+void las_or_csv_to_scratch(Options& opt,
+			   cartography::Datum const& datum,
+			   std::vector<std::string> & tmp_files){
 
   if (!opt.has_las_or_csv)
     return;
@@ -265,7 +267,7 @@ void las_or_csv_to_tifs(Options& opt,
   // create blocks smaller than what OrthoImageView will use later.
   int block_size = asp::OrthoRasterizerView::max_subblock_size();
 
-  // For csv and las files, create temporary tif files. In those files
+  // For csv and las files, create temporary scratch files. In those files
   // we'll have the points binned so that nearby points have nearby
   // indices.  This is key to fast rasterization later.
   for (int i = 0; i < num_files; i++){
@@ -276,9 +278,9 @@ void las_or_csv_to_tifs(Options& opt,
     std::string stem    = fs::path( in_file ).stem().string();
     std::string suffix;
     if (opt.out_prefix.find(stem) != std::string::npos)
-      suffix = ".tif";
+      suffix = ".bin";
     else
-      suffix = "-" + stem + ".tif";
+      suffix = "-" + stem + ".bin";
     std::string out_file = opt.out_prefix + "-tmp" + suffix;
 
     // Handle the case when the output file may exist
@@ -295,20 +297,20 @@ void las_or_csv_to_tifs(Options& opt,
       vw_throw( ArgumentErr() << "Too many attempts at creating a temporary file.\n");
 
     // TODO: This if statement should not be needed, the function should handle it!
-    // Perform the actual conversion to a tif file
+    // Perform the actual conversion to a scratch file
     if (asp::is_las(in_file)) {
-      asp::las_or_csv_to_tif(in_file, out_file, num_rows, block_size,
-			     &opt, pc_georef, csv_conv);
+      asp::las_or_csv_to_scratch(in_file, out_file, num_rows, block_size,
+				 pc_georef, csv_conv);
     } else { // CSV
-      asp::las_or_csv_to_tif(in_file, out_file, num_rows, block_size,
-			     &opt, csv_georef, csv_conv);
+      asp::las_or_csv_to_scratch(in_file, out_file, num_rows, block_size,
+				 csv_georef, csv_conv);
     }
     opt.pointcloud_files[i] = out_file; // so we can use it instead of the las file
-    tmp_tifs.push_back(out_file); // so we can wipe it later
+    tmp_files.push_back(out_file); // so we can wipe it later
   }
 
   sw.stop();
-  vw_out(DebugMessage,"asp") << "LAS or CSV to TIF conversion time: " << sw.elapsed_seconds() << std::endl;
+  vw_out(DebugMessage,"asp") << "LAS or CSV to scratch conversion time: " << sw.elapsed_seconds() << std::endl;
 
 }
 
@@ -860,10 +862,11 @@ namespace asp{
     VW_ASSERT(pc_files.size() >= 1,
 	      ArgumentErr() << "Expecting at least one file.\n");
 
-    int num_channels0 = get_num_channels(pc_files[0]);
+    // The scratch files made from LAS or CSV files have only the points.
+    int num_channels0 = asp::is_point_scratch(pc_files[0]) ? 3 : get_num_channels(pc_files[0]);
     int min_num_channels = num_channels0;
     for (int i = 1; i < (int)pc_files.size(); i++){
-      int num_channels = get_num_channels(pc_files[i]);
+      int num_channels = asp::is_point_scratch(pc_files[i]) ? 3 : get_num_channels(pc_files[i]);
       min_num_channels = std::min(min_num_channels, num_channels);
       if (num_channels != num_channels0)
 	min_num_channels = std::min(min_num_channels, 3);
@@ -875,6 +878,18 @@ namespace asp{
 
 
 
+/// Remove a temporary file when going out of scope, so it does not
+/// stay behind if an error is thrown.
+struct TmpFileRemover {
+  std::string file;
+  ~TmpFileRemover(){
+    try {
+      if (file != "" && fs::exists(file))
+        fs::remove(file);
+    } catch (...) {} // Must not throw while unwinding
+  }
+};
+
 /// Do more work!
 void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 				Options& opt,
@@ -929,7 +944,71 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
   // rather than filling holes in the cloud first. This is faster.
   rasterizer.set_hole_fill_len(0);
 
-  ImageViewRef< PixelGray<float> > rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+  // The DEM, the error, and the DRG are all made by binning the same
+  // points, only with different textures. Bin them together, so the
+  // points are read and filtered once rather than once per product.
+  // Filling holes in the DRG changes the points, so then the DRG is
+  // done on its own.
+  std::vector< ImageViewRef<float> > textures;
+  int num_channels = asp::num_channels(opt.pointcloud_files);
+  int dem_plane = -1, error_plane = -1, drg_plane = -1;
+  if ( !opt.no_dem ){
+    dem_plane = textures.size();
+    textures.push_back(rasterizer.texture()); // the heights
+  }
+  if ( opt.do_error ){
+    if (num_channels == 4){
+      // The error is a scalar.
+      ImageViewRef<Vector4> point_disk_image = asp::form_point_cloud_composite<Vector4>(opt.pointcloud_files,
+							    asp::OrthoRasterizerView::max_subblock_size());
+      error_plane = textures.size();
+      textures.push_back(channel_cast<float>(select_channel(point_disk_image,3)));
+    }else if (num_channels == 6){
+      // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
+      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>(opt.pointcloud_files,
+							    asp::OrthoRasterizerView::max_subblock_size());
+      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+      error_plane = textures.size();
+      for (int ch_index = 0; ch_index < 3; ch_index++)
+	textures.push_back(channel_cast<float>(select_channel(ned_err, ch_index)));
+    }
+  }
+  if ( opt.do_ortho && opt.ortho_hole_fill_len == 0 ){
+    ImageViewRef< PixelGray<float> > texture = asp::form_point_cloud_composite< PixelGray<float> >(opt.texture_files,
+							  asp::OrthoRasterizerView::max_subblock_size());
+    drg_plane = textures.size();
+    textures.push_back(channel_cast<float>(channels_to_planes(texture)));
+  }
+
+  // With a single texture the rasterizer is used directly. Otherwise
+  // the rasters are written once as the planes of a temporary image,
+  // and each product is made from its plane.
+  TmpFileRemover rasters_remover;
+  std::vector< ImageViewRef< PixelGray<float> > > rasters(textures.size());
+  std::string & rasters_file = rasters_remover.file;
+  if (textures.size() == 1){
+    rasterizer.set_texture(textures[0]);
+    rasters[0] = rasterizer;
+  }else if (textures.size() > 1){
+    Stopwatch sw1;
+    sw1.start();
+    rasters_file = opt.out_prefix + "-tmp-rasters.tif";
+    vw_out() << "Writing: " << rasters_file << "\n";
+    cartography::GeoReference no_georef;
+    bool has_georef = false, has_nodata = false;
+    vw::cartography::block_write_gdal_image(rasters_file,
+					    asp::OrthoRasterizerMultiView(rasterizer, textures),
+					    has_georef, no_georef, has_nodata, opt.nodata_value,
+					    opt, TerminalProgressCallback("asp", "Rasters: "));
+    DiskImageView<float> rasters_image(rasters_file);
+    for (size_t k = 0; k < rasters.size(); k++)
+      rasters[k] = pixel_cast< PixelGray<float> >(select_plane(rasters_image, k));
+    sw1.stop();
+    vw_out(DebugMessage,"asp") << "Rasters render time: "
+			       << sw1.elapsed_seconds() << std::endl;
+  }
+
+  ImageViewRef< PixelGray<float> > rasterizer_fsaa;
 
   // Write out the DEM. We've set the texture to be the height.
   Vector2 tile_size(vw_settings().default_tile_size(),
@@ -937,6 +1016,7 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
   if ( !opt.no_dem ){
     Stopwatch sw2;
     sw2.start();
+    rasterizer_fsaa = generate_fsaa_raster( rasters[dem_plane], opt );
     ImageViewRef< PixelGray<float> > dem
       = asp::round_image_pixels_skip_nodata(rasterizer_fsaa, opt.rounding_error,
 					    opt.nodata_value);
@@ -963,33 +1043,18 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 
   // Write triangulation error image if requested
   if ( opt.do_error ) {
-    int num_channels = asp::num_channels(opt.pointcloud_files);
-
     int hole_fill_len = 0;
     if (num_channels == 4){
-      // The error is a scalar.
-      ImageViewRef<Vector4> point_disk_image = asp::form_point_cloud_composite<Vector4>(opt.pointcloud_files,
-							    asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
-      rasterizer.set_texture( error_channel );
-      rasterizer.set_hole_fill_len(hole_fill_len);
-      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+      rasterizer_fsaa = generate_fsaa_raster( rasters[error_plane], opt );
       save_image(opt,
 		 asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
 						     opt.rounding_error,
 						     opt.nodata_value),
 		 georef, hole_fill_len, "IntersectionErr");
     }else if (num_channels == 6){
-      // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
-      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>(opt.pointcloud_files,
-							    asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
       std::vector< ImageViewRef< PixelGray<float> > >  rasterized(3);
       for (int ch_index = 0; ch_index < 3; ch_index++){
-	ImageViewRef<double> ch = select_channel(ned_err, ch_index);
-	rasterizer.set_texture(ch);
-	rasterizer.set_hole_fill_len(hole_fill_len);
-	rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+	rasterizer_fsaa = generate_fsaa_raster( rasters[error_plane + ch_index], opt );
 	rasterized[ch_index] =
 	  block_cache(rasterizer_fsaa, tile_size, opt.num_threads);
       }
@@ -1013,16 +1078,25 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     int hole_fill_len = opt.ortho_hole_fill_len;
     Stopwatch sw3;
     sw3.start();
-    ImageViewRef< PixelGray<float> > texture = asp::form_point_cloud_composite< PixelGray<float> >(opt.texture_files,
-							  asp::OrthoRasterizerView::max_subblock_size());
-    rasterizer.set_texture(texture);
-    rasterizer.set_hole_fill_len(hole_fill_len);
-    rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+    if (drg_plane >= 0){
+      rasterizer_fsaa = generate_fsaa_raster( rasters[drg_plane], opt );
+    }else{
+      ImageViewRef< PixelGray<float> > texture = asp::form_point_cloud_composite< PixelGray<float> >(opt.texture_files,
+							    asp::OrthoRasterizerView::max_subblock_size());
+      rasterizer.set_texture(texture);
+      rasterizer.set_hole_fill_len(hole_fill_len);
+      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+    }
     asp::save_image(opt, rasterizer_fsaa, georef, hole_fill_len, "DRG");
     sw3.stop();
     vw_out(DebugMessage,"asp") << "DRG render time: " << sw3.elapsed_seconds() << std::endl;
   }
 
+  // The products are written, so the rasters are no longer needed
+  rasters.clear();
+  if (rasters_file != "" && fs::exists(rasters_file))
+    fs::remove(rasters_file);
+
   // Write out a normalized version of the DEM, if requested (for debugging)
   if (opt.do_normalize) {
     int hole_fill_len = 0;
@@ -1040,12 +1114,129 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 } // End do_software_rasterization
 
 
+// Find the box of the projected points in each sub-block of the point
+// image, and the histogram of the errors, from the index stereo_tri
+// saves next to the point cloud, so that the rasterizer need not read
+// the cloud for them. Returns false if there is no index which can be
+// used, and then the rasterizer reads the cloud. The boxes are
+// estimated, so the rasterizer checks them against the points it reads.
+bool summary_from_index(Options const& opt, cartography::GeoReference const& georef,
+			double avg_lon, double estim_max_error,
+			asp::PointImageSummary & summary){
+
+  // The index describes the points as they were saved
+  if (opt.pointcloud_files.size() != 1 || opt.has_las_or_csv ||
+      opt.phi_rot != 0 || opt.omega_rot != 0 || opt.kappa_rot != 0 ||
+      opt.lon_offset != 0 || opt.lat_offset != 0 || opt.height_offset != 0 ||
+      opt.max_valid_triangulation_error > 0.0 || opt.target_projwin != BBox2() ||
+      (opt.remove_outliers_with_pct && estim_max_error <= 0.0))
+    return false;
+
+  std::string cloud_file = opt.pointcloud_files[0];
+  DiskImageView<float> cloud(cloud_file);
+  asp::PointCloudIndex index;
+  try{
+    if (!index.read(cloud_file, Vector2i(cloud.cols(), cloud.rows())))
+      return false;
+  }catch(const std::exception& e){
+    vw_out(WarningMessage) << e.what() << "Will read the point cloud instead.\n";
+    return false;
+  }
+  if (index.semi_major_axis() != georef.datum().semi_major_axis() ||
+      index.semi_minor_axis() != georef.datum().semi_minor_axis())
+    return false;
+
+  // A cloud wider than tall is transposed by form_point_cloud_composite().
+  bool transposed = (cloud.rows() < cloud.cols());
+  int sub_block_size = asp::OrthoRasterizerView::sub_block_size(cloud.cols(), cloud.rows());
+  int ratio = sub_block_size/asp::PointCloudIndex::BLOCK_SIZE;
+
+  summary = asp::PointImageSummary();
+  summary.sub_block_size = sub_block_size;
+  double max_sagitta = 0.0;
+  asp::CenterLongitudeFunc center_lon(avg_lon);
+  for (int sby = 0; sby*ratio < index.num_blocks_y(); sby++){
+    for (int sbx = 0; sbx*ratio < index.num_blocks_x(); sbx++){
+
+      BBox3 llh;
+      int64 count = 0;
+      for (int by = sby*ratio; by < std::min((sby+1)*ratio, index.num_blocks_y()); by++){
+	for (int bx = sbx*ratio; bx < std::min((sbx+1)*ratio, index.num_blocks_x()); bx++){
+	  if (index.count(bx, by) == 0) continue;
+	  count += index.count(bx, by);
+	  llh.grow(index.box(bx, by));
+	}
+      }
+      if (count == 0) continue;
+
+      // Recenter the longitudes as is done for the points. Give up
+      // if the points of a sub-block end up on both sides of the cut.
+      Vector3 diag = llh.max() - llh.min();
+      llh.min() = center_lon(llh.min());
+      llh.max() = llh.min() + diag;
+      if (llh.max()[0] > avg_lon + 180)
+	return false;
+
+      // The projection of the longitude-latitude box is bounded by the
+      // projection of its sides, which are curved once projected, so
+      // sample each side. How far the midpoint of every other sample is
+      // from the chord between its neighbors estimates how far the sides
+      // may bulge beyond the box of the samples.
+      const int num_samples = 4; // Intervals per side
+      BBox3 proj;
+      for (int side = 0; side < 4; side++){
+	Vector2 side_pts[num_samples + 1];
+	for (int i = 0; i <= num_samples; i++){
+	  double t = double(i)/num_samples;
+	  Vector2 ll;
+	  if (side < 2) ll = Vector2(llh.min()[0] + t*diag[0], llh.min()[1] + side*diag[1]);
+	  else          ll = Vector2(llh.min()[0] + (side - 2)*diag[0], llh.min()[1] + t*diag[1]);
+	  side_pts[i] = georef.lonlat_to_point(ll);
+	  proj.grow(Vector3(side_pts[i][0], side_pts[i][1], llh.min()[2]));
+	  proj.grow(Vector3(side_pts[i][0], side_pts[i][1], llh.max()[2]));
+	}
+	for (int i = 1; i < num_samples; i += 2)
+	  max_sagitta = std::max(max_sagitta,
+				 norm_2(side_pts[i] - (side_pts[i-1] + side_pts[i+1])/2.0));
+      }
+      summary.bbox.grow(proj);
+      proj.max()[0] = boost::math::float_next(proj.max()[0]);
+      proj.max()[1] = boost::math::float_next(proj.max()[1]);
+
+      BBox2i pix(sbx*sub_block_size, sby*sub_block_size, sub_block_size, sub_block_size);
+      pix.crop(BBox2i(0, 0, cloud.cols(), cloud.rows()));
+      if (transposed)
+	pix = BBox2i(pix.min().y(), pix.min().x(), pix.height(), pix.width());
+      summary.boundaries.push_back(std::make_pair(proj, pix));
+    }
+  }
+
+  // The bulge between samples half as far apart is about a quarter of
+  // the one measured. Pad by twice that.
+  summary.boundary_padding = max_sagitta/2.0;
+
+  // Bin the errors the way the rasterizer does
+  if (opt.remove_outliers_with_pct){
+    int len = asp::OrthoRasterizerView::num_error_hist_bins();
+    summary.errors_hist = std::vector<double>(len, 0.0);
+    std::vector<double> const& hist = index.errors_hist();
+    for (int i = 0; i < (int)hist.size(); i++){
+      double err = asp::PointCloudIndex::hist_bin_center(i);
+      int k = round((len-1)*std::min(err, estim_max_error)/estim_max_error);
+      summary.errors_hist[k] += hist[i];
+    }
+  }
+
+  return true;
+}
+
 // Wrapper for do_software_rasterization that goes through all spacing values
 void do_software_rasterization_multi_spacing( const ImageViewRef<Vector3>& proj_point_input,
 					      Options& opt,
 					      cartography::GeoReference& georef,
 					      ImageViewRef<double> const& error_image,
-					      double estim_max_error) {
+					      double estim_max_error,
+					      asp::PointImageSummary const* summary) {
   // Perform the slow initialization that can be shared by all output resolutions
   Stopwatch sw1;
   sw1.start();
@@ -1057,7 +1248,7 @@ void do_software_rasterization_multi_spacing( const ImageViewRef<Vector3>& proj_
 	       opt.remove_outliers_with_pct, opt.remove_outliers_params,
 	       error_image, estim_max_error, opt.max_valid_triangulation_error,
 	       opt.median_filter_params, opt.erode_len, opt.has_las_or_csv,
-	       TerminalProgressCallback("asp","QuadTree: ") );
+	       TerminalProgressCallback("asp","QuadTree: "), summary );
 
   sw1.stop();
   vw_out(DebugMessage,"asp") << "Quad time: " << sw1.elapsed_seconds() << std::endl;
@@ -1076,6 +1267,10 @@ void do_software_rasterization_multi_spacing( const ImageViewRef<Vector3>& proj_
     // Required second init step for each spacing
     rasterizer.initialize_spacing(this_spacing);
 
+    // The products of the previous spacing may have changed the
+    // texture, so start again from the heights.
+    rasterizer.set_texture(select_channel(proj_point_input.impl(),2));
+
     // Each spacing gets a variation of the output prefix
     if (i == 0)
       opt.out_prefix = base_out_prefix;
@@ -1086,6 +1281,15 @@ void do_software_rasterization_multi_spacing( const ImageViewRef<Vector3>& proj_
   } // End loop through spacings
 
   opt.out_prefix = base_out_prefix; // Restore the original value
+
+  // If the index of the cloud was not right, some points may be
+  // missing, so make everything again by reading the cloud.
+  if (summary != NULL && rasterizer.summary_mismatch()){
+    vw_out(WarningMessage) << "The point cloud index does not match the point cloud. "
+			   << "Reading the point cloud instead.\n";
+    do_software_rasterization_multi_spacing(proj_point_input, opt, georef, error_image,
+					    estim_max_error, NULL);
+  }
 }
 
 
@@ -1146,15 +1350,16 @@ int main( int argc, char *argv[] ) {
       asp::set_srs_string(opt.target_srs_string, have_user_datum, user_datum, output_georef);
     }
 
-    // Convert any input LAS or CSV files to ASP's point cloud tif format
+    // Convert any input LAS or CSV files to scratch files of points,
+    // which are read like ASP's point cloud tif files
     // - The output and input datum will match unless the input data files
     //   themselves specify a different datum.
     // - Should all be XYZ format when finished
-    std::vector<std::string> tmp_tifs;
-    las_or_csv_to_tifs(opt, output_georef.datum(), tmp_tifs);
+    std::vector<std::string> tmp_files;
+    las_or_csv_to_scratch(opt, output_georef.datum(), tmp_files);
 
     // Generate a merged xyz point cloud consisting of all inputs
-    // - By now, each input exists in xyz tif format.
+    // - By now, each input exists in xyz tif or scratch format.
     ImageViewRef<Vector3> point_image = asp::form_point_cloud_composite<Vector3>(opt.pointcloud_files,
 						  asp::OrthoRasterizerView::max_subblock_size());
 
@@ -1231,6 +1436,11 @@ int main( int argc, char *argv[] ) {
     
     //std::cout << "output_georef after lon center: \n" << output_georef << std::endl;   
 
+    // If stereo_tri saved an index of the cloud, it saves a pass over the cloud
+    asp::PointImageSummary summary;
+    bool has_summary = summary_from_index(opt, output_georef, avg_lon, estim_max_error,
+					  summary);
+
     // We trade off readability here to avoid ImageViewRef dereferences
     if (opt.lon_offset != 0 || opt.lat_offset != 0 || opt.height_offset != 0) {
       vw_out() << "\t--> Applying offset: " << opt.lon_offset
@@ -1244,7 +1454,7 @@ int main( int argc, char *argv[] ) {
 			   opt.lat_offset,
 			   opt.height_offset)),
 	       output_georef),
-	   opt, output_georef, error_image, estim_max_error);
+	   opt, output_georef, error_image, estim_max_error, NULL);
     } else {
       do_software_rasterization_multi_spacing
 	  (geodetic_to_point
@@ -1252,12 +1462,13 @@ int main( int argc, char *argv[] ) {
 		  (cartesian_to_geodetic(point_image, output_georef),
 		   avg_lon),
 	       output_georef),
-	  opt, output_georef, error_image, estim_max_error);
+	  opt, output_georef, error_image, estim_max_error,
+	  has_summary ? &summary : NULL);
     }
 
     // Wipe the temporary files
-    for (int i = 0; i < (int)tmp_tifs.size(); i++)
-      if (fs::exists(tmp_tifs[i])) fs::remove(tmp_tifs[i]);
+    for (int i = 0; i < (int)tmp_files.size(); i++)
+      if (fs::exists(tmp_files[i])) fs::remove(tmp_files[i]);
 
   } ASP_STANDARD_CATCHES;
 
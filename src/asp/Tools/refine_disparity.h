@@ -0,0 +1,365 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file refine_disparity.h
+///
+/// Subpixel refinement of the integer disparity, shared by stereo_rfne
+/// and by stereo_corr when correlation and refinement are fused.
+
+#ifndef __ASP_TOOLS_REFINE_DISPARITY_H__
+#define __ASP_TOOLS_REFINE_DISPARITY_H__
+
+#include <asp/Tools/stereo.h>
+#include <asp/Sessions/StereoSession.h>
+#include <asp/Core/AffineSubpixel.h>
+#include <vw/Image/Filter.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Stereo/PreFilter.h>
+#include <vw/Stereo/CostFunctions.h>
+#include <vw/Stereo/SubpixelView.h>
+#include <vw/Stereo/EMSubpixelCorrelatorView.h>
+#include <vw/Stereo/DisparityMap.h>
+
+namespace vw {
+  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+namespace asp {
+
+/// Subpixel modes 2 and 3, with the window sums done with vector
+/// instructions. Each tile is refined on its own, from crops of the
+/// prefiltered images with a margin for the kernel at the coarsest
+/// pyramid level.
+class AffineSubpixelView : public vw::ImageViewBase<AffineSubpixelView> {
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > m_disp;
+  vw::ImageViewRef<vw::PixelGray<float> > m_left_image, m_right_image;
+  vw::stereo::PrefilterModeType m_prefilter_mode;
+  double m_prefilter_width;
+  AffineSubpixelOptions m_opt;
+
+  // Round down to a multiple of align
+  static vw::Vector2i align_down(vw::Vector2i const& pix, int align) {
+    return vw::Vector2i(int(std::floor(double(pix[0])/align))*align,
+                        int(std::floor(double(pix[1])/align))*align);
+  }
+
+  // Crop a region of the image, filtered as if the whole image was
+  vw::ImageView<float> prefiltered_crop(vw::ImageViewRef<vw::PixelGray<float> > const& image,
+                                        vw::BBox2i const& region) const {
+    using namespace vw;
+    int pad = int(std::ceil(3.0*m_prefilter_width)) + 2;
+    BBox2i padded = region;
+    padded.expand(pad);
+    ImageView<PixelGray<float> > padded_img = crop(edge_extend(image, ConstantEdgeExtension()), padded);
+    ImageView<PixelGray<float> > filtered;
+    if (m_prefilter_mode == vw::stereo::PREFILTER_LOG)
+      filtered = laplacian_filter(gaussian_filter(padded_img, m_prefilter_width));
+    else if (m_prefilter_mode == vw::stereo::PREFILTER_MEANSUB)
+      filtered = padded_img - gaussian_filter(padded_img, m_prefilter_width);
+    else
+      filtered = padded_img;
+    return crop(select_channel(filtered, 0), pad, pad, region.width(), region.height());
+  }
+
+public:
+  typedef vw::PixelMask<vw::Vector2f> pixel_type;
+  typedef pixel_type                  result_type;
+  typedef vw::ProceduralPixelAccessor<AffineSubpixelView> pixel_accessor;
+
+  AffineSubpixelView(vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disp,
+                     vw::ImageViewRef<vw::PixelGray<float> > const& left_image,
+                     vw::ImageViewRef<vw::PixelGray<float> > const& right_image,
+                     vw::stereo::PrefilterModeType prefilter_mode, double prefilter_width,
+                     AffineSubpixelOptions const& opt):
+    m_disp(disp), m_left_image(left_image), m_right_image(right_image),
+    m_prefilter_mode(prefilter_mode), m_prefilter_width(prefilter_width), m_opt(opt) {}
+
+  inline vw::int32 cols  () const { return m_disp.cols(); }
+  inline vw::int32 rows  () const { return m_disp.rows(); }
+  inline vw::int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, vw::int32 /*p*/ = 0 ) const {
+    vw_throw(vw::NoImplErr() << "AffineSubpixelView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+    using namespace vw;
+
+    // The pyramid levels line up only if the crops start at multiples
+    // of 2^max_levels.
+    int align  = 1 << m_opt.max_levels;
+    int margin = (std::max(m_opt.kernel_size[0], m_opt.kernel_size[1])/2 + 2) * align;
+    BBox2i left_region = bbox;
+    left_region.expand(margin);
+    left_region.min() = align_down(left_region.min(), align);
+
+    // Only the pixels in the tile are refined
+    ImageView<pixel_type> tile_disp(left_region.width(), left_region.height());
+    ImageView<pixel_type> disp = crop(m_disp, bbox);
+    BBox2f disp_range;
+    for (int row = 0; row < disp.rows(); row++) {
+      for (int col = 0; col < disp.cols(); col++) {
+        if (!is_valid(disp(col, row)))
+          continue;
+        tile_disp(col + bbox.min().x() - left_region.min().x(),
+                  row + bbox.min().y() - left_region.min().y()) = disp(col, row);
+        disp_range.grow(disp(col, row).child());
+      }
+    }
+
+    if (!disp_range.empty()) {
+      Vector2i disp_min(std::floor(disp_range.min()[0]), std::floor(disp_range.min()[1]));
+      Vector2i disp_max(std::ceil (disp_range.max()[0]), std::ceil (disp_range.max()[1]));
+      BBox2i right_region(left_region.min() + disp_min, left_region.max() + disp_max);
+      right_region.expand(margin);
+      right_region.min() = align_down(right_region.min(), align);
+
+      ImageView<float> left_tile  = prefiltered_crop(m_left_image,  left_region);
+      ImageView<float> right_tile = prefiltered_crop(m_right_image, right_region);
+      affine_subpixel_refine(left_tile, right_tile, left_region.min() - right_region.min(),
+                             m_opt, tile_disp);
+    }
+
+    disp = crop(tile_disp, bbox - left_region.min());
+    return prerasterize_type(disp, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+/// How far beyond a tile, shifted by its disparities, refinement may
+/// read the right image. The affine modes go through a pyramid, and
+/// their tiles are padded for the kernel at the coarsest level twice,
+/// once around the left tile and once around its disparities.
+inline int refinement_right_image_margin() {
+  int half_kernel = vw::math::max(stereo_settings().subpixel_kernel)/2 + 2;
+  int prefilter   = int(std::ceil(3.0*stereo_settings().slogW)) + 2;
+  if (stereo_settings().subpixel_mode <= 1)
+    return half_kernel + prefilter;
+  return 2*(half_kernel << stereo_settings().subpixel_max_levels) + prefilter;
+}
+
+/// Refine the integer disparity with the selected subpixel mode.
+template <class Image1T, class Image2T>
+vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+refine_disparity(Image1T const& left_image,
+                 Image2T const& right_image,
+                 vw::ImageViewRef< vw::PixelMask<vw::Vector2f> > const& integer_disp,
+                 ASPGlobalOptions const& opt, bool verbose){
+
+  using namespace vw;
+  using namespace vw::stereo;
+  using std::endl;
+
+  ImageViewRef<PixelMask<Vector2f> > refined_disp = integer_disp;
+
+  PrefilterModeType prefilter_mode = 
+    static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
+
+  // Modes 2 and 3 have an implementation of their own, with the window
+  // sums done with vector instructions, if asked for.
+  bool use_simd = (stereo_settings().subpixel_simd != "off");
+  AffineSubpixelOptions affine_opt;
+  if (use_simd) {
+    affine_opt.kernel_size  = stereo_settings().subpixel_kernel;
+    affine_opt.max_levels   = stereo_settings().subpixel_max_levels;
+    affine_opt.use_bayes_em = (stereo_settings().subpixel_mode == 2);
+    affine_opt.isa          = subpixel_isa_from_string(stereo_settings().subpixel_simd);
+  }
+
+  if (stereo_settings().subpixel_mode == 0) {
+    // Do nothing
+    if (verbose)
+      vw_out() << "\t--> Skipping subpixel mode.\n";
+  }
+  if (stereo_settings().subpixel_mode == 1) {
+    // Parabola
+    
+    if (verbose) {
+      vw_out() << "\t--> Using parabola subpixel mode.\n";
+      if (stereo_settings().pre_filter_mode == 2)
+        vw_out() << "\t--> Using LOG pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else if (stereo_settings().pre_filter_mode == 1)
+        vw_out() << "\t--> Using Subtracted Mean pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else
+        vw_out() << "\t--> NO preprocessing" << endl;
+    } 
+    
+    refined_disp = parabola_subpixel( integer_disp,
+                                      left_image, right_image,
+                                      prefilter_mode, stereo_settings().slogW,
+                                      stereo_settings().subpixel_kernel );
+    
+  } // End parabola cases
+  if (stereo_settings().subpixel_mode == 2) {
+    // Bayes EM
+    if (verbose){
+      vw_out() << "\t--> Using affine adaptive subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+      if (use_simd)
+        vw_out() << "\t--> Using " << subpixel_isa_name(affine_opt.isa) << " instructions.\n";
+    }
+    if (use_simd)
+      refined_disp = AffineSubpixelView(integer_disp,
+                                        pixel_cast<PixelGray<float> >(left_image),
+                                        pixel_cast<PixelGray<float> >(right_image),
+                                        prefilter_mode, stereo_settings().slogW, affine_opt);
+    else
+      refined_disp =
+        bayes_em_subpixel( integer_disp,
+                           left_image, right_image,
+                           prefilter_mode, stereo_settings().slogW,
+                           stereo_settings().subpixel_kernel,
+                           stereo_settings().subpixel_max_levels );
+
+  } // End Bayes EM cases
+  if (stereo_settings().subpixel_mode == 3) {
+    // Fast affine
+    if (verbose){
+      vw_out() << "\t--> Using affine subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+      if (use_simd)
+        vw_out() << "\t--> Using " << subpixel_isa_name(affine_opt.isa) << " instructions.\n";
+    }
+    if (use_simd)
+      refined_disp = AffineSubpixelView(integer_disp,
+                                        pixel_cast<PixelGray<float> >(left_image),
+                                        pixel_cast<PixelGray<float> >(right_image),
+                                        prefilter_mode, stereo_settings().slogW, affine_opt);
+    else
+      refined_disp =
+        affine_subpixel( integer_disp,
+                         left_image, right_image,
+                         prefilter_mode, stereo_settings().slogW,
+                         stereo_settings().subpixel_kernel,
+                         stereo_settings().subpixel_max_levels );
+
+  } // End Fast affine cases
+  if (stereo_settings().subpixel_mode == 4) {
+    // Lucas-Kanade
+    if (verbose){
+      vw_out() << "\t--> Using Lucas-Kanade subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+    }
+    refined_disp =
+      lk_subpixel( integer_disp,
+                   left_image, right_image,
+                   prefilter_mode, stereo_settings().slogW,
+                   stereo_settings().subpixel_kernel,
+                   stereo_settings().subpixel_max_levels );
+
+  } // End Lucas-Kanade cases
+  if (stereo_settings().subpixel_mode == 5) {
+    // Affine and Bayes subpixel refinement always use the LogPreprocessingFilter...
+    if (verbose){
+      vw_out() << "\t--> Using EM Subpixel mode "
+               << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Mode 3 does internal preprocessing;"
+               << " settings will be ignored. " << endl;
+    }
+
+    typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+    EMCorrelator em_correlator(channels_to_planes(left_image),
+                               channels_to_planes(right_image),
+                               pixel_cast<PixelMask<Vector2f> >(integer_disp), -1);
+    em_correlator.set_em_iter_max   (stereo_settings().subpixel_em_iter       );
+    em_correlator.set_inner_iter_max(stereo_settings().subpixel_affine_iter   );
+    em_correlator.set_kernel_size   (stereo_settings().subpixel_kernel        );
+    em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
+
+    DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
+
+    block_write_image(em_disparity_map_rsrc, em_correlator,
+                      TerminalProgressCallback("asp", "\t--> EM Refinement :"));
+
+    DiskImageResource *em_disparity_map_rsrc_2 =
+      DiskImageResourceOpenEXR::construct_open(opt.out_prefix + "-F6.exr");
+    DiskImageView<PixelMask<Vector<float, 5> > > em_disparity_disk_image(em_disparity_map_rsrc_2);
+
+    ImageViewRef<Vector<float, 3> > disparity_uncertainty =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractUncertaintyFunctor());
+    ImageViewRef<float> spectral_uncertainty =
+      per_pixel_filter(disparity_uncertainty,
+                       EMCorrelator::SpectralRadiusUncertaintyFunctor());
+    write_image(opt.out_prefix+"-US.tif", spectral_uncertainty);
+    write_image(opt.out_prefix+"-U.tif", disparity_uncertainty);
+
+    refined_disp =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractDisparityFunctor());
+  } // End EM subpixel cases 
+  if ((stereo_settings().subpixel_mode < 0) || (stereo_settings().subpixel_mode > 5)){
+    if (verbose) {
+      vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Doing nothing\n";
+    }
+  }
+
+  return refined_disp;
+}
+
+/// Bayes EM subpixel refinement assumes that the images are normalized.
+/// If normalization was skipped in preprocessing, normalize them now.
+inline void normalize_images_for_refinement
+  (ASPGlobalOptions const& opt,
+   vw::ImageViewRef<vw::uint8> const& left_mask,
+   vw::ImageViewRef<vw::uint8> const& right_mask,
+   vw::ImageViewRef<vw::PixelGray<float> > & left_image,
+   vw::ImageViewRef<vw::PixelGray<float> > & right_image){
+
+  using namespace vw;
+
+  bool skip_img_norm = asp::skip_image_normalization(opt);
+  if (!skip_img_norm || stereo_settings().subpixel_mode != 2)
+    return;
+
+  ImageViewRef< PixelMask< PixelGray<float> > > Limg
+    = copy_mask(left_image, create_mask(left_mask));
+  ImageViewRef< PixelMask< PixelGray<float> > > Rimg
+    = copy_mask(right_image, create_mask(right_mask));
+
+  Vector<float32> left_stats, right_stats;
+  std::string left_stats_file  = opt.out_prefix+"-lStats.tif";
+  std::string right_stats_file = opt.out_prefix+"-rStats.tif";
+  vw_out() << "Reading: " << left_stats_file << ' ' << right_stats_file << std::endl;
+  read_vector(left_stats,  left_stats_file );
+  read_vector(right_stats, right_stats_file);
+  normalize_images(stereo_settings().force_use_entire_range,
+                   stereo_settings().individually_normalize,
+                   false, // Use std stretch
+                   left_stats, right_stats, Limg, Rimg);
+  left_image  = apply_mask(Limg);
+  right_image = apply_mask(Rimg);
+}
+
+} // end namespace asp
+
+#endif//__ASP_TOOLS_REFINE_DISPARITY_H__
@@ -30,6 +30,7 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Sessions/ResourceLoader.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/AffineSubpixel.h>
 
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics.hpp>
@@ -291,7 +292,9 @@ namespace asp {
       ("session-type,t",      po::value(&opt.stereo_session_string),
                               "Select the stereo session type to use for processing. [options: pinhole isis dg rpc spot5 aster pinholemappinhole isismapisis dgmaprpc rpcmaprpc astermaprpc spot5maprpc]")
       ("stereo-file,s",       po::value(&opt.stereo_default_filename)->default_value("./stereo.default"),
-       "Explicitly specify the stereo.default file to use. [default: ./stereo.default]");
+       "Explicitly specify the stereo.default file to use. [default: ./stereo.default]")
+      ("save-stage-instrumentation", po::bool_switch(&stereo_settings().save_stage_instrumentation)->default_value(false)->implicit_value(true),
+       "Save the time, memory, and I/O used by each stage, as <output prefix>-<stage>-instrumentation.json.");
 
 
     // We distinguish between all_general_options, which is all the
@@ -519,7 +522,7 @@ namespace asp {
     const bool dem_provided = !opt.input_dem.empty();
 
     // Seed mode valid values
-    if (stereo_settings().seed_mode > 3){
+    if (stereo_settings().seed_mode > 4){
       vw_throw(ArgumentErr() << "Invalid value for seed-mode: " << stereo_settings().seed_mode << ".\n");
     }
 
@@ -529,6 +532,47 @@ namespace asp {
       vw_throw( ArgumentErr() << "Cannot use local homography without computing low-resolution disparity.\n");
     }
 
+    // Seed mode 4 makes no D_sub, from which the local homographies are found
+    if (stereo_settings().seed_mode == 4 &&
+        stereo_settings().use_local_homography){
+      vw_throw( ArgumentErr() << "Cannot use local homography with seed-mode 4.\n");
+    }
+
+    // The on-demand low-res seed is made only for seed mode 1, and it
+    // is never saved as a whole, so what needs all of D_sub can't use it.
+    if (stereo_settings().lowres_seed_on_demand){
+      if (stereo_settings().seed_mode != 1)
+        vw_throw( ArgumentErr() << "The option lowres-seed-on-demand requires corr-seed-mode 1.\n");
+      if (stereo_settings().use_local_homography)
+        vw_throw( ArgumentErr() << "The option lowres-seed-on-demand cannot be used with "
+                  << "use-local-homography.\n");
+      if (stereo_settings().rm_quantile_multiple > 0.0)
+        vw_throw( ArgumentErr() << "The option lowres-seed-on-demand cannot be used with "
+                  << "rm-quantile-multiple.\n");
+    }
+
+    // Will throw if the instruction set is not known
+    if (stereo_settings().subpixel_simd != "off")
+      subpixel_isa_from_string(stereo_settings().subpixel_simd);
+
+    // Fused correlation and refinement works tile by tile, so it cannot
+    // be used where the tiles of D.tif must be blended, or written out
+    // to disk, or be found again in a later run.
+    if (stereo_settings().fuse_correlation_and_refinement){
+      if (stereo_settings().stereo_algorithm != 0)
+        vw_throw( ArgumentErr() << "The option fuse-correlation-and-refinement "
+                  << "requires stereo-algorithm 0.\n");
+      if (stereo_settings().subpixel_mode > 4)
+        vw_throw( ArgumentErr() << "The option fuse-correlation-and-refinement "
+                  << "requires subpixel-mode 0 to 4.\n");
+      if (stereo_settings().use_local_homography)
+        vw_throw( ArgumentErr() << "The option fuse-correlation-and-refinement cannot be used with "
+                  << "use-local-homography.\n");
+      if (stereo_settings().incremental_correlation)
+        vw_throw( ArgumentErr() << "The option fuse-correlation-and-refinement cannot be used with "
+                  << "incremental-correlation.\n");
+    }
+
     // D_sub from DEM needs a positive disparity_estimation_dem_error
     if (stereo_settings().seed_mode == 2 &&
         stereo_settings().disparity_estimation_dem_error <= 0.0){
@@ -26,7 +26,9 @@ when running the SGM algorithm on large data sets using parallel_stereo.
 #include <asp/Tools/stereo.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Sessions/ResourceLoader.h>
+#include <asp/Core/BlockCache.h>
 #include <boost/filesystem.hpp>
+#include <map>
 
 using namespace vw;
 using namespace vw::stereo;
@@ -520,6 +522,231 @@ void fill_blend_options(ASPGlobalOptions const& opt, BlendOptions & blend_option
   blend_options.sgm_collar_size = stereo_settings().sgm_collar_size;
 }
 
+/// Blend the whole grid of parallel_stereo tiles in one process. As in
+/// tile_blend(), each output pixel is the weighted average of all the
+/// tiles whose buffered region covers it, and is valid where the tile
+/// owning it is valid. Tiles are loaded on demand into a cache holding
+/// cache_bytes, or three rows of tiles if that is 0. As the output is
+/// written in raster order, each tile is loaded only once if the cache
+/// holds at least two rows.
+class TileGridBlendView: public ImageViewBase<TileGridBlendView> {
+  typedef PixelMask<Vector3f>       TilePixelType; // Disparity and weight
+  typedef BlockCache<TilePixelType> CacheType;
+  typedef ImageView<TilePixelType>  TileDataType;
+
+  std::string m_out_prefix;
+  Vector2i    m_image_size, m_job_size;
+  BBox2i      m_window;
+  int         m_collar, m_tiles_x, m_tiles_y;
+  boost::shared_ptr<CacheType> m_cache;
+  std::vector<boost::shared_ptr<Mutex> > m_load_mutexes; // So a tile is loaded by one thread
+
+  // A tile of the grid, without its collar
+  BBox2i tile_bbox(int tx, int ty) const {
+    BBox2i box(tx*m_job_size[0], ty*m_job_size[1], m_job_size[0], m_job_size[1]);
+    box.crop(BBox2i(0, 0, m_image_size[0], m_image_size[1]));
+    return box;
+  }
+
+  // The region covered by the disparity of a tile, which has a collar
+  // on each side, except at the edges of the processed window.
+  BBox2i buffered_bbox(int tx, int ty) const {
+    BBox2i box = tile_bbox(tx, ty);
+    box.expand(m_collar);
+    box.crop(m_window);
+    return box;
+  }
+
+  // The naming of the tile directories must be in sync with parallel_stereo
+  std::string tile_file(int tx, int ty) const {
+    BBox2i box = tile_bbox(tx, ty);
+    std::ostringstream os;
+    os << box.min().x() << "_" << box.min().y() << "_" << box.width() << "_" << box.height();
+    return m_out_prefix + "-" + os.str() + "/" + os.str() + "-Dnosym.tif";
+  }
+
+  // Load the disparity of a tile and its blending weights. Returns an
+  // empty image for tiles outside the window or which failed.
+  TileDataType load_tile(int tx, int ty) const {
+    TileDataType data;
+    std::string file = tile_file(tx, ty);
+    BBox2i box = buffered_bbox(tx, ty);
+    if (box.empty() || !boost::filesystem::exists(file))
+      return data;
+
+    DispImageType disp = DiskImageType(file);
+    if (disp.cols() != box.width() || disp.rows() != box.height())
+      vw_throw( ArgumentErr() << "Expecting " << file << " to be of size "
+                              << box.width() << " x " << box.height() << ".\n" );
+    WeightsType weights;
+    centerline_weights(disp, weights, bounding_box(disp));
+
+    data.set_size(disp.cols(), disp.rows());
+    for (int row = 0; row < disp.rows(); row++) {
+      for (int col = 0; col < disp.cols(); col++) {
+        Vector2f d = disp(col, row).child();
+        data(col, row) = TilePixelType(Vector3f(d[0], d[1], weights(col, row)));
+        if (!is_valid(disp(col, row)))
+          data(col, row).invalidate();
+      }
+    }
+    return data;
+  }
+
+  TileDataType tile_data(int tx, int ty) const {
+    CacheType::KeyT key(tx, ty);
+    TileDataType data;
+    if (m_cache->get(key, data))
+      return data;
+    Mutex::Lock lock(*m_load_mutexes[ty*m_tiles_x + tx]);
+    if (m_cache->get(key, data))
+      return data; // Loaded by another thread while we waited
+    data = load_tile(tx, ty);
+    m_cache->put(key, data);
+    return data;
+  }
+
+public:
+  TileGridBlendView(std::string const& out_prefix, Vector2i const& image_size,
+                    BBox2i const& window, Vector2i const& job_size, int collar,
+                    size_t cache_bytes):
+    m_out_prefix(out_prefix), m_image_size(image_size), m_job_size(job_size),
+    m_window(window), m_collar(collar) {
+    m_window.crop(BBox2i(0, 0, image_size[0], image_size[1]));
+    m_tiles_x = (image_size[0] + job_size[0] - 1)/job_size[0];
+    m_tiles_y = (image_size[1] + job_size[1] - 1)/job_size[1];
+
+    size_t tile_bytes = size_t(job_size[0] + 2*collar)*(job_size[1] + 2*collar)*sizeof(TilePixelType);
+    if (cache_bytes == 0)
+      cache_bytes = 3*m_tiles_x*tile_bytes;
+    vw_out() << "\t--> Keeping up to " << cache_bytes/(1024*1024) << " MB of tiles in memory.\n";
+    if (cache_bytes < 2*m_tiles_x*tile_bytes)
+      vw_out(WarningMessage) << "The memory for tiles holds less than two rows of them, "
+                             << "so tiles will be read from disk more than once.\n";
+    m_cache.reset(new CacheType(cache_bytes));
+    for (int i = 0; i < m_tiles_x*m_tiles_y; i++)
+      m_load_mutexes.push_back(boost::shared_ptr<Mutex>(new Mutex));
+  }
+
+  // Image View interface
+  typedef PixelMask<Vector2f> pixel_type;
+  typedef pixel_type          result_type;
+  typedef ProceduralPixelAccessor<TileGridBlendView> pixel_accessor;
+
+  inline int32 cols  () const { return m_image_size[0]; }
+  inline int32 rows  () const { return m_image_size[1]; }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "TileGridBlendView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    // Sum the weighted disparities of all tiles covering the box
+    ImageView<Vector2f> sums   (bbox.width(), bbox.height());
+    ImageView<float>    weights(bbox.width(), bbox.height());
+    fill(sums, Vector2f());
+    fill(weights, 0.0);
+    std::map<std::pair<int, int>, TileDataType> tiles;
+    int min_tx = std::max(0, (bbox.min().x() - m_collar)/m_job_size[0]);
+    int min_ty = std::max(0, (bbox.min().y() - m_collar)/m_job_size[1]);
+    int max_tx = std::min(m_tiles_x - 1, (bbox.max().x() - 1 + m_collar)/m_job_size[0]);
+    int max_ty = std::min(m_tiles_y - 1, (bbox.max().y() - 1 + m_collar)/m_job_size[1]);
+    for (int ty = min_ty; ty <= max_ty; ty++) {
+      for (int tx = min_tx; tx <= max_tx; tx++) {
+        BBox2i region  = buffered_bbox(tx, ty);
+        BBox2i overlap = region;
+        overlap.crop(bbox);
+        if (overlap.empty())
+          continue;
+        TileDataType data = tile_data(tx, ty);
+        tiles[std::make_pair(tx, ty)] = data;
+        if (data.cols() == 0)
+          continue;
+        for (int row = overlap.min().y(); row < overlap.max().y(); row++) {
+          for (int col = overlap.min().x(); col < overlap.max().x(); col++) {
+            Vector3f const& p = data(col - region.min().x(), row - region.min().y()).child();
+            sums   (col - bbox.min().x(), row - bbox.min().y()) += p[2]*Vector2f(p[0], p[1]);
+            weights(col - bbox.min().x(), row - bbox.min().y()) += p[2];
+          }
+        }
+      }
+    }
+
+    // Keep the pixels valid in the tile owning them
+    ImageView<pixel_type> output(bbox.width(), bbox.height());
+    fill(output, pixel_type());
+    for (std::map<std::pair<int, int>, TileDataType>::const_iterator it = tiles.begin();
+         it != tiles.end(); it++) {
+      TileDataType const& data = it->second;
+      BBox2i region = buffered_bbox(it->first.first, it->first.second);
+      BBox2i owned  = tile_bbox(it->first.first, it->first.second);
+      owned.crop(region);
+      owned.crop(bbox);
+      if (data.cols() == 0 || owned.empty())
+        continue;
+      for (int row = owned.min().y(); row < owned.max().y(); row++) {
+        for (int col = owned.min().x(); col < owned.max().x(); col++) {
+          TilePixelType const& p = data(col - region.min().x(), row - region.min().y());
+          if (!is_valid(p))
+            continue;
+          float w = weights(col - bbox.min().x(), row - bbox.min().y());
+          if (w > 0)
+            output(col - bbox.min().x(), row - bbox.min().y())
+              = pixel_type(sums(col - bbox.min().x(), row - bbox.min().y())/w);
+          else
+            output(col - bbox.min().x(), row - bbox.min().y())
+              = pixel_type(Vector2f(p.child()[0], p.child()[1]));
+        }
+      }
+    }
+
+    return prerasterize_type(output, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+/// Blend all parallel_stereo tiles at once, writing RD.tif for the
+/// whole image. Here opt.out_prefix is the prefix of the whole run.
+void stereo_blending_whole_grid( ASPGlobalOptions const& opt ) {
+
+  Vector2i job_size = stereo_settings().parallel_job_size;
+  if (job_size[0] <= 0 || job_size[1] <= 0)
+    vw_throw( ArgumentErr() << "With --single-process-blend, the parallel_stereo "
+                            << "job size must be set with --parallel-job-size.\n" );
+
+  std::string left_file = opt.out_prefix + "-L.tif";
+  Vector2i image_size = file_image_size(left_file, left_file);
+  BBox2i window = stereo_settings().trans_crop_win;
+  if (window == BBox2i(0, 0, 0, 0))
+    window = BBox2i(0, 0, image_size[0], image_size[1]);
+
+  cartography::GeoReference left_georef;
+  bool   has_left_georef = read_georeference(left_georef, left_file);
+  bool   has_nodata      = false;
+  double nodata          = -32768.0;
+
+  TileGridBlendView output(opt.out_prefix, image_size, window, job_size,
+                           stereo_settings().sgm_collar_size,
+                           size_t(stereo_settings().single_process_blend_cache_mb)*1024*1024);
+
+  string rd_file = opt.out_prefix + "-RD.tif";
+  vw_out() << "Writing: " << rd_file << "\n";
+  vw::cartography::block_write_gdal_image(rd_file, output,
+                                          has_left_georef, left_georef,
+                                          has_nodata, nodata, opt,
+                                          TerminalProgressCallback("asp", "\t--> Blending :") );
+}
+
 void stereo_blending( ASPGlobalOptions const& opt ) {
 
   BlendOptions blend_options;
@@ -586,7 +813,10 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
-    stereo_blending( opt );
+    if (stereo_settings().single_process_blend)
+      stereo_blending_whole_grid( opt );
+    else
+      stereo_blending( opt );
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : BLENDING FINISHED \n";
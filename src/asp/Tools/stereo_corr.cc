@@ -26,8 +26,16 @@
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/refine_disparity.h>
 #include <asp/Core/DemDisparity.h>
 #include <asp/Core/LocalHomography.h>
+#include <asp/Core/SearchRangeIndex.h>
+#include <asp/Core/BlockCache.h>
+#include <asp/Core/TileHash.h>
+#include <asp/Core/CorrelationTelemetry.h>
+#include <asp/Core/StageInstrumentation.h>
+#include <asp/Core/WarpedFootprints.h>
+#include <vw/Core/Stopwatch.h>
 #include <asp/Sessions/StereoSession.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -57,8 +65,8 @@ stereo::CostFunctionType get_cost_mode_value() {
 // Read the search range from D_sub, and scale it to the full image
 void read_search_range_from_dsub(ASPGlobalOptions & opt){
 
-  // No D_sub is generated or should be used for seed mode 0.
-  if (stereo_settings().seed_mode == 0)
+  // No D_sub is generated or should be used for seed modes 0 and 4.
+  if (stereo_settings().seed_mode == 0 || stereo_settings().seed_mode == 4)
     return;
 
   DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
@@ -84,6 +92,71 @@ void read_search_range_from_dsub(ASPGlobalOptions & opt){
 
 
 
+/// The search range for low-resolution correlation in seed mode 1.
+/// This is the full-resolution search range scaled down, and expanded
+/// by the user-selected amount.
+BBox2i lowres_corr_search_range( Vector2 const& downsample_scale ) {
+
+  // Compute the initial search range in the subsampled image
+  BBox2i search_range( floor(elem_prod(downsample_scale,stereo_settings().search_range.min())),
+                       ceil (elem_prod(downsample_scale,stereo_settings().search_range.max())) );
+
+  Vector2i expansion( search_range.width(),
+                      search_range.height() );
+  expansion *= stereo_settings().seed_percent_pad / 2.0f;
+  // Expand by the user selected amount. Default is 25%.
+  search_range.min() -= expansion;
+  search_range.max() += expansion;
+  return search_range;
+}
+
+/// Low-resolution correlation followed by threshold-based outlier
+/// removal, as a view over all of L_sub. Nothing is computed until a
+/// region of it is rasterized.
+ImageViewRef<PixelMask<Vector2f> >
+lowres_disparity_view( DiskImageView<PixelGray<float> > const& left_sub,
+                       DiskImageView<PixelGray<float> > const& right_sub,
+                       DiskImageView<vw::uint8>         const& left_mask_sub,
+                       DiskImageView<vw::uint8>         const& right_mask_sub,
+                       BBox2i const& search_range,
+                       int corr_timeout, double seconds_per_op,
+                       int collar_size, double mean_scale ) {
+
+  stereo::CostFunctionType cost_mode = get_cost_mode_value();
+  Vector2i kernel_size  = stereo_settings().corr_kernel;
+  const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+
+  // TODO: Why the extra filtering step here? PyramidCorrelationView already performs 1-3 iterations of outlier removal.
+  return rm_outliers_using_thresh( // Throw out individual pixels that are far from any neighbors
+           vw::stereo::pyramid_correlate( // Compute image correlation using the PyramidCorrelationView class
+               left_sub, right_sub,
+               left_mask_sub, right_mask_sub,
+               vw::stereo::PREFILTER_LOG, stereo_settings().slogW,
+               search_range, kernel_size, cost_mode,
+               corr_timeout, seconds_per_op,
+               stereo_settings().xcorr_threshold, rm_half_kernel,
+               stereo_settings().corr_max_levels,
+               static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm),
+               collar_size,
+               stereo_settings().corr_blob_filter_area*mean_scale,
+               SAVE_CORR_DEBUG
+           ),
+           // To do: all these hard-coded values must be replaced with
+           // appropriate params from user's stereo.default, for
+           // consistency with how disparity is filtered in stereo_fltr,
+           // when invoking disparity_cleanup_using_thresh.
+           1, 1, // in stereo.default we have 5 5
+           // Changing below the hard-coded value from 2.0 to using a
+           // param.  The default value will still be 2.0 but is now
+           // modifiable. Need to get rid of the 2.0/3.0 factor and
+           // study how it affects the result.
+           stereo_settings().rm_threshold*2.0/3.0,
+           // Another change of hard-coded value to param. Get rid of 0.5/0.6
+           // and study the effect.
+           (stereo_settings().rm_min_matches/100.0)*0.5/0.6
+         ); // End outlier removal arguments
+}
+
 /// Produces the low-resolution disparity file D_sub
 void produce_lowres_disparity( ASPGlobalOptions & opt ) {
 
@@ -101,19 +174,10 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
                             double(left_sub.rows()) / double(Lmask.rows()) );
   double mean_scale = (downsample_scale[0] + downsample_scale[1]) / 2.0;
 
-  // Compute the initial search range in the subsampled image
-  BBox2i search_range( floor(elem_prod(downsample_scale,stereo_settings().search_range.min())),
-                       ceil (elem_prod(downsample_scale,stereo_settings().search_range.max())) );
-
   if ( stereo_settings().seed_mode == 1 ) {
 
     // Use low-res correlation to get the low-res disparity
-    Vector2i expansion( search_range.width(),
-                  			search_range.height() );
-    expansion *= stereo_settings().seed_percent_pad / 2.0f;
-    // Expand by the user selected amount. Default is 25%.
-    search_range.min() -= expansion;
-    search_range.max() += expansion;
+    BBox2i search_range = lowres_corr_search_range(downsample_scale);
     //VW_OUT(DebugMessage,"asp") << "D_sub search range: " << search_range << " px\n";
     std::cout << "D_sub search range: " << search_range << " px\n";
     stereo::CostFunctionType cost_mode = get_cost_mode_value();
@@ -132,42 +196,14 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
           (opt.raster_tile_size[1] > left_sub.rows())   )
         collar_size = 0;
     
-      // Warning: A giant function call approaches!
-      // TODO: Why the extra filtering step here? PyramidCorrelationView already performs 1-3 iterations of outlier removal.
       vw::cartography::block_write_gdal_image( // Write to disk
           opt.out_prefix + "-D_sub.tif",
-          rm_outliers_using_thresh( // Throw out individual pixels that are far from any neighbors
-              vw::stereo::pyramid_correlate( // Compute image correlation using the PyramidCorrelationView class
-                  left_sub, right_sub,
-                  left_mask_sub, right_mask_sub,
-                  vw::stereo::PREFILTER_LOG, stereo_settings().slogW,
-                  search_range, kernel_size, cost_mode,
-                  corr_timeout, seconds_per_op,
-                  stereo_settings().xcorr_threshold, rm_half_kernel,
-                  stereo_settings().corr_max_levels,
-                  static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm),
-                  collar_size,
-                  stereo_settings().corr_blob_filter_area*mean_scale,
-                  SAVE_CORR_DEBUG
-              ),
-              // To do: all these hard-coded values must be replaced with
-              // appropriate params from user's stereo.default, for
-              // consistency with how disparity is filtered in stereo_fltr,
-              // when invoking disparity_cleanup_using_thresh.
-              1, 1, // in stereo.default we have 5 5
-              // Changing below the hard-coded value from 2.0 to using a
-              // param.  The default value will still be 2.0 but is now
-              // modifiable. Need to get rid of the 2.0/3.0 factor and
-              // study how it affects the result.
-              stereo_settings().rm_threshold*2.0/3.0,
-              // Another change of hard-coded value to param. Get rid of 0.5/0.6
-              // and study the effect.
-              (stereo_settings().rm_min_matches/100.0)*0.5/0.6
-          ), // End outlier removal arguments
+          lowres_disparity_view(left_sub, right_sub, left_mask_sub, right_mask_sub,
+                                search_range, corr_timeout, seconds_per_op,
+                                collar_size, mean_scale),
           opt,
           TerminalProgressCallback("asp", "\t--> Low-resolution disparity:")
       );
-      // End of giant function call block
     }
     else { // Use quantile based filtering - This filter needs to be profiled to improve its speed.
     
@@ -209,6 +245,240 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
   read_search_range_from_dsub(opt); // TODO: We already call this when needed!
 } // End produce_lowres_disparity
 
+/// Load D_sub, D_sub_spread (if needed and present), and the local
+/// homographies (if needed), for seeding full-resolution correlation.
+void load_lowres_seed( ASPGlobalOptions const& opt,
+                       ImageViewRef<PixelMask<Vector2f> > & sub_disp,
+                       ImageViewRef<PixelMask<Vector2i> > & sub_disp_spread,
+                       ImageView<Matrix3x3> & local_hom ) {
+
+  std::string dsub_file   = opt.out_prefix+"-D_sub.tif";
+  std::string spread_file = opt.out_prefix+"-D_sub_spread.tif";
+
+  // Seed mode 4 uses interest point matches rather than D_sub.
+  if ( stereo_settings().seed_mode == 4 )
+    return;
+
+  if ( stereo_settings().seed_mode > 0 )
+    sub_disp = DiskImageView<PixelMask<Vector2f> >(dsub_file);
+  if ( stereo_settings().seed_mode == 2 ||  stereo_settings().seed_mode == 3 ){
+    // D_sub_spread is mandatory for seed_mode 2 and 3.
+    sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
+  }else if ( stereo_settings().seed_mode == 1 ){
+    // D_sub_spread is optional for seed_mode 1, we use it only if it is provided.
+    if (fs::exists(spread_file)) {
+      try {
+        sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
+      }
+      catch (...) {}
+    }
+  }
+
+  if ( stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography ){
+    string local_hom_file = opt.out_prefix + "-local_hom.txt";
+    read_local_homographies(local_hom_file, local_hom);
+  }
+}
+
+/// Load the per-tile search range index saved next to D_sub. If it is
+/// missing or was made from other inputs, compute it, and save it if
+/// save_index is set. The inputs are compared by the hash of the pixels
+/// of D_sub and D_sub_spread rather than by file time, as stereo_parse
+/// rewrites these with a georeference after the index is made.
+void load_search_range_index( ASPGlobalOptions const& opt, bool save_index,
+                              ImageViewRef<PixelMask<Vector2f> > const& sub_disp,
+                              ImageViewRef<PixelMask<Vector2i> > const& sub_disp_spread,
+                              ImageView<Matrix3x3> const& local_hom,
+                              SearchRangeIndex & search_index ) {
+
+  int      ts         = ASPGlobalOptions::corr_tile_size();
+  Vector2i image_size = file_image_size( opt.out_prefix + "-L.tif" );
+  Vector2i sub_size( sub_disp.cols(), sub_disp.rows() );
+  bool     use_local_homography = stereo_settings().use_local_homography;
+  bool     has_spread = ( sub_disp_spread.cols() != 0 && sub_disp_spread.rows() != 0 );
+
+  // D_sub is small, so read it, and its spread, fully in memory once,
+  // both for the hash and for computing the index.
+  ImageView<PixelMask<Vector2f> > sub_disp_mem = sub_disp;
+  ImageView<PixelMask<Vector2i> > spread_mem;
+  if (has_spread)
+    spread_mem = sub_disp_spread;
+
+  ContentHash hash;
+  hash.add_image(sub_disp_mem);
+  hash.add_image(spread_mem);
+  if (use_local_homography)
+    hash.add_file(opt.out_prefix + "-local_hom.txt");
+
+  std::string index_file = opt.out_prefix + "-D_sub_index.bin";
+  if (fs::exists(index_file)) {
+    try {
+      search_index.read(index_file);
+      if (search_index.is_compatible(ts, image_size, sub_size,
+                                     use_local_homography, has_spread) &&
+          search_index.input_hash() == hash.value())
+        return;
+    } catch (vw::IOErr const& e) {}
+  }
+
+  vw_out() << "\t--> Computing the search range index.\n";
+  compute_search_range_index(sub_disp_mem, spread_mem, local_hom, use_local_homography,
+                             image_size, ts, search_index);
+  search_index.set_input_hash(hash.value());
+
+  if (save_index) {
+    vw_out() << "Writing: " << index_file << "\n";
+    search_index.write(index_file);
+  }
+}
+
+/// Read interest point matches between the unaligned input images, and
+/// return the left points and the disparities, both in the coordinates of
+/// the aligned images L.tif and R.tif. Points which fall outside of the
+/// aligned images are skipped.
+void read_aligned_ip_disparities( ASPGlobalOptions const& opt,
+                                  std::string const& match_filename,
+                                  std::vector<Vector2> & left_points,
+                                  std::vector<Vector2> & disparities ) {
+
+  left_points.clear();
+  disparities.clear();
+
+  vector<ip::InterestPoint> ip1, ip2;
+  ip::read_binary_match_file( match_filename, ip1, ip2 );
+
+  Matrix<double> align_left_matrix  = math::identity_matrix<3>();
+  Matrix<double> align_right_matrix = math::identity_matrix<3>();
+  if ( fs::exists(opt.out_prefix+"-align-L.exr") )
+    read_matrix(align_left_matrix, opt.out_prefix + "-align-L.exr");
+  if ( fs::exists(opt.out_prefix+"-align-R.exr") )
+    read_matrix(align_right_matrix, opt.out_prefix + "-align-R.exr");
+
+  Vector2 left_size  = file_image_size( opt.out_prefix+"-L.tif" );
+  Vector2 right_size = file_image_size( opt.out_prefix+"-R.tif" );
+
+  // Loop through all the IP we found
+  for ( size_t i = 0; i < ip1.size(); i++ ) {
+    // Apply the alignment transforms to the recorded IP
+    Vector3 r = align_right_matrix * Vector3(ip2[i].x, ip2[i].y, 1);
+    Vector3 l = align_left_matrix  * Vector3(ip1[i].x, ip1[i].y, 1);
+
+    // Normalize the coordinates, but don't divide by 0
+    if (l[2] == 0 || r[2] == 0) 
+      continue;
+    r /= r[2];
+    l /= l[2];
+
+    // Skip points which fall outside the transformed images
+    // - This is not a very precise check but points should already be filtered.
+    // - Could replace this with a statistical filter if we need to.
+    if ((l[0] > left_size [0])  || (l[1] > left_size [1]) ||
+        (r[0] > right_size[0])  || (r[1] > right_size[1]) ||
+        (l[0] < 0) || (l[1] < 0) || (r[0] < 0) || (r[1] < 0) )
+      continue;
+
+    left_points.push_back(subvector(l,0,2));
+    disparities.push_back(subvector(r,0,2) - subvector(l,0,2));
+  }
+}
+
+/// Read the interest point matches between L_sub.tif and R_sub.tif,
+/// made when there are none for the full-resolution images, and scale
+/// them to L.tif and R.tif. Returns false if there are none either.
+bool read_lowres_ip_disparities( ASPGlobalOptions const& opt,
+                                 std::vector<Vector2> & left_points,
+                                 std::vector<Vector2> & disparities ) {
+
+  left_points.clear();
+  disparities.clear();
+
+  string match_filename = ip::match_filename(opt.out_prefix, opt.out_prefix+"-L_sub.tif",
+                                             opt.out_prefix+"-R_sub.tif");
+  if (!fs::exists(match_filename))
+    return false;
+
+  vector<ip::InterestPoint> ip1, ip2;
+  ip::read_binary_match_file( match_filename, ip1, ip2 );
+
+  Vector2 left_scale  = elem_quot( Vector2(file_image_size( opt.out_prefix+"-L.tif" )),
+                                   Vector2(file_image_size( opt.out_prefix+"-L_sub.tif" )) );
+  Vector2 right_scale = elem_quot( Vector2(file_image_size( opt.out_prefix+"-R.tif" )),
+                                   Vector2(file_image_size( opt.out_prefix+"-R_sub.tif" )) );
+  for ( size_t i = 0; i < ip1.size(); i++ ) {
+    Vector2 l = elem_prod( Vector2(ip1[i].x, ip1[i].y), left_scale  );
+    Vector2 r = elem_prod( Vector2(ip2[i].x, ip2[i].y), right_scale );
+    left_points.push_back(l);
+    disparities.push_back(r - l);
+  }
+  return true;
+}
+
+// For seed mode 4, a tile with fewer interest points than this within
+// half a tile of it takes its search range from this many nearest ones.
+const int IP_SEED_MIN_POINTS = 10;
+
+// For seed mode 4, the search range of each tile is grown by this many
+// pixels on each side beyond the range of its interest points, as these
+// sample the disparity only sparsely.
+const int IP_SEED_MARGIN = 8;
+
+// For seed mode 4, the disparities of the interest points of a tile
+// which are more than this many interquartile ranges beyond the
+// quartiles are taken to be wrong matches, and do not widen its range.
+const double IP_SEED_OUTLIER_FACTOR = 1.5;
+
+/// Load the per-tile search range index made from interest point matches
+/// in seed mode 4. If it is missing or was made from other matches or
+/// alignment, compute it, and save it if save_index is set.
+void load_ip_search_range_index( ASPGlobalOptions const& opt, bool save_index,
+                                 SearchRangeIndex & search_index ) {
+
+  int      ts         = ASPGlobalOptions::corr_tile_size();
+  Vector2i image_size = file_image_size( opt.out_prefix + "-L.tif" );
+
+  string match_filename = ip::match_filename(opt.out_prefix, opt.in_file1, opt.in_file2);
+  string sub_match_filename = ip::match_filename(opt.out_prefix, opt.out_prefix+"-L_sub.tif",
+                                                 opt.out_prefix+"-R_sub.tif");
+  std::string index_file = opt.out_prefix + "-ip_search_range_index.bin";
+  ContentHash hash;
+  hash.add_file(match_filename);
+  hash.add_file(sub_match_filename);
+  hash.add_file(opt.out_prefix + "-align-L.exr");
+  hash.add_file(opt.out_prefix + "-align-R.exr");
+  hash.add_value(double(stereo_settings().seed_percent_pad));
+
+  if (fs::exists(index_file)) {
+    try {
+      search_index.read(index_file);
+      if (search_index.is_compatible(ts, image_size, image_size, false, false) &&
+          search_index.input_hash() == hash.value())
+        return;
+    } catch (vw::IOErr const& e) {}
+  }
+
+  std::vector<Vector2> left_points, disparities;
+  if (fs::exists(match_filename))
+    read_aligned_ip_disparities(opt, match_filename, left_points, disparities);
+  else if (!read_lowres_ip_disparities(opt, left_points, disparities))
+    vw_throw( ArgumentErr() << "Seed mode 4 needs interest point matches, but found neither "
+              << match_filename << " nor " << sub_match_filename << ".\n" );
+  if (left_points.empty())
+    vw_throw( ArgumentErr() << "Seed mode 4 needs interest point matches, but none "
+              << "are within the aligned images.\n" );
+
+  vw_out() << "\t--> Computing the search range index from " << left_points.size()
+           << " interest point matches.\n";
+  compute_search_range_index_from_points(left_points, disparities, image_size, ts,
+                                         IP_SEED_MIN_POINTS, stereo_settings().seed_percent_pad,
+                                         IP_SEED_MARGIN, IP_SEED_OUTLIER_FACTOR, search_index);
+  search_index.set_input_hash(hash.value());
+
+  if (save_index) {
+    vw_out() << "Writing: " << index_file << "\n";
+    search_index.write(index_file);
+  }
+}
+
 /// The first step of correlation computation.
 void lowres_correlation( ASPGlobalOptions & opt ) {
 
@@ -268,44 +538,12 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
       std::cout << "Loading existing IP... " << std::endl;
     
       // There exists a matchfile out there.
-      vector<ip::InterestPoint> ip1, ip2;
-      ip::read_binary_match_file( match_filename, ip1, ip2 );
-
-      Matrix<double> align_left_matrix  = math::identity_matrix<3>();
-      Matrix<double> align_right_matrix = math::identity_matrix<3>();
-      if ( fs::exists(opt.out_prefix+"-align-L.exr") )
-        read_matrix(align_left_matrix, opt.out_prefix + "-align-L.exr");
-      if ( fs::exists(opt.out_prefix+"-align-R.exr") )
-        read_matrix(align_right_matrix, opt.out_prefix + "-align-R.exr");
+      std::vector<Vector2> left_points, disparities;
+      read_aligned_ip_disparities(opt, match_filename, left_points, disparities);
 
-      Vector2 left_size  = file_image_size( opt.out_prefix+"-L.tif" );
-      Vector2 right_size = file_image_size( opt.out_prefix+"-R.tif" );
-
-      // Loop through all the IP we found
       BBox2 search_range;
-      for ( size_t i = 0; i < ip1.size(); i++ ) {
-        // Apply the alignment transforms to the recorded IP
-        Vector3 r = align_right_matrix * Vector3(ip2[i].x, ip2[i].y, 1);
-        Vector3 l = align_left_matrix  * Vector3(ip1[i].x, ip1[i].y, 1);
-
-	      // Normalize the coordinates, but don't divide by 0
-	      if (l[2] == 0 || r[2] == 0) 
-          continue;
-	      r /= r[2];
-	      l /= l[2];
-
-        // Skip points which fall outside the transformed images
-        // - This is not a very precise check but points should already be filtered.
-        // - Could replace this with a statistical filter if we need to.
-	      if ((l[0] > left_size [0])  || (l[1] > left_size [1]) ||
-	          (r[0] > right_size[0])  || (r[1] > right_size[1]) ||
-	          (l[0] < 0) || (l[1] < 0) || (r[0] < 0) || (r[1] < 0) )
-          continue;
-
-        Vector2 this_disparity = subvector(r,0,2) - subvector(l,0,2);        
-        //std::cout << "this_disparity = " << this_disparity << std::endl;
-	      search_range.grow(this_disparity);
-      }
+      for ( size_t i = 0; i < disparities.size(); i++ )
+        search_range.grow(disparities[i]);
       stereo_settings().search_range = grow_bbox_to_int( search_range );
     }
     vw_out() << "\t--> Detected search range: " << stereo_settings().search_range << "\n";
@@ -316,8 +554,12 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
   DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
                            Rmask(opt.out_prefix + "-rMask.tif");
 
-  // Performing disparity on sub images
-  if ( stereo_settings().seed_mode > 0 ) {
+  // Performing disparity on sub images. When it is computed on
+  // demand, all that is needed here is the search range found above.
+  // With seed mode 4, the interest point matches take its place.
+  bool seed_on_demand = stereo_settings().lowres_seed_on_demand;
+  bool seed_from_ip   = (stereo_settings().seed_mode == 4);
+  if ( stereo_settings().seed_mode > 0 && !seed_on_demand && !seed_from_ip ) {
 
     // Reuse prior existing D_sub if it exists, unless we
     // are cropping the images each time, when D_sub must
@@ -347,7 +589,8 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
   }
 
   // Create the local homographies based on D_sub
-  if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography){
+  if (stereo_settings().seed_mode > 0 && !seed_on_demand && !seed_from_ip &&
+      stereo_settings().use_local_homography){
     string local_hom_file = opt.out_prefix + "-local_hom.txt";
     try {
       ImageView<Matrix3x3> local_hom;
@@ -357,11 +600,167 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
     }
   }
 
+  // Tabulate the search range of each tile, so that full-resolution
+  // correlation need not scan D_sub for every tile.
+  if (seed_from_ip){
+    SearchRangeIndex search_index;
+    load_ip_search_range_index(opt, true, search_index);
+  } else if (stereo_settings().seed_mode > 0 && !seed_on_demand){
+    ImageViewRef<PixelMask<Vector2f> > sub_disp;
+    ImageViewRef<PixelMask<Vector2i> > sub_disp_spread;
+    ImageView<Matrix3x3> local_hom;
+    SearchRangeIndex search_index;
+    load_lowres_seed(opt, sub_disp, sub_disp_spread, local_hom);
+    load_search_range_index(opt, true, sub_disp, sub_disp_spread, local_hom, search_index);
+  }
+
   vw_out() << "\n[ " << current_posix_time_string() << " ] : LOW-RESOLUTION CORRELATION FINISHED \n";
 } // End lowres_correlation
 
 
 
+/// Convert a search range found in D_sub to full resolution.
+BBox2f upscale_search_range( BBox2i const& lowres_range, Vector2 const& upscale_factor ) {
+  BBox2f search_range;
+  search_range = lowres_range;
+  // Expand the search range by 1. This is necessary since
+  // D_sub is integer-valued, and perhaps the search
+  // range was supposed to be a fraction of integer bigger.
+  search_range.expand(1);
+
+  // Scale the search range to full-resolution
+  search_range.min() = floor(elem_prod(search_range.min(), upscale_factor));
+  search_range.max() = ceil (elem_prod(search_range.max(), upscale_factor));
+  return search_range;
+}
+
+/// Computes the low-resolution disparity lazily, one square region of
+/// L_sub at a time, when a full-resolution tile first needs it. Each
+/// region is correlated with a collar around it, so that the outlier
+/// filter sees the same neighbors as when all of D_sub is computed at
+/// once, and is then kept for use by other tiles. Different regions can
+/// be computed in parallel, while tiles needing a region being computed
+/// wait for it.
+class LowResSeedCache {
+public:
+
+  // Size, in low-resolution pixels, of each region and of its collar.
+  static const int REGION_SIZE = 256;
+  static const int COLLAR_SIZE = 16;
+
+  LowResSeedCache( ASPGlobalOptions const& opt ):
+    m_left_sub      (opt.out_prefix + "-L_sub.tif"),
+    m_right_sub     (opt.out_prefix + "-R_sub.tif"),
+    m_left_mask_sub (opt.out_prefix + "-lMask_sub.tif"),
+    m_right_mask_sub(opt.out_prefix + "-rMask_sub.tif") {
+
+    Vector2i full_size = file_image_size(opt.out_prefix + "-L.tif");
+    Vector2  downsample_scale( double(m_left_sub.cols()) / double(full_size[0]),
+                               double(m_left_sub.rows()) / double(full_size[1]) );
+    double mean_scale = (downsample_scale[0] + downsample_scale[1]) / 2.0;
+
+    BBox2i search_range = lowres_corr_search_range(downsample_scale);
+    vw_out() << "\t--> Computing low-resolution disparity on demand with search range "
+             << search_range << "\n";
+
+    int    corr_timeout   = 5*stereo_settings().corr_timeout; // 5x, so try hard
+    double seconds_per_op = 0.0;
+    if (corr_timeout > 0)
+      seconds_per_op = calc_seconds_per_op(get_cost_mode_value(), m_left_sub, m_right_sub,
+                                           stereo_settings().corr_kernel);
+
+    m_disp = lowres_disparity_view(m_left_sub, m_right_sub, m_left_mask_sub, m_right_mask_sub,
+                                   search_range, corr_timeout, seconds_per_op,
+                                   stereo_settings().sgm_collar_size, mean_scale);
+  }
+
+  int32 cols() const { return m_left_sub.cols(); }
+  int32 rows() const { return m_left_sub.rows(); }
+
+  /// Find the range of the low-resolution disparity in the low-res box
+  /// seed_bbox, computing the disparity of the regions it touches if
+  /// not done yet. Returns false if there are no valid disparities there.
+  bool search_range( BBox2i const& seed_bbox, BBox2i & range ) {
+
+    range = BBox2i();
+    bool found = false;
+    if (seed_bbox.empty())
+      return false;
+
+    ImageViewRef<PixelMask<Vector2i> > no_spread;
+    Matrix<double> no_hom = math::identity_matrix<3>();
+    int min_col = seed_bbox.min().x()/REGION_SIZE, max_col = (seed_bbox.max().x()-1)/REGION_SIZE;
+    int min_row = seed_bbox.min().y()/REGION_SIZE, max_row = (seed_bbox.max().y()-1)/REGION_SIZE;
+    for (int row = min_row; row <= max_row; row++){
+      for (int col = min_col; col <= max_col; col++){
+        boost::shared_ptr<Region> region = get_region(col, row);
+        BBox2i box = seed_bbox;
+        box.crop(region->bbox);
+        BBox2i region_range;
+        if (!lowres_search_range(region->disp, no_spread, no_hom, false,
+                                 box - region->bbox.min(), region_range))
+          continue;
+        if (found)
+          range.grow(region_range);
+        else
+          range = region_range;
+        found = true;
+      }
+    }
+
+    if (!found)
+      range = BBox2i(0, 0, 0, 0);
+    return found;
+  }
+
+private:
+
+  struct Region {
+    Mutex  mutex;
+    bool   done;
+    BBox2i bbox;
+    ImageView<PixelMask<Vector2f> > disp;
+    Region(): done(false) {}
+  };
+
+  /// Find the given region, computing it first if need be.
+  boost::shared_ptr<Region> get_region( int col, int row ) {
+
+    boost::shared_ptr<Region> region;
+    {
+      Mutex::Lock lock(m_mutex);
+      boost::shared_ptr<Region> & entry = m_regions[std::make_pair(col, row)];
+      if (!entry)
+        entry.reset(new Region);
+      region = entry;
+    }
+
+    // Other threads needing this region wait here until it is done
+    Mutex::Lock lock(region->mutex);
+    if (!region->done){
+      BBox2i bbox(col*REGION_SIZE, row*REGION_SIZE, REGION_SIZE, REGION_SIZE);
+      bbox.crop(bounding_box(m_left_sub));
+      BBox2i collar_bbox = bbox;
+      collar_bbox.expand(COLLAR_SIZE);
+      collar_bbox.crop(bounding_box(m_left_sub));
+
+      VW_OUT(DebugMessage, "stereo") << "Computing low-resolution disparity for: "
+                                     << bbox << "\n";
+      ImageView<PixelMask<Vector2f> > collar_disp = crop(m_disp, collar_bbox);
+      region->disp = crop(collar_disp, bbox - collar_bbox.min());
+      region->bbox = bbox;
+      region->done = true;
+    }
+    return region;
+  }
+
+  DiskImageView<PixelGray<float> > m_left_sub, m_right_sub;
+  DiskImageView<vw::uint8>         m_left_mask_sub, m_right_mask_sub;
+  ImageViewRef<PixelMask<Vector2f> > m_disp;
+  std::map<std::pair<int, int>, boost::shared_ptr<Region> > m_regions;
+  Mutex m_mutex;
+};
+
 /// This correlator takes a low resolution disparity image as an input
 /// so that it may narrow its search range for each tile that is processed.
 class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
@@ -372,6 +771,23 @@ class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
   ImageViewRef<PixelMask<Vector2f> > m_sub_disp;
   ImageViewRef<PixelMask<Vector2i> > m_sub_disp_spread;
   ImageView<Matrix3x3> const& m_local_hom;
+  SearchRangeIndex     const& m_search_index;
+  boost::shared_ptr<LowResSeedCache> m_seed_cache; // Set if computing the seed on demand
+
+  boost::shared_ptr<CorrelationTelemetry> m_telemetry; // Per-tile timing
+  boost::shared_ptr<WarpedFootprintStore> m_warped_footprints; // Set if saving the warps
+
+  // For incremental correlation
+  boost::shared_ptr<TileHashTable>   m_tile_hashes, m_prev_tile_hashes;
+  ImageViewRef<PixelMask<Vector2f> > m_prev_disp;
+  Vector2i m_crop_min;
+
+  // The right image and mask, read through a block cache shared by all
+  // tiles, as neighboring tiles with wide search ranges read mostly the
+  // same right image region. Used only if corr-right-image-cache-mb is
+  // positive.
+  CachedBlockView<DiskImageView<PixelGray<float> > > m_right_image_cached;
+  CachedBlockView<DiskImageView<vw::uint8> >         m_right_mask_cached;
 
   // Settings
   Vector2  m_upscale_factor;
@@ -389,6 +805,18 @@ public:
   typedef ImageViewRef<PixelMask<Vector2f> > DispSeedImageType;
   typedef ImageViewRef<PixelMask<Vector2i> > SpreadImageType;
   typedef ImageType::pixel_type InputPixelType;
+  typedef CachedBlockView<ImageType> CachedImageType;
+  typedef CachedBlockView<MaskType>  CachedMaskType;
+
+  // Size of the blocks in the right image cache.
+  static const int CACHE_BLOCK_SIZE = 256;
+
+  /// The share of the right image cache memory for pixels of given
+  /// size, with the memory split between the image and the mask.
+  static size_t right_image_cache_bytes(size_t pixel_size) {
+    size_t total = size_t(std::max(0, stereo_settings().corr_right_image_cache_mb))*1024*1024;
+    return total / (sizeof(InputPixelType) + sizeof(vw::uint8)) * pixel_size;
+  }
 
   SeededCorrelatorView( ImageType             const& left_image,
                         ImageType             const& right_image,
@@ -397,18 +825,29 @@ public:
                         DispSeedImageType     const& sub_disp,
                         SpreadImageType       const& sub_disp_spread,
                         ImageView<Matrix3x3>  const& local_hom,
+                        SearchRangeIndex      const& search_index,
+                        boost::shared_ptr<LowResSeedCache> seed_cache,
                         Vector2i const& kernel_size,
                         stereo::CostFunctionType cost_mode,
                         int corr_timeout, double seconds_per_op) :
     m_left_image(left_image.impl()), m_right_image(right_image.impl()),
     m_left_mask (left_mask.impl ()), m_right_mask (right_mask.impl ()),
     m_sub_disp(sub_disp.impl()), m_sub_disp_spread(sub_disp_spread.impl()),
-    m_local_hom(local_hom),
+    m_local_hom(local_hom), m_search_index(search_index), m_seed_cache(seed_cache),
+    m_right_image_cached(cached_block_view(right_image.impl(), CACHE_BLOCK_SIZE,
+                                           right_image_cache_bytes(sizeof(InputPixelType)))),
+    m_right_mask_cached (cached_block_view(right_mask.impl(),  CACHE_BLOCK_SIZE,
+                                           right_image_cache_bytes(sizeof(vw::uint8)))),
     m_kernel_size(kernel_size),  m_cost_mode(cost_mode),
     m_corr_timeout(corr_timeout), m_seconds_per_op(seconds_per_op){
-    m_upscale_factor[0] = double(m_left_image.cols()) / m_sub_disp.cols();
-    m_upscale_factor[1] = double(m_left_image.rows()) / m_sub_disp.rows();
-    m_seed_bbox = bounding_box( m_sub_disp );
+    Vector2i sub_size( m_sub_disp.cols(), m_sub_disp.rows() );
+    if (m_seed_cache)
+      sub_size = Vector2i( m_seed_cache->cols(), m_seed_cache->rows() );
+    else if (stereo_settings().seed_mode == 4)
+      sub_size = m_search_index.sub_image_size(); // Ranges are at full resolution
+    m_upscale_factor[0] = double(m_left_image.cols()) / sub_size[0];
+    m_upscale_factor[1] = double(m_left_image.rows()) / sub_size[1];
+    m_seed_bbox = BBox2i( 0, 0, sub_size[0], sub_size[1] );
   }
 
   // Image View interface
@@ -427,6 +866,142 @@ public:
     return pixel_type();
   }
 
+  /// The region of the right image which the correlator may access when
+  /// processing the tile bbox with given search range.
+  BBox2i right_footprint(BBox2i const& bbox, BBox2f const& search_range) const {
+    return asp::correlation_footprint(bbox, search_range, footprint_margin(),
+                                      bounding_box(m_left_image));
+  }
+
+  /// How far beyond a tile, or its search range, the correlator may read.
+  int footprint_margin() const {
+    int collar = 0;
+    if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW)
+      collar = stereo_settings().sgm_collar_size;
+    return asp::correlation_footprint_margin(m_kernel_size,
+                                             stereo_settings().corr_max_levels, collar);
+  }
+
+  /// A hash of all that the disparity of tile bbox depends on: the
+  /// settings, the search range and homography, and the input pixels
+  /// which the correlator may read.
+  uint64 tile_input_hash(BBox2i const& bbox, BBox2f const& search_range,
+                         Matrix<double> const& fullres_hom) const {
+    ContentHash hash;
+    hash.add_value(m_kernel_size[0]);
+    hash.add_value(m_kernel_size[1]);
+    hash.add_value(int(m_cost_mode));
+    hash.add_value(m_corr_timeout);
+    hash.add_value(int(stereo_settings().pre_filter_mode));
+    hash.add_value(double(stereo_settings().slogW));
+    hash.add_value(double(stereo_settings().xcorr_threshold));
+    hash.add_value(int(stereo_settings().corr_max_levels));
+    hash.add_value(int(stereo_settings().stereo_algorithm));
+    hash.add_value(int(stereo_settings().sgm_collar_size));
+    hash.add_value(int(stereo_settings().corr_blob_filter_area));
+    hash.add_value(double(search_range.min().x()));
+    hash.add_value(double(search_range.min().y()));
+    hash.add_value(double(search_range.max().x()));
+    hash.add_value(double(search_range.max().y()));
+    for (size_t row = 0; row < fullres_hom.rows(); row++)
+      for (size_t col = 0; col < fullres_hom.cols(); col++)
+        hash.add_value(double(fullres_hom(row, col)));
+
+    BBox2i left_box = bbox;
+    left_box.expand(footprint_margin());
+    left_box.crop(bounding_box(m_left_image));
+
+    // The region of the right image before any warping
+    BBox2i right_box;
+    if (stereo_settings().use_local_homography){
+      BBox2i footprint = right_footprint(bbox, search_range);
+      Matrix<double> inv_hom = vw::math::inverse(fullres_hom);
+      BBox2 raw_box;
+      for (int i = 0; i < 4; i++){
+        Vector3 corner( i % 2 == 0 ? footprint.min().x() : footprint.max().x(),
+                        i / 2 == 0 ? footprint.min().y() : footprint.max().y(), 1 );
+        Vector3 raw = inv_hom*corner;
+        if (raw[2] != 0)
+          raw_box.grow(subvector(raw, 0, 2)/raw[2]);
+      }
+      right_box = grow_bbox_to_int(raw_box);
+      right_box.expand(2); // For interpolation
+    }else{
+      right_box = bbox;
+      right_box.min() += Vector2i(floor(search_range.min()));
+      right_box.max() += Vector2i(ceil (search_range.max()));
+      right_box.expand(footprint_margin());
+    }
+    right_box.crop(bounding_box(m_right_image));
+
+    hash.add_bbox(left_box);
+    hash.add_bbox(right_box);
+    hash.add_image(ImageView<InputPixelType>(crop(m_left_image,  left_box )));
+    hash.add_image(ImageView<vw::uint8     >(crop(m_left_mask,   left_box )));
+    hash.add_image(ImageView<InputPixelType>(crop(m_right_image, right_box)));
+    hash.add_image(ImageView<vw::uint8     >(crop(m_right_mask,  right_box)));
+    return hash.value();
+  }
+
+  /// Record the timing of a tile, if telemetry is enabled.
+  void record_tile(BBox2i const& bbox, BBox2f const& search_range,
+                   double seconds, double seconds_per_op, bool reused) const {
+    if (!m_telemetry)
+      return;
+    CorrTileRecord record;
+    record.tile           = bbox;
+    record.search_range   = search_range;
+    record.ops            = search_volume(bbox, search_range);
+    record.seconds        = seconds;
+    record.seconds_per_op = seconds_per_op;
+    record.timed_out      = !reused && may_time_out(bbox, search_range, seconds_per_op);
+    record.reused         = reused;
+    m_telemetry->add(record);
+  }
+
+  /// Whether the correlator may skip parts of this tile, if their
+  /// estimated time exceeds the timeout. It checks each region at each
+  /// pyramid level, and none is larger or has a larger search range than
+  /// the tile at full resolution.
+  bool may_time_out(BBox2i const& bbox, BBox2f const& search_range,
+                    double seconds_per_op) const {
+    if (m_corr_timeout <= 0)
+      return false;
+    return seconds_per_op*search_volume(bbox, search_range) > m_corr_timeout;
+  }
+
+  /// With incremental correlation, record the hash of a correlated tile,
+  /// unless it may have timed out, as then its result depends on the
+  /// load of the machine and must not be reused.
+  void save_tile_hash(BBox2i const& bbox, BBox2f const& search_range,
+                      double seconds_per_op, uint64 hash) const {
+    if (m_tile_hashes && !may_time_out(bbox, search_range, seconds_per_op))
+      m_tile_hashes->set(bbox - m_crop_min, hash);
+  }
+
+  void set_telemetry( boost::shared_ptr<CorrelationTelemetry> telemetry ) {
+    m_telemetry = telemetry;
+  }
+
+  /// Save the warped right image footprint of each tile, made larger
+  /// so that refinement can use it too.
+  void set_warped_footprints( boost::shared_ptr<WarpedFootprintStore> warped_footprints ) {
+    m_warped_footprints = warped_footprints;
+  }
+
+  /// Enable incremental correlation. The hash of each tile is recorded
+  /// in tile_hashes. Tiles whose hash is the same as in prev_tile_hashes
+  /// are copied from prev_disp. Tiles are relative to crop_min.
+  void set_incremental( boost::shared_ptr<TileHashTable> tile_hashes,
+                        boost::shared_ptr<TileHashTable> prev_tile_hashes,
+                        ImageViewRef<pixel_type> const& prev_disp,
+                        Vector2i const& crop_min ) {
+    m_tile_hashes      = tile_hashes;
+    m_prev_tile_hashes = prev_tile_hashes;
+    m_prev_disp        = prev_disp;
+    m_crop_min         = crop_min;
+  }
+
   /// Does the work
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
@@ -438,85 +1013,50 @@ public:
     ImageViewRef<InputPixelType> right_trans_img;
     ImageViewRef<vw::uint8     > right_trans_mask;
 
-    bool do_round = true; // round integer disparities after transform
-
     // User strategies
     BBox2f local_search_range;
     if ( stereo_settings().seed_mode > 0 ) {
 
-      // The low-res version of bbox
-      BBox2i seed_bbox( elem_quot(bbox.min(), m_upscale_factor),
-			                  elem_quot(bbox.max(), m_upscale_factor) );
-      seed_bbox.expand(1);
-      seed_bbox.crop( m_seed_bbox );
-      // Get the disparity range in d_sub corresponding to this tile.
-      VW_OUT(DebugMessage, "stereo") << "Getting disparity range for : " << seed_bbox << "\n";
-      DispSeedImageType disparity_in_box = crop( m_sub_disp, seed_bbox );
-
-      if (!use_local_homography){
-        local_search_range = stereo::get_disparity_range( disparity_in_box );
-      }else{ // seed_mode == 0
+      if (use_local_homography){
         int ts = ASPGlobalOptions::corr_tile_size();
         lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
-        local_search_range = stereo::get_disparity_range
-          (transform_disparities(do_round, seed_bbox,
-			     lowres_hom, disparity_in_box));
       }
 
-      bool has_sub_disp_spread = ( m_sub_disp_spread.cols() != 0 &&
-			                             m_sub_disp_spread.rows() != 0 );
-      // Sanity check: If m_sub_disp_spread was provided, it better have the same size as sub_disp.
-      if ( has_sub_disp_spread &&
-           m_sub_disp_spread.cols() != m_sub_disp.cols() &&
-           m_sub_disp_spread.rows() != m_sub_disp.rows() ){
-        vw_throw( ArgumentErr() << "stereo_corr: D_sub and D_sub_spread must have equal sizes.\n");
+      // Look up the search range in the precomputed index. That is the
+      // range of this tile only if the tile is within a single cell, else
+      // it is computed from D_sub below, as the union of the ranges of
+      // the cells would be wider. With seed mode 4 the index is all there is.
+      BBox2i lowres_range;
+      bool found = false;
+      if (!m_seed_cache &&
+          (stereo_settings().seed_mode == 4 || m_search_index.is_single_cell(bbox)))
+        found = m_search_index.lookup(bbox, lowres_range);
+
+      if (!found && stereo_settings().seed_mode == 4){
+        // No interest points at all, which is checked for when making
+        // the index, so this should not happen.
+        lowres_range = stereo_settings().search_range;
+      }else if (!found){
+        // The low-res version of bbox
+        BBox2i seed_bbox( elem_quot(bbox.min(), m_upscale_factor),
+                          elem_quot(bbox.max(), m_upscale_factor) );
+        seed_bbox.expand(1);
+        seed_bbox.crop( m_seed_bbox );
+        // Get the disparity range in d_sub corresponding to this tile.
+        VW_OUT(DebugMessage, "stereo") << "Getting disparity range for : " << seed_bbox << "\n";
+        if (m_seed_cache)
+          m_seed_cache->search_range(seed_bbox, lowres_range);
+        else
+          lowres_search_range(m_sub_disp, m_sub_disp_spread, lowres_hom,
+                              use_local_homography, seed_bbox, lowres_range);
       }
-
-      if (has_sub_disp_spread){
-        // Expand the disparity range by m_sub_disp_spread.
-        SpreadImageType spread_in_box = crop( m_sub_disp_spread, seed_bbox );
-
-        if (!use_local_homography){
-          BBox2f spread = stereo::get_disparity_range( spread_in_box );
-          local_search_range.min() -= spread.max();
-          local_search_range.max() += spread.max();
-        }else{
-          DispSeedImageType upper_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
-                                                               disparity_in_box + spread_in_box);
-          DispSeedImageType lower_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
-                                                               disparity_in_box - spread_in_box);
-          BBox2f upper_range = stereo::get_disparity_range(upper_disp);
-          BBox2f lower_range = stereo::get_disparity_range(lower_disp);
-
-          local_search_range = upper_range;
-          local_search_range.grow(lower_range);
-        } //endif use_local_homography
-      } //endif has_sub_disp_spread
+      local_search_range = upscale_search_range(lowres_range, m_upscale_factor);
 
       if (use_local_homography){
         Vector3 upscale(     m_upscale_factor[0],     m_upscale_factor[1], 1 );
         Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
         fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
-
-        ImageViewRef< PixelMask<InputPixelType> >
-          right_trans_masked_img
-          = transform (copy_mask( m_right_image.impl(),
-			          create_mask(m_right_mask.impl()) ),
-	               HomographyTransform(fullres_hom),
-	               m_left_image.impl().cols(), m_left_image.impl().rows());
-        right_trans_img  = apply_mask(right_trans_masked_img);
-        right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
-      } //endif use_local_homography
-
-      local_search_range = grow_bbox_to_int(local_search_range);
-      // Expand local_search_range by 1. This is necessary since
-      // m_sub_disp is integer-valued, and perhaps the search
-      // range was supposed to be a fraction of integer bigger.
-      local_search_range.expand(1);
-      
-      // Scale the search range to full-resolution
-      local_search_range.min() = floor(elem_prod(local_search_range.min(),m_upscale_factor));
-      local_search_range.max() = ceil (elem_prod(local_search_range.max(),m_upscale_factor));
+      }
 
       VW_OUT(DebugMessage, "stereo") << "SeededCorrelatorView("
 				     << bbox << ") search range "
@@ -529,53 +1069,289 @@ public:
 				    << stereo_settings().search_range << "\n";
     }
 
-    // Now we are ready to actually perform correlation
-    const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
-    if (use_local_homography){
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageViewRef<InputPixelType>, 
-                                                 MaskType,  ImageViewRef<vw::uint8     > > CorrView;
-      CorrView corr_view( m_left_image,   right_trans_img,
-                          m_left_mask,    right_trans_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          stereo_settings().corr_blob_filter_area,
-                          SAVE_CORR_DEBUG );
-      return corr_view.prerasterize(bbox);
-    }else{
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageType, MaskType, MaskType > CorrView;
-      CorrView corr_view( m_left_image,   m_right_image,
-                          m_left_mask,    m_right_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          stereo_settings().corr_blob_filter_area,
-                          SAVE_CORR_DEBUG );
-      return corr_view.prerasterize(bbox);
+    // With incremental correlation, copy the result of the previous run
+    // for this tile if nothing it depends on has changed.
+    uint64 hash = 0;
+    if (m_tile_hashes){
+      BBox2i tile = bbox - m_crop_min;
+      uint64 prev_hash;
+      hash = tile_input_hash(bbox, local_search_range, fullres_hom);
+      if (m_prev_tile_hashes && m_prev_tile_hashes->get(tile, prev_hash) && prev_hash == hash){
+        VW_OUT(DebugMessage, "stereo") << "Reusing the previous disparity for: " << tile << "\n";
+        m_tile_hashes->set(tile, hash);
+        ImageView<pixel_type> prev_disp = crop(m_prev_disp, tile);
+        record_tile(bbox, local_search_range, 0.0, 0.0, true);
+        return prerasterize_type(prev_disp, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+      }
     }
+
+    // Estimate the time for this tile with the rate measured on the
+    // first tiles rather than with the startup benchmark. That one ran
+    // on an idle machine, while this runs alongside the other tiles.
+    double seconds_per_op = m_seconds_per_op;
+    if (m_telemetry && m_corr_timeout > 0) {
+      if (m_telemetry->needs_calibration() && bbox.width() >= 64 && bbox.height() >= 64)
+        m_telemetry->add_calibration(calc_seconds_per_op(m_cost_mode, crop(m_left_image, bbox),
+                                                         crop(m_right_image, bbox),
+                                                         m_kernel_size));
+      m_telemetry->measured_seconds_per_op(seconds_per_op);
+    }
+
+    Stopwatch sw;
+    sw.start();
+
+    if (use_local_homography){
+      // Warp, just once, only the part of the right image this tile
+      // can see. Otherwise the lazy transform would be evaluated anew
+      // each time the correlator pulls from it, at every pyramid level.
+      // Refinement reads only its own, smaller margin around the tile
+      // shifted over the search range, so only that much is saved for it.
+      BBox2i footprint = right_footprint(bbox, local_search_range);
+      BBox2i saved_footprint;
+      if (m_warped_footprints) {
+        saved_footprint = asp::correlation_footprint(bbox, local_search_range,
+                                                     refinement_right_image_margin(),
+                                                     bounding_box(m_left_image));
+        if (!saved_footprint.empty())
+          footprint.grow(saved_footprint);
+      }
+      ImageView< PixelMask<InputPixelType> > right_trans_footprint
+        = crop(transform (copy_mask( m_right_image.impl(),
+                                     create_mask(m_right_mask.impl()) ),
+                          HomographyTransform(fullres_hom),
+                          m_left_image.impl().cols(), m_left_image.impl().rows()),
+               footprint);
+
+      // Put the warped footprint back in full image coordinates. Pixels
+      // outside of it are invalid.
+      ImageViewRef< PixelMask<InputPixelType> > right_trans_masked_img
+        = asp::footprint_in_image(right_trans_footprint, footprint,
+                                  m_left_image.impl().cols(), m_left_image.impl().rows());
+      right_trans_img  = apply_mask(right_trans_masked_img);
+      right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
+
+      if (m_warped_footprints && !saved_footprint.empty()) {
+        int ts = ASPGlobalOptions::corr_tile_size();
+        m_warped_footprints->write(Vector2i(bbox.min().x()/ts, bbox.min().y()/ts),
+                                   saved_footprint,
+                                   apply_mask(crop(right_trans_footprint,
+                                                   saved_footprint - footprint.min())));
+      }
+    } //endif use_local_homography
+
+    // Now we are ready to actually perform correlation
+    if (use_local_homography)
+      return correlate(right_trans_img, right_trans_mask, bbox, local_search_range,
+                       seconds_per_op, hash, sw);
+    if (stereo_settings().corr_right_image_cache_mb > 0)
+      return correlate(m_right_image_cached, m_right_mask_cached, bbox, local_search_range,
+                       seconds_per_op, hash, sw);
+    return correlate(m_right_image, m_right_mask, bbox, local_search_range,
+                     seconds_per_op, hash, sw);
     
   } // End function prerasterize_helper
 
+  /// Correlate the tile bbox against the given right image and mask,
+  /// and record how long it took since sw was started.
+  template <class RImageT, class RMaskT>
+  prerasterize_type correlate(RImageT const& right_image, RMaskT const& right_mask,
+                              BBox2i const& bbox, BBox2f const& search_range,
+                              double seconds_per_op, uint64 hash, Stopwatch & sw) const {
+    const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+    typedef vw::stereo::PyramidCorrelationView<ImageType, RImageT,
+                                               MaskType,  RMaskT > CorrView;
+    CorrView corr_view( m_left_image,   right_image,
+                        m_left_mask,    right_mask,
+                        static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
+                        stereo_settings().slogW,
+                        search_range,
+                        m_kernel_size,  m_cost_mode,
+                        m_corr_timeout, seconds_per_op,
+                        stereo_settings().xcorr_threshold,
+                        rm_half_kernel,
+                        stereo_settings().corr_max_levels,
+                        static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
+                        stereo_settings().sgm_collar_size,
+                        stereo_settings().corr_blob_filter_area,
+                        SAVE_CORR_DEBUG );
+    prerasterize_type result = corr_view.prerasterize(bbox);
+    sw.stop();
+    record_tile(bbox, search_range, sw.elapsed_seconds(), seconds_per_op, false);
+    save_tile_hash(bbox, search_range, seconds_per_op, hash);
+    return result;
+  }
+
   template <class DestT>
   inline void rasterize(DestT const& dest, BBox2i bbox) const {
     vw::rasterize(prerasterize(bbox), dest, bbox);
   }
 }; // End class SeededCorrelatorView
 
+/// With fused correlation and refinement, each tile is correlated, with
+/// a margin for the subpixel kernel, and refined right away, so that the
+/// integer disparity never goes to disk. The refinement reads the same
+/// images as the correlator, so the pixels it needs are in the cache.
+/// The correlator then runs on the expanded tiles rather than on the
+/// tiles of D.tif, so near tile edges the result may differ slightly
+/// from that of separate correlation and refinement.
+template <class CorrelatorT>
+class FusedRefinementView : public ImageViewBase<FusedRefinementView<CorrelatorT> > {
+  CorrelatorT m_correlator;
+  ImageViewRef<PixelGray<float> > m_left_image, m_right_image;
+  ASPGlobalOptions const& m_opt;
+  int m_margin;
+
+public:
+  typedef PixelMask<Vector2f> pixel_type;
+  typedef pixel_type          result_type;
+  typedef ProceduralPixelAccessor<FusedRefinementView> pixel_accessor;
+
+  FusedRefinementView( CorrelatorT const& correlator,
+                       ImageViewRef<PixelGray<float> > const& left_image,
+                       ImageViewRef<PixelGray<float> > const& right_image,
+                       ASPGlobalOptions const& opt ):
+    m_correlator(correlator), m_left_image(left_image), m_right_image(right_image),
+    m_opt(opt), m_margin(margin()) {}
+
+  /// The integer disparity needed around a tile to refine it. Parabola
+  /// fitting uses the disparity at each pixel only, while the affine
+  /// modes go through a pyramid, with the kernel growing at each level.
+  static int margin() {
+    if (stereo_settings().subpixel_mode <= 1)
+      return 0;
+    return (max(stereo_settings().subpixel_kernel)/2 + 1) << stereo_settings().subpixel_max_levels;
+  }
+
+  inline int32 cols  () const { return m_correlator.cols(); }
+  inline int32 rows  () const { return m_correlator.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "FusedRefinementView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    BBox2i expanded = bbox;
+    expanded.expand(m_margin);
+    expanded.crop(bounding_box(m_correlator));
+    ImageView<pixel_type> integer_disp = crop(m_correlator, expanded);
+
+    // Outside of the expanded tile the disparity is invalid
+    ImageViewRef<pixel_type> integer_disp_ref
+      = crop(edge_extend(integer_disp, ZeroEdgeExtension()),
+             -expanded.min().x(), -expanded.min().y(), cols(), rows());
+
+    bool verbose = false;
+    ImageView<pixel_type> tile_disparity
+      = crop(refine_disparity(m_left_image, m_right_image, integer_disp_ref, m_opt, verbose),
+             bbox);
+    return prerasterize_type(tile_disparity, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class CorrelatorT>
+FusedRefinementView<CorrelatorT>
+fused_refinement_view( ImageViewBase<CorrelatorT> const& correlator,
+                       ImageViewRef<PixelGray<float> > const& left_image,
+                       ImageViewRef<PixelGray<float> > const& right_image,
+                       ASPGlobalOptions const& opt ) {
+  return FusedRefinementView<CorrelatorT>(correlator.impl(), left_image, right_image, opt);
+}
+
+
+/// Split the output into tiles, and sort them so that the ones likely to
+/// take the longest come first. The work for a tile is estimated as its
+/// area, times the kernel area, times the area of its search range, with
+/// the latter looked up in the search range index. Tiles are in respect to
+/// trans_crop_win, whose corner is at crop_min in the full image.
+std::vector<BBox2i> tiles_by_decreasing_cost( Vector2i const& image_size,
+                                              Vector2i const& crop_min,
+                                              Vector2i const& tile_size,
+                                              Vector2i const& kernel_size,
+                                              Vector2  const& upscale_factor,
+                                              SearchRangeIndex const& search_index ) {
+
+  std::vector<BBox2i> tiles = subdivide_bbox( BBox2i(0, 0, image_size[0], image_size[1]),
+                                              tile_size[0], tile_size[1] );
+
+  std::vector< std::pair<double, int> > costs( tiles.size() );
+  for (size_t i = 0; i < tiles.size(); i++){
+    BBox2f search_range;
+    search_range = stereo_settings().search_range;
+    BBox2i lowres_range;
+    if ( stereo_settings().seed_mode > 0 &&
+         search_index.lookup(tiles[i] + crop_min, lowres_range) )
+      search_range = upscale_search_range(lowres_range, upscale_factor);
+
+    double cost = correlation_ops(tiles[i], kernel_size, search_range);
+    // Negate so that sorting puts the most expensive tiles first, and
+    // ties are kept in raster order.
+    costs[i] = std::make_pair(-cost, int(i));
+  }
+  std::sort(costs.begin(), costs.end());
+
+  std::vector<BBox2i> sorted_tiles( tiles.size() );
+  for (size_t i = 0; i < costs.size(); i++)
+    sorted_tiles[i] = tiles[costs[i].second];
+  return sorted_tiles;
+}
+
+/// For incremental correlation, load the tile hashes of the previous
+/// run, and move its disparity aside, so that the tiles whose inputs did
+/// not change can be copied from it. The hash file is removed first, so
+/// that if this run is interrupted the next one will start from scratch
+/// rather than trust a partially written D.tif. Returns false if there
+/// is no usable previous run.
+bool load_previous_disparity( ASPGlobalOptions const& opt,
+                              Vector2i const& out_size,
+                              TileHashTable & prev_tile_hashes,
+                              ImageViewRef<PixelMask<Vector2f> > & prev_disp ) {
+
+  // Under parallel_stereo, the output of this tile was renamed to
+  // Dnosym.tif and D.tif is a link to the mosaic of all tiles, which
+  // must not be overwritten by this run.
+  string d_file      = previous_tile_output(opt.out_prefix, "-D.tif", "-Dnosym.tif");
+  string link_file   = opt.out_prefix + "-D.tif";
+  string prev_d_file = opt.out_prefix + "-D_prev.tif";
+  string hash_file   = opt.out_prefix + "-D_tile_hashes.txt";
+  if (fs::is_symlink(link_file))
+    fs::remove(link_file);
+  if (!fs::exists(hash_file))
+    return false;
+
+  bool is_good = !d_file.empty();
+  try {
+    prev_tile_hashes.read(hash_file);
+  } catch (vw::IOErr const& e) {
+    is_good = false;
+  }
+  fs::remove(hash_file);
+  if (!is_good || prev_tile_hashes.image_size() != out_size ||
+      file_image_size(d_file) != out_size)
+    return false;
+
+  fs::rename(d_file, prev_d_file);
+
+  // Read the correct type of correlation file (float for SGM/MGM, otherwise integer)
+  boost::scoped_ptr<SrcImageResource> rsrc(DiskImageResource::open(prev_d_file));
+  if (rsrc->channel_type() == VW_CHANNEL_INT32)
+    prev_disp = pixel_cast<PixelMask<Vector2f> >(DiskImageView< PixelMask<Vector2i> >(prev_d_file));
+  else
+    prev_disp = DiskImageView< PixelMask<Vector2f> >(prev_d_file);
+
+  vw_out() << "\t--> Reusing unchanged tiles from the previous run.\n";
+  return true;
+}
 
 /// Main stereo correlation function, called after parsing input arguments.
 void stereo_correlation( ASPGlobalOptions& opt ) {
@@ -585,15 +1361,32 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   // Note that even when we are told to skip low-resolution correlation,
   // we must still go through the motions when seed_mode is 0, to be
   // able to get a search range, even though we don't write D_sub then.
-  if (!stereo_settings().skip_low_res_disparity_comp || stereo_settings().seed_mode == 0)
+  // The same holds when D_sub is computed on demand.
+  bool seed_on_demand = stereo_settings().lowres_seed_on_demand;
+  if (!stereo_settings().skip_low_res_disparity_comp || stereo_settings().seed_mode == 0 ||
+      seed_on_demand)
     lowres_correlation(opt);
+  stage_instrumentation().end_phase("low_resolution_correlation");
 
   if (stereo_settings().compute_low_res_disparity_only) 
     return; // Just computed the low-res disparity, so quit.
 
   vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 1 --> CORRELATION \n";
 
-  read_search_range_from_dsub(opt);
+  if (!seed_on_demand)
+    read_search_range_from_dsub(opt);
+
+  // With seed mode 4 the overall search range is the union of the ranges
+  // of all tiles, as found from the interest point matches.
+  SearchRangeIndex search_index;
+  if ( stereo_settings().seed_mode == 4 ) {
+    load_ip_search_range_index(opt, !stereo_settings().skip_low_res_disparity_comp,
+                               search_index);
+    BBox2i search_range;
+    if (search_index.lookup(BBox2i(0, 0, search_index.image_size()[0],
+                                   search_index.image_size()[1]), search_range))
+      stereo_settings().search_range = search_range;
+  }
 
   // Provide the user with some feedback of what we are actually going to use.
   vw_out()   << "\t--------------------------------------------------\n";
@@ -609,34 +1402,26 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   vw_out() << "\t--------------------------------------------------\n";
 
   // Load up for the actual native resolution processing
-  DiskImageView<PixelGray<float> > left_disk_image (opt.out_prefix+"-L.tif"),
-                                   right_disk_image(opt.out_prefix+"-R.tif");
-  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
-                           Rmask(opt.out_prefix + "-rMask.tif");
+  DiskImageView<PixelGray<float> >
+    left_disk_image  = instrumented_disk_image_view<PixelGray<float> >(opt.out_prefix+"-L.tif"),
+    right_disk_image = instrumented_disk_image_view<PixelGray<float> >(opt.out_prefix+"-R.tif");
+  DiskImageView<vw::uint8>
+    Lmask = instrumented_disk_image_view<vw::uint8>(opt.out_prefix + "-lMask.tif"),
+    Rmask = instrumented_disk_image_view<vw::uint8>(opt.out_prefix + "-rMask.tif");
   ImageViewRef<PixelMask<Vector2f> > sub_disp;
-  std::string dsub_file   = opt.out_prefix+"-D_sub.tif";
-  std::string spread_file = opt.out_prefix+"-D_sub_spread.tif";
-  
-  if ( stereo_settings().seed_mode > 0 )
-    sub_disp = DiskImageView<PixelMask<Vector2f> >(dsub_file);
   ImageViewRef<PixelMask<Vector2i> > sub_disp_spread;
-  if ( stereo_settings().seed_mode == 2 ||  stereo_settings().seed_mode == 3 ){
-    // D_sub_spread is mandatory for seed_mode 2 and 3.
-    sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
-  }else if ( stereo_settings().seed_mode == 1 ){
-    // D_sub_spread is optional for seed_mode 1, we use it only if it is provided.
-    if (fs::exists(spread_file)) {
-      try {
-        sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
-      }
-      catch (...) {}
-    }
-  }
-
   ImageView<Matrix3x3> local_hom;
-  if ( stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography ){
-    string local_hom_file = opt.out_prefix + "-local_hom.txt";
-    read_local_homographies(local_hom_file, local_hom);
+  boost::shared_ptr<LowResSeedCache> seed_cache;
+  if (seed_on_demand) {
+    seed_cache.reset(new LowResSeedCache(opt));
+  } else {
+    load_lowres_seed(opt, sub_disp, sub_disp_spread, local_hom);
+
+    // When run from parallel_stereo, the index must have been written
+    // during low-res correlation, so don't write it from each process.
+    if ( stereo_settings().seed_mode > 0 && stereo_settings().seed_mode != 4 )
+      load_search_range_index(opt, !stereo_settings().skip_low_res_disparity_comp,
+                              sub_disp, sub_disp_spread, local_hom, search_index);
   }
 
   stereo::CostFunctionType cost_mode = get_cost_mode_value();
@@ -649,12 +1434,67 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
 
   // Set up the reference to the stereo disparity code
   // - Processing is limited to trans_crop_win for use with parallel_stereo.
-  ImageViewRef<PixelMask<Vector2f> > fullres_disparity =
-    crop(SeededCorrelatorView( left_disk_image, right_disk_image, Lmask, Rmask,
-                               sub_disp, sub_disp_spread, local_hom, kernel_size, 
-                               cost_mode, corr_timeout, seconds_per_op ), 
-         trans_crop_win);
-  
+  SeededCorrelatorView correlator( left_disk_image, right_disk_image, Lmask, Rmask,
+                                   sub_disp, sub_disp_spread, local_hom, search_index,
+                                   seed_cache,
+                                   kernel_size, 
+                                   cost_mode, corr_timeout, seconds_per_op );
+
+  // With incremental correlation, tiles whose inputs did not change
+  // since the previous run are copied from its output.
+  string d_file    = opt.out_prefix + "-D.tif";
+  string hash_file = opt.out_prefix + "-D_tile_hashes.txt";
+  boost::shared_ptr<TileHashTable> tile_hashes, prev_tile_hashes;
+  if (stereo_settings().incremental_correlation) {
+    Vector2i out_size( trans_crop_win.width(), trans_crop_win.height() );
+    tile_hashes.reset(new TileHashTable(out_size));
+    prev_tile_hashes.reset(new TileHashTable);
+    ImageViewRef<PixelMask<Vector2f> > prev_disp;
+    if (!load_previous_disparity(opt, out_size, *prev_tile_hashes, prev_disp))
+      prev_tile_hashes.reset();
+    correlator.set_incremental(tile_hashes, prev_tile_hashes, prev_disp, trans_crop_win.min());
+  }
+
+  // Measure the correlation rate on the first tiles to tell which tiles
+  // would exceed the timeout, and record the timing of each tile if asked.
+  boost::shared_ptr<CorrelationTelemetry> telemetry;
+  bool save_telemetry = stereo_settings().save_corr_telemetry;
+  if (save_telemetry || (corr_timeout > 0 && stereo_settings().corr_timeout_calibration_tiles > 0)) {
+    telemetry.reset(new CorrelationTelemetry(stereo_settings().corr_timeout_calibration_tiles));
+    correlator.set_telemetry(telemetry);
+  }
+
+  // Footprints from an earlier run may be for other homographies
+  if (stereo_settings().reuse_local_homography_warps && stereo_settings().use_local_homography &&
+      stereo_settings().seed_mode > 0) {
+    boost::shared_ptr<WarpedFootprintStore>
+      warped_footprints(new WarpedFootprintStore(opt.out_prefix));
+    warped_footprints->clear();
+    correlator.set_warped_footprints(warped_footprints);
+  }
+
+  // With fused correlation and refinement, the output is RD.tif rather
+  // than D.tif, and stereo_rfne has nothing to do.
+  bool fused = stereo_settings().fuse_correlation_and_refinement;
+  ImageViewRef<PixelMask<Vector2f> > fullres_disparity;
+  if (fused) {
+    ImageViewRef<PixelGray<float> > left_image = left_disk_image, right_image = right_disk_image;
+    normalize_images_for_refinement(opt, Lmask, Rmask, left_image, right_image);
+
+    // Print the refinement settings once, as stereo_rfne does
+    bool verbose = true;
+    ImageView<PixelGray<float>    > left_dummy(1, 1), right_dummy(1, 1);
+    ImageView<PixelMask<Vector2f> > dummy_disp(1, 1);
+    refine_disparity(left_dummy, right_dummy, dummy_disp, opt, verbose);
+
+    d_file = opt.out_prefix + "-RD.tif";
+    fullres_disparity
+      = timed_tile_view(crop(fused_refinement_view(correlator, left_image, right_image, opt),
+                             trans_crop_win));
+  } else {
+    fullres_disparity = timed_tile_view(crop(correlator, trans_crop_win));
+  }
+
   switch(stereo_settings().pre_filter_mode){
   case 2:
     vw_out() << "\t--> Using LOG pre-processing filter with "
@@ -673,23 +1513,84 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   bool   has_nodata      = false;
   double nodata          = -32768.0;
 
-  string d_file = opt.out_prefix + "-D.tif";
   vw_out() << "Writing: " << d_file << "\n";
-  if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW) {
-    // SGM performs subpixel correlation in this step, so write out floats.
-    vw::cartography::block_write_gdal_image(d_file, fullres_disparity,
+
+  // Unless disabled, start with the tiles with the largest search
+  // ranges, so that they don't end up running alone at the end.
+  bool in_order = !stereo_settings().disable_cost_based_tile_order;
+  std::vector<BBox2i> tiles;
+  if (in_order) {
+    // With the seed computed on demand, the search index is empty and
+    // all tiles are estimated to cost the same.
+    Vector2i sub_size( sub_disp.cols(), sub_disp.rows() );
+    if (!search_index.empty())
+      sub_size = search_index.sub_image_size();
+    Vector2 upscale_factor( double(left_disk_image.cols()) / std::max(1, sub_size[0]),
+                            double(left_disk_image.rows()) / std::max(1, sub_size[1]) );
+    tiles = tiles_by_decreasing_cost( Vector2i(fullres_disparity.cols(), fullres_disparity.rows()),
+                                      trans_crop_win.min(), opt.raster_tile_size,
+                                      kernel_size, upscale_factor, search_index );
+  }
+
+  if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW || fused) {
+    // SGM performs subpixel correlation in this step, as does fused
+    // refinement, so write out floats.
+    if (in_order)
+      block_write_gdal_image_in_order(d_file, fullres_disparity, tiles,
+                                      has_left_georef, left_georef,
+                                      has_nodata, nodata, opt,
+                                      TerminalProgressCallback("asp", "\t--> Correlation :") );
+    else
+      vw::cartography::block_write_gdal_image(d_file, fullres_disparity,
 			        has_left_georef, left_georef,
 			        has_nodata, nodata, opt,
 			        TerminalProgressCallback("asp", "\t--> Correlation :") );
   } else {
     // Otherwise cast back to integer results to save on storage space.
-    vw::cartography::block_write_gdal_image(d_file, 
+    if (in_order)
+      block_write_gdal_image_in_order(d_file,
+                                      pixel_cast<PixelMask<Vector2i> >(fullres_disparity), tiles,
+                                      has_left_georef, left_georef,
+                                      has_nodata, nodata, opt,
+                                      TerminalProgressCallback("asp", "\t--> Correlation :") );
+    else
+      vw::cartography::block_write_gdal_image(d_file, 
               pixel_cast<PixelMask<Vector2i> >(fullres_disparity),
 			        has_left_georef, left_georef,
 			        has_nodata, nodata, opt,
 			        TerminalProgressCallback("asp", "\t--> Correlation :") );
   }
 
+  double measured_seconds_per_op;
+  if (telemetry && telemetry->measured_seconds_per_op(measured_seconds_per_op))
+    vw_out() << "\t--> Measured correlation seconds per op: " << measured_seconds_per_op
+             << " (benchmark: " << seconds_per_op << ")\n";
+  if (save_telemetry) {
+    string telemetry_file = opt.out_prefix + "-corr_telemetry.csv";
+    vw_out() << "Writing: " << telemetry_file << "\n";
+    telemetry->write(telemetry_file);
+  }
+
+  if (tile_hashes) {
+    if (prev_tile_hashes)
+      vw_out() << "\t--> Reused the previous disparity for "
+               << tile_hashes->count_equal(*prev_tile_hashes) << " out of "
+               << tile_hashes->size() << " tiles.\n";
+    vw_out() << "Writing: " << hash_file << "\n";
+    tile_hashes->write(hash_file);
+    fs::remove(opt.out_prefix + "-D_prev.tif");
+  }
+
+  StageInstrumentation & instrumentation = stage_instrumentation();
+  instrumentation.end_phase("correlation");
+  instrumentation.add_input_file(opt.out_prefix + "-L.tif");
+  instrumentation.add_input_file(opt.out_prefix + "-R.tif");
+  instrumentation.add_input_file(opt.out_prefix + "-lMask.tif");
+  instrumentation.add_input_file(opt.out_prefix + "-rMask.tif");
+  if ( stereo_settings().seed_mode > 0 && stereo_settings().seed_mode != 4 && !seed_on_demand )
+    instrumentation.add_input_file(opt.out_prefix + "-D_sub.tif");
+  instrumentation.add_output_file(d_file);
+
   vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED \n";
 
 } // End function stereo_correlation
@@ -722,7 +1623,10 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
+    if (stereo_settings().save_stage_instrumentation)
+      stage_instrumentation().start("corr", opt.out_prefix);
     stereo_correlation( opt );
+    stage_instrumentation().write();
   
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
@@ -25,9 +25,10 @@
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Image/BlobIndex.h>
 #include <vw/Image/ErodeView.h>
-#include <vw/Image/InpaintView.h>
 
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/HoleFill.h>
+#include <asp/Core/StageInstrumentation.h>
 #include <asp/Sessions/StereoSession.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -243,26 +244,96 @@ struct MultipleDisparityCleanUp {
   }
 };
 
+/// The subsampled good pixel map, filled in as the tiles of the
+/// disparity are computed for other outputs, so that it does not need
+/// a pass of its own. Pixels are sampled every given number of pixels.
+class GoodPixelMapAccumulator {
+  ImageView< PixelRGB<uint8> > m_map;
+  int   m_step;
+  Mutex m_mutex;
+public:
+  GoodPixelMapAccumulator(int cols, int rows, int step):
+    m_map((cols - 1)/step + 1, (rows - 1)/step + 1), m_step(step) {}
+
+  /// Store the samples in a tile of the full resolution map. Tiles may
+  /// overlap, as they then agree.
+  void add(ImageView< PixelRGB<uint8> > const& tile, Vector2i const& corner) {
+    int col0 = (corner.x() + m_step - 1)/m_step;
+    int row0 = (corner.y() + m_step - 1)/m_step;
+    Mutex::Lock lock(m_mutex);
+    for (int row = row0; row*m_step < corner.y() + tile.rows(); row++)
+      for (int col = col0; col*m_step < corner.x() + tile.cols(); col++)
+        m_map(col, row) = tile(col*m_step - corner.x(), row*m_step - corner.y());
+  }
+
+  ImageView< PixelRGB<uint8> > const& map() const { return m_map; }
+};
+
+/// Pass the tiles of a disparity through unchanged, while recording
+/// its good pixel map.
+template <class ImageT>
+class GoodPixelTapView: public ImageViewBase<GoodPixelTapView<ImageT> >{
+  ImageT                   m_img;
+  DiskImageView<vw::uint8> m_left_mask;
+  boost::shared_ptr<GoodPixelMapAccumulator> m_good_pixels;
+public:
+  GoodPixelTapView( ImageViewBase<ImageT> const& img,
+                    DiskImageView<vw::uint8> const& left_mask,
+                    boost::shared_ptr<GoodPixelMapAccumulator> good_pixels ):
+    m_img(img.impl()), m_left_mask(left_mask), m_good_pixels(good_pixels){}
+
+  // Image View interface
+  typedef typename ImageT::pixel_type pixel_type;
+  typedef pixel_type                  result_type;
+  typedef ProceduralPixelAccessor<GoodPixelTapView> pixel_accessor;
+
+  inline int32 cols  () const { return m_img.cols(); }
+  inline int32 rows  () const { return m_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "GoodPixelTapView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<pixel_type> tile = crop(m_img, bbox);
+    ImageView< PixelRGB<uint8> > good_pixels
+      = apply_mask(copy_mask(stereo::missing_pixel_image(tile),
+                             create_mask(crop(m_left_mask, bbox), 0)));
+    m_good_pixels->add(good_pixels, bbox.min());
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+// Write F.tif, and the good pixel map of the disparity before hole
+// filling and blob removal. The disparity is computed only once for
+// both, or twice with hole filling, as the holes must be found first.
 template <class ImageT>
-void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
+void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& filteredview,
                                     ASPGlobalOptions const& opt ) {
-  // Write Good Pixel Map
-  // Sub-sampling so that the user can actually view it.
-  double sub_scale = double( min( inputview.impl().cols(),
-                                inputview.impl().rows() ) ) / 2048.0;
+  // Sub-sampling so that the user can actually view the good pixel map.
+  double sub_scale = double( min( filteredview.impl().cols(),
+                                filteredview.impl().rows() ) ) / 2048.0;
   if (sub_scale < 1) // Don't use a sub_scale less than one.
     sub_scale = 1;
 
-  // Write out the good pixel map
-  std::string goodPixelFile = opt.out_prefix + "-GoodPixelMap.tif";
-  vw_out() << "Writing: " << goodPixelFile << std::endl;
-  ImageViewRef<  PixelRGB<uint8> > goodPixelImage
-    = subsample(apply_mask
-                (copy_mask
-                 (stereo::missing_pixel_image(inputview.impl()),
-                  create_mask(DiskImageView<vw::uint8>(opt.out_prefix+"-lMask.tif"), 0)
-                  )
-                 ), sub_scale);
+  // Record the good pixel map from the first pass over the disparity
+  boost::shared_ptr<GoodPixelMapAccumulator>
+    good_pixels(new GoodPixelMapAccumulator(filteredview.impl().cols(),
+                                            filteredview.impl().rows(), int(sub_scale)));
+  GoodPixelTapView<ImageT> inputview(filteredview.impl(),
+                                     DiskImageView<vw::uint8>(opt.out_prefix+"-lMask.tif"),
+                                     good_pixels);
 
   // Determine if we can attach geo information to the output image
   cartography::GeoReference left_georef;
@@ -270,46 +341,29 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
   bool has_nodata = false;
   double nodata = -32768.0;
 
-  vw::cartography::GeoReference good_pixel_georef;
-  if (has_left_georef) {
-    // Account for scale. Note that goodPixelImage is not guaranteed to respect
-    // the sub_scale factor above, hence this calculation.
-    double good_pixel_scale = 0.5*( double(goodPixelImage.cols())/inputview.impl().cols()
-                                    + double(goodPixelImage.rows())/inputview.impl().rows());
-    good_pixel_georef = resample(left_georef, good_pixel_scale);
-  }
-
-  vw::cartography::block_write_gdal_image
-    ( goodPixelFile, goodPixelImage, has_left_georef, good_pixel_georef,
-      has_nodata, nodata,
-      opt, TerminalProgressCallback("asp", "\t--> Good pixel map: ") );
-
   bool removeSmallBlobs = (stereo_settings().erode_max_size > 0);
 
   string outF = opt.out_prefix + "-F.tif";
 
   // Fill holes
   if(stereo_settings().enable_fill_holes) {
-    // Generate a list of blobs below a maximum size
-    // - This requires the entire input image to be read in
-    //    and produces a single blob list for the entire image.
+    // Find the holes below a maximum size. The holes are labeled in
+    // each tile in parallel and merged across tiles, so the image is
+    // never held in memory in full.
     vw_out() << "\t--> Filling holes with inpainting method.\n";
-    BlobIndexThreaded smallHoleIndex( invert_mask( inputview.impl() ),
-                                      stereo_settings().fill_hole_max_size,
-                                      vw::vw_settings().default_tile_size(),
-                                      vw::vw_settings().default_num_threads()
-                                      );
-    vw_out() << "\t    * Identified " << smallHoleIndex.num_blobs() << " holes\n";
-    bool use_grassfire = true;
-    typename ImageT::pixel_type default_inpaint_val;
-
+    TiledHoleIndex smallHoleIndex( inputview.cols(), inputview.rows(),
+                                   vw::vw_settings().default_tile_size(),
+                                   stereo_settings().fill_hole_max_size );
+    build_hole_index( inputview, smallHoleIndex );
+    vw_out() << "\t    * Identified " << smallHoleIndex.num_holes() << " holes\n";
+    stage_instrumentation().end_phase("hole_index");
 
     if (!removeSmallBlobs) { // Skip small blob removal
       // Write out the image to disk, filling in the blobs in the process
       vw_out() << "Writing: " << outF << endl;
       vw::cartography::block_write_gdal_image( outF,
-                                   inpaint(inputview.impl(), smallHoleIndex,
-                                           use_grassfire, default_inpaint_val),
+                                   timed_tile_view
+                                   (inpaint_holes(filteredview.impl(), smallHoleIndex)),
                                    has_left_georef, left_georef,
                                    has_nodata, nodata, opt,
                                    TerminalProgressCallback
@@ -320,11 +374,10 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
       // - Blob removal is done second to make sure inner-blob holes are removed.
       vw_out() << "Writing: " << outF << endl;
       vw::cartography::block_write_gdal_image( outF,
-                                   per_tile_erode
-                                   (inpaint(inputview.impl(),
-                                            smallHoleIndex,
-                                            use_grassfire,
-                                            default_inpaint_val) ),
+                                   timed_tile_view
+                                   (per_tile_erode
+                                    (inpaint_holes(filteredview.impl(),
+                                                   smallHoleIndex) )),
                                    has_left_georef, left_georef,
                                    has_nodata, nodata, opt,
                                    TerminalProgressCallback
@@ -334,7 +387,7 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
   } else { // No hole filling
     if (!removeSmallBlobs) { // Skip small blob removal
       vw_out() << "Writing: " << outF << endl;
-      vw::cartography::block_write_gdal_image( outF, inputview.impl(),
+      vw::cartography::block_write_gdal_image( outF, timed_tile_view(inputview),
                                    has_left_georef, left_georef,
                                    has_nodata, nodata, opt,
                                    TerminalProgressCallback
@@ -344,7 +397,7 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
       vw_out() << "\t--> Removing small blobs.\n";
       // Write out the image to disk, removing the blobs in the process
       vw_out() << "Writing: " << outF << endl;
-      vw::cartography::block_write_gdal_image(outF, per_tile_erode(inputview.impl()),
+      vw::cartography::block_write_gdal_image(outF, timed_tile_view(per_tile_erode(inputview)),
                                   has_left_georef, left_georef,
                                   has_nodata, nodata, opt,
                                   TerminalProgressCallback
@@ -352,6 +405,32 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
     }
 
   } // End no hole filling case
+
+  StageInstrumentation & instrumentation = stage_instrumentation();
+  instrumentation.end_phase("filtering");
+
+  // Write out the good pixel map
+  std::string goodPixelFile = opt.out_prefix + "-GoodPixelMap.tif";
+  vw_out() << "Writing: " << goodPixelFile << std::endl;
+  ImageView< PixelRGB<uint8> > const& goodPixelImage = good_pixels->map();
+
+  vw::cartography::GeoReference good_pixel_georef;
+  if (has_left_georef) {
+    // Account for scale. Note that goodPixelImage is not guaranteed to respect
+    // the sub_scale factor above, hence this calculation.
+    double good_pixel_scale = 0.5*( double(goodPixelImage.cols())/filteredview.impl().cols()
+                                    + double(goodPixelImage.rows())/filteredview.impl().rows());
+    good_pixel_georef = resample(left_georef, good_pixel_scale);
+  }
+
+  vw::cartography::block_write_gdal_image
+    ( goodPixelFile, goodPixelImage, has_left_georef, good_pixel_georef,
+      has_nodata, nodata,
+      opt, TerminalProgressCallback("asp", "\t--> Good pixel map: ") );
+  instrumentation.end_phase("good_pixel_map");
+
+  instrumentation.add_output_file(goodPixelFile);
+  instrumentation.add_output_file(outF);
 } //end write_good_pixel_and_filtered
 
 void stereo_filtering( ASPGlobalOptions& opt ) {
@@ -368,7 +447,8 @@ void stereo_filtering( ASPGlobalOptions& opt ) {
 
     // Apply filtering for high frequencies
     typedef DiskImageView<PixelMask<Vector2f> > input_type;
-    input_type disparity_disk_image(post_correlation_fname);
+    input_type disparity_disk_image
+      = instrumented_disk_image_view<PixelMask<Vector2f> >(post_correlation_fname);
 
     // Applying additional clipping from the edge. We make new
     // mask files to avoid a weird and tricky segfault due to ownership issues.
@@ -484,7 +564,10 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
+    if (stereo_settings().save_stage_instrumentation)
+      stage_instrumentation().start("fltr", opt.out_prefix);
     stereo_filtering( opt );
+    stage_instrumentation().write();
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : FILTERING FINISHED \n";
@@ -126,6 +126,9 @@ int main( int argc, char* argv[] ) {
       vw_out() << "collar_size," << 0 << endl;
     else
       vw_out() << "collar_size," << stereo_settings().sgm_collar_size << endl;
+    vw_out() << "fuse_correlation_and_refinement,"
+             << stereo_settings().fuse_correlation_and_refinement << endl;
+    vw_out() << "single_process_blend," << stereo_settings().single_process_blend << endl;
 
     // This block of code should be in its own executable but I am
     // reluctant to create one just for it. This functionality will be
@@ -26,6 +26,7 @@
 #include <vw/Math/Functors.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/StageInstrumentation.h>
 #include <asp/Sessions/ResourceLoader.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -505,6 +506,8 @@ int main(int argc, char* argv[]) {
     asp::parse_multiview(argc, argv, PreProcessingDescription(),
                          verbose, output_prefix, opt_vec);
     ASPGlobalOptions opt = opt_vec[0];
+    if (stereo_settings().save_stage_instrumentation)
+      stage_instrumentation().start("pprc", opt.out_prefix);
 
     vw_out() << "Using image  files: " << opt.in_file1  << ", " << opt.in_file2  << std::endl;
     vw_out() << "Using camera files: " << opt.cam_file1 << ", " << opt.cam_file2 << std::endl;
@@ -523,6 +526,15 @@ int main(int argc, char* argv[]) {
     vw_out() << "Using \"" << opt.stereo_default_filename << "\"\n";
     stereo_preprocessing(adjust_left_image_size, opt );
 
+    StageInstrumentation & instrumentation = stage_instrumentation();
+    instrumentation.add_input_file(opt.in_file1);
+    instrumentation.add_input_file(opt.in_file2);
+    const char* outputs[] = {"-L.tif", "-R.tif", "-lMask.tif", "-rMask.tif",
+                             "-L_sub.tif", "-R_sub.tif", "-lMask_sub.tif", "-rMask_sub.tif"};
+    for (size_t i = 0; i < sizeof(outputs)/sizeof(outputs[0]); i++)
+      instrumentation.add_output_file(opt.out_prefix + outputs[i]);
+    instrumentation.write();
+
     vw_out() << "\n[ " << current_posix_time_string() << " ] : PREPROCESSING FINISHED \n";
 
      xercesc::XMLPlatformUtils::Terminate();
@@ -20,12 +20,11 @@
 ///
 
 #include <asp/Tools/stereo.h>
-#include <vw/Stereo/PreFilter.h>
-#include <vw/Stereo/CostFunctions.h>
-#include <vw/Stereo/SubpixelView.h>
-#include <vw/Stereo/EMSubpixelCorrelatorView.h>
+#include <asp/Tools/refine_disparity.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Core/LocalHomography.h>
+#include <asp/Core/StageInstrumentation.h>
+#include <asp/Core/WarpedFootprints.h>
 #include <asp/Sessions/StereoSession.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -34,146 +33,60 @@ using namespace vw::stereo;
 using namespace asp;
 using namespace std;
 
-namespace vw {
-  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
+// The right image warped by the local homography of a tile, read from
+// the footprint saved during correlation. Any box not fully inside the
+// footprint is warped anew, so a wrong guess of what refinement reads
+// costs time, but does not change the result.
+template <class PixelT>
+class WarpedFootprintView: public ImageViewBase<WarpedFootprintView<PixelT> >{
+  DiskImageView<PixelT> m_footprint_image;
+  BBox2i                m_footprint;
+  ImageViewRef<PixelT>  m_warped; // The warp of the whole right image
+public:
+  WarpedFootprintView(std::string const& footprint_file, BBox2i const& footprint,
+                      ImageViewRef<PixelT> const& warped):
+    m_footprint_image(footprint_file), m_footprint(footprint), m_warped(warped) {
+    VW_ASSERT(m_footprint_image.cols() == footprint.width() &&
+              m_footprint_image.rows() == footprint.height(),
+              IOErr() << "Unexpected size of: " << footprint_file << ".\n");
+  }
 
-template <class Image1T, class Image2T>
-ImageViewRef<PixelMask<Vector2f> >
-refine_disparity(Image1T const& left_image,
-                 Image2T const& right_image,
-                 ImageViewRef< PixelMask<Vector2f> > const& integer_disp,
-                 ASPGlobalOptions const& opt, bool verbose){
+  typedef PixelT                                       pixel_type;
+  typedef pixel_type                                   result_type;
+  typedef ProceduralPixelAccessor<WarpedFootprintView> pixel_accessor;
 
-  ImageViewRef<PixelMask<Vector2f> > refined_disp = integer_disp;
+  inline int32 cols  () const { return m_warped.cols(); }
+  inline int32 rows  () const { return m_warped.rows(); }
+  inline int32 planes() const { return 1; }
 
-  PrefilterModeType prefilter_mode = 
-    static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
 
-  if (stereo_settings().subpixel_mode == 0) {
-    // Do nothing
-    if (verbose)
-      vw_out() << "\t--> Skipping subpixel mode.\n";
+  inline pixel_type operator()( double i, double j, int32 p = 0 ) const {
+    if (m_footprint.contains(Vector2i(i, j)))
+      return m_footprint_image(i - m_footprint.min().x(), j - m_footprint.min().y(), p);
+    return m_warped(i, j, p);
   }
-  if (stereo_settings().subpixel_mode == 1) {
-    // Parabola
-    
-    if (verbose) {
-      vw_out() << "\t--> Using parabola subpixel mode.\n";
-      if (stereo_settings().pre_filter_mode == 2)
-        vw_out() << "\t--> Using LOG pre-processing filter with "
-                 << stereo_settings().slogW << " sigma blur.\n";
-      else if (stereo_settings().pre_filter_mode == 1)
-        vw_out() << "\t--> Using Subtracted Mean pre-processing filter with "
-                 << stereo_settings().slogW << " sigma blur.\n";
-      else
-        vw_out() << "\t--> NO preprocessing" << endl;
-    } 
-    
-    refined_disp = parabola_subpixel( integer_disp,
-                                      left_image, right_image,
-                                      prefilter_mode, stereo_settings().slogW,
-                                      stereo_settings().subpixel_kernel );
-    
-  } // End parabola cases
-  if (stereo_settings().subpixel_mode == 2) {
-    // Bayes EM
-    if (verbose){
-      vw_out() << "\t--> Using affine adaptive subpixel mode\n";
-      vw_out() << "\t--> Forcing use of LOG filter with "
-               << stereo_settings().slogW << " sigma blur.\n";
-    }
-    refined_disp =
-      bayes_em_subpixel( integer_disp,
-                         left_image, right_image,
-                         prefilter_mode, stereo_settings().slogW,
-                         stereo_settings().subpixel_kernel,
-                         stereo_settings().subpixel_max_levels );
-
-  } // End Bayes EM cases
-  if (stereo_settings().subpixel_mode == 3) {
-    // Fast affine
-    if (verbose){
-      vw_out() << "\t--> Using affine subpixel mode\n";
-      vw_out() << "\t--> Forcing use of LOG filter with "
-               << stereo_settings().slogW << " sigma blur.\n";
-    }
-    refined_disp =
-      affine_subpixel( integer_disp,
-                       left_image, right_image,
-                       prefilter_mode, stereo_settings().slogW,
-                       stereo_settings().subpixel_kernel,
-                       stereo_settings().subpixel_max_levels );
-
-  } // End Fast affine cases
-  if (stereo_settings().subpixel_mode == 4) {
-    // Lucas-Kanade
-    if (verbose){
-      vw_out() << "\t--> Using Lucas-Kanade subpixel mode\n";
-      vw_out() << "\t--> Forcing use of LOG filter with "
-               << stereo_settings().slogW << " sigma blur.\n";
-    }
-    refined_disp =
-      lk_subpixel( integer_disp,
-                   left_image, right_image,
-                   prefilter_mode, stereo_settings().slogW,
-                   stereo_settings().subpixel_kernel,
-                   stereo_settings().subpixel_max_levels );
-
-  } // End Lucas-Kanade cases
-  if (stereo_settings().subpixel_mode == 5) {
-    // Affine and Bayes subpixel refinement always use the LogPreprocessingFilter...
-    if (verbose){
-      vw_out() << "\t--> Using EM Subpixel mode "
-               << stereo_settings().subpixel_mode << endl;
-      vw_out() << "\t--> Mode 3 does internal preprocessing;"
-               << " settings will be ignored. " << endl;
-    }
 
-    typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
-    EMCorrelator em_correlator(channels_to_planes(left_image),
-                               channels_to_planes(right_image),
-                               pixel_cast<PixelMask<Vector2f> >(integer_disp), -1);
-    em_correlator.set_em_iter_max   (stereo_settings().subpixel_em_iter       );
-    em_correlator.set_inner_iter_max(stereo_settings().subpixel_affine_iter   );
-    em_correlator.set_kernel_size   (stereo_settings().subpixel_kernel        );
-    em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
-
-    DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
-
-    block_write_image(em_disparity_map_rsrc, em_correlator,
-                      TerminalProgressCallback("asp", "\t--> EM Refinement :"));
-
-    DiskImageResource *em_disparity_map_rsrc_2 =
-      DiskImageResourceOpenEXR::construct_open(opt.out_prefix + "-F6.exr");
-    DiskImageView<PixelMask<Vector<float, 5> > > em_disparity_disk_image(em_disparity_map_rsrc_2);
-
-    ImageViewRef<Vector<float, 3> > disparity_uncertainty =
-      per_pixel_filter(em_disparity_disk_image,
-                       EMCorrelator::ExtractUncertaintyFunctor());
-    ImageViewRef<float> spectral_uncertainty =
-      per_pixel_filter(disparity_uncertainty,
-                       EMCorrelator::SpectralRadiusUncertaintyFunctor());
-    write_image(opt.out_prefix+"-US.tif", spectral_uncertainty);
-    write_image(opt.out_prefix+"-U.tif", disparity_uncertainty);
-
-    refined_disp =
-      per_pixel_filter(em_disparity_disk_image,
-                       EMCorrelator::ExtractDisparityFunctor());
-  } // End EM subpixel cases 
-  if ((stereo_settings().subpixel_mode < 0) || (stereo_settings().subpixel_mode > 5)){
-    if (verbose) {
-      vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << endl;
-      vw_out() << "\t--> Doing nothing\n";
-    }
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<pixel_type> tile;
+    if (m_footprint.contains(bbox))
+      tile = crop(m_footprint_image, bbox - m_footprint.min());
+    else
+      tile = crop(m_warped, bbox);
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
 
-  return refined_disp;
-}
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
 
 // Perform refinement in each tile. If using local homography,
 // apply the local homography transform for the given tile
-// to the right image before doing refinement in that tile.
+// to the right image before doing refinement in that tile,
+// or read it back if saved during correlation.
 template <class Image1T, class Image2T, class SeedDispT>
 class PerTileRfne: public ImageViewBase<PerTileRfne<Image1T, Image2T, SeedDispT> >{
   Image1T              m_left_image;
@@ -184,6 +97,29 @@ class PerTileRfne: public ImageViewBase<PerTileRfne<Image1T, Image2T, SeedDispT>
   ImageView<Matrix3x3> m_local_hom;
   ASPGlobalOptions const&       m_opt;
   Vector2              m_upscale_factor;
+  boost::shared_ptr<WarpedFootprintStore> m_warped_footprints; // Set if reading saved warps
+
+  // Find the warped right image saved during correlation, if it covers
+  // all that refinement of this tile is expected to read. Reads outside
+  // of it are warped anew by WarpedFootprintView.
+  bool find_warped_footprint(BBox2i const& bbox, Vector2i const& cell,
+                             std::string & file, BBox2i & footprint) const {
+    ImageView<PixelMask<Vector2f> > disp = crop(m_integer_disp, bbox);
+    BBox2f disp_range;
+    for (int row = 0; row < disp.rows(); row++)
+      for (int col = 0; col < disp.cols(); col++)
+        if (is_valid(disp(col, row)))
+          disp_range.grow(disp(col, row).child());
+    if (disp_range.empty())
+      return false;
+
+    BBox2i region = bbox;
+    region.min() += Vector2i(floor(disp_range.min()));
+    region.max() += Vector2i(ceil (disp_range.max()));
+    region.expand(refinement_right_image_margin());
+    region.crop(bounding_box(m_left_image));
+    return m_warped_footprints->find(cell, region, file, footprint);
+  }
 
 public:
   PerTileRfne( ImageViewBase<Image1T>   const& left_image,
@@ -192,11 +128,12 @@ public:
                ImageViewBase<SeedDispT> const& integer_disp,
                ImageViewBase<SeedDispT> const& sub_disp,
                ImageView    <Matrix3x3> const& local_hom,
-               ASPGlobalOptions const& opt):
+               ASPGlobalOptions const& opt,
+               boost::shared_ptr<WarpedFootprintStore> warped_footprints):
     m_left_image(left_image.impl()), m_right_image(right_image.impl()),
     m_right_mask(right_mask),
     m_integer_disp( integer_disp.impl() ), m_sub_disp( sub_disp.impl() ),
-    m_local_hom(local_hom), m_opt(opt){
+    m_local_hom(local_hom), m_opt(opt), m_warped_footprints(warped_footprints){
 
     m_upscale_factor = Vector2(double(m_left_image.impl().cols()) / m_sub_disp.cols(),
                                double(m_left_image.impl().rows()) / m_sub_disp.rows());
@@ -226,7 +163,8 @@ public:
     if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography){
 
       int ts = ASPGlobalOptions::corr_tile_size();
-      Matrix<double>  lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
+      Vector2i cell(bbox.min().x()/ts, bbox.min().y()/ts);
+      Matrix<double>  lowres_hom = m_local_hom(cell[0], cell[1]);
       Vector3 upscale( m_upscale_factor[0],     m_upscale_factor[1],     1 );
       Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
       Matrix<double>  fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
@@ -239,6 +177,11 @@ public:
                      HomographyTransform(fullres_hom),
                      m_left_image.impl().cols(), m_left_image.impl().rows());
       ImageViewRef<right_pix_type> right_trans_img = apply_mask(right_trans_masked_img);
+      std::string footprint_file;
+      BBox2i footprint;
+      if (m_warped_footprints && find_warped_footprint(bbox, cell, footprint_file, footprint))
+        right_trans_img = WarpedFootprintView<right_pix_type>(footprint_file, footprint,
+                                                              right_trans_img);
 
 
       tile_disparity = crop(refine_disparity(m_left_image, right_trans_img,
@@ -274,10 +217,12 @@ per_tile_rfne( ImageViewBase<Image1T  > const& left,
                ImageViewBase<SeedDispT> const& integer_disp,
                ImageViewBase<SeedDispT> const& sub_disp,
                ImageView<Matrix3x3    > const& local_hom,
-               ASPGlobalOptions const& opt) {
+               ASPGlobalOptions const& opt,
+               boost::shared_ptr<WarpedFootprintStore> warped_footprints) {
   typedef PerTileRfne<Image1T, Image2T, SeedDispT> return_type;
   return return_type( left.impl(), right.impl(), right_mask,
-                      integer_disp.impl(), sub_disp.impl(), local_hom, opt );
+                      integer_disp.impl(), sub_disp.impl(), local_hom, opt,
+                      warped_footprints );
 }
 
 void stereo_refinement( ASPGlobalOptions const& opt ) {
@@ -293,10 +238,10 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
   string right_mask_file  = opt.out_prefix+"-rMask.tif";
 
   try {
-    left_image   = DiskImageView< PixelGray<float> >(left_image_file );
-    right_image  = DiskImageView< PixelGray<float> >(right_image_file);
-    left_mask    = DiskImageView<uint8>(left_mask_file );
-    right_mask   = DiskImageView<uint8>(right_mask_file);
+    left_image   = instrumented_disk_image_view< PixelGray<float> >(left_image_file );
+    right_image  = instrumented_disk_image_view< PixelGray<float> >(right_image_file);
+    left_mask    = instrumented_disk_image_view<uint8>(left_mask_file );
+    right_mask   = instrumented_disk_image_view<uint8>(right_mask_file);
 
     // Read the correct type of correlation file (float for SGM/MGM, otherwise integer)
     std::string disp_file = opt.out_prefix + "-D.tif";
@@ -304,9 +249,9 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
     ChannelTypeEnum disp_data_type = rsrc->channel_type();
     if (disp_data_type == VW_CHANNEL_INT32)
       integer_disp = pixel_cast<PixelMask<Vector2f> >(
-                      DiskImageView< PixelMask<Vector2i> >(disp_file));
+                      instrumented_disk_image_view< PixelMask<Vector2i> >(disp_file));
     else // File on disk is float
-      integer_disp = DiskImageView< PixelMask<Vector2f> >(disp_file);
+      integer_disp = instrumented_disk_image_view< PixelMask<Vector2f> >(disp_file);
     
     if ( stereo_settings().seed_mode > 0 &&
          stereo_settings().use_local_homography ){
@@ -321,27 +266,18 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
                             << e.what() << "\nExiting.\n\n" );
   }
 
-  bool skip_img_norm = asp::skip_image_normalization(opt);
-  if (skip_img_norm && stereo_settings().subpixel_mode == 2){
-    // Images were not normalized in pre-processing. Must do so now
-    // as bayes_em_subpixel assumes them to be normalized.
-    ImageViewRef< PixelMask< PixelGray<float> > > Limg
-      = copy_mask(left_image, create_mask(left_mask));
-    ImageViewRef< PixelMask< PixelGray<float> > > Rimg
-      = copy_mask(right_image, create_mask(right_mask));
-
-    Vector<float32> left_stats, right_stats;
-    string left_stats_file  = opt.out_prefix+"-lStats.tif";
-    string right_stats_file = opt.out_prefix+"-rStats.tif";
-    vw_out() << "Reading: " << left_stats_file << ' ' << right_stats_file << endl;
-    read_vector(left_stats,  left_stats_file );
-    read_vector(right_stats, right_stats_file);
-    normalize_images(stereo_settings().force_use_entire_range,
-                     stereo_settings().individually_normalize,
-                     false, // Use std stretch
-                     left_stats, right_stats, Limg, Rimg);
-    left_image  = apply_mask(Limg);
-    right_image = apply_mask(Rimg);
+  normalize_images_for_refinement(opt, left_mask, right_mask, left_image, right_image);
+
+  // Use the right image warps saved during correlation, unless the
+  // images were normalized just now, and so differ from those warped.
+  boost::shared_ptr<WarpedFootprintStore> warped_footprints;
+  bool normalized_here = (skip_image_normalization(opt) && stereo_settings().subpixel_mode == 2);
+  if ( stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography &&
+       stereo_settings().reuse_local_homography_warps && !normalized_here ){
+    warped_footprints.reset(new WarpedFootprintStore(opt.out_prefix));
+    warped_footprints->load_index();
+    vw_out() << "\t--> Reading the right image warps saved by correlation from: "
+             << warped_footprints->directory() << "\n";
   }
 
   // The whole goal of this block it to go through the motions of
@@ -353,9 +289,10 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
   refine_disparity(left_dummy, right_dummy, dummy_disp, opt, verbose);
 
   ImageViewRef< PixelMask<Vector2f> > refined_disp
-    = crop(per_tile_rfne(left_image, right_image, right_mask,
-                    integer_disp, sub_disp, local_hom, opt), 
-           stereo_settings().trans_crop_win);
+    = timed_tile_view(crop(per_tile_rfne(left_image, right_image, right_mask,
+                                         integer_disp, sub_disp, local_hom, opt,
+                                         warped_footprints),
+                           stereo_settings().trans_crop_win));
   
   cartography::GeoReference left_georef;
   bool   has_left_georef = read_georeference(left_georef,  opt.out_prefix + "-L.tif");
@@ -368,6 +305,19 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
                               has_left_georef, left_georef,
                               has_nodata, nodata, opt,
                               TerminalProgressCallback("asp", "\t--> Refinement :") );
+
+  // The saved warps are not needed past refinement, so free their disk
+  // space. Refinement run again will warp the right image itself.
+  if (warped_footprints) {
+    vw_out() << "\t--> Removing: " << warped_footprints->directory() << "\n";
+    warped_footprints->clear();
+  }
+
+  StageInstrumentation & instrumentation = stage_instrumentation();
+  instrumentation.add_input_file(opt.out_prefix + "-L.tif");
+  instrumentation.add_input_file(opt.out_prefix + "-R.tif");
+  instrumentation.add_input_file(opt.out_prefix + "-D.tif");
+  instrumentation.add_output_file(rd_file);
 }
 
 int main(int argc, char* argv[]) {
@@ -394,7 +344,14 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
-    stereo_refinement( opt );
+    if (stereo_settings().fuse_correlation_and_refinement) {
+      vw_out() << "\t--> Refinement was done during correlation, skipping.\n";
+    } else {
+      if (stereo_settings().save_stage_instrumentation)
+        stage_instrumentation().start("rfne", opt.out_prefix);
+      stereo_refinement( opt );
+      stage_instrumentation().write();
+    }
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : REFINEMENT FINISHED \n";
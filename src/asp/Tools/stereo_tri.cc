@@ -26,12 +26,16 @@
 #include <vw/InterestPoint/InterestData.h>
 
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RayGridCameraModel.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <asp/Tools/ccd_adjust.h>
+#include <asp/Core/StageInstrumentation.h>
+#include <asp/Core/PointCloudIndex.h>
 
 // We must have the implementations of all sessions for triangulation
 #include <asp/Sessions/StereoSessionFactory.h>
+#include <asp/Sessions/ResourceLoader.h>
 #include <asp/Sessions/StereoSessionDGMapRPC.h>
 #include <asp/Sessions/StereoSessionIsis.h>
 #include <asp/Sessions/StereoSessionNadirPinhole.h>
@@ -40,6 +44,8 @@
 #include <asp/Sessions/StereoSessionSpot.h>
 #include <asp/Sessions/StereoSessionASTER.h>
 #include <xercesc/util/PlatformUtils.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <algorithm>
 #include <ctime>
 
 using namespace vw;
@@ -55,6 +61,53 @@ namespace vw {
   template<> struct PixelFormatID<Vector<float,  6> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
   template<> struct PixelFormatID<Vector<float,  4> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
   template<> struct PixelFormatID<Vector<float,  2> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_2_CHANNEL; };
+  template<> struct PixelFormatID<Vector<int32,  6> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+  template<> struct PixelFormatID<Vector<int32,  4> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
+}
+
+/// To interpolate the camera rays of each box on a grid, see
+/// RayGridCameraModel. With no cameras the rays are found exactly.
+struct RayGridParams {
+  vector<const camera::CameraModel*> cameras;
+  vector<BBox2> image_boxes; // The camera images, if known, to clamp the grids to
+  bool   least_squares; // These two make the stereo model of a box
+  double angle_tol;
+  double spacing, max_error;
+  RayGridParams(): least_squares(false), angle_tol(0), spacing(0), max_error(0) {}
+};
+
+/// The box of the camera pixels to put on a ray grid. Spurious
+/// disparities can send a few pixels far away, which would make the
+/// grid huge, so the box holds only the pixels between the 1st and the
+/// 99th percentiles each way, within the image box, if not empty. The
+/// exact camera does the other pixels.
+BBox2 ray_grid_box(vector<double> const& pix_x, vector<double> const& pix_y,
+                   BBox2 const& image_box) {
+  vector<double> xs, ys;
+  for (size_t k = 0; k < pix_x.size(); k++) {
+    if (pix_x[k] == pix_x[k]) { // Not NaN
+      xs.push_back(pix_x[k]);
+      ys.push_back(pix_y[k]);
+    }
+  }
+  if (xs.empty())
+    return BBox2();
+
+  size_t lo = xs.size()/100, hi = xs.size() - 1 - lo;
+  Vector2 box_min, box_max;
+  vector<double> * coords[2] = {&xs, &ys};
+  for (int k = 0; k < 2; k++) {
+    vector<double> & v = *coords[k];
+    std::nth_element(v.begin(), v.begin() + lo, v.end());
+    box_min[k] = v[lo];
+    std::nth_element(v.begin(), v.begin() + hi, v.end());
+    box_max[k] = v[hi];
+  }
+
+  BBox2 box(box_min, box_max);
+  if (!image_box.empty())
+    box.crop(image_box);
+  return box;
 }
 
 /// The main class for taking in a set of disparities and returning a point cloud via joint triangulation.
@@ -65,6 +118,7 @@ class StereoTXAndErrorView : public ImageViewBase<StereoTXAndErrorView<Disparity
   vector<TXT>  m_transforms; // e.g., map-projection or homography to undo
   StereoModelT m_stereo_model;
   bool         m_is_map_projected;
+  RayGridParams m_ray_grid;
   typedef typename DisparityImageT::pixel_type DPixelT;
 
 public:
@@ -77,11 +131,13 @@ public:
   StereoTXAndErrorView( vector<DisparityImageT> const& disparity_maps,
                         vector<TXT>             const& transforms,
                         StereoModelT            const& stereo_model,
-                        bool is_map_projected) :
+                        bool is_map_projected,
+                        RayGridParams           const& ray_grid = RayGridParams()) :
     m_disparity_maps(disparity_maps),
     m_transforms(transforms),
     m_stereo_model(stereo_model),
-    m_is_map_projected(is_map_projected) {
+    m_is_map_projected(is_map_projected),
+    m_ray_grid(ray_grid) {
 
     // Sanity check
     for (int p = 1; p < (int)m_disparity_maps.size(); p++){
@@ -99,6 +155,7 @@ public:
 
   /// Compute the 3D coordinate corresponding to a pixel location.
   /// - p is not actually used here, it should always be zero!
+  /// - This is slow, it is best to rasterize whole boxes of pixels.
   inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
       
     // For each input image, de-warp the pixel in to the native camera coordinates
@@ -124,7 +181,8 @@ public:
     return result; // Contains location and error vector
   }
 
-  typedef StereoTXAndErrorView<ImageViewRef<DPixelT>, TXT, StereoModelT> prerasterize_type;
+  /// The box is triangulated in one go, see triangulate_box().
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
     return PreRasterHelper( bbox, m_transforms );
   }
@@ -139,19 +197,24 @@ private:
   template <class T>
   prerasterize_type PreRasterHelper( BBox2i const& bbox, vector<T> const& transforms) const {
 
+    if (transforms.size() != m_disparity_maps.size() + 1){
+      vw_throw( ArgumentErr() << "In multi-view triangulation, "
+                << "the number of disparities must be one less "
+                << "than the number of images." );
+    }
+
+    // We explicitly bring in-memory the disparities for the current box
+    // to speed up processing later.
+    vector< ImageView<DPixelT> > disparity_clips(m_disparity_maps.size());
+    for (int p = 0; p < (int)m_disparity_maps.size(); p++)
+      disparity_clips[p] = crop( m_disparity_maps[p], bbox );
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+
     // Code for NON-MAP-PROJECTED session types.
     if (m_is_map_projected == false) {
-      // We explicitly bring in-memory the disparities for the current box
-      // to speed up processing later, and then we pretend this is the entire
-      // image by virtually enlarging it using a CropView.
-      vector< ImageViewRef<DPixelT> > disparity_cropviews;
-      for (int p = 0; p < (int)m_disparity_maps.size(); p++){
-        ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-        ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-        disparity_cropviews.push_back(cropview_clip);
-      }
-
-      return prerasterize_type(disparity_cropviews, transforms, m_stereo_model, m_is_map_projected);
+      triangulate_box(bbox, disparity_clips, transforms, tile);
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
     }
 
     // Code for MAP-PROJECTED session types.
@@ -164,24 +227,10 @@ private:
     vector<T> transforms_copy = transforms;
     transforms_copy[0].reverse_bbox(bbox); // As a side effect this call makes transforms_copy create a local cache we want later
 
-    if (transforms_copy.size() != m_disparity_maps.size() + 1){
-      vw_throw( ArgumentErr() << "In multi-view triangulation, "
-                << "the number of disparities must be one less "
-                << "than the number of images." );
-    }
-
-    vector< ImageViewRef<DPixelT> > disparity_cropviews;
-    for (int p = 0; p < (int)m_disparity_maps.size(); p++){
-
-      // We explicitly bring in-memory the disparities for the current
-      // box to speed up processing later, and then we pretend this is
-      // the entire image by virtually enlarging it using a CropView.
-      ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-      ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-      disparity_cropviews.push_back(cropview_clip);
+    for (int p = 0; p < (int)disparity_clips.size(); p++){
 
       // Work out what spots in the right image we'll be touching.
-      BBox2i disparity_range = stereo::get_disparity_range(clip);
+      BBox2i disparity_range = stereo::get_disparity_range(disparity_clips[p]);
       disparity_range.max() += Vector2i(1,1);
       BBox2i right_bbox = bbox + disparity_range.min();
       right_bbox.max() += disparity_range.size();
@@ -190,9 +239,114 @@ private:
       transforms_copy[p+1].reverse_bbox(right_bbox); // As a side effect this call makes transforms_copy create a local cache we want later
     }
 
-    return prerasterize_type(disparity_cropviews, transforms_copy, m_stereo_model, m_is_map_projected);
+    triangulate_box(bbox, disparity_clips, transforms_copy, tile);
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   } // End function PreRasterHelper() DGMapRPC version
 
+  /// Triangulate a box. First each image de-warps all its pixels, one
+  /// row at a time, into per-image arrays of x and y, then the rays
+  /// through them are intersected pixel by pixel. The buffers are
+  /// allocated once per box, not per pixel. A pixel with no valid
+  /// disparity sees only the left ray, so the stereo model would
+  /// return zero for it, and it is not called. With ray grids, the
+  /// rays are interpolated over the box of de-warped pixels of each
+  /// image.
+  template <class T>
+  void triangulate_box( BBox2i const& bbox,
+                        vector< ImageView<DPixelT> > const& disparities,
+                        vector<T> const& transforms,
+                        ImageView<pixel_type> & tile ) const {
+
+    int num_disp = disparities.size();
+    int width    = bbox.width();
+    int height   = bbox.height();
+    size_t num_pix = size_t(width)*height;
+    double nan   = std::numeric_limits<double>::quiet_NaN();
+
+    vector< vector<double> > pix_x(num_disp + 1, vector<double>(num_pix)),
+                             pix_y(num_disp + 1, vector<double>(num_pix));
+    vector<uint8> num_valid(num_pix, 0);
+
+    // De-warp the right pixels, and count for each pixel how many are valid
+    for (int c = 0; c < num_disp; c++) {
+      for (int row = 0; row < height; row++) {
+        double y = bbox.min().y() + row;
+        double * px = &pix_x[c+1][size_t(row)*width];
+        double * py = &pix_y[c+1][size_t(row)*width];
+        uint8  * nv = &num_valid [size_t(row)*width];
+        for (int col = 0; col < width; col++) {
+          DPixelT const& disp = disparities[c](col, row);
+          if (!is_valid(disp)) { // Insert flag values
+            px[col] = nan;
+            py[col] = nan;
+            continue;
+          }
+          Vector2 pix = transforms[c+1].reverse( Vector2(bbox.min().x() + col, y)
+                                                 + stereo::DispHelper(disp) );
+          px[col] = pix[0];
+          py[col] = pix[1];
+          nv[col]++;
+        }
+      }
+    }
+
+    // De-warp the left pixels which will be used
+    for (int row = 0; row < height; row++) {
+      double y = bbox.min().y() + row;
+      double * px = &pix_x[0][size_t(row)*width];
+      double * py = &pix_y[0][size_t(row)*width];
+      uint8  * nv = &num_valid[size_t(row)*width];
+      for (int col = 0; col < width; col++) {
+        if (nv[col] == 0) {
+          px[col] = nan;
+          py[col] = nan;
+          continue;
+        }
+        Vector2 pix = transforms[0].reverse( Vector2(bbox.min().x() + col, y) );
+        px[col] = pix[0];
+        py[col] = pix[1];
+      }
+    }
+
+    // The stereo model for the rays interpolated on grids
+    vector< boost::shared_ptr<asp::RayGridCameraModel> > grid_cameras;
+    boost::scoped_ptr<StereoModelT> grid_model;
+    if (!m_ray_grid.cameras.empty()) {
+      std::vector<const camera::CameraModel*> grid_ptrs;
+      for (int c = 0; c <= num_disp; c++) {
+        BBox2 image_box;
+        if (!m_ray_grid.image_boxes.empty())
+          image_box = m_ray_grid.image_boxes[c];
+        BBox2 box = ray_grid_box(pix_x[c], pix_y[c], image_box);
+        grid_cameras.push_back(boost::shared_ptr<asp::RayGridCameraModel>
+                               (new asp::RayGridCameraModel(m_ray_grid.cameras[c])));
+        grid_cameras.back()->build(box, m_ray_grid.spacing, m_ray_grid.max_error);
+        grid_ptrs.push_back(grid_cameras.back().get());
+      }
+      grid_model.reset(new StereoModelT(grid_ptrs, m_ray_grid.least_squares,
+                                        m_ray_grid.angle_tol));
+    }
+    StereoModelT const& model = grid_model ? *grid_model : m_stereo_model;
+
+    // Intersect the rays
+    vector<Vector2> pixVec(num_disp + 1);
+    Vector3 errorVec;
+    for (int row = 0; row < height; row++) {
+      for (int col = 0; col < width; col++) {
+        size_t k = size_t(row)*width + col;
+        pixel_type & result = tile(col, row);
+        if (num_valid[k] == 0) {
+          result = pixel_type();
+          continue;
+        }
+        for (int c = 0; c <= num_disp; c++)
+          pixVec[c] = Vector2(pix_x[c][k], pix_y[c][k]);
+        subvector(result,0,3) = model(pixVec, errorVec);
+        subvector(result,3,3) = errorVec;
+      }
+    }
+  }
+
 }; // End class StereoTXAndErrorView
 
 /// Just a wrapper function for StereoTXAndErrorView view construction
@@ -201,10 +355,11 @@ StereoTXAndErrorView<DisparityT, TXT, StereoModelT>
 stereo_error_triangulate( vector<DisparityT> const& disparities,
                           vector<TXT>        const& transforms,
                           StereoModelT       const& model,
-                          bool is_map_projected ) {
+                          bool is_map_projected,
+                          RayGridParams      const& ray_grid ) {
 
   typedef StereoTXAndErrorView<DisparityT, TXT, StereoModelT> result_type;
-  return result_type( disparities, transforms, model, is_map_projected );
+  return result_type( disparities, transforms, model, is_map_projected, ray_grid );
 }
 
 /// Bin the disparities, and from each bin get a disparity value.
@@ -303,20 +458,96 @@ namespace asp{
                                                          PointAndErrorNorm() );
   }
 
+  // The norm of the triangulation error of a point, as point2dem finds it
+  inline double point_error_norm(Vector4 const& pt) { return fabs(pt[3]); }
+  inline double point_error_norm(Vector6 const& pt) { return norm_2(subvector(pt,3,3)); }
+
+  /// Pass the tiles of a point cloud through unchanged, while adding
+  /// their points to the index of the cloud.
   template <class ImageT>
-  void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
-                        string const& point_cloud_file,
-                        ASPGlobalOptions const& opt){
+  class PointCloudIndexTapView: public ImageViewBase<PointCloudIndexTapView<ImageT> >{
+    ImageT                              m_img;
+    cartography::Datum                  m_datum;
+    boost::shared_ptr<PointCloudIndex>  m_index;
+  public:
+    PointCloudIndexTapView( ImageViewBase<ImageT> const& img,
+                            cartography::Datum const& datum,
+                            boost::shared_ptr<PointCloudIndex> index ):
+      m_img(img.impl()), m_datum(datum), m_index(index){}
+
+    // Image View interface
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef ProceduralPixelAccessor<PointCloudIndexTapView> pixel_accessor;
+
+    inline int32 cols  () const { return m_img.cols(); }
+    inline int32 rows  () const { return m_img.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+      vw_throw(NoImplErr() << "PointCloudIndexTapView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+      ImageView<pixel_type> tile = crop(m_img, bbox);
+      ImageView<Vector4> points(tile.cols(), tile.rows());
+      for (int row = 0; row < tile.rows(); row++){
+        for (int col = 0; col < tile.cols(); col++){
+          Vector3 xyz = subvector(tile(col, row), 0, 3);
+          if (xyz == Vector3()){ // invalid
+            points(col, row) = Vector4(0, 0, std::numeric_limits<double>::quiet_NaN(), 0);
+            continue;
+          }
+          subvector(points(col, row), 0, 3) = m_datum.cartesian_to_geodetic(xyz);
+          points(col, row)[3] = point_error_norm(tile(col, row));
+        }
+      }
+      m_index->add_tile(bbox, points);
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows() );
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  void write_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
+                         string const& point_cloud_file,
+                         ASPGlobalOptions const& opt){
 
-    vw_out() << "Writing point cloud: " << point_cloud_file << "\n";
     bool has_georef = true;
     cartography::GeoReference georef = opt.session->get_georef();
 
     bool has_nodata = false;
     double nodata = -std::numeric_limits<float>::max(); // smallest float
 
-    // TODO: Replace this with with a function call!
-    if ( (opt.session->name() == "isis") || (opt.session->name() == "isismapisis")){
+    if (stereo_settings().compact_point_cloud){
+      if (norm_2(shift) == 0)
+        vw_throw( ArgumentErr() << "A compact point cloud needs the point cloud center. "
+                  << "It cannot be used with --save-double-precision-point-cloud.\n" );
+      if ( (opt.session->name() == "isis") || (opt.session->name() == "isismapisis")){
+        // ISIS does not support multi-threading
+        asp::write_quantized_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            point_cloud, has_georef, georef,
+            opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+      }else{
+        asp::block_write_quantized_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            point_cloud, has_georef, georef,
+            opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+      }
+    }else if ( (opt.session->name() == "isis") || (opt.session->name() == "isismapisis")){
+      // TODO: Replace this with with a function call!
       // ISIS does not support multi-threading
       asp::write_approx_gdal_image
         ( point_cloud_file, shift,
@@ -332,7 +563,34 @@ namespace asp{
           has_georef, georef, has_nodata, nodata,
           opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
     }
+  }
+
+  template <class ImageT>
+  void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
+                        string const& point_cloud_file,
+                        ASPGlobalOptions const& opt){
+
+    vw_out() << "Writing point cloud: " << point_cloud_file << "\n";
+
+    // An index from an earlier run would not be for this cloud
+    string index_file = PointCloudIndex::file_name(point_cloud_file);
+    if (fs::exists(index_file))
+      fs::remove(index_file);
 
+    if (!stereo_settings().save_point_cloud_index) {
+      write_point_cloud(shift, point_cloud, point_cloud_file, opt);
+      return;
+    }
+
+    // Record the index of the cloud as it is written, so that point2dem
+    // need not read the cloud to find where its points are.
+    cartography::Datum datum = opt.session->get_georef().datum();
+    boost::shared_ptr<PointCloudIndex>
+      index(new PointCloudIndex(Vector2i(point_cloud.cols(), point_cloud.rows()),
+                                datum.semi_major_axis(), datum.semi_minor_axis()));
+    write_point_cloud(shift, PointCloudIndexTapView<ImageT>(point_cloud, datum, index),
+                      point_cloud_file, opt);
+    index->write(point_cloud_file);
   }
 
   Vector3 find_approx_points_median(vector<Vector3> const& points){
@@ -561,11 +819,36 @@ void stereo_triangulation( string          const& output_prefix,
     StereoModelT stereo_model( camera_ptrs, stereo_settings().use_least_squares,
                                angle_tol);
 
+    // For linescan cameras, interpolate the rays of each tile on a grid
+    RayGridParams ray_grid;
+    std::string session_name = opt_vec[0].session->name();
+    bool is_linescan = (session_name == "dg"    || session_name == "dgmaprpc"    ||
+                        session_name == "aster" || session_name == "astermaprpc" ||
+                        session_name == "spot5" || session_name == "spot5maprpc" ||
+                        session_name == "isis"  || session_name == "isismapisis");
+    if (is_linescan && stereo_settings().ray_grid_spacing > 0) {
+      ray_grid.cameras       = camera_ptrs;
+      ray_grid.least_squares = stereo_settings().use_least_squares;
+      ray_grid.angle_tol     = angle_tol;
+      ray_grid.spacing       = stereo_settings().ray_grid_spacing;
+      ray_grid.max_error     = stereo_settings().ray_grid_max_error;
+      // With map-projected inputs the image files are not the camera images
+      if (!is_map_projected) {
+        for (int c = 0; c < num_cams; c++) {
+          Vector2i size = asp::file_image_size(image_files[c], camera_files[c]);
+          ray_grid.image_boxes.push_back(BBox2(Vector2(0, 0),
+                                               Vector2(size[0] - 1, size[1] - 1)));
+        }
+      }
+      vw_out() << "\t--> Interpolating the camera rays with a grid spacing of "
+               << ray_grid.spacing << " pixels.\n";
+    }
+
     // Apply radius function and stereo model in one go
     vw_out() << "\t--> Generating a 3D point cloud." << endl;
     ImageViewRef<Vector6> point_cloud = per_pixel_filter
       (stereo_error_triangulate
-       (disparity_maps, transforms, stereo_model, is_map_projected),
+       (disparity_maps, transforms, stereo_model, is_map_projected, ray_grid),
        universe_radius_func);
 
     // If we crop the left and right images, at each run we must
@@ -584,6 +867,7 @@ void stereo_triangulation( string          const& output_prefix,
         }
       }
     }
+    stage_instrumentation().end_phase("point_cloud_center");
     if (stereo_settings().compute_point_cloud_center_only){
       vw_out() << "Computed the point cloud center. Will stop here." << endl;
       return;
@@ -600,12 +884,14 @@ void stereo_triangulation( string          const& output_prefix,
                                << "vector between rays is not meaningful. "
                                << "Setting it to (err_len, 0, 0)." << endl;
 
-      ImageViewRef<Vector6> crop_pc = crop(point_cloud, cbox);
+      ImageViewRef<Vector6> crop_pc = timed_tile_view(crop(point_cloud, cbox));
       save_point_cloud(cloud_center, crop_pc, point_cloud_file, opt_vec[0]);
     }else{
-      ImageViewRef<Vector4> crop_pc = crop(point_and_error_norm(point_cloud), cbox);
+      ImageViewRef<Vector4> crop_pc = timed_tile_view(crop(point_and_error_norm(point_cloud), cbox));
       save_point_cloud(cloud_center, crop_pc, point_cloud_file, opt_vec[0]);
     } // End if/else
+    stage_instrumentation().end_phase("triangulation");
+    stage_instrumentation().add_output_file(point_cloud_file);
 
     // Must print this at the end, as it contains statistics on the number of rejected points.
     vw_out() << "\t--> " << universe_radius_func;
@@ -651,6 +937,11 @@ int main( int argc, char* argv[] ) {
     if (opt_vec.empty())
       vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
 
+    if (stereo_settings().save_stage_instrumentation)
+      stage_instrumentation().start("tri", output_prefix);
+    for (int p = 0; p < (int)opt_vec.size(); p++)
+      stage_instrumentation().add_input_file(opt_vec[p].out_prefix+"-F.tif");
+
     // Triangulation uses small tiles.
     //---------------------------------------------------------
     int ts = ASPGlobalOptions::tri_tile_size();
@@ -683,6 +974,8 @@ int main( int argc, char* argv[] ) {
 
 #undef INSTANTIATE
 
+    stage_instrumentation().write();
+
     vw_out() << "\n[ " << current_posix_time_string() << " ] : TRIANGULATION FINISHED \n";
 
     xercesc::XMLPlatformUtils::Terminate();